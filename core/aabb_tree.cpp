@@ -0,0 +1,543 @@
+#include "aabb_tree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <mutex>
+
+using namespace std;
+
+namespace gengine {
+
+/// How a query region relates to a box: skip it, look inside, or take all of it
+enum class Overlap { OUTSIDE, PARTIAL, INSIDE };
+
+static auto lower_corner(const BoundingBox& box) -> glm::vec3 { return box.center - box.extents; }
+
+static auto upper_corner(const BoundingBox& box) -> glm::vec3 { return box.center + box.extents; }
+
+/// Half the surface area, which is what inserting next to a node adds to the tree's cost
+static auto area(const glm::vec3& lower, const glm::vec3& upper) -> float
+{
+	const auto size = upper - lower;
+	return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+static auto contains(
+	const glm::vec3& lower, const glm::vec3& upper, const glm::vec3& inner_lower,
+	const glm::vec3& inner_upper) -> bool
+{
+	return lower.x <= inner_lower.x && lower.y <= inner_lower.y && lower.z <= inner_lower.z &&
+		   inner_upper.x <= upper.x && inner_upper.y <= upper.y && inner_upper.z <= upper.z;
+}
+
+static auto classify(const Frustum& frustum, const glm::vec3& lower, const glm::vec3& upper)
+	-> Overlap
+{
+	const auto center = (lower + upper) * 0.5f;
+	const auto extents = (upper - lower) * 0.5f;
+	auto overlap = Overlap::INSIDE;
+	for (auto i = size_t{0}; i < 6; i++) {
+		const auto distance = frustum.x[i] * center.x + frustum.y[i] * center.y +
+							  frustum.z[i] * center.z + frustum.w[i];
+		const auto reach = abs(frustum.x[i]) * extents.x + abs(frustum.y[i]) * extents.y +
+						   abs(frustum.z[i]) * extents.z;
+		if (distance + reach < 0.0f) {
+			return Overlap::OUTSIDE;
+		}
+		if (distance - reach < 0.0f) {
+			overlap = Overlap::PARTIAL;
+		}
+	}
+	return overlap;
+}
+
+static auto classify(const BoundingBox& box, const glm::vec3& lower, const glm::vec3& upper)
+	-> Overlap
+{
+	const auto box_lower = lower_corner(box);
+	const auto box_upper = upper_corner(box);
+	if (upper.x < box_lower.x || upper.y < box_lower.y || upper.z < box_lower.z ||
+		box_upper.x < lower.x || box_upper.y < lower.y || box_upper.z < lower.z) {
+		return Overlap::OUTSIDE;
+	}
+	return contains(box_lower, box_upper, lower, upper) ? Overlap::INSIDE : Overlap::PARTIAL;
+}
+
+static auto classify(const Sphere& sphere, const glm::vec3& lower, const glm::vec3& upper)
+	-> Overlap
+{
+	// Nearest point of the box to the center, and the corner furthest from it
+	const auto nearest = glm::min(glm::max(sphere.center, lower), upper) - sphere.center;
+	const auto furthest =
+		glm::max(glm::abs(lower - sphere.center), glm::abs(upper - sphere.center));
+	const auto radius_squared = sphere.radius * sphere.radius;
+	if (glm::dot(nearest, nearest) > radius_squared) {
+		return Overlap::OUTSIDE;
+	}
+	return glm::dot(furthest, furthest) <= radius_squared ? Overlap::INSIDE : Overlap::PARTIAL;
+}
+
+/// Distance along the ray to where it enters the box, or infinity if it misses
+static auto entry_distance(
+	const Ray& ray, const glm::vec3& inverse_direction, const glm::vec3& lower,
+	const glm::vec3& upper) -> float
+{
+	// Slabs: fmin and fmax drop the NaN of an axis-parallel ray starting on a face
+	auto first = 0.0f;
+	auto last = ray.max_distance;
+	for (auto axis = 0; axis < 3; axis++) {
+		const auto t1 = (lower[axis] - ray.origin[axis]) * inverse_direction[axis];
+		const auto t2 = (upper[axis] - ray.origin[axis]) * inverse_direction[axis];
+		first = fmax(first, fmin(t1, t2));
+		last = fmin(last, fmax(t1, t2));
+	}
+	return first <= last ? first : numeric_limits<float>::infinity();
+}
+
+AabbTree::AabbTree(float margin) : margin{margin} {}
+
+auto AabbTree::insert(Entity entity, const BoundingBox& box) -> uint32_t
+{
+	unique_lock lock{mutex};
+	const auto leaf = allocate_node();
+	nodes[leaf].box = box;
+	nodes[leaf].entity = entity;
+	fatten(nodes[leaf]);
+	insert_leaf(leaf);
+	leaf_count++;
+	return leaf;
+}
+
+auto AabbTree::remove(uint32_t proxy) -> void
+{
+	unique_lock lock{mutex};
+	remove_leaf(proxy);
+	free_node(proxy);
+	leaf_count--;
+}
+
+auto AabbTree::move(uint32_t proxy, const BoundingBox& box) -> bool
+{
+	unique_lock lock{mutex};
+	return move_locked(proxy, box);
+}
+
+auto AabbTree::move(std::span<const ProxyMove> moves) -> std::size_t
+{
+	unique_lock lock{mutex};
+	auto reinserted = size_t{0};
+	for (const auto& move : moves) {
+		reinserted += move_locked(move.proxy, move.box) ? 1 : 0;
+	}
+	return reinserted;
+}
+
+auto AabbTree::move_locked(uint32_t proxy, const BoundingBox& box) -> bool
+{
+	nodes[proxy].box = box;
+	if (contains(nodes[proxy].lower, nodes[proxy].upper, lower_corner(box), upper_corner(box))) {
+		return false;
+	}
+
+	// Removing frees the leaf's parent, which inserting reuses, so `nodes` never grows here
+	remove_leaf(proxy);
+	fatten(nodes[proxy]);
+	insert_leaf(proxy);
+	return true;
+}
+
+auto AabbTree::fatten(Node& leaf) const -> void
+{
+	const auto padding = glm::vec3(margin, margin, margin);
+	leaf.lower = lower_corner(leaf.box) - padding;
+	leaf.upper = upper_corner(leaf.box) + padding;
+}
+
+auto AabbTree::allocate_node() -> uint32_t
+{
+	auto node = free_list;
+	if (node == NO_PROXY) {
+		node = static_cast<uint32_t>(nodes.size());
+		nodes.push_back({});
+	}
+	else {
+		free_list = nodes[node].parent;
+	}
+	nodes[node].parent = NO_PROXY;
+	nodes[node].left = NO_PROXY;
+	nodes[node].right = NO_PROXY;
+	nodes[node].height = 0;
+	nodes[node].entity = NO_ENTITY;
+	return node;
+}
+
+auto AabbTree::free_node(uint32_t node) -> void
+{
+	nodes[node].parent = free_list;
+	nodes[node].height = -1;
+	free_list = node;
+}
+
+auto AabbTree::insert_leaf(uint32_t leaf) -> void
+{
+	if (root == NO_PROXY) {
+		root = leaf;
+		nodes[leaf].parent = NO_PROXY;
+		return;
+	}
+
+	// Walk down to the sibling which grows the tree's surface area least
+	const auto leaf_lower = nodes[leaf].lower;
+	const auto leaf_upper = nodes[leaf].upper;
+	auto sibling = root;
+	while (nodes[sibling].height > 0) {
+		const auto& node = nodes[sibling];
+		const auto node_area = area(node.lower, node.upper);
+		const auto combined_area =
+			area(glm::min(node.lower, leaf_lower), glm::max(node.upper, leaf_upper));
+
+		// Pairing with this node makes a new parent; going deeper enlarges this node
+		const auto cost = 2.0f * combined_area;
+		const auto inherited = 2.0f * (combined_area - node_area);
+		const auto descend = [&](uint32_t child) {
+			const auto& c = nodes[child];
+			const auto grown = area(glm::min(c.lower, leaf_lower), glm::max(c.upper, leaf_upper));
+			return (c.height == 0 ? grown : grown - area(c.lower, c.upper)) + inherited;
+		};
+		const auto left_cost = descend(node.left);
+		const auto right_cost = descend(node.right);
+		if (cost < left_cost && cost < right_cost) {
+			break;
+		}
+		sibling = left_cost < right_cost ? node.left : node.right;
+	}
+
+	const auto old_parent = nodes[sibling].parent;
+	const auto new_parent = allocate_node();
+	auto& parent = nodes[new_parent];
+	parent.parent = old_parent;
+	parent.left = sibling;
+	parent.right = leaf;
+	parent.height = nodes[sibling].height + 1;
+	parent.lower = glm::min(nodes[sibling].lower, leaf_lower);
+	parent.upper = glm::max(nodes[sibling].upper, leaf_upper);
+	nodes[sibling].parent = new_parent;
+	nodes[leaf].parent = new_parent;
+
+	if (old_parent == NO_PROXY) {
+		root = new_parent;
+	}
+	else if (nodes[old_parent].left == sibling) {
+		nodes[old_parent].left = new_parent;
+	}
+	else {
+		nodes[old_parent].right = new_parent;
+	}
+
+	refit(new_parent);
+}
+
+auto AabbTree::remove_leaf(uint32_t leaf) -> void
+{
+	if (leaf == root) {
+		root = NO_PROXY;
+		return;
+	}
+
+	// The leaf's sibling takes its parent's place
+	const auto parent = nodes[leaf].parent;
+	const auto grandparent = nodes[parent].parent;
+	const auto sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+	free_node(parent);
+
+	nodes[sibling].parent = grandparent;
+	if (grandparent == NO_PROXY) {
+		root = sibling;
+		return;
+	}
+	if (nodes[grandparent].left == parent) {
+		nodes[grandparent].left = sibling;
+	}
+	else {
+		nodes[grandparent].right = sibling;
+	}
+	refit(grandparent);
+}
+
+auto AabbTree::refit(uint32_t node) -> void
+{
+	while (node != NO_PROXY) {
+		node = balance(node);
+		auto& n = nodes[node];
+		const auto& left = nodes[n.left];
+		const auto& right = nodes[n.right];
+		n.height = 1 + max(left.height, right.height);
+		n.lower = glm::min(left.lower, right.lower);
+		n.upper = glm::max(left.upper, right.upper);
+		node = n.parent;
+	}
+}
+
+auto AabbTree::balance(uint32_t a) -> uint32_t
+{
+	auto& node_a = nodes[a];
+	if (node_a.height < 2) {
+		return a;
+	}
+
+	// Lift whichever child is more than one level taller than the other, and hand its
+	// shorter child down to `a`
+	const auto b = node_a.left;
+	const auto c = node_a.right;
+	const auto skew = nodes[c].height - nodes[b].height;
+	if (skew >= -1 && skew <= 1) {
+		return a;
+	}
+
+	const auto up = skew > 1 ? c : b;
+	const auto kept = skew > 1 ? b : c;
+	auto& node_up = nodes[up];
+	const auto f = node_up.left;
+	const auto g = node_up.right;
+	const auto taller = nodes[f].height > nodes[g].height ? f : g;
+	const auto shorter = taller == f ? g : f;
+
+	node_up.left = a;
+	node_up.right = taller;
+	node_up.parent = node_a.parent;
+	node_a.parent = up;
+	if (node_up.parent == NO_PROXY) {
+		root = up;
+	}
+	else if (nodes[node_up.parent].left == a) {
+		nodes[node_up.parent].left = up;
+	}
+	else {
+		nodes[node_up.parent].right = up;
+	}
+
+	if (skew > 1) {
+		node_a.right = shorter;
+	}
+	else {
+		node_a.left = shorter;
+	}
+	nodes[shorter].parent = a;
+
+	node_a.lower = glm::min(nodes[kept].lower, nodes[shorter].lower);
+	node_a.upper = glm::max(nodes[kept].upper, nodes[shorter].upper);
+	node_a.height = 1 + max(nodes[kept].height, nodes[shorter].height);
+	node_up.lower = glm::min(node_a.lower, nodes[taller].lower);
+	node_up.upper = glm::max(node_a.upper, nodes[taller].upper);
+	node_up.height = 1 + max(node_a.height, nodes[taller].height);
+	return up;
+}
+
+template <class Test, class Visit>
+auto AabbTree::traverse(std::vector<uint32_t>& stack, Test&& test, Visit&& visit) const -> void
+{
+	if (root == NO_PROXY) {
+		return;
+	}
+
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const auto& node = nodes[stack.back()];
+		stack.pop_back();
+
+		if (node.height == 0) {
+			if (test(lower_corner(node.box), upper_corner(node.box)) != Overlap::OUTSIDE) {
+				visit(node.entity);
+			}
+			continue;
+		}
+
+		const auto overlap = test(node.lower, node.upper);
+		if (overlap == Overlap::PARTIAL) {
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+		}
+		else if (overlap == Overlap::INSIDE) {
+			// Every box in here is inside too, so take them without testing
+			const auto base = stack.size();
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+			while (stack.size() > base) {
+				const auto& inner = nodes[stack.back()];
+				stack.pop_back();
+				if (inner.height == 0) {
+					visit(inner.entity);
+				}
+				else {
+					stack.push_back(inner.left);
+					stack.push_back(inner.right);
+				}
+			}
+		}
+	}
+}
+
+auto AabbTree::raycast_locked(const Ray& ray, std::vector<uint32_t>& stack) const -> RayHit
+{
+	auto hit = RayHit{NO_ENTITY, numeric_limits<float>::infinity()};
+	if (root == NO_PROXY) {
+		return hit;
+	}
+
+	const auto inverse_direction =
+		glm::vec3(1.0f / ray.direction.x, 1.0f / ray.direction.y, 1.0f / ray.direction.z);
+	const auto entry = [&](uint32_t node) {
+		return entry_distance(ray, inverse_direction, nodes[node].lower, nodes[node].upper);
+	};
+
+	stack.clear();
+	stack.push_back(root);
+	while (!stack.empty()) {
+		const auto index = stack.back();
+		stack.pop_back();
+		const auto& node = nodes[index];
+		if (entry(index) >= hit.distance) {
+			continue;
+		}
+
+		if (node.height == 0) {
+			const auto distance = entry_distance(
+				ray, inverse_direction, lower_corner(node.box), upper_corner(node.box));
+			if (distance < hit.distance) {
+				hit = {node.entity, distance};
+			}
+			continue;
+		}
+
+		// Nearer child on top, so it can shorten the ray before the other is tried
+		if (entry(node.left) < entry(node.right)) {
+			stack.push_back(node.right);
+			stack.push_back(node.left);
+		}
+		else {
+			stack.push_back(node.left);
+			stack.push_back(node.right);
+		}
+	}
+	return hit;
+}
+
+auto AabbTree::query(const Frustum& frustum, std::vector<Entity>& hits) const -> void
+{
+	shared_lock lock{mutex};
+	auto stack = vector<uint32_t>{};
+	traverse(
+		stack,
+		[&](const glm::vec3& lower, const glm::vec3& upper) {
+			return classify(frustum, lower, upper);
+		},
+		[&](Entity entity) { hits.push_back(entity); });
+}
+
+auto AabbTree::query(const BoundingBox& box, std::vector<Entity>& hits) const -> void
+{
+	shared_lock lock{mutex};
+	auto stack = vector<uint32_t>{};
+	traverse(
+		stack,
+		[&](const glm::vec3& lower, const glm::vec3& upper) { return classify(box, lower, upper); },
+		[&](Entity entity) { hits.push_back(entity); });
+}
+
+auto AabbTree::query(const Sphere& sphere, std::vector<Entity>& hits) const -> void
+{
+	shared_lock lock{mutex};
+	auto stack = vector<uint32_t>{};
+	traverse(
+		stack,
+		[&](const glm::vec3& lower, const glm::vec3& upper) {
+			return classify(sphere, lower, upper);
+		},
+		[&](Entity entity) { hits.push_back(entity); });
+}
+
+auto AabbTree::raycast(const Ray& ray) const -> RayHit
+{
+	shared_lock lock{mutex};
+	auto stack = vector<uint32_t>{};
+	return raycast_locked(ray, stack);
+}
+
+/// Run each query of a batch, sharing one lock and one traversal stack
+template <class Query, class Traverse>
+static auto query_batch(std::span<const Query> queries, QueryResults& results, Traverse&& traverse)
+	-> void
+{
+	results.entities.clear();
+	results.offsets.clear();
+	results.offsets.push_back(0);
+	auto stack = vector<uint32_t>{};
+	for (const auto& query : queries) {
+		traverse(query, stack);
+		results.offsets.push_back(static_cast<uint32_t>(results.entities.size()));
+	}
+}
+
+auto AabbTree::query(std::span<const Frustum> frustums, QueryResults& results) const -> void
+{
+	shared_lock lock{mutex};
+	query_batch(frustums, results, [&](const Frustum& frustum, vector<uint32_t>& stack) {
+		traverse(
+			stack,
+			[&](const glm::vec3& lower, const glm::vec3& upper) {
+				return classify(frustum, lower, upper);
+			},
+			[&](Entity entity) { results.entities.push_back(entity); });
+	});
+}
+
+auto AabbTree::query(std::span<const BoundingBox> boxes, QueryResults& results) const -> void
+{
+	shared_lock lock{mutex};
+	query_batch(boxes, results, [&](const BoundingBox& box, vector<uint32_t>& stack) {
+		traverse(
+			stack,
+			[&](const glm::vec3& lower, const glm::vec3& upper) {
+				return classify(box, lower, upper);
+			},
+			[&](Entity entity) { results.entities.push_back(entity); });
+	});
+}
+
+auto AabbTree::query(std::span<const Sphere> spheres, QueryResults& results) const -> void
+{
+	shared_lock lock{mutex};
+	query_batch(spheres, results, [&](const Sphere& sphere, vector<uint32_t>& stack) {
+		traverse(
+			stack,
+			[&](const glm::vec3& lower, const glm::vec3& upper) {
+				return classify(sphere, lower, upper);
+			},
+			[&](Entity entity) { results.entities.push_back(entity); });
+	});
+}
+
+auto AabbTree::raycast(std::span<const Ray> rays, std::span<RayHit> hits) const -> void
+{
+	shared_lock lock{mutex};
+	auto stack = vector<uint32_t>{};
+	for (auto i = size_t{0}; i < rays.size(); i++) {
+		hits[i] = raycast_locked(rays[i], stack);
+	}
+}
+
+auto AabbTree::size() const -> std::size_t
+{
+	shared_lock lock{mutex};
+	return leaf_count;
+}
+
+auto AabbTree::height() const -> uint32_t
+{
+	shared_lock lock{mutex};
+	return root == NO_PROXY ? 0 : static_cast<uint32_t>(nodes[root].height);
+}
+
+} // namespace gengine
@@ -0,0 +1,158 @@
+/**
+ * @file aabb_tree.h - a dynamic bounding volume hierarchy over moving boxes.
+ *
+ * Each proxy is a leaf holding an object's box, enlarged by a margin.  Moving a box only
+ * touches the tree once it leaves that fat box: the leaf is then taken out and inserted
+ * again where it adds the least surface area, and the tree is rebalanced by rotations on
+ * the way up.  Objects jittering in place cost nothing.
+ *
+ * Any number of threads may query at once; insert, remove and move wait for them.
+ * Queries are exact against each object's own box, not the fat one.
+ */
+
+#pragma once
+
+#include "assets.h"
+#include "entity_store.h"
+#include "frustum_culling.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <span>
+#include <vector>
+
+namespace gengine {
+
+/// A proxy which no object has
+constexpr uint32_t NO_PROXY = UINT32_MAX;
+
+struct Sphere {
+	glm::vec3 center;
+	float radius;
+};
+
+struct Ray {
+	glm::vec3 origin;
+	/// Needn't be normalized; hit distances are in multiples of it
+	glm::vec3 direction;
+	float max_distance;
+};
+
+struct RayHit {
+	/// NO_ENTITY if the ray hit nothing
+	Entity entity;
+	/// Along the ray to where it enters the entity's box; 0 if it starts inside
+	float distance;
+};
+
+/// A proxy's new box, for moving many at once
+struct ProxyMove {
+	uint32_t proxy;
+	BoundingBox box;
+};
+
+/// The hits of a batch of queries, back to back
+struct QueryResults {
+	std::vector<Entity> entities;
+	/// Query i hit entities[offsets[i]] up to entities[offsets[i + 1]]
+	std::vector<uint32_t> offsets;
+
+	auto hits(std::size_t query) const -> std::span<const Entity>
+	{
+		return std::span{entities}.subspan(offsets[query], offsets[query + 1] - offsets[query]);
+	}
+};
+
+class AabbTree {
+public:
+	/// @param margin how far each box is enlarged along every axis before it's stored
+	explicit AabbTree(float margin = 0.5f);
+
+	AabbTree(const AabbTree&) = delete;
+	AabbTree& operator=(const AabbTree&) = delete;
+
+	/// @return a proxy for the entity's box, valid until it's removed
+	auto insert(Entity entity, const BoundingBox& box) -> uint32_t;
+
+	auto remove(uint32_t proxy) -> void;
+
+	/// @return whether the box left its fat box, so the proxy was reinserted
+	auto move(uint32_t proxy, const BoundingBox& box) -> bool;
+
+	/// Move many proxies under one lock; returns how many were reinserted
+	auto move(std::span<const ProxyMove> moves) -> std::size_t;
+
+	/// Append the entities whose boxes are at least partly inside
+	auto query(const Frustum& frustum, std::vector<Entity>& hits) const -> void;
+	auto query(const BoundingBox& box, std::vector<Entity>& hits) const -> void;
+	auto query(const Sphere& sphere, std::vector<Entity>& hits) const -> void;
+
+	/// The first box along the ray
+	auto raycast(const Ray& ray) const -> RayHit;
+
+	/// Run a batch of queries under one lock, replacing `results`
+	auto query(std::span<const Frustum> frustums, QueryResults& results) const -> void;
+	auto query(std::span<const BoundingBox> boxes, QueryResults& results) const -> void;
+	auto query(std::span<const Sphere> spheres, QueryResults& results) const -> void;
+
+	/// @param hits one per ray
+	auto raycast(std::span<const Ray> rays, std::span<RayHit> hits) const -> void;
+
+	auto size() const -> std::size_t;
+
+	/// Longest path from the root to a leaf; about 1.4 * log2(size()) when balanced
+	auto height() const -> uint32_t;
+
+private:
+	struct Node {
+		/// Fat box of a leaf, or the union of both children
+		glm::vec3 lower;
+		glm::vec3 upper;
+		/// The leaf's own box
+		BoundingBox box;
+		/// Parent, or the next free node
+		uint32_t parent;
+		uint32_t left;
+		uint32_t right;
+		/// 0 for leaves, -1 for free nodes
+		int32_t height;
+		Entity entity;
+	};
+
+	auto allocate_node() -> uint32_t;
+	auto free_node(uint32_t node) -> void;
+
+	auto insert_leaf(uint32_t leaf) -> void;
+	auto remove_leaf(uint32_t leaf) -> void;
+
+	/// Rotate the subtree at `node` if it's unbalanced; returns its new root
+	auto balance(uint32_t node) -> uint32_t;
+
+	/// Refit heights and boxes from `node` up to the root, balancing on the way
+	auto refit(uint32_t node) -> void;
+
+	/// Enlarge a leaf's fat box around its box
+	auto fatten(Node& leaf) const -> void;
+
+	auto move_locked(uint32_t proxy, const BoundingBox& box) -> bool;
+
+	/// Visit the leaves `test` finds in the query; a node it finds wholly inside has its
+	/// whole subtree taken without further tests
+	template <class Test, class Visit>
+	auto traverse(std::vector<uint32_t>& stack, Test&& test, Visit&& visit) const -> void;
+
+	auto raycast_locked(const Ray& ray, std::vector<uint32_t>& stack) const -> RayHit;
+
+	std::vector<Node> nodes;
+	uint32_t root = NO_PROXY;
+	uint32_t free_list = NO_PROXY;
+	std::size_t leaf_count = 0;
+	float margin;
+
+	mutable std::shared_mutex mutex;
+};
+
+} // namespace gengine
@@ -0,0 +1,111 @@
+/**
+ * Pack asset files into a ".gpak" archive which the engine reads in place of them.
+ *
+ * BUILD: cmake --workflow --preset linux-(vk|gl)-dev
+ * RUN: archivetools <archive.gpak> <file or directory>...
+ *      archivetools --list <archive.gpak>
+ *
+ * Entries are named relative to the archive's directory, so "./data.gpak" built from
+ * "assets/" answers for "./assets/..." once mounted.
+ */
+
+#include "asset_archive.h"
+
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static auto list(const filesystem::path& archive_path) -> bool
+{
+	const auto archive = gengine::AssetArchive::open(archive_path);
+	if (!archive.has_value()) {
+		cerr << "Error: " << archive.error() << endl;
+		return false;
+	}
+
+	auto total_size = uint64_t{0};
+	auto total_stored = uint64_t{0};
+	for (const auto name : (*archive)->names()) {
+		const auto [size, stored] = *(*archive)->sizes(name);
+		total_size += size;
+		total_stored += stored;
+		cout << name << " " << size << " -> " << stored << " bytes" << endl;
+	}
+	cout << (*archive)->names().size() << " entries " << total_size << " -> " << total_stored
+		 << " bytes" << endl;
+
+	return true;
+}
+
+/// Add a file, or every file under a directory, named relative to the archive
+static auto collect(
+	const filesystem::path& archive_path,
+	const filesystem::path& path,
+	vector<gengine::ArchiveInput>& inputs) -> bool
+{
+	const auto root = filesystem::absolute(archive_path).parent_path();
+
+	const auto add = [&](const filesystem::path& file) {
+		const auto absolute = filesystem::absolute(file).lexically_normal();
+		if (absolute == filesystem::absolute(archive_path).lexically_normal()) {
+			return;
+		}
+		for (const auto& part : absolute) {
+			if (part == ".gengine-cache") {
+				return; // Import caches are rebuilt per machine
+			}
+		}
+		const auto name = absolute.lexically_relative(root).generic_string();
+		if (name.empty() || name.starts_with("..")) {
+			cerr << "Error: " << file.string() << " is outside " << root.string() << endl;
+			return;
+		}
+		inputs.push_back({name, absolute});
+	};
+
+	if (filesystem::is_regular_file(path)) {
+		add(path);
+		return true;
+	}
+	if (!filesystem::is_directory(path)) {
+		cerr << "Error: Cannot find " << path.string() << endl;
+		return false;
+	}
+	for (const auto& entry : filesystem::recursive_directory_iterator(path)) {
+		if (entry.is_regular_file()) {
+			add(entry.path());
+		}
+	}
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	if (argc == 3 && string(argv[1]) == "--list") {
+		return list(argv[2]) ? 0 : 1;
+	}
+
+	if (argc < 3) {
+		cerr << "Usage: " << argv[0] << " <archive.gpak> <file or directory>..." << endl;
+		cerr << "       " << argv[0] << " --list <archive.gpak>" << endl;
+		return 1;
+	}
+
+	const auto archive_path = filesystem::path{argv[1]};
+	auto inputs = vector<gengine::ArchiveInput>{};
+	for (auto i = 2; i < argc; i++) {
+		if (!collect(archive_path, argv[i], inputs)) {
+			return 1;
+		}
+	}
+
+	if (const auto written = gengine::write_archive(archive_path, inputs); !written.has_value()) {
+		cerr << "Error: " << written.error() << endl;
+		return 1;
+	}
+
+	return list(archive_path) ? 0 : 1;
+}
@@ -0,0 +1,237 @@
+/**
+ * Load, reload and evict images through TextureFactory, on the CPU only.
+ *
+ * BUILD: cmake --workflow --preset linux-(vk|gl)-dev
+ * RUN: ctest -R assets, or asset-tests
+ *
+ * A PNG with a baked ".gtex" sibling is loaded, then rewritten with other pixels, and
+ * unloaded by name the way a scene's hot reload does it.  The next load must decode the
+ * new PNG, not serve the cached image or the bake which is now older than the PNG.
+ *
+ * An image kept over the memory budget because it's in use must be evicted as soon as
+ * the last copy of its asset goes.
+ */
+
+#include "assets.h"
+#include "textures.h"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static auto failures = 0;
+
+static auto check(bool ok, const string& what) -> void
+{
+	if (!ok) {
+		cerr << "Error: " << what << endl;
+		failures++;
+	}
+}
+
+// A minimal PNG writer: RGBA8, stored (uncompressed) deflate blocks ----------
+
+static auto crc32(const vector<uint8_t>& bytes, size_t first) -> uint32_t
+{
+	auto crc = 0xFFFFFFFFu;
+	for (auto i = first; i < bytes.size(); i++) {
+		crc ^= bytes[i];
+		for (auto bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+		}
+	}
+	return ~crc;
+}
+
+static auto put_u32(vector<uint8_t>& out, uint32_t value) -> void
+{
+	for (auto shift = 24; shift >= 0; shift -= 8) {
+		out.push_back(static_cast<uint8_t>(value >> shift));
+	}
+}
+
+static auto put_chunk(vector<uint8_t>& out, const char* type, const vector<uint8_t>& data)
+	-> void
+{
+	put_u32(out, static_cast<uint32_t>(data.size()));
+	const auto start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	put_u32(out, crc32(out, start));
+}
+
+static auto encode_png(uint32_t width, uint32_t height, const vector<uint8_t>& rgba)
+	-> vector<uint8_t>
+{
+	// Each row starts with filter type 0
+	auto raw = vector<uint8_t>{};
+	for (auto y = 0u; y < height; y++) {
+		raw.push_back(0);
+		const auto row = rgba.begin() + size_t{y} * width * 4;
+		raw.insert(raw.end(), row, row + width * 4);
+	}
+
+	auto zlib = vector<uint8_t>{0x78, 0x01};
+	for (auto offset = size_t{0}; offset < raw.size() || offset == 0;) {
+		const auto length = static_cast<uint16_t>(min<size_t>(raw.size() - offset, 65535));
+		const auto last = offset + length == raw.size();
+		zlib.push_back(last ? 1 : 0);
+		zlib.push_back(static_cast<uint8_t>(length));
+		zlib.push_back(static_cast<uint8_t>(length >> 8));
+		zlib.push_back(static_cast<uint8_t>(~length));
+		zlib.push_back(static_cast<uint8_t>(~length >> 8));
+		zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+		if (last) {
+			break;
+		}
+	}
+	auto a = 1u;
+	auto b = 0u;
+	for (const auto byte : raw) {
+		a = (a + byte) % 65521;
+		b = (b + a) % 65521;
+	}
+	put_u32(zlib, b << 16 | a);
+
+	auto header = vector<uint8_t>{};
+	put_u32(header, width);
+	put_u32(header, height);
+	header.insert(header.end(), {8, 6, 0, 0, 0});
+
+	auto png = vector<uint8_t>{0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	put_chunk(png, "IHDR", header);
+	put_chunk(png, "IDAT", zlib);
+	put_chunk(png, "IEND", {});
+	return png;
+}
+
+static auto write_file(const filesystem::path& path, const void* data, size_t size) -> void
+{
+	auto file = ofstream{path, ios::binary | ios::trunc};
+	file.write(static_cast<const char*>(data), static_cast<streamsize>(size));
+}
+
+/**
+ * An 8x8 image of one color, but for a translucent corner: the image keeps all four
+ * channels when decoded, and rows can't swap unseen.
+ */
+static auto solid_image(array<uint8_t, 4> color) -> vector<uint8_t>
+{
+	auto rgba = vector<uint8_t>{};
+	for (auto i = 0; i < 64; i++) {
+		rgba.insert(rgba.end(), color.begin(), color.end());
+	}
+	rgba[0] = 255 - color[0];
+	rgba[3] = 100;
+	return rgba;
+}
+
+static auto test_reload_edited_png() -> void
+{
+	constexpr auto SIZE = 8u;
+	const auto directory = filesystem::temp_directory_path() / "gengine-asset-tests";
+	filesystem::remove_all(directory);
+	filesystem::create_directories(directory);
+	const auto previous_directory = filesystem::current_path();
+	filesystem::current_path(directory);
+
+	// Requested by a relative path, which the asset's name normalizes
+	const auto path = string{"texture.png"};
+	const auto baked_path =
+		directory / ("texture.png." + string{gpu::texture_format_name(gpu::TextureFormat::BC1)} +
+					 ".gtex");
+
+	const auto before = solid_image({200, 40, 40, 255});
+	const auto before_png = encode_png(SIZE, SIZE, before);
+	write_file(path, before_png.data(), before_png.size());
+	const auto baked = gpu::write_texture_file(
+		gpu::encode_texture(gpu::TextureFormat::BC1, SIZE, SIZE, before.data()));
+	write_file(baked_path, baked.data(), baked.size());
+	filesystem::last_write_time(
+		baked_path, filesystem::last_write_time(path) + chrono::seconds{1});
+
+	auto textures = gengine::TextureFactory{};
+	textures.set_baked_formats({gpu::TextureFormat::BC1});
+
+	const auto first = textures.load_image_from_file(path);
+	check(first.has_value(), "first load failed");
+	if (first.has_value()) {
+		check(first->baked != nullptr, "a current bake was not used");
+		check(
+			first->baked_format == gpu::TextureFormat::BC1 &&
+				first->format == gpu::PixelFormat::RGB8,
+			"the bake's format was not carried through");
+
+		// Edit the PNG after its bake, then reload it the way reload_image does
+		const auto after = solid_image({30, 90, 220, 255});
+		const auto after_png = encode_png(SIZE, SIZE, after);
+		write_file(path, after_png.data(), after_png.size());
+		filesystem::last_write_time(
+			path, filesystem::last_write_time(baked_path) + chrono::seconds{1});
+
+		textures.unload_image({.name = first->name});
+		for (const auto& request : {first->name, path}) {
+			const auto reloaded = textures.load_image_from_file(request);
+			check(reloaded.has_value(), "reload of " + request + " failed");
+			if (!reloaded.has_value()) {
+				continue;
+			}
+			check(reloaded->baked == nullptr, request + ": the stale bake was used");
+			const auto decoded = reloaded->data != nullptr &&
+								 reloaded->format == gpu::PixelFormat::RGBA8 &&
+								 reloaded->width == SIZE && reloaded->height == SIZE;
+			check(decoded, request + ": not decoded as 8x8 RGBA8");
+			check(
+				decoded && memcmp(reloaded->data, after.data(), after.size()) == 0,
+				request + ": pixels are not the edited ones");
+			check(reloaded->content_hash != first->content_hash, request + ": same content hash");
+		}
+	}
+
+	filesystem::current_path(previous_directory);
+	filesystem::remove_all(directory);
+}
+
+static auto test_trim_when_unpinned() -> void
+{
+	constexpr auto SIZE = 8u;
+	const auto path = filesystem::temp_directory_path() / "gengine-asset-tests-pin.png";
+	const auto png = encode_png(SIZE, SIZE, solid_image({10, 200, 10, 255}));
+	write_file(path, png.data(), png.size());
+
+	auto textures = gengine::TextureFactory{};
+	textures.set_memory_budget(1);
+	{
+		const auto image = textures.load_image_from_file(path.string());
+		check(image.has_value(), "load failed");
+		check(
+			textures.get_cache_stats().resident_images == 1,
+			"an image in use was evicted to fit the budget");
+	}
+	check(
+		textures.get_cache_stats().resident_images == 0,
+		"an image over budget stayed cached after its last copy went");
+
+	filesystem::remove(path);
+}
+
+int main()
+{
+	test_reload_edited_png();
+	test_trim_when_unpinned();
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return 1;
+	}
+	cout << "[info]\t asset tests passed" << endl;
+	return 0;
+}
@@ -0,0 +1,348 @@
+#include "asset_archive.h"
+#include "thread_pool.h"
+
+#include <lz4.h>
+#include <lz4hc.h>
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+auto align_up(uint64_t offset, uint64_t alignment) -> uint64_t
+{
+	return (offset + alignment - 1) / alignment * alignment;
+}
+
+/// One input, ready to be laid out
+struct PackedEntry {
+	string name;
+	uint64_t size;
+	vector<uint32_t> chunk_sizes;
+	vector<byte> stored;
+};
+
+auto pack_entry(const ArchiveInput& input, uint32_t chunk_size)
+	-> expected<PackedEntry, string>
+{
+	const auto file = MappedFile::open(input.path);
+	if (!file.has_value()) {
+		return unexpected(file.error());
+	}
+	const auto bytes = (*file)->bytes();
+
+	auto entry = PackedEntry{input.name, bytes.size(), {}, {}};
+	entry.stored.reserve(bytes.size());
+
+	auto scratch = vector<char>(LZ4_compressBound(static_cast<int>(chunk_size)));
+	for (auto offset = size_t{0}; offset < bytes.size(); offset += chunk_size) {
+		const auto chunk = bytes.subspan(offset, min<size_t>(chunk_size, bytes.size() - offset));
+		const auto compressed_size = LZ4_compress_HC(
+			reinterpret_cast<const char*>(chunk.data()),
+			scratch.data(),
+			static_cast<int>(chunk.size()),
+			static_cast<int>(scratch.size()),
+			LZ4HC_CLEVEL_DEFAULT);
+
+		// A chunk which doesn't shrink is kept as it was
+		if (compressed_size <= 0 || static_cast<size_t>(compressed_size) >= chunk.size()) {
+			entry.stored.insert(entry.stored.end(), chunk.begin(), chunk.end());
+			entry.chunk_sizes.push_back(static_cast<uint32_t>(chunk.size()));
+		}
+		else {
+			const auto compressed = as_bytes(span{scratch}.first(compressed_size));
+			entry.stored.insert(entry.stored.end(), compressed.begin(), compressed.end());
+			entry.chunk_sizes.push_back(static_cast<uint32_t>(compressed_size));
+		}
+	}
+
+	// Store entries which LZ4 can't shrink by much, so they're read in place
+	if (entry.stored.size() + entry.stored.size() / 16 >= bytes.size()) {
+		entry.stored.assign(bytes.begin(), bytes.end());
+		entry.chunk_sizes.clear();
+	}
+
+	return entry;
+}
+
+} // namespace
+
+auto AssetArchive::open(const filesystem::path& path)
+	-> expected<shared_ptr<const AssetArchive>, string>
+{
+	auto file = MappedFile::open(path);
+	if (!file.has_value()) {
+		return unexpected(file.error());
+	}
+
+	const auto bytes = (*file)->bytes();
+	const auto damaged = unexpected("Damaged archive " + path.string());
+
+	auto archive = shared_ptr<AssetArchive>(new AssetArchive{});
+	archive->file = *file;
+
+	if (bytes.size() < sizeof(ArchiveHeader)) {
+		return damaged;
+	}
+	memcpy(&archive->header, bytes.data(), sizeof(ArchiveHeader));
+	const auto& header = archive->header;
+	if (memcmp(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0 ||
+		header.version != ARCHIVE_VERSION || header.chunk_size == 0) {
+		return unexpected("Unsupported archive " + path.string());
+	}
+
+	const auto toc_size = header.entry_count * sizeof(ArchiveEntry);
+	if (header.entry_count > bytes.size() / sizeof(ArchiveEntry) ||
+		sizeof(ArchiveHeader) + toc_size > bytes.size() || header.names_offset > bytes.size() ||
+		header.names_size > bytes.size() - header.names_offset) {
+		return damaged;
+	}
+	archive->entries = {
+		reinterpret_cast<const ArchiveEntry*>(bytes.data() + sizeof(ArchiveHeader)),
+		header.entry_count};
+
+	// Check every range once, so reads can trust them
+	for (const auto& entry : archive->entries) {
+		auto stored_size = entry.size;
+		if (entry.chunk_count > 0) {
+			const auto expected_chunks = (entry.size + header.chunk_size - 1) / header.chunk_size;
+			if (entry.chunk_count != expected_chunks ||
+				entry.chunk_sizes_offset > bytes.size() ||
+				entry.chunk_count > (bytes.size() - entry.chunk_sizes_offset) / sizeof(uint32_t)) {
+				return damaged;
+			}
+			stored_size = archive->stored_size(entry);
+		}
+		if (entry.name_offset > header.names_size ||
+			entry.name_size > header.names_size - entry.name_offset ||
+			entry.offset > bytes.size() || stored_size > bytes.size() - entry.offset) {
+			return damaged;
+		}
+	}
+
+	cout << "[info]\t Opened archive " << path.string() << " (" << header.entry_count
+		 << " entries)" << endl;
+
+	return archive;
+}
+
+auto AssetArchive::entry_name(const ArchiveEntry& entry) const -> string_view
+{
+	const auto names = file->text().substr(header.names_offset, header.names_size);
+	return names.substr(entry.name_offset, entry.name_size);
+}
+
+auto AssetArchive::find(string_view name) const -> const ArchiveEntry*
+{
+	const auto it = lower_bound(
+		entries.begin(), entries.end(), name, [this](const ArchiveEntry& entry, string_view name) {
+			return entry_name(entry) < name;
+		});
+	if (it == entries.end() || entry_name(*it) != name) {
+		return nullptr;
+	}
+	return &*it;
+}
+
+auto AssetArchive::contains(string_view name) const -> bool { return find(name) != nullptr; }
+
+auto AssetArchive::names() const -> vector<string_view>
+{
+	auto result = vector<string_view>{};
+	result.reserve(entries.size());
+	for (const auto& entry : entries) {
+		result.push_back(entry_name(entry));
+	}
+	return result;
+}
+
+auto AssetArchive::sizes(string_view name) const -> optional<pair<uint64_t, uint64_t>>
+{
+	const auto entry = find(name);
+	if (entry == nullptr) {
+		return nullopt;
+	}
+	return pair{entry->size, stored_size(*entry)};
+}
+
+auto AssetArchive::chunk_stored_size(const ArchiveEntry& entry, uint32_t chunk) const -> uint32_t
+{
+	auto size = uint32_t{0};
+	memcpy(
+		&size,
+		file->bytes().data() + entry.chunk_sizes_offset + chunk * sizeof(uint32_t),
+		sizeof(uint32_t));
+	return size;
+}
+
+auto AssetArchive::stored_size(const ArchiveEntry& entry) const -> uint64_t
+{
+	if (entry.chunk_count == 0) {
+		return entry.size;
+	}
+	auto size = uint64_t{0};
+	for (auto chunk = 0u; chunk < entry.chunk_count; chunk++) {
+		size += chunk_stored_size(entry, chunk);
+	}
+	return size;
+}
+
+auto AssetArchive::read(string_view name) const -> expected<FileView, string>
+{
+	const auto entry = find(name);
+	if (entry == nullptr) {
+		return unexpected("No " + string(name) + " in archive");
+	}
+
+	const auto bytes = file->bytes();
+	if (entry->chunk_count == 0) {
+		return FileView{file, bytes.subspan(entry->offset, entry->size)};
+	}
+
+	auto buffer = make_shared<vector<byte>>(entry->size);
+
+	// Chunks are independent: each job decompresses one straight into place
+	auto& pool = ThreadPool::shared();
+	auto jobs = vector<future<bool>>{};
+	jobs.reserve(entry->chunk_count);
+	auto stored_offset = entry->offset;
+	for (auto chunk = 0u; chunk < entry->chunk_count; chunk++) {
+		const auto stored_size = chunk_stored_size(*entry, chunk);
+		const auto source = bytes.subspan(stored_offset, stored_size);
+		const auto target = span{*buffer}.subspan(
+			uint64_t{chunk} * header.chunk_size,
+			min<uint64_t>(header.chunk_size, entry->size - uint64_t{chunk} * header.chunk_size));
+		stored_offset += stored_size;
+
+		jobs.push_back(pool.submit([source, target]() {
+			if (source.size() == target.size()) {
+				memcpy(target.data(), source.data(), target.size());
+				return true;
+			}
+			const auto size = LZ4_decompress_safe(
+				reinterpret_cast<const char*>(source.data()),
+				reinterpret_cast<char*>(target.data()),
+				static_cast<int>(source.size()),
+				static_cast<int>(target.size()));
+			return size == static_cast<int>(target.size());
+		}));
+	}
+
+	auto intact = true;
+	for (auto& job : jobs) {
+		intact = pool.wait(job) && intact;
+	}
+	if (!intact) {
+		return unexpected("Damaged entry " + string(name) + " in archive");
+	}
+
+	const auto data = span<const byte>{*buffer};
+	return FileView{std::move(buffer), data};
+}
+
+auto write_archive(
+	const filesystem::path& archive_path,
+	span<const ArchiveInput> inputs,
+	uint32_t chunk_size,
+	uint32_t alignment) -> expected<void, string>
+{
+	if (chunk_size == 0 || alignment == 0) {
+		return unexpected("Chunk size and alignment must be positive");
+	}
+
+	// Compress every file at once
+	auto& pool = ThreadPool::shared();
+	auto jobs = vector<future<expected<PackedEntry, string>>>{};
+	for (const auto& input : inputs) {
+		jobs.push_back(
+			pool.submit([&input, chunk_size]() { return pack_entry(input, chunk_size); }));
+	}
+	auto packed = vector<PackedEntry>{};
+	for (auto& job : jobs) {
+		auto entry = pool.wait(job);
+		if (!entry.has_value()) {
+			return unexpected(entry.error());
+		}
+		packed.push_back(std::move(*entry));
+	}
+
+	// The table of contents is binary searched by name
+	sort(packed.begin(), packed.end(), [](const PackedEntry& a, const PackedEntry& b) {
+		return a.name < b.name;
+	});
+	for (auto i = size_t{1}; i < packed.size(); i++) {
+		if (packed[i - 1].name == packed[i].name) {
+			return unexpected("Duplicate archive entry " + packed[i].name);
+		}
+	}
+
+	// Lay out the header, table of contents, names and chunk sizes up front...
+	auto header = ArchiveHeader{};
+	memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+	header.version = ARCHIVE_VERSION;
+	header.chunk_size = chunk_size;
+	header.alignment = alignment;
+	header.entry_count = packed.size();
+	header.names_offset = sizeof(ArchiveHeader) + packed.size() * sizeof(ArchiveEntry);
+
+	auto names = string{};
+	auto entries = vector<ArchiveEntry>{};
+	for (const auto& entry : packed) {
+		entries.push_back(
+			{names.size(),
+			 static_cast<uint32_t>(entry.name.size()),
+			 static_cast<uint32_t>(entry.chunk_sizes.size()),
+			 0,
+			 entry.size,
+			 0});
+		names += entry.name;
+	}
+	header.names_size = names.size();
+
+	auto offset = header.names_offset + header.names_size;
+	for (auto i = size_t{0}; i < packed.size(); i++) {
+		entries[i].chunk_sizes_offset = offset;
+		offset += packed[i].chunk_sizes.size() * sizeof(uint32_t);
+	}
+
+	// ...then every entry's data on its own alignment boundary
+	for (auto i = size_t{0}; i < packed.size(); i++) {
+		offset = align_up(offset, alignment);
+		entries[i].offset = offset;
+		offset += packed[i].stored.size();
+	}
+
+	auto stream = ofstream(archive_path, ios::binary | ios::trunc);
+	if (!stream.is_open()) {
+		return unexpected("Cannot write " + archive_path.string());
+	}
+	const auto write = [&stream](const void* data, size_t size) {
+		stream.write(static_cast<const char*>(data), size);
+	};
+	write(&header, sizeof(header));
+	write(entries.data(), entries.size() * sizeof(ArchiveEntry));
+	write(names.data(), names.size());
+	for (const auto& entry : packed) {
+		write(entry.chunk_sizes.data(), entry.chunk_sizes.size() * sizeof(uint32_t));
+	}
+	const auto padding = vector<char>(alignment, 0);
+	for (auto i = size_t{0}; i < packed.size(); i++) {
+		const auto position = static_cast<uint64_t>(stream.tellp());
+		write(padding.data(), entries[i].offset - position);
+		write(packed[i].stored.data(), packed[i].stored.size());
+	}
+
+	if (!stream.good()) {
+		return unexpected("Cannot write " + archive_path.string());
+	}
+	return {};
+}
+
+} // namespace gengine
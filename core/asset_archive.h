@@ -0,0 +1,132 @@
+/**
+ * @file asset_archive.h - many asset files packed into one, read through a memory map.
+ *
+ * Layout, all little-endian:
+ *
+ *   ArchiveHeader
+ *   ArchiveEntry[entry_count]   table of contents, sorted by name
+ *   names                       every entry's name, back to back
+ *   uint32_t[]                  stored size of each chunk of each compressed entry
+ *   entry data                  each entry starts on a multiple of `alignment`
+ *
+ * Entries which LZ4 can't shrink are stored as-is and read in place. The rest are
+ * split into chunks of `chunk_size` bytes which are compressed independently, so
+ * they decompress in parallel. A chunk which didn't shrink is stored as-is too.
+ *
+ * Entry names are paths relative to the archive's directory, with '/' separators.
+ */
+
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gengine {
+
+constexpr char ARCHIVE_MAGIC[4] = {'G', 'P', 'A', 'K'};
+
+constexpr uint32_t ARCHIVE_VERSION = 1;
+
+constexpr uint32_t DEFAULT_ARCHIVE_CHUNK_SIZE = 128 * 1024;
+
+/// Page-aligned entries can be handed out straight from the mapping
+constexpr uint32_t DEFAULT_ARCHIVE_ALIGNMENT = 4096;
+
+/// Mounted at startup when it exists; see mount_archive in vfs.h
+constexpr std::string_view DEFAULT_ARCHIVE_PATH = "./data.gpak";
+
+struct ArchiveHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t chunk_size;
+	uint32_t alignment;
+	uint64_t entry_count;
+	uint64_t names_offset;
+	uint64_t names_size;
+};
+
+struct ArchiveEntry {
+	uint64_t name_offset;
+	uint32_t name_size;
+	/// Zero when the entry is stored uncompressed
+	uint32_t chunk_count;
+	/// Where the entry's stored bytes start
+	uint64_t offset;
+	/// Size of the entry once decompressed
+	uint64_t size;
+	/// Where the entry's `chunk_count` stored chunk sizes are
+	uint64_t chunk_sizes_offset;
+};
+
+/**
+ * @brief An archive file mapped into memory.
+ * @note Thread-safe; reads don't modify the archive.
+ */
+class AssetArchive {
+public:
+	static auto open(const std::filesystem::path& path)
+		-> std::expected<std::shared_ptr<const AssetArchive>, std::string>;
+
+	auto contains(std::string_view name) const -> bool;
+
+	/**
+	 * @brief The bytes of one entry.
+	 *
+	 * Stored entries are served from the mapping without copying. Compressed ones are
+	 * decompressed chunk by chunk on the shared ThreadPool.
+	 */
+	auto read(std::string_view name) const -> std::expected<FileView, std::string>;
+
+	/// Every entry name, sorted
+	auto names() const -> std::vector<std::string_view>;
+
+	/// Size of the entry once decompressed, and the bytes it takes in the archive
+	auto sizes(std::string_view name) const -> std::optional<std::pair<uint64_t, uint64_t>>;
+
+private:
+	AssetArchive() = default;
+
+	auto find(std::string_view name) const -> const ArchiveEntry*;
+
+	auto entry_name(const ArchiveEntry& entry) const -> std::string_view;
+
+	auto chunk_stored_size(const ArchiveEntry& entry, uint32_t chunk) const -> uint32_t;
+
+	/// Bytes the entry takes in the archive
+	auto stored_size(const ArchiveEntry& entry) const -> uint64_t;
+
+	std::shared_ptr<const MappedFile> file;
+
+	ArchiveHeader header{};
+
+	std::span<const ArchiveEntry> entries;
+};
+
+/// One file to pack
+struct ArchiveInput {
+	/// Name inside the archive, relative to the archive's directory
+	std::string name;
+	std::filesystem::path path;
+};
+
+/**
+ * @brief Pack files into a new archive, compressing them in parallel.
+ * @param inputs any order; names must be unique
+ */
+auto write_archive(
+	const std::filesystem::path& archive_path,
+	std::span<const ArchiveInput> inputs,
+	uint32_t chunk_size = DEFAULT_ARCHIVE_CHUNK_SIZE,
+	uint32_t alignment = DEFAULT_ARCHIVE_ALIGNMENT) -> std::expected<void, std::string>;
+
+} // namespace gengine
@@ -1,10 +1,22 @@
 #include "assets.h"
+#include "config.h"
+#include "gltf.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "mesh_optimizer.h"
+#include "mesh_simplifier.h"
+#include "profiler.h"
+#include "scene_cache.h"
 #include "stb/stb_image.h"
+#include "thread_pool.h"
+#include "vfs.h"
 
 #ifdef __EMSCRIPTEN__
 #include <emscripten/fetch.h>
 #endif
 
+#include <assimp/IOStream.hpp>
+#include <assimp/IOSystem.hpp>
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/quaternion.h>
@@ -13,9 +25,18 @@
 #include <glm/gtc/quaternion.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <optional>
 #include <sstream>
 #include <unordered_map>
 
@@ -26,30 +47,172 @@ using namespace std;
 
 namespace gengine {
 
-auto TextureFactory::get_image_log() -> const ImageLog* { return &image_log; }
+/// Load the first baked sibling of an image file, in order of preference
+static auto load_baked_image(
+	const filesystem::path& normalized_path, const std::vector<gpu::TextureFormat>& formats)
+	-> std::optional<ImageAsset>
+{
+	for (const auto format : formats) {
+		auto baked_path = normalized_path;
+		baked_path += "." + string(gpu::texture_format_name(format)) + ".gtex";
 
-auto TextureFactory::get_image_cache() -> const ImageCache* { return &image_cache; }
+		if (!asset_file_exists(baked_path)) {
+			continue;
+		}
 
-auto TextureFactory::image_in_cache(const std::string& path) -> bool
-{
-	return image_cache.find(path) != image_cache.end();
+		// An image edited since it was baked wins over its bake; archives carry no times
+		auto source_error = error_code{};
+		auto baked_error = error_code{};
+		const auto source_time = filesystem::last_write_time(normalized_path, source_error);
+		const auto baked_time = filesystem::last_write_time(baked_path, baked_error);
+		if (!source_error && !baked_error && baked_time < source_time) {
+			cout << "[info]\t " << baked_path.string() << " is older than its image, ignoring it"
+				 << endl;
+			continue;
+		}
+
+		auto scope = ProfileScope{normalized_path.string(), "baked"};
+		const auto file = read_asset_file(baked_path);
+		if (!file.has_value()) {
+			cout << "Error: " << file.error() << endl;
+			continue;
+		}
+		scope.add_bytes(file->bytes().size());
+
+		auto texture = gpu::read_texture_file(file->bytes(), file->storage);
+		if (!texture.has_value() || texture->format != format) {
+			cout << "Error: Cannot load " << baked_path.string() << ": "
+				 << (texture.has_value() ? "wrong format" : texture.error()) << endl;
+			continue;
+		}
+
+		cout << "ImageAsset " << baked_path.string() << " (" << texture->width << "x"
+			 << texture->height << ") " << gpu::texture_format_name(format)
+			 << " mips:" << texture->levels.size() << endl;
+
+		auto size_bytes = size_t{0};
+		for (const auto& level : texture->levels) {
+			size_bytes += level.data.size();
+		}
+		// The file holds the format, dimensions and every level
+		const auto content_hash = hash_bytes(file->bytes());
+
+		// BC1 and ETC2 blocks hold no alpha
+		const auto channels = format == gpu::TextureFormat::BC1 ||
+									  format == gpu::TextureFormat::ETC2_RGB8
+								  ? gpu::PixelFormat::RGB8
+								  : gpu::PixelFormat::RGBA8;
+
+		return ImageAsset{
+			normalized_path,
+			texture->width,
+			texture->height,
+			channels,
+			nullptr,
+			make_shared<const gpu::TextureData>(std::move(*texture)),
+			nullptr,
+			size_bytes,
+			content_hash,
+			format};
+	}
+
+	return nullopt;
 }
 
-auto TextureFactory::load_image_from_file(const std::string& path)
-	-> std::expected<ImageAsset, std::string>
+/**
+ * @brief Drop channels which carry nothing: color when every pixel is gray, alpha when
+ *        every pixel is opaque.  Pixels are repacked in place.
+ * @return the channels left
+ */
+static auto drop_redundant_channels(unsigned char* data, size_t pixel_count, int channel_count)
+	-> int
 {
-	// Return the cached asset
-	if (image_in_cache(path)) {
-		return image_cache.at(path);
+	const auto has_color = channel_count >= 3;
+	const auto has_alpha = channel_count == 2 || channel_count == 4;
+	auto gray = has_color;
+	auto opaque = has_alpha;
+	for (auto i = size_t{0}; i < pixel_count && (gray || opaque); i++) {
+		const auto pixel = data + i * channel_count;
+		gray = gray && pixel[0] == pixel[1] && pixel[0] == pixel[2];
+		opaque = opaque && pixel[channel_count - 1] == 255;
+	}
+
+	const auto color_channels = gray || !has_color ? 1 : 3;
+	const auto kept = color_channels + (has_alpha && !opaque ? 1 : 0);
+	if (kept == channel_count) {
+		return channel_count;
 	}
+	// Each pixel moves to an offset no later than its own, so front to back is safe
+	for (auto i = size_t{0}; i < pixel_count; i++) {
+		const auto src = data + i * channel_count;
+		const auto dst = data + i * kept;
+		memmove(dst, src, color_channels);
+		if (kept > color_channels) {
+			dst[color_channels] = src[channel_count - 1];
+		}
+	}
+	return kept;
+}
+
+/// Wrap pixels from stb in an ImageAsset which frees them with its last copy
+static auto make_decoded_image(
+	std::string name, int width, int height, int channel_count, unsigned char* data) -> ImageAsset
+{
+	const auto storage =
+		shared_ptr<const void>(data, [](const void* pixels) { stbi_image_free(const_cast<void*>(pixels)); });
+	channel_count =
+		drop_redundant_channels(data, static_cast<size_t>(width) * height, channel_count);
+	const auto format = gpu::pixel_format_from_channels(channel_count);
+	const auto size_bytes = static_cast<size_t>(width) * height * channel_count;
+
+	// Decoded pixels, so the same image hashes the same whichever way it was encoded
+	auto content_hash = hash_combine(hash_combine(hash_string("pixels"), width), height);
+	content_hash = hash_combine(content_hash, format);
+	content_hash = hash_bytes(as_bytes(span{data, size_bytes}), content_hash);
+
+	return ImageAsset{
+		std::move(name),
+		static_cast<uint32_t>(width),
+		static_cast<uint32_t>(height),
+		format,
+		data,
+		nullptr,
+		storage,
+		size_bytes,
+		content_hash};
+}
 
+/// Decode an image file with stb.  Safe to call from any thread.
+static auto decode_image_file(
+	const std::string& path, const std::vector<gpu::TextureFormat>& baked_formats)
+	-> TextureFactory::ImageResult
+{
 	auto width = 0;
 	auto height = 0;
 	auto channel_count = 0;
 
 	filesystem::path normalized_path = filesystem::current_path() / path;
 
-	const auto data = stbi_load(normalized_path.c_str(), &width, &height, &channel_count, 4);
+	if (auto baked = load_baked_image(normalized_path, baked_formats)) {
+		return *baked;
+	}
+
+	// The file may come from an archive, so stb decodes it from memory.  Images keep the
+	// channels they were stored with; a gray mask takes a quarter of the RGBA memory.
+	auto read_scope = optional<ProfileScope>{in_place, normalized_path.string(), "read"};
+	const auto file = read_asset_file(normalized_path);
+	const auto bytes = file.has_value() ? file->bytes() : span<const byte>{};
+	read_scope->add_bytes(bytes.size());
+	read_scope.reset();
+
+	auto decode_scope = ProfileScope{normalized_path.string(), "decode"};
+	const auto data = stbi_load_from_memory(
+		reinterpret_cast<const unsigned char*>(bytes.data()),
+		static_cast<int>(bytes.size()),
+		&width,
+		&height,
+		&channel_count,
+		0);
 
 	if (data == nullptr) {
 		cout << "Error: Cannot load " << normalized_path.string() << endl;
@@ -57,64 +220,384 @@ auto TextureFactory::load_image_from_file(const std::string& path)
 		return std::unexpected("Cannot load " + normalized_path.string());
 	}
 
-	const auto image_asset = ImageAsset{
-		normalized_path,
-		static_cast<uint32_t>(width),
-		static_cast<uint32_t>(height),
-		static_cast<uint32_t>(4),
-		data};
-
-	image_log.push_back(image_asset);
 	cout << "ImageAsset " << path.data() << " (" << width << "x" << height
-		 << ") channels=" << channel_count << " (fixed to 4)" << endl;
+		 << ") channels=" << channel_count << endl;
+	decode_scope.add_bytes(static_cast<uint64_t>(width) * height * channel_count);
 
-	image_cache[path] = image_asset;
-
-	return image_asset;
+	return make_decoded_image(normalized_path, width, height, channel_count, data);
 }
 
-auto TextureFactory::load_image_from_memory(
-	const std::string& name, const unsigned char* buffer, uint32_t buffer_len) -> ImageAsset
+/// Decode an encoded image in memory with stb.  Safe to call from any thread.
+static auto decode_image_blob(const std::string& name, std::span<const unsigned char> bytes)
+	-> TextureFactory::ImageResult
 {
-	if (image_cache.find(name) != image_cache.end()) {
-		return image_cache.at(name);
-	}
-
 	auto width = 0;
 	auto height = 0;
 	auto channel_count = 0;
 
-	const auto data = stbi_load_from_memory(buffer, buffer_len, &width, &height, &channel_count, 4);
+	auto scope = ProfileScope{name, "decode"};
+	const auto data =
+		stbi_load_from_memory(bytes.data(), bytes.size(), &width, &height, &channel_count, 0);
 
-	const auto image_asset = ImageAsset{
-		name,
-		static_cast<uint32_t>(width),
-		static_cast<uint32_t>(height),
-		static_cast<uint32_t>(4),
-		data};
+	if (data == nullptr) {
+		cout << "Error: Cannot decode " << name << endl;
+		return std::unexpected("Cannot decode " + name);
+	}
 
-	image_log.push_back(image_asset);
 	cout << "ImageAsset " << name << " (" << width << "x" << height
-		 << ") channels=" << channel_count << " (fixed to 4)" << endl;
+		 << ") channels=" << channel_count << endl;
+	scope.add_bytes(static_cast<uint64_t>(width) * height * channel_count);
+
+	return make_decoded_image(name, width, height, channel_count, data);
+}
+
+auto TextureFactory::get_image_log() -> ImageLog
+{
+	std::lock_guard lock{mutex};
+	return image_log;
+}
+
+auto TextureFactory::get_image_cache() -> ImageCache
+{
+	std::lock_guard lock{mutex};
+	auto snapshot = ImageCache{};
+	for (auto& [key, entry] : image_cache) {
+		snapshot.emplace(key, pin_image(entry));
+	}
+	return snapshot;
+}
+
+auto TextureFactory::set_memory_budget(std::size_t bytes) -> void
+{
+	std::lock_guard lock{mutex};
+	memory_budget = bytes;
+	trim_image_cache();
+}
+
+auto TextureFactory::get_cache_stats() -> ImageCacheStats
+{
+	std::lock_guard lock{mutex};
+	return {hits, misses, evictions, image_cache.size(), resident_bytes, memory_budget};
+}
+
+auto TextureFactory::get_baked_formats() -> std::vector<gpu::TextureFormat>
+{
+	std::lock_guard lock{mutex};
+	return baked_formats;
+}
+
+auto TextureFactory::image_in_cache(const std::string& path) -> bool
+{
+	return image_cache.find(path) != image_cache.end();
+}
+
+auto TextureFactory::cache_image(const std::string& key, const ImageAsset& asset) -> ImageAsset
+{
+	evict_image(key);
+	lru_order.push_front(key);
+	auto& entry = image_cache[key] = CacheEntry{asset, lru_order.begin(), {}};
+	resident_bytes += asset.size_bytes;
+	// Pinned first, so the trim can't evict the image it was decoded for
+	auto pinned = pin_image(entry);
+	trim_image_cache();
+	return pinned;
+}
+
+auto TextureFactory::pin_image(CacheEntry& entry) -> ImageAsset
+{
+	// The pin owns the pixels too, so the cache may drop its own copy while they're used
+	struct Owners {
+		shared_ptr<const void> storage;
+		shared_ptr<const gpu::TextureData> baked;
+	};
+
+	auto pin = entry.pin.lock();
+	if (pin == nullptr) {
+		// Copies only go outside the cache, so the last one never goes while `mutex` is held
+		pin = shared_ptr<const void>(
+			new Owners{entry.asset.storage, entry.asset.baked},
+			[factory = weak_ptr{self}](const void* owners) {
+				delete static_cast<const Owners*>(owners);
+				if (const auto alive = factory.lock()) {
+					std::lock_guard lock{(*alive)->mutex};
+					(*alive)->trim_image_cache();
+				}
+			});
+		entry.pin = pin;
+	}
+
+	auto asset = entry.asset;
+	asset.storage = pin;
+	if (asset.baked != nullptr) {
+		asset.baked = shared_ptr<const gpu::TextureData>(pin, asset.baked.get());
+	}
+	return asset;
+}
+
+auto TextureFactory::evict_image(const std::string& key) -> void
+{
+	const auto it = image_cache.find(key);
+	if (it == image_cache.end()) {
+		return;
+	}
+	resident_bytes -= it->second.asset.size_bytes;
+	lru_order.erase(it->second.lru_position);
+	image_cache.erase(it);
+}
+
+auto TextureFactory::trim_image_cache() -> void
+{
+	// Copies held outside the cache share its pin
+	const auto is_pinned = [](const CacheEntry& entry) { return !entry.pin.expired(); };
+
+	auto it = lru_order.end();
+	while (resident_bytes > memory_budget && it != lru_order.begin()) {
+		--it;
+		const auto& entry = image_cache.at(*it);
+		if (is_pinned(entry)) {
+			continue;
+		}
+		cout << "~ ImageAsset " << *it << " (evicted)" << endl;
+		const auto key = *it++;
+		evict_image(key);
+		evictions++;
+	}
+}
+
+auto TextureFactory::request_image(
+	const std::string& key, std::function<ImageResult()> decode, bool run_inline) -> ImageFuture
+{
+	auto promise = std::make_shared<std::promise<ImageResult>>();
+	auto future = promise->get_future().share();
+	{
+		std::lock_guard lock{mutex};
+
+		// Return the cached asset
+		if (const auto it = image_cache.find(key); it != image_cache.end()) {
+			hits++;
+			lru_order.splice(lru_order.begin(), lru_order, it->second.lru_position);
+			promise->set_value(pin_image(it->second));
+			return future;
+		}
+
+		// Join a decode which is already running
+		if (const auto it = in_flight.find(key); it != in_flight.end()) {
+			hits++;
+			return it->second;
+		}
+
+		misses++;
+		in_flight[key] = future;
+	}
+
+	auto job = [this, key, decode = std::move(decode), promise]() {
+		auto result = decode();
+		{
+			std::lock_guard lock{mutex};
+			if (result.has_value()) {
+				auto record = *result;
+				record.data = nullptr;
+				record.baked = nullptr;
+				record.storage = nullptr;
+				image_log.push_back(std::move(record));
+				result = cache_image(key, *result);
+			}
+			in_flight.erase(key);
+		}
+		promise->set_value(std::move(result));
+	};
+
+	if (run_inline) {
+		job();
+	}
+	else {
+		ThreadPool::shared().submit(std::move(job));
+	}
+
+	return future;
+}
+
+auto TextureFactory::set_baked_formats(std::vector<gpu::TextureFormat> formats) -> void
+{
+	std::lock_guard lock{mutex};
+	baked_formats = std::move(formats);
+}
+
+auto TextureFactory::load_image_from_file(const std::string& path) -> ImageResult
+{
+	const auto formats = get_baked_formats();
+	auto future = request_image(
+		path, [path, formats]() { return decode_image_file(path, formats); }, true);
+	return ThreadPool::shared().wait(future);
+}
 
-	image_cache[name] = image_asset;
+auto TextureFactory::load_image_from_memory(
+	const std::string& name, const unsigned char* buffer, uint32_t buffer_len) -> ImageAsset
+{
+	const auto bytes = std::span{buffer, buffer_len};
+	auto future =
+		request_image(name, [name, bytes]() { return decode_image_blob(name, bytes); }, true);
+	const auto result = ThreadPool::shared().wait(future);
+
+	// Preserve the old contract: a failed decode yields an empty image
+	return result.value_or(ImageAsset{
+		name, 0, 0, gpu::PixelFormat::RGBA8, nullptr, nullptr, nullptr, 0, 0});
+}
+
+auto TextureFactory::load_images_from_files(std::span<const std::string> paths)
+	-> std::vector<ImageFuture>
+{
+	const auto formats = get_baked_formats();
+	auto futures = std::vector<ImageFuture>{};
+	futures.reserve(paths.size());
+	for (const auto& path : paths) {
+		futures.push_back(request_image(
+			path, [path, formats]() { return decode_image_file(path, formats); }, false));
+	}
+	return futures;
+}
 
-	return image_asset;
+auto TextureFactory::load_images_from_memory(std::span<const ImageBlob> blobs)
+	-> std::vector<ImageFuture>
+{
+	auto futures = std::vector<ImageFuture>{};
+	futures.reserve(blobs.size());
+	for (const auto& blob : blobs) {
+		futures.push_back(request_image(
+			blob.name, [blob]() { return decode_image_blob(blob.name, blob.bytes); }, false));
+	}
+	return futures;
 }
 
 auto TextureFactory::unload_image(const ImageAsset& asset) -> void
 {
-	image_cache.erase(asset.name);
-	stbi_image_free(asset.data);
+	std::lock_guard lock{mutex};
+	// Files are cached under the path they were requested by, which the name normalizes
+	auto keys = std::vector<std::string>{asset.name};
+	for (const auto& [key, entry] : image_cache) {
+		if (entry.asset.name == asset.name) {
+			keys.push_back(key);
+		}
+	}
+	for (const auto& key : keys) {
+		evict_image(key);
+	}
+}
+
+auto TextureFactory::unload_images_with_prefix(std::string_view prefix) -> void
+{
+	std::lock_guard lock{mutex};
+	auto keys = std::vector<std::string>{};
+	for (const auto& [key, entry] : image_cache) {
+		if (entry.asset.name.starts_with(prefix)) {
+			keys.push_back(key);
+		}
+	}
+	for (const auto& key : keys) {
+		evict_image(key);
+	}
 }
 
 auto TextureFactory::unload_all_images() -> void
 {
-	for (auto it = image_cache.begin(); it != image_cache.end();) {
-		cout << "~ ImageAsset " << it->first << endl;
-		stbi_image_free(it->second.data);
-		image_cache.erase(it++);
+	std::lock_guard lock{mutex};
+	for (const auto& key : lru_order) {
+		cout << "~ ImageAsset " << key << endl;
+	}
+	image_cache.clear();
+	lru_order.clear();
+	resident_bytes = 0;
+}
+
+auto GeometryAsset::vertex_stride() const -> std::size_t
+{
+	auto stride = std::size_t{0};
+	for (const auto attribute : layout) {
+		stride += gpu::vertex_attribute_size(attribute);
+	}
+	return stride;
+}
+
+auto GeometryAsset::vertex_count() const -> std::size_t
+{
+	const auto stride = vertex_stride();
+	return stride == 0 ? 0 : vertices.size() / stride;
+}
+
+auto GeometryAsset::position(std::size_t vertex) const -> glm::vec3
+{
+	auto position = glm::vec3{};
+	memcpy(&position, vertices.data() + vertex * vertex_stride(), sizeof(position));
+	return position;
+}
+
+auto GeometryAsset::bounding_box() const -> BoundingBox
+{
+	const auto count = vertex_count();
+	if (count == 0) {
+		return {glm::vec3{0.0f}, glm::vec3{0.0f}};
+	}
+
+	auto min = position(0);
+	auto max = min;
+	for (auto i = std::size_t{1}; i < count; i++) {
+		const auto p = position(i);
+		min = glm::min(min, p);
+		max = glm::max(max, p);
+	}
+	return {(min + max) * 0.5f, (max - min) * 0.5f};
+}
+
+auto GeometryAsset::bounding_sphere() const -> BoundingSphere
+{
+	const auto count = vertex_count();
+	if (count == 0) {
+		return {glm::vec3{0.0f}, 0.0f};
+	}
+
+	const auto center = bounding_box().center;
+	auto radius_squared = 0.0f;
+	for (auto i = std::size_t{0}; i < count; i++) {
+		const auto offset = position(i) - center;
+		radius_squared = std::max(radius_squared, glm::dot(offset, offset));
+	}
+	return {center, std::sqrt(radius_squared)};
+}
+
+auto GeometryAsset::lod_count() const -> std::size_t { return lods.empty() ? 1 : lods.size(); }
+
+auto GeometryAsset::lod_indices(std::size_t level) const -> std::span<const unsigned int>
+{
+	if (lods.empty()) {
+		return indices;
+	}
+	const auto& lod = lods.at(level);
+	return indices.subspan(lod.first_index, lod.index_count);
+}
+
+auto geometry_content_hash(const GeometryAsset& geometry) -> uint64_t
+{
+	auto hash = hash_string("geometry");
+	for (const auto attribute : geometry.layout) {
+		hash = hash_combine(hash, static_cast<uint32_t>(attribute));
 	}
+	hash = hash_bytes(geometry.vertices, hash_combine(hash, geometry.vertices.size()));
+	hash = hash_bytes(as_bytes(geometry.indices), hash_combine(hash, geometry.indices.size()));
+	return hash_bytes(as_bytes(span{geometry.lods}), hash);
+}
+
+auto make_geometry_asset(
+	std::vector<gpu::VertexAttribute> layout,
+	std::vector<std::byte>&& vertices,
+	std::vector<unsigned int>&& indices) -> GeometryAsset
+{
+	struct Arrays {
+		std::vector<std::byte> vertices;
+		std::vector<unsigned int> indices;
+	};
+	const auto arrays =
+		std::make_shared<const Arrays>(Arrays{std::move(vertices), std::move(indices)});
+	return {std::move(layout), arrays->vertices, arrays->indices, arrays};
 }
 
 /// @brief Temporary structure used to track entity relationships
@@ -140,71 +623,192 @@ struct AssetDecoding {
 	std::unordered_map<MaterialIdx, std::vector<ObjectIdx>> material_to_objects;
 };
 
-auto calculateWorldTransform(const aiNode* node) -> glm::mat4
+/// Flatten the node tree in depth-first order, so parents come before children
+auto flattenNodes(const aiNode* root, std::vector<NodeAsset>& nodes)
+	-> std::vector<const aiNode*>
 {
-	std::vector<aiNode*> parents{};
-	aiNode* parent = node->mParent;
-	while (parent != nullptr) {
-		parents.push_back(parent);
-		parent = parent->mParent;
+	auto flat = std::vector<const aiNode*>{};
+	auto pending = std::vector<std::pair<const aiNode*, int32_t>>{{root, NO_PARENT}};
+	while (!pending.empty()) {
+		const auto [node, parent] = pending.back();
+		pending.pop_back();
+
+		const auto index = static_cast<int32_t>(flat.size());
+		flat.push_back(node);
+		nodes.push_back({glm::transpose(glm::make_mat4(&node->mTransformation.a1)), parent});
+
+		// Reversed, so children pop off the stack in their original order
+		for (auto i = node->mNumChildren; i-- > 0;) {
+			pending.push_back({node->mChildren[i], index});
+		}
 	}
-	auto worldTransform = glm::mat4{1.0f};
-	for (int i = parents.size() - 1; i >= 0; i--) {
-		const auto tr = glm::transpose(glm::make_mat4(&parents[i]->mTransformation.a1));
-		worldTransform *= tr;
+	return flat;
+}
+
+auto traverseNodes(AssetDecoding& decoding, SceneAsset& assets, const aiScene* scene) -> void
+{
+	const auto flat = flattenNodes(scene->mRootNode, assets.nodes);
+
+	// Resolve every world transform in one pass over the flat hierarchy
+	auto hierarchy = TransformHierarchy{};
+	hierarchy.reserve(assets.nodes.size());
+	for (const auto& node : assets.nodes) {
+		hierarchy.add_node(node.parent, node.transform);
 	}
-	return worldTransform;
-};
+	hierarchy.update();
+
+	for (auto node_idx = 0u; node_idx < flat.size(); node_idx++) {
+		const auto node = flat[node_idx];
+		for (auto i = 0; i < node->mNumMeshes; ++i) {
+			const auto mesh_idx = node->mMeshes[i];
+			decoding.mesh_to_objects[mesh_idx].push_back(decoding.objectCount);
+			decoding.objectCount += 1;
+			assets.objects.push_back({hierarchy.world(node_idx), 0, 0, node_idx});
+		}
+	}
+}
 
-auto traverseNode(
-	AssetDecoding& decoding, SceneAsset& assets, const aiScene* scene, const aiNode* node) -> void
+/// IEEE 754 binary16, rounding to nearest
+static auto float_to_half(float value) -> uint16_t
 {
-	const auto transform = calculateWorldTransform(node);
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint16_t sign = (bits >> 16) & 0x8000;
+	const int exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
 
-	for (auto i = 0; i < node->mNumMeshes; ++i) {
-		const auto mesh_idx = node->mMeshes[i];
-		const auto mesh = scene->mMeshes[mesh_idx];
-		decoding.mesh_to_objects[mesh_idx].push_back(decoding.objectCount);
-		decoding.objectCount += 1;
-		assets.objects.push_back({transform, 0, 0});
+	if ((bits & 0x7fffffff) > 0x7f800000) {
+		return sign | 0x7e00; // NaN
+	}
+	if (exponent >= 31) {
+		return sign | 0x7c00; // overflow to infinity
 	}
+	if (exponent <= 0) {
+		if (exponent < -10) {
+			return sign;
+		}
+		mantissa |= 0x800000;
+		const auto shift = 14 - exponent;
+		const auto half = static_cast<uint16_t>(mantissa >> shift);
+		return sign | (half + ((mantissa >> (shift - 1)) & 1));
+	}
+	const auto half = static_cast<uint16_t>((exponent << 10) | (mantissa >> 13));
+	// a carry out of the mantissa correctly bumps the exponent
+	return sign | (half + ((mantissa >> 12) & 1));
+}
 
-	for (auto i = 0; i < node->mNumChildren; ++i) {
-		const auto child = node->mChildren[i];
-		traverseNode(decoding, assets, scene, child);
+template <class Int> static auto pack_snorm(float value) -> Int
+{
+	constexpr auto max = static_cast<float>(std::numeric_limits<Int>::max());
+	return static_cast<Int>(std::round(std::clamp(value, -1.0f, 1.0f) * max));
+}
+
+template <class Int> static auto pack_unorm(float value) -> Int
+{
+	constexpr auto max = static_cast<float>(std::numeric_limits<Int>::max());
+	return static_cast<Int>(std::round(std::clamp(value, 0.0f, 1.0f) * max));
+}
+
+/// Encode one attribute from `values` (as many floats as it has components)
+static auto write_vertex_attribute(gpu::VertexAttribute attribute, const float* values, std::byte* out)
+	-> void
+{
+	switch (attribute) {
+	case gpu::VertexAttribute::VEC3_FLOAT:
+		memcpy(out, values, 3 * sizeof(float));
+		break;
+	case gpu::VertexAttribute::VEC2_FLOAT:
+		memcpy(out, values, 2 * sizeof(float));
+		break;
+	case gpu::VertexAttribute::VEC3_SNORM16: {
+		const int16_t packed[4] = {
+			pack_snorm<int16_t>(values[0]), pack_snorm<int16_t>(values[1]),
+			pack_snorm<int16_t>(values[2]), 0};
+		memcpy(out, packed, sizeof(packed));
+		break;
+	}
+	case gpu::VertexAttribute::VEC3_SNORM8: {
+		const int8_t packed[4] = {
+			pack_snorm<int8_t>(values[0]), pack_snorm<int8_t>(values[1]),
+			pack_snorm<int8_t>(values[2]), 0};
+		memcpy(out, packed, sizeof(packed));
+		break;
+	}
+	case gpu::VertexAttribute::VEC2_SNORM16: {
+		const int16_t packed[2] = {pack_snorm<int16_t>(values[0]), pack_snorm<int16_t>(values[1])};
+		memcpy(out, packed, sizeof(packed));
+		break;
+	}
+	case gpu::VertexAttribute::VEC2_UNORM16: {
+		const uint16_t packed[2] = {
+			pack_unorm<uint16_t>(values[0]), pack_unorm<uint16_t>(values[1])};
+		memcpy(out, packed, sizeof(packed));
+		break;
+	}
+	case gpu::VertexAttribute::VEC2_HALF: {
+		const uint16_t packed[2] = {float_to_half(values[0]), float_to_half(values[1])};
+		memcpy(out, packed, sizeof(packed));
+		break;
+	}
 	}
 }
 
-auto processGeometry(const aiScene* scene, size_t mesh_idx, size_t& material_idx) -> GeometryAsset
+/// Whether `layout` describes position, normal & uv with a full-precision position
+static auto is_model_vertex_layout(const std::vector<gpu::VertexAttribute>& layout) -> bool
+{
+	using gpu::VertexAttribute;
+	const auto is_vec3 = [](VertexAttribute attribute) {
+		return attribute == VertexAttribute::VEC3_FLOAT ||
+			   attribute == VertexAttribute::VEC3_SNORM16 ||
+			   attribute == VertexAttribute::VEC3_SNORM8;
+	};
+	const auto is_vec2 = [](VertexAttribute attribute) {
+		return attribute == VertexAttribute::VEC2_FLOAT ||
+			   attribute == VertexAttribute::VEC2_SNORM16 ||
+			   attribute == VertexAttribute::VEC2_UNORM16 || attribute == VertexAttribute::VEC2_HALF;
+	};
+	return layout.size() == 3 && layout[0] == VertexAttribute::VEC3_FLOAT && is_vec3(layout[1]) &&
+		   is_vec2(layout[2]);
+}
+
+auto processGeometry(
+	const aiScene* scene,
+	size_t mesh_idx,
+	const std::vector<gpu::VertexAttribute>& layout,
+	size_t& material_idx) -> GeometryAsset
 {
 	const auto ai_mesh = scene->mMeshes[mesh_idx];
 
-	const size_t vertex_buffer_size = ai_mesh->mNumVertices * 3 * sizeof(float);
-	const size_t normal_buffer_size = ai_mesh->mNumVertices * 3 * sizeof(float);
-	const size_t uv_buffer_size = ai_mesh->mNumVertices * 2 * sizeof(float);
+	// interleave vertices in `layout`, flipping Y into render orientation
+
+	auto offsets = std::array<size_t, 3>{};
+	auto stride = size_t{0};
+	for (auto i = 0; i < 3; i++) {
+		offsets[i] = stride;
+		stride += gpu::vertex_attribute_size(layout[i]);
+	}
+
 	const size_t index_buffer_size = ai_mesh->mNumFaces * 3 * sizeof(unsigned int);
-	const size_t mesh_size =
-		vertex_buffer_size + normal_buffer_size + uv_buffer_size + index_buffer_size;
+	const size_t mesh_size = ai_mesh->mNumVertices * stride + index_buffer_size;
 
 	std::cout << "Mesh " << mesh_idx << " (" << mesh_size << " bytes)" << std::endl;
 
-	auto vertices = std::vector<float>(ai_mesh->mNumVertices * 3);
-	auto vertices_aux = std::vector<float>(ai_mesh->mNumVertices * 5);
 	auto indices = std::vector<unsigned int>(ai_mesh->mNumFaces * 3);
 
-	// accumulate vertices
+	auto vertices = std::vector<std::byte>(ai_mesh->mNumVertices * stride);
+	auto vertex = vertices.data();
 
-	for (auto j = 0; j < ai_mesh->mNumVertices; ++j) {
-		vertices[j * 3 + 0] = ai_mesh->mVertices[j].x;
-		vertices[j * 3 + 1] = ai_mesh->mVertices[j].y;
-		vertices[j * 3 + 2] = ai_mesh->mVertices[j].z;
+	for (auto j = 0; j < ai_mesh->mNumVertices; ++j, vertex += stride) {
+		const float position[3] = {
+			ai_mesh->mVertices[j].x, -ai_mesh->mVertices[j].y, ai_mesh->mVertices[j].z};
+		const float normal[3] = {
+			ai_mesh->mNormals[j].x, ai_mesh->mNormals[j].y, ai_mesh->mNormals[j].z};
+		const float uv[2] = {ai_mesh->mTextureCoords[0][j].x, ai_mesh->mTextureCoords[0][j].y};
 
-		vertices_aux[j * 5 + 0] = ai_mesh->mNormals[j].x;
-		vertices_aux[j * 5 + 1] = ai_mesh->mNormals[j].y;
-		vertices_aux[j * 5 + 2] = ai_mesh->mNormals[j].z;
-
-		vertices_aux[j * 5 + 3] = ai_mesh->mTextureCoords[0][j].x;
-		vertices_aux[j * 5 + 4] = ai_mesh->mTextureCoords[0][j].y;
+		write_vertex_attribute(layout[0], position, vertex + offsets[0]);
+		write_vertex_attribute(layout[1], normal, vertex + offsets[1]);
+		write_vertex_attribute(layout[2], uv, vertex + offsets[2]);
 	}
 
 	// extract indices from faces
@@ -218,7 +822,7 @@ auto processGeometry(const aiScene* scene, size_t mesh_idx, size_t& material_idx
 
 	material_idx = ai_mesh->mMaterialIndex;
 
-	return {vertices, vertices_aux, indices};
+	return make_geometry_asset(layout, std::move(vertices), std::move(indices));
 }
 
 auto extractTextures(
@@ -248,27 +852,459 @@ auto extractTextures(
 	}
 };
 
+/// A file read through read_asset_file, so Assimp can import from archives
+class AssetIOStream : public Assimp::IOStream {
+public:
+	explicit AssetIOStream(FileView file) : file(std::move(file)) {}
+
+	auto Read(void* buffer, size_t size, size_t count) -> size_t override
+	{
+		if (size == 0 || count == 0) {
+			return 0;
+		}
+		const auto remaining = file.data.size() - cursor;
+		count = std::min(count, remaining / size);
+		std::memcpy(buffer, file.data.data() + cursor, size * count);
+		cursor += size * count;
+		return count;
+	}
+
+	auto Write(const void*, size_t, size_t) -> size_t override { return 0; }
+
+	auto Seek(size_t offset, aiOrigin origin) -> aiReturn override
+	{
+		const auto size = file.data.size();
+		if (origin == aiOrigin_CUR) {
+			offset += cursor;
+		}
+		else if (origin == aiOrigin_END) {
+			if (offset > size) {
+				return aiReturn_FAILURE;
+			}
+			offset = size - offset;
+		}
+		if (offset > size) {
+			return aiReturn_FAILURE;
+		}
+		cursor = offset;
+		return aiReturn_SUCCESS;
+	}
+
+	auto Tell() const -> size_t override { return cursor; }
+
+	auto FileSize() const -> size_t override { return file.data.size(); }
+
+	auto Flush() -> void override {}
+
+private:
+	FileView file;
+	size_t cursor = 0;
+};
+
+/// Lets Assimp find models and their sidecar files (.mtl, .bin) in mounted archives
+class AssetIOSystem : public Assimp::IOSystem {
+public:
+	auto Exists(const char* path) const -> bool override { return asset_file_exists(path); }
+
+	auto getOsSeparator() const -> char override { return '/'; }
+
+	auto Open(const char* path, const char* mode) -> Assimp::IOStream* override
+	{
+		if (std::string_view{mode}.find_first_of("wa+") != std::string_view::npos) {
+			return nullptr;
+		}
+		auto file = read_asset_file(path);
+		if (!file.has_value()) {
+			return nullptr;
+		}
+		return new AssetIOStream(std::move(*file));
+	}
+
+	auto Close(Assimp::IOStream* stream) -> void override { delete stream; }
+};
+
+/// Optimize a freshly decoded mesh and generate its levels of detail, per the import settings
+static auto finish_geometry(
+	GeometryAsset geometry,
+	const ModelImportSettings& settings,
+	size_t mesh_idx,
+	const std::string& asset_name) -> GeometryAsset
+{
+	if (settings.optimize_meshes) {
+		auto scope = ProfileScope{asset_name, "optimize"};
+		const auto before = analyze_vertex_cache(geometry.indices, geometry.vertex_count());
+		geometry = optimize_geometry(geometry);
+		const auto after = analyze_vertex_cache(geometry.indices, geometry.vertex_count());
+		std::cout << "Mesh " << mesh_idx << " optimized: " << geometry.vertex_count()
+				  << " vertices, ACMR " << before.acmr << " -> " << after.acmr << ", ATVR "
+				  << before.atvr << " -> " << after.atvr << std::endl;
+	}
+	if (!settings.lod_errors.empty()) {
+		auto scope = ProfileScope{asset_name, "lod"};
+		geometry = generate_lods(geometry, settings.lod_errors);
+		scope.add_bytes(geometry.indices.size_bytes());
+		for (auto level = size_t{1}; level < geometry.lod_count(); level++) {
+			std::cout << "Mesh " << mesh_idx << " LOD " << level << ": "
+					  << geometry.lods[level].index_count / 3 << " triangles, error "
+					  << geometry.lods[level].error << std::endl;
+		}
+	}
+	geometry.content_hash = geometry_content_hash(geometry);
+	return geometry;
+}
+
+/**
+ * Interleave one glTF primitive straight from its accessors, flipping Y into render
+ * orientation like processGeometry.  Indices which need no conversion are borrowed
+ * from the file rather than copied.
+ */
+static auto glb_geometry(
+	const GlbModel& glb,
+	const GltfPrimitive& primitive,
+	const std::vector<gpu::VertexAttribute>& layout,
+	const ModelImportSettings& settings) -> GeometryAsset
+{
+	const auto& positions = glb.accessors[*primitive.position];
+	const auto vertex_count = positions.count;
+	const auto attribute = [&](std::optional<uint32_t> index, uint32_t components) {
+		const auto accessor = index.has_value() ? &glb.accessors[*index] : nullptr;
+		const auto usable = accessor != nullptr && accessor->count == vertex_count &&
+							accessor->components == components;
+		return usable ? accessor : nullptr;
+	};
+	const auto normals = attribute(primitive.normal, 3);
+	const auto uvs = attribute(primitive.texcoord, 2);
+
+	struct Arrays {
+		std::vector<std::byte> vertices;
+		std::vector<unsigned int> indices;
+		/// The file, when `indices` is borrowed from it
+		std::shared_ptr<const void> file;
+	};
+	auto arrays = std::make_shared<Arrays>();
+	auto indices = std::span<const unsigned int>{};
+
+	if (primitive.indices.has_value()) {
+		const auto& accessor = glb.accessors[*primitive.indices];
+		const auto triangle_indices = accessor.count - accessor.count % 3;
+		const auto aligned =
+			reinterpret_cast<uintptr_t>(accessor.data.data()) % alignof(unsigned int) == 0;
+		const auto borrowable = accessor.component_type == GltfComponentType::UNSIGNED_INT &&
+								accessor.tightly_packed() && aligned &&
+								!settings.flip_winding_order;
+		if (borrowable) {
+			const auto first = reinterpret_cast<const unsigned int*>(accessor.data.data());
+			indices = {first, triangle_indices};
+		}
+		if (!borrowable ||
+			std::any_of(indices.begin(), indices.end(), [&](auto i) { return i >= vertex_count; })) {
+			arrays->indices.resize(triangle_indices);
+			for (auto i = size_t{0}; i < triangle_indices; i++) {
+				const auto index = accessor.read_index(i);
+				arrays->indices[i] = index < vertex_count ? index : 0;
+			}
+		}
+		else {
+			arrays->file = glb.file.storage;
+		}
+	}
+	else {
+		arrays->indices.resize(vertex_count - vertex_count % 3);
+		std::iota(arrays->indices.begin(), arrays->indices.end(), 0u);
+	}
+	if (!arrays->file) {
+		if (settings.flip_winding_order) {
+			for (auto i = size_t{0}; i + 2 < arrays->indices.size(); i += 3) {
+				std::swap(arrays->indices[i + 1], arrays->indices[i + 2]);
+			}
+		}
+		indices = arrays->indices;
+	}
+
+	// Missing normals are generated like aiProcess_GenNormals would, but smooth
+	auto generated_normals = std::vector<glm::vec3>{};
+	if (normals == nullptr) {
+		generated_normals.resize(vertex_count);
+		for (auto i = size_t{0}; i + 2 < indices.size(); i += 3) {
+			auto corners = std::array<glm::vec3, 3>{};
+			for (auto k = 0; k < 3; k++) {
+				positions.read_float(indices[i + k], &corners[k].x);
+			}
+			const auto face = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+			for (auto k = 0; k < 3; k++) {
+				generated_normals[indices[i + k]] += face;
+			}
+		}
+		for (auto& normal : generated_normals) {
+			const auto length = glm::length(normal);
+			normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+		}
+	}
+
+	auto offsets = std::array<size_t, 3>{};
+	auto stride = size_t{0};
+	for (auto i = 0; i < 3; i++) {
+		offsets[i] = stride;
+		stride += gpu::vertex_attribute_size(layout[i]);
+	}
+
+	arrays->vertices.resize(vertex_count * stride);
+	auto vertex = arrays->vertices.data();
+	for (auto j = size_t{0}; j < vertex_count; ++j, vertex += stride) {
+		float position[3];
+		positions.read_float(j, position);
+		position[1] = -position[1];
+
+		float normal[3];
+		if (normals != nullptr) {
+			normals->read_float(j, normal);
+		}
+		else {
+			memcpy(normal, &generated_normals[j].x, sizeof(normal));
+		}
+
+		// Assimp flips glTF's top-left uv origin, then aiProcess_FlipUVs flips it back
+		float uv[2] = {0.0f, 0.0f};
+		if (uvs != nullptr) {
+			uvs->read_float(j, uv);
+			if (!settings.flip_uvs) {
+				uv[1] = 1.0f - uv[1];
+			}
+		}
+
+		write_vertex_attribute(layout[0], position, vertex + offsets[0]);
+		write_vertex_attribute(layout[1], normal, vertex + offsets[1]);
+		write_vertex_attribute(layout[2], uv, vertex + offsets[2]);
+	}
+
+	return {layout, arrays->vertices, indices, std::move(arrays)};
+}
+
+/**
+ * Build a SceneAsset from a .glb, as Assimp would have imported it.
+ * @param texture_references filled in per material, for the scene cache
+ */
+static auto import_glb(
+	TextureFactory& texture_factory,
+	const GlbModel& glb,
+	const filesystem::path& normalized_path,
+	const ModelImportSettings& settings,
+	const std::vector<gpu::VertexAttribute>& vertex_layout,
+	std::vector<std::vector<TextureReference>>& texture_references) -> SceneAsset
+{
+	auto& pool = ThreadPool::shared();
+	const auto asset_name = normalized_path.string();
+
+	auto assets = SceneAsset{};
+	assets.path = normalized_path;
+
+	// Flatten the node tree in depth-first order, so parents come before children
+	auto flat = std::vector<uint32_t>{};
+	{
+		auto scope = ProfileScope{asset_name, "traverse"};
+		auto visited = std::vector<bool>(glb.nodes.size());
+		auto pending = std::vector<std::pair<uint32_t, int32_t>>{};
+		for (auto root = glb.roots.rbegin(); root != glb.roots.rend(); ++root) {
+			pending.push_back({*root, NO_PARENT});
+		}
+		while (!pending.empty()) {
+			const auto [node, parent] = pending.back();
+			pending.pop_back();
+			if (visited[node]) {
+				continue; // malformed files may share or loop nodes
+			}
+			visited[node] = true;
+
+			const auto index = static_cast<int32_t>(flat.size());
+			flat.push_back(node);
+			assets.nodes.push_back({glb.nodes[node].transform, parent});
+
+			const auto& children = glb.nodes[node].children;
+			for (auto child = children.rbegin(); child != children.rend(); ++child) {
+				pending.push_back({*child, index});
+			}
+		}
+	}
+
+	auto hierarchy = TransformHierarchy{};
+	hierarchy.reserve(assets.nodes.size());
+	for (const auto& node : assets.nodes) {
+		hierarchy.add_node(node.parent, node.transform);
+	}
+	hierarchy.update();
+
+	// One geometry per primitive, shared by every node drawing its mesh
+	constexpr auto NO_MATERIAL = std::numeric_limits<uint32_t>::max();
+	auto geometry_of = std::map<std::pair<uint32_t, size_t>, size_t>{};
+	auto material_of = std::map<uint32_t, size_t>{};
+	auto primitives = std::vector<const GltfPrimitive*>{};
+	for (auto node_idx = 0u; node_idx < flat.size(); node_idx++) {
+		const auto& node = glb.nodes[flat[node_idx]];
+		if (!node.mesh.has_value()) {
+			continue;
+		}
+		const auto& mesh = glb.meshes[*node.mesh];
+		for (auto p = size_t{0}; p < mesh.primitives.size(); p++) {
+			const auto& primitive = mesh.primitives[p];
+			if (primitive.mode != GLTF_MODE_TRIANGLES || !primitive.position.has_value()) {
+				continue;
+			}
+			const auto [geometry, added] =
+				geometry_of.try_emplace({*node.mesh, p}, primitives.size());
+			if (added) {
+				primitives.push_back(&primitive);
+			}
+
+			auto material_key = primitive.material.value_or(NO_MATERIAL);
+			if (material_key != NO_MATERIAL && material_key >= glb.materials.size()) {
+				material_key = NO_MATERIAL;
+			}
+			const auto [material, material_added] =
+				material_of.try_emplace(material_key, assets.materials.size());
+			if (material_added) {
+				const auto color = material_key == NO_MATERIAL
+									   ? glm::vec3(1.0f)
+									   : glm::vec3(glb.materials[material_key].base_color);
+				assets.materials.push_back({{}, color});
+			}
+
+			assets.objects.push_back(
+				{hierarchy.world(node_idx), geometry->second, material->second, node_idx});
+		}
+	}
+
+	auto geometry_jobs = std::vector<std::future<GeometryAsset>>{};
+	for (auto i = size_t{0}; i < primitives.size(); i++) {
+		geometry_jobs.push_back(pool.submit([&, i]() {
+			auto scope = optional<ProfileScope>{in_place, asset_name, "geometry"};
+			auto geometry = glb_geometry(glb, *primitives[i], vertex_layout, settings);
+			scope->add_bytes(geometry.vertices.size_bytes() + geometry.indices.size_bytes());
+			scope.reset();
+			return finish_geometry(std::move(geometry), settings, i, asset_name);
+		}));
+	}
+
+	// Embedded images decode straight from the file, with no copy in between
+	auto image_paths = std::vector<std::string>{};
+	auto image_blobs = std::vector<ImageBlob>{};
+	auto image_materials = std::vector<std::pair<uint32_t, size_t>>{};
+	for (const auto& [material_key, material_idx] : material_of) {
+		if (material_key == NO_MATERIAL) {
+			continue;
+		}
+		const auto image = glb.materials[material_key].base_color_image;
+		if (!image.has_value()) {
+			continue;
+		}
+		const auto& source = glb.images[*image];
+		if (!source.bytes.empty()) {
+			image_blobs.push_back(
+				{normalized_path.string() + "#" + std::to_string(*image),
+				 {reinterpret_cast<const unsigned char*>(source.bytes.data()),
+				  source.bytes.size()}});
+		}
+		else {
+			image_paths.push_back((normalized_path.parent_path() / source.uri).string());
+		}
+		image_materials.push_back({*image, material_idx});
+	}
+	auto file_images = texture_factory.load_images_from_files(image_paths);
+	auto embedded_images = texture_factory.load_images_from_memory(image_blobs);
+
+	for (auto& job : geometry_jobs) {
+		assets.geometries.push_back(pool.wait(job));
+	}
+
+	texture_references.resize(assets.materials.size());
+	auto file_image = file_images.begin();
+	auto embedded_image = embedded_images.begin();
+	auto image_path = image_paths.begin();
+	auto image_blob = image_blobs.begin();
+	for (const auto& [image, material_idx] : image_materials) {
+		const auto embedded = !glb.images[image].bytes.empty();
+		const auto result = pool.wait(embedded ? *embedded_image++ : *file_image++);
+		const auto reference =
+			embedded ? TextureReference{image_blob->name, std::as_bytes(image_blob->bytes)}
+					 : TextureReference{*image_path, {}};
+		if (embedded) {
+			image_blob++;
+		}
+		else {
+			image_path++;
+		}
+		if (!result.has_value()) {
+			std::cout << "Error: " << result.error() << std::endl;
+			continue;
+		}
+		assets.materials[material_idx].textures.push_back(*result);
+		texture_references[material_idx].push_back(reference);
+	}
+
+	return assets;
+}
+
 /// TODO - make this return 'expected<MeshAsset, AssetError>'
 auto load_model(
-	TextureFactory& texture_factory,
-	std::string_view path,
-	bool flipUVs,
-	bool flipWindingOrder) -> SceneAsset
+	TextureFactory& texture_factory, std::string_view path, const ModelImportSettings& settings)
+	-> SceneAsset
 {
-	static auto importer = Assimp::Importer{};
+	// Each call owns its importer: waiting on this model's jobs below may run another
+	// model's load_model on this thread, which mustn't free this call's scene
+	Assimp::Importer importer;
+	auto& pool = ThreadPool::shared();
 
 	filesystem::path normalized_path = filesystem::current_path() / path;
+	const auto asset_name = normalized_path.string();
 
 	cout << "Scene path: " << normalized_path << endl;
 
 	uint32_t importFlags = aiProcess_Triangulate | aiProcess_GenNormals;
-	if (flipUVs) {
+	if (settings.flip_uvs) {
 		importFlags |= aiProcess_FlipUVs;
 	}
-	if (flipWindingOrder) {
+	if (settings.flip_winding_order) {
 		importFlags |= aiProcess_FlipWindingOrder;
 	}
 
+	// Skip Assimp entirely if this exact import has been done before
+#if !GENGINE_PLATFORM_WEB
+	const auto cache_key = scene_cache_key(normalized_path, importFlags, settings);
+	if (cache_key.has_value() && settings.reuse_cache) {
+		auto scope = ProfileScope{asset_name, "cache_read"};
+		if (auto cached = read_scene_cache(texture_factory, normalized_path, *cache_key)) {
+			return std::move(*cached);
+		}
+	}
+#endif
+
+	auto vertex_layout = settings.vertex_layout;
+	if (!is_model_vertex_layout(vertex_layout)) {
+		cout << "Error: unsupported model vertex layout; using the default" << endl;
+		vertex_layout = MODEL_VERTEX_LAYOUT;
+	}
+
+	// Binary glTF skips Assimp; its buffers are read where they lie in the file
+	if (normalized_path.extension() == ".glb") {
+		auto read_scope = optional<ProfileScope>{in_place, asset_name, "read"};
+		const auto glb = read_glb(normalized_path);
+		if (glb.has_value()) {
+			read_scope->add_bytes(glb->file.bytes().size());
+			read_scope.reset();
+
+			auto texture_references = std::vector<std::vector<TextureReference>>{};
+			auto assets = import_glb(
+				texture_factory, *glb, normalized_path, settings, vertex_layout, texture_references);
+#if !GENGINE_PLATFORM_WEB
+			if (cache_key.has_value()) {
+				auto scope = ProfileScope{asset_name, "cache_write"};
+				write_scene_cache(*cache_key, assets, texture_references);
+			}
+#endif
+			return assets;
+		}
+		cout << "[info]\t " << glb.error() << "; importing with Assimp" << endl;
+	}
+
 	// ifstream file(normalized_path.c_str(), ios::binary | ios::ate);
 
 	// if (!file.is_open()) {
@@ -282,6 +1318,9 @@ auto load_model(
 	// cout << "Scene " << normalized_path.c_str() << " with size " << fileSize << endl;
 
 	// const auto scene = importer.ReadFileFromMemory(pBuffer, fileSize, importFlags, "GLFW2");
+	// The importer owns its handler and frees the previous one
+	importer.SetIOHandler(new AssetIOSystem{});
+	auto read_scope = optional<ProfileScope>{in_place, asset_name, "read"};
 	const auto ai_scene = importer.ReadFile(normalized_path.c_str(), importFlags);
 	if ((!ai_scene) || (ai_scene->mFlags == AI_SCENE_FLAGS_INCOMPLETE) || (!ai_scene->mRootNode)) {
 		std::cerr << "Error: Scene cannot be located: " << normalized_path << std::endl;
@@ -290,6 +1329,7 @@ auto load_model(
 		return {};
 	}
 
+	// Count what Assimp decoded, as floats
 	for (int ai_mesh_idx = 0; ai_mesh_idx < ai_scene->mNumMeshes; ai_mesh_idx++) {
 		const aiMesh* ai_mesh = ai_scene->mMeshes[ai_mesh_idx];
 		const size_t vertex_buffer_size = ai_mesh->mNumVertices * 3 * sizeof(float);
@@ -298,7 +1338,9 @@ auto load_model(
 		const size_t index_buffer_size = ai_mesh->mNumFaces * 3 * sizeof(unsigned int);
 		const size_t mesh_size =
 			vertex_buffer_size + normal_buffer_size + uv_buffer_size + index_buffer_size;
+		read_scope->add_bytes(mesh_size);
 	}
+	read_scope.reset();
 
 	// delete[] pBuffer;
 
@@ -306,18 +1348,44 @@ auto load_model(
 	auto assets = SceneAsset{};
 	assets.path = normalized_path;
 
-	traverseNode(decoding, assets, ai_scene, ai_scene->mRootNode);
+	{
+		auto scope = ProfileScope{asset_name, "traverse"};
+		traverseNodes(decoding, assets, ai_scene);
+	}
 
 	// Load meshes
-	for (const auto& [mesh_idx, object_indices] : decoding.mesh_to_objects) {
+	// Geometry decoding fans out across the pool; results are gathered in a fixed order.
+	struct GeometryJob {
+		size_t mesh_idx;
+		std::vector<size_t> object_indices;
 		size_t material_idx;
-		const auto geometry = processGeometry(ai_scene, mesh_idx, material_idx);
+		std::future<GeometryAsset> geometry;
+	};
+	auto geometry_jobs = std::vector<GeometryJob>{};
+	geometry_jobs.reserve(decoding.mesh_to_objects.size());
+	for (const auto& [mesh_idx, object_indices] : decoding.mesh_to_objects) {
+		geometry_jobs.push_back({mesh_idx, object_indices, 0, {}});
+	}
+	for (auto& job : geometry_jobs) {
+		job.geometry = pool.submit([ai_scene, &job, &settings, &vertex_layout, &asset_name]() {
+			auto process_scope = optional<ProfileScope>{in_place, asset_name, "geometry"};
+			auto geometry =
+				processGeometry(ai_scene, job.mesh_idx, vertex_layout, job.material_idx);
+			process_scope->add_bytes(geometry.vertices.size_bytes() + geometry.indices.size_bytes());
+			process_scope.reset();
+
+			return finish_geometry(std::move(geometry), settings, job.mesh_idx, asset_name);
+		});
+	}
 
-		for (const auto object_idx : object_indices) {
+	for (auto& job : geometry_jobs) {
+		const auto geometry = pool.wait(job.geometry);
+
+		for (const auto object_idx : job.object_indices) {
 			assets.objects[object_idx].geometry = assets.geometries.size();
 
-			if (material_idx >= 0) {
-				decoding.material_to_objects[material_idx].push_back(object_idx);
+			if (job.material_idx >= 0) {
+				decoding.material_to_objects[job.material_idx].push_back(object_idx);
 			}
 		}
 
@@ -341,9 +1409,28 @@ auto load_model(
 		assets.materials.push_back(gengine::MaterialAsset({}, color));
 	}
 
+	// Decode every texture as one batch, then hand them out to materials in order
+	auto texture_paths = std::vector<std::string>{};
+	for (const auto& [texture_path, material_indices] : decoding.texpaths_to_materials) {
+		texture_paths.push_back(texture_path);
+	}
+	auto embed_blobs = std::vector<ImageBlob>{};
+	for (const auto& [embed_idx, material_indices] : decoding.embeds_to_materials) {
+		const auto embed = ai_scene->mTextures[embed_idx];
+		embed_blobs.push_back(
+			{normalized_path.string() + "#" + std::to_string(embed_idx),
+			 {reinterpret_cast<const unsigned char*>(embed->pcData), embed->mWidth}});
+	}
+	auto file_images = texture_factory.load_images_from_files(texture_paths);
+	auto embedded_images = texture_factory.load_images_from_memory(embed_blobs);
+
+	// Remember where each material's textures came from, for the scene cache
+	auto texture_references = std::vector<std::vector<TextureReference>>(assets.materials.size());
+
 	// Load textures from disk
+	auto file_image = file_images.begin();
 	for (const auto& [texture_path, material_indices] : decoding.texpaths_to_materials) {
-		const auto imageAsset = texture_factory.load_image_from_file(texture_path);
+		const auto imageAsset = pool.wait(*file_image++);
 		if (imageAsset.has_value()) {
 			// Assign texture to all meshes which use it
 			for (auto material_idx : material_indices) {
@@ -352,6 +1439,7 @@ auto load_model(
 					material_idx -= 1;
 				}
 				assets.materials[material_idx].textures.push_back(*imageAsset);
+				texture_references[material_idx].push_back({texture_path, {}});
 			}
 		}
 		else {
@@ -360,25 +1448,50 @@ auto load_model(
 	}
 
 	// Load textures from memory
+	auto embedded_image = embedded_images.begin();
+	auto embed_blob = embed_blobs.begin();
 	for (const auto& [embed_idx, material_indices] : decoding.embeds_to_materials) {
-		const auto embed = ai_scene->mTextures[embed_idx];
-		const auto texture_name = std::to_string(embed_idx);
-
-		// Load from memory
-		const auto imageAsset = texture_factory.load_image_from_memory(
-			texture_name, reinterpret_cast<const unsigned char*>(embed->pcData), embed->mWidth);
+		const auto imageAsset = pool.wait(*embedded_image++);
+		const auto& blob = *embed_blob++;
+		if (!imageAsset.has_value()) {
+			std::cout << "Error: " << imageAsset.error() << std::endl;
+			continue;
+		}
 
 		// Assign texture to all meshes which use it
 		for (const auto material_idx : material_indices) {
-			assets.materials[material_idx].textures.push_back(imageAsset);
+			assets.materials[material_idx].textures.push_back(*imageAsset);
+			texture_references[material_idx].push_back({blob.name, std::as_bytes(blob.bytes)});
 		}
 	}
 
+#if !GENGINE_PLATFORM_WEB
+	if (cache_key.has_value()) {
+		auto scope = ProfileScope{asset_name, "cache_write"};
+		write_scene_cache(*cache_key, assets, texture_references);
+	}
+#endif
+
 	importer.FreeScene();
 
 	return assets;
 }
 
+auto load_file_view(std::string_view path) -> FileView
+{
+	filesystem::path normalized_path = filesystem::current_path() / path;
+
+	auto file = read_asset_file(normalized_path);
+	if (!file.has_value()) {
+		cout << "Error: failed to open file " << normalized_path << endl;
+		return {};
+	}
+
+	cout << "File path: " << normalized_path << endl;
+
+	return std::move(*file);
+}
+
 auto load_file(std::string_view path) -> std::string // TODO? return std::optional<std::string>
 {
 #if 0
@@ -401,20 +1514,7 @@ auto load_file(std::string_view path) -> std::string // TODO? return std::option
 	emscripten_fetch_close(fetch);
 	return "";
 #else
-	filesystem::path normalized_path = filesystem::current_path() / path;
-	const auto stream = ifstream(normalized_path.c_str(), ifstream::binary);
-
-	if (!stream) {
-		cout << "Error: failed to open file " << normalized_path << endl;
-		// abort();
-		return ""; // TODO: see function signature
-	}
-
-	cout << "File path: " << normalized_path << endl;
-
-	stringstream buffer{};
-	buffer << stream.rdbuf();
-	return buffer.str();
+	return string{load_file_view(path).text()};
 #endif
 }
 
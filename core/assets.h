@@ -1,9 +1,21 @@
 #pragma once
 
+#include "gpu.h"
+#include "mapped_file.h"
+#include "textures.h"
+#include "transform_hierarchy.h"
+
 #include <glm/glm.hpp>
 
+#include <cstdint>
 #include <expected>
+#include <functional>
+#include <future>
+#include <list>
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
 #include <string>
 #include <string_view>
 #include <tuple>
@@ -16,45 +28,253 @@ struct ImageAsset {
 	std::string name;
 	unsigned int width;
 	unsigned int height;
-	unsigned int channel_count;
+	/// Layout of `data`, with only the channels the image was stored with; for a baked
+	/// texture, the channels its blocks decode to
+	gpu::PixelFormat format;
 	unsigned char* data;
+	/// Set instead of `data` when the image was loaded from a baked texture
+	std::shared_ptr<const gpu::TextureData> baked;
+	/// Owns `data`; every copy of the asset keeps the pixels alive
+	std::shared_ptr<const void> storage;
+	/// Bytes of pixel data held in system memory, all mip levels included
+	std::size_t size_bytes;
+	/// Hash of the pixels, or of the baked texture; identical images hash the same
+	uint64_t content_hash;
+	/// The block format of `baked`, kept in the image log once the texture is gone
+	std::optional<gpu::TextureFormat> baked_format = std::nullopt;
+};
+
+/// Encoded image bytes waiting to be decoded, e.g. a texture embedded in a model file
+struct ImageBlob {
+	std::string name;
+	std::span<const unsigned char> bytes;
 };
 
+/// Counters for TextureFactory's image cache
+struct ImageCacheStats {
+	/// Requests served from the cache, or by joining a decode in flight
+	std::size_t hits;
+	/// Requests which started a decode
+	std::size_t misses;
+	std::size_t evictions;
+	std::size_t resident_images;
+	std::size_t resident_bytes;
+	std::size_t budget_bytes;
+};
+
+/**
+ * @brief Decodes images into system memory and caches them by path or name.
+ * @note Thread-safe.  Batches decode on the shared ThreadPool, and a request for an
+ *       image which is already being decoded joins the decode in flight.
+ *
+ * The cache keeps at most a memory budget of pixels, evicting the least recently
+ * used images first.  An image is pinned, and never evicted, while any copy of its
+ * ImageAsset is alive outside the cache: a caller holding an asset for an upload in
+ * flight can rely on its pixels.  Pinned images may push the cache over budget; it's
+ * trimmed back as soon as the last copy of one goes, and when the budget changes.
+ */
 class TextureFactory {
 public:
+	/// Images loaded so far.  Entries carry no pixels, so they don't pin anything.
 	using ImageLog = std::vector<ImageAsset>;
 
 	using ImageCache = std::unordered_map<std::string, ImageAsset>;
 
-	auto load_image_from_file(const std::string& path) -> std::expected<ImageAsset, std::string>;
+	static constexpr std::size_t DEFAULT_MEMORY_BUDGET = 512 * 1024 * 1024;
+
+	using ImageResult = std::expected<ImageAsset, std::string>;
+
+	using ImageFuture = std::shared_future<ImageResult>;
+
+	auto load_image_from_file(const std::string& path) -> ImageResult;
 
 	auto load_image_from_memory(
 		const std::string& name, const unsigned char* buffer, uint32_t buffer_len) -> ImageAsset;
 
+	/// Decode a batch of image files on the thread pool
+	auto load_images_from_files(std::span<const std::string> paths) -> std::vector<ImageFuture>;
+
+	/// Decode a batch of encoded images on the thread pool.
+	/// @note The blobs' bytes must stay alive until their futures are ready.
+	auto load_images_from_memory(std::span<const ImageBlob> blobs) -> std::vector<ImageFuture>;
+
+	/// Drop an image by name, whichever path it was requested by, so the next load decodes it
 	auto unload_image(const ImageAsset& asset) -> void;
 
+	/// Drop every image whose name starts with `prefix`, e.g. a model's embedded textures
+	auto unload_images_with_prefix(std::string_view prefix) -> void;
+
 	auto unload_all_images() -> void;
 
-	auto get_image_log() -> const ImageLog*;
+	/**
+	 * @brief Prefer baked textures in these formats, best first.
+	 *
+	 * Loading "foo.png" first looks for "foo.png.<format>.gtex" (see texturetools)
+	 * in each of these formats, and only decodes the PNG if none exists, or if the PNG
+	 * on disk was modified after it was baked.
+	 */
+	auto set_baked_formats(std::vector<gpu::TextureFormat> formats) -> void;
+
+	/// A snapshot of every image loaded so far
+	auto get_image_log() -> ImageLog;
 
-	auto get_image_cache() -> const ImageCache*;
+	/// A snapshot of the images currently in system memory
+	/// @note The snapshot's assets pin their images until it's destroyed.
+	auto get_image_cache() -> ImageCache;
+
+	/// Evict unpinned images, least recently used first, until the cache fits `bytes`
+	auto set_memory_budget(std::size_t bytes) -> void;
+
+	auto get_cache_stats() -> ImageCacheStats;
 
 private:
+	struct CacheEntry {
+		ImageAsset asset;
+		/// Position in lru_order
+		std::list<std::string>::iterator lru_position;
+		/// Owned by every copy handed out; the image is pinned while it lives
+		std::weak_ptr<const void> pin;
+	};
+
 	/// An append-only log of all the images from this loader
 	ImageLog image_log;
 
 	/// A CRUD cache of images persisted in system memory
-	ImageCache image_cache;
+	std::unordered_map<std::string, CacheEntry> image_cache;
+
+	/// Cache keys, most recently used first
+	std::list<std::string> lru_order;
+
+	std::size_t memory_budget = DEFAULT_MEMORY_BUDGET;
+	std::size_t resident_bytes = 0;
+	std::size_t hits = 0;
+	std::size_t misses = 0;
+	std::size_t evictions = 0;
+
+	/// Decodes which have started but not yet reached image_cache
+	std::unordered_map<std::string, ImageFuture> in_flight;
+
+	/// Baked formats which the renderer can sample, best first
+	std::vector<gpu::TextureFormat> baked_formats;
+
+	/// Guards every member above
+	std::mutex mutex;
+
+	/**
+	 * Find or start the decode for one cache key.
+	 * @param decode produces the image; runs at most once per key while in flight
+	 * @param run_inline decode on the calling thread instead of the pool
+	 */
+	auto request_image(
+		const std::string& key, std::function<ImageResult()> decode, bool run_inline)
+		-> ImageFuture;
+
+	auto get_baked_formats() -> std::vector<gpu::TextureFormat>;
 
 	auto image_in_cache(const std::string& path) -> bool;
+
+	/// Insert or replace a decoded image, then trim to the budget.  Needs `mutex`.
+	/// @return a copy of the asset which pins it
+	auto cache_image(const std::string& key, const ImageAsset& asset) -> ImageAsset;
+
+	/// A copy of a cached image to hand out, which pins it.  Needs `mutex`.
+	auto pin_image(CacheEntry& entry) -> ImageAsset;
+
+	/// Drop one image from the cache.  Needs `mutex`.
+	auto evict_image(const std::string& key) -> void;
+
+	/// Evict unpinned images until the cache fits the budget.  Needs `mutex`.
+	auto trim_image_cache() -> void;
+
+	/// Lets pins which outlive this factory know it's gone; destroyed first
+	std::shared_ptr<TextureFactory*> self = std::make_shared<TextureFactory*>(this);
+};
+
+struct BoundingSphere {
+	glm::vec3 center;
+	float radius;
 };
 
+/// An axis-aligned box, as its center and half its size along each axis
+struct BoundingBox {
+	glm::vec3 center;
+	glm::vec3 extents;
+};
+
+/// One level of detail: a range of GeometryAsset::indices drawing the whole mesh
+struct GeometryLod {
+	uint32_t first_index;
+	uint32_t index_count;
+	/// How far this level strays from the full mesh, in model units
+	float error;
+};
+
+/**
+ * @brief One mesh, ready for upload as-is.
+ *
+ * Vertices are interleaved in the order given by `layout`, and are already in render
+ * orientation (Y flipped from the source file).  The position is always the first
+ * attribute, as VEC3_FLOAT.
+ *
+ * Every level of detail shares the vertices; their triangle lists are stored one
+ * after another in `indices`, finest first.
+ */
 struct GeometryAsset {
-	std::vector<float> vertices;	 // raw positions
-	std::vector<float> vertices_aux; // normals, uvs
-	std::vector<unsigned int> indices;
+	std::vector<gpu::VertexAttribute> layout;
+	std::span<const std::byte> vertices;
+	std::span<const unsigned int> indices;
+	/// Owns the memory behind the spans: heap arrays, or a mapped cache file
+	std::shared_ptr<const void> storage;
+	/// Empty when the mesh has a single level covering all of `indices`
+	std::vector<GeometryLod> lods;
+	/// See geometry_content_hash; set once the geometry is final
+	uint64_t content_hash = 0;
+
+	/// Bytes per vertex
+	auto vertex_stride() const -> std::size_t;
+
+	auto vertex_count() const -> std::size_t;
+
+	auto position(std::size_t vertex) const -> glm::vec3;
+
+	/// The smallest axis-aligned box around every vertex
+	auto bounding_box() const -> BoundingBox;
+
+	/// A sphere around every vertex, centered on their bounding box
+	auto bounding_sphere() const -> BoundingSphere;
+
+	auto lod_count() const -> std::size_t;
+
+	/// The triangle list of one level; level 0 is the full mesh
+	auto lod_indices(std::size_t level) const -> std::span<const unsigned int>;
 };
 
+/**
+ * The vertex layout of imported models: position, normal, uv.
+ *
+ * Normals are snorm8 and uvs are half floats, which the shaders read as plain
+ * floats; that's 20 bytes per vertex instead of 32.
+ */
+inline const auto MODEL_VERTEX_LAYOUT = std::vector<gpu::VertexAttribute>{
+	gpu::VertexAttribute::VEC3_FLOAT,
+	gpu::VertexAttribute::VEC3_SNORM8,
+	gpu::VertexAttribute::VEC2_HALF};
+
+/// Full-precision variant of MODEL_VERTEX_LAYOUT
+inline const auto MODEL_VERTEX_LAYOUT_FLOAT = std::vector<gpu::VertexAttribute>{
+	gpu::VertexAttribute::VEC3_FLOAT,
+	gpu::VertexAttribute::VEC3_FLOAT,
+	gpu::VertexAttribute::VEC2_FLOAT};
+
+/// Wrap freshly decoded arrays in a GeometryAsset which owns them
+auto make_geometry_asset(
+	std::vector<gpu::VertexAttribute> layout,
+	std::vector<std::byte>&& vertices,
+	std::vector<unsigned int>&& indices) -> GeometryAsset;
+
+/// Hash of everything a geometry uploads: layout, vertices, indices and levels of detail
+auto geometry_content_hash(const GeometryAsset& geometry) -> uint64_t;
+
 struct MaterialAsset {
 	std::vector<ImageAsset> textures;
 	glm::vec3 color;
@@ -62,11 +282,22 @@ struct MaterialAsset {
 
 /// @brief A MeshAsset belongs to a SceneAsset.
 struct MeshAsset {
+	/// World transform of `node`, as imported
 	glm::mat4 transform;
 	/// Index into SceneAsset::geometries
 	size_t geometry;
 	/// Index into SceneAsset::materials
 	size_t material;
+	/// Index into SceneAsset::nodes
+	uint32_t node;
+};
+
+/// One node of a model's hierarchy
+struct NodeAsset {
+	/// Relative to the parent
+	glm::mat4 transform;
+	/// Index into SceneAsset::nodes, always smaller than this node's; or NO_PARENT
+	int32_t parent;
 };
 
 struct SceneAsset {
@@ -74,13 +305,44 @@ struct SceneAsset {
 	std::vector<MeshAsset> objects;
 	std::vector<GeometryAsset> geometries;
 	std::vector<MaterialAsset> materials;
+	/// The model's node hierarchy, parents before children
+	std::vector<NodeAsset> nodes;
+};
+
+/// Simplification targets for generated levels of detail, finest first
+inline const auto DEFAULT_LOD_ERRORS = std::vector<float>{0.01f, 0.03f, 0.1f};
+
+/// How to turn a model file into a SceneAsset
+struct ModelImportSettings {
+	bool flip_uvs = false;
+	bool flip_winding_order = false;
+	/// Weld vertices and reorder meshes for the vertex cache, overdraw and vertex fetch
+	bool optimize_meshes = true;
+	/**
+	 * Attribute formats for position, normal and uv, in that order.  It must match the
+	 * pipeline the model is drawn with, and the position must stay VEC3_FLOAT.
+	 */
+	std::vector<gpu::VertexAttribute> vertex_layout = MODEL_VERTEX_LAYOUT;
+	/**
+	 * One simplified level of detail is generated per entry, each allowed to stray
+	 * this far from the full mesh, as a fraction of the mesh's bounding radius.
+	 */
+	std::vector<float> lod_errors = DEFAULT_LOD_ERRORS;
+	/// Whether an earlier import in the scene cache may stand in for this one.  The new
+	/// import is written to the cache either way.
+	bool reuse_cache = true;
 };
 
 auto load_model(
-	TextureFactory& texture_factory,
-	std::string_view path,
-	bool flipUVs = false,
-	bool flipWindingOrder = false) -> SceneAsset;
+	TextureFactory& texture_factory, std::string_view path, const ModelImportSettings& settings = {})
+	-> SceneAsset;
+
+/**
+ * @brief Map a file into memory without copying it, or read it from a mounted archive.
+ * @return an empty view if the file can't be opened
+ */
+auto load_file_view(std::string_view path) -> FileView;
 
+/// Read a whole file into a string.  Prefer `load_file_view`, which doesn't copy.
 auto load_file(std::string_view path) -> std::string;
 } // namespace gengine
\ No newline at end of file
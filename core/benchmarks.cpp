@@ -0,0 +1,291 @@
+/**
+ * Micro-benchmarks for the engine's hot loops, on synthetic data, and for model import.
+ *
+ * BUILD: cmake --build <build dir> --target gengine-bench
+ * RUN: gengine-bench [benchmark]...
+ *
+ * Each benchmark prints the best and median time over several runs.  Without arguments
+ * every benchmark runs; otherwise only the named ones.  Build with optimizations on, as
+ * the numbers mean nothing in a debug build.  "models" imports files from ./data, so
+ * run it from the repository root.
+ */
+
+#include "assets.h"
+#include "entity_store.h"
+#include "scene.h"
+#include "thread_pool.h"
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+constexpr auto RUNS = 10;
+
+/// Time `run` RUNS times after one warm-up run, and print the best and median
+static auto measure(const string& name, const function<void()>& run) -> void
+{
+	run();
+
+	auto times = vector<double>{};
+	for (auto i = 0; i < RUNS; i++) {
+		const auto start = chrono::steady_clock::now();
+		run();
+		const auto end = chrono::steady_clock::now();
+		times.push_back(chrono::duration<double, milli>(end - start).count());
+	}
+	ranges::sort(times);
+
+	cout << "  " << name << ": best " << times.front() << " ms, median " << times[RUNS / 2]
+		 << " ms" << endl;
+}
+
+// Entity iteration -----------------------------------------------------------
+
+constexpr auto ENTITY_COUNT = 1'000'000;
+
+/// Same work as select_lod_levels, so both layouts are timed on the real inner loop
+static auto lod_level(const RenderLod& lod, const glm::mat4& transform, const glm::vec3& camera)
+	-> uint32_t
+{
+	const auto scale = std::sqrt(std::max(
+		{glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+		 glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+		 glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))}));
+	const auto center = glm::vec3(transform * glm::vec4(lod.center, 1.0f));
+	const auto distance = std::max(glm::length(center - camera) - lod.radius * scale, 1e-3f);
+	const auto pixels_per_unit = 1000.0f * scale / distance;
+
+	for (auto level = lod.level_count; level-- > 1;) {
+		if (lod.errors[level] * pixels_per_unit <= 1.0f) {
+			return level;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Pick a LOD level for 1M renderables, stored the way Scene stored them before it had an
+ * EntityStore (one vector per component, indexed alike) and stored by archetype.
+ *
+ * The store also holds one body entity per eight renderables, as a scene does, which
+ * every query skips.
+ */
+static auto benchmark_entities() -> void
+{
+	cout << "entities (" << ENTITY_COUNT << " renderables)" << endl;
+
+	auto random = mt19937{1};
+	auto coordinate = uniform_real_distribution<float>{-500.0f, 500.0f};
+
+	auto lod = RenderLod{};
+	lod.radius = 1.0f;
+	lod.level_count = 4;
+	lod.errors = {0.0f, 0.01f, 0.05f, 0.2f};
+
+	// Before: parallel vectors
+	auto transforms = vector<glm::mat4>{};
+	auto render_lods = vector<RenderLod>{};
+	auto renderables = vector<Renderable>{};
+
+	// After: archetypes
+	auto entities = gengine::EntityStore{};
+
+	for (auto i = 0; i < ENTITY_COUNT; i++) {
+		const auto position = glm::vec3{coordinate(random), coordinate(random), coordinate(random)};
+		const auto transform = Transform{glm::translate(glm::mat4{1.0f}, position)};
+		const auto node = SceneNode{static_cast<uint32_t>(i)};
+
+		transforms.push_back(transform.matrix);
+		render_lods.push_back(lod);
+		renderables.push_back({});
+
+		entities.create(transform, node, lod, Renderable{});
+		if (i % 8 == 0) {
+			entities.create(transform, node, RigidBody{});
+		}
+	}
+
+	const auto camera = glm::vec3{0.0f};
+
+	measure("parallel vectors", [&]() {
+		for (size_t i = 0; i < transforms.size(); i++) {
+			renderables[i].lod_level = lod_level(render_lods[i], transforms[i], camera);
+		}
+	});
+
+	measure("EntityStore::each", [&]() {
+		entities.each<Transform, RenderLod, Renderable>(
+			[&](gengine::Entity,
+				const Transform& transform,
+				const RenderLod& lod,
+				Renderable& renderable) {
+				renderable.lod_level = lod_level(lod, transform.matrix, camera);
+			});
+	});
+
+	measure("EntityStore::each_chunk", [&]() {
+		entities.each_chunk<Transform, RenderLod, Renderable>(
+			[&](span<const gengine::Entity> chunk,
+				span<Transform> transforms,
+				span<RenderLod> lods,
+				span<Renderable> renderables) {
+				for (size_t row = 0; row < chunk.size(); row++) {
+					renderables[row].lod_level =
+						lod_level(lods[row], transforms[row].matrix, camera);
+				}
+			});
+	});
+
+	auto& pool = gengine::ThreadPool::shared();
+	measure("EntityStore::parallel_each (" + to_string(pool.thread_count()) + " workers)", [&]() {
+		entities.parallel_each<Transform, RenderLod, Renderable>(
+			pool,
+			[&](gengine::Entity,
+				const Transform& transform,
+				const RenderLod& lod,
+				Renderable& renderable) {
+				renderable.lod_level = lod_level(lod, transform.matrix, camera);
+			});
+	});
+}
+
+// Transform hierarchy --------------------------------------------------------
+
+constexpr auto NODE_COUNT = 100'000;
+
+/**
+ * Resolve the world transforms of a random 100k-node tree: all of them after the root
+ * moves, one subtree after its root moves, and one leaf.  For scale, also each node's
+ * world transform walked up its parent chain, as assets were resolved before.
+ */
+static auto benchmark_hierarchy() -> void
+{
+	cout << "hierarchy (" << NODE_COUNT << " nodes)" << endl;
+
+	auto random = mt19937{1};
+	auto hierarchy = gengine::TransformHierarchy{};
+	hierarchy.reserve(NODE_COUNT);
+
+	auto parents = vector<int32_t>{};
+	for (auto i = 0; i < NODE_COUNT; i++) {
+		const auto parent =
+			i == 0 ? gengine::NO_PARENT : static_cast<int32_t>(random() % static_cast<uint32_t>(i));
+		parents.push_back(parent);
+		hierarchy.add_node(parent, glm::translate(glm::mat4{1.0f}, glm::vec3{1.0f, 0.0f, 0.0f}));
+	}
+	hierarchy.update();
+
+	// Parents come first, so subtree sizes add up from the back
+	auto subtree_sizes = vector<uint32_t>(NODE_COUNT, 1);
+	for (auto i = NODE_COUNT; i-- > 1;) {
+		subtree_sizes[parents[i]] += subtree_sizes[i];
+	}
+
+	const auto move = [&](uint32_t node) {
+		hierarchy.set_local(node, hierarchy.local(node));
+		hierarchy.update();
+	};
+
+	measure("full update", [&]() { move(0); });
+
+	// The largest subtree rooted past the first 1% of nodes, so it's a model-sized one
+	auto subtree = static_cast<uint32_t>(NODE_COUNT / 100);
+	for (auto i = subtree; i < NODE_COUNT; i++) {
+		if (subtree_sizes[i] > subtree_sizes[subtree]) {
+			subtree = i;
+		}
+	}
+	measure(
+		"dirty subtree (" + to_string(subtree_sizes[subtree]) + " nodes)",
+		[&]() { move(subtree); });
+
+	measure("dirty leaf", [&]() { move(NODE_COUNT - 1); });
+
+	// Kept so the walk isn't optimized away
+	volatile auto sink = 0.0f;
+	measure("parent-chain walk per node", [&]() {
+		for (auto i = 0; i < NODE_COUNT; i++) {
+			auto world = hierarchy.local(i);
+			for (auto node = parents[i]; node != gengine::NO_PARENT; node = parents[node]) {
+				world = hierarchy.local(node) * world;
+			}
+			sink = world[3][0];
+		}
+	});
+}
+
+// Model import ---------------------------------------------------------------
+
+/// The models of the default scene whose import is worth fanning out
+const auto MODEL_PATHS = vector<string>{"./data/map.obj", "./data/skjarisles.glb"};
+
+/**
+ * Import models one after another on this thread, and all at once on the pool, as
+ * SceneBuilder::build does.  Every run starts with an empty TextureFactory and skips the
+ * scene cache, so each decodes its textures and rebuilds its meshes.
+ */
+static auto benchmark_models() -> void
+{
+	cout << "models (" << MODEL_PATHS.size() << " files)" << endl;
+
+	auto settings = gengine::ModelImportSettings{};
+	settings.reuse_cache = false;
+
+	measure("one after another", [&]() {
+		auto textures = gengine::TextureFactory{};
+		for (const auto& path : MODEL_PATHS) {
+			gengine::load_model(textures, path, settings);
+		}
+	});
+
+	auto& pool = gengine::ThreadPool::shared();
+	measure("fanned out (" + to_string(pool.thread_count()) + " workers)", [&]() {
+		auto textures = gengine::TextureFactory{};
+		auto imports = vector<future<gengine::SceneAsset>>{};
+		for (const auto& path : MODEL_PATHS) {
+			imports.push_back(
+				pool.submit([&, path]() { return gengine::load_model(textures, path, settings); }));
+		}
+		for (auto& import : imports) {
+			pool.wait(import);
+		}
+	});
+}
+
+struct Benchmark {
+	string name;
+	function<void()> run;
+};
+
+int main(int argc, char** argv)
+{
+	const auto benchmarks = vector<Benchmark>{
+		{"entities", benchmark_entities},
+		{"hierarchy", benchmark_hierarchy},
+		{"models", benchmark_models},
+	};
+
+	auto selected = vector<string>(argv + 1, argv + argc);
+	for (const auto& name : selected) {
+		if (ranges::none_of(benchmarks, [&](const auto& b) { return b.name == name; })) {
+			cerr << "Error: no benchmark named " << name << endl;
+			return 1;
+		}
+	}
+
+	for (const auto& benchmark : benchmarks) {
+		if (selected.empty() || ranges::find(selected, benchmark.name) != selected.end()) {
+			benchmark.run();
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,517 @@
+/**
+ * Cook the models under a directory, and the textures they use, into the forms the
+ * engine loads fastest.
+ *
+ * BUILD: cmake --workflow --preset linux-(vk|gl)-dev
+ * RUN (from the directory the game runs in):
+ *     gengine-cook [--format bc7|bc1|etc2|rgba8]... [--force] [directory]
+ *
+ * Models are imported into the scene cache (.gengine-cache/), their meshes optimized and
+ * their levels of detail generated, and each image a model uses is baked to
+ * "<image>.<format>.gtex".  load_model and TextureFactory prefer both on their own.
+ *
+ * A model is imported with the default settings unless "<directory>/cook.txt" lists it,
+ * one import per line: "<path in directory> [flip_uvs] [flip_winding]", matching the
+ * game's VisualModelSettings.
+ *
+ * The dependency graph: a model's import depends on every file it reads (the model and
+ * its .mtl or .bin sidecars) and leads to its textures; a baked texture depends on its
+ * image.  ".gengine-cache/cook.state" keeps what each output was cooked from, so a
+ * warm cook only redoes outputs whose inputs, settings or cooker version changed.
+ *
+ * TODO record cold and warm cook times on the bundled data; none have been measured yet
+ *      (see docs/build.md, "Cooking assets").
+ */
+
+#include "assets.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "scene_cache.h"
+#include "stb/stb_image.h"
+#include "textures.h"
+#include "thread_pool.h"
+#include "vfs.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <optional>
+#include <set>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/// Bump whenever the cooker's outputs change for the same inputs
+constexpr uint32_t COOK_VERSION = 1;
+
+constexpr auto MODEL_EXTENSIONS = array{".obj", ".glb", ".gltf", ".fbx", ".dae"};
+
+constexpr auto IMAGE_EXTENSIONS = array{".png", ".jpg", ".jpeg", ".tga", ".bmp"};
+
+/// One file an output was cooked from, as it was then
+struct InputStamp {
+	filesystem::path path;
+	uint64_t size;
+	int64_t modified;
+	uint64_t content_hash;
+};
+
+/// What one output was last cooked from
+struct CookRecord {
+	/// Hash of the cooker version and the output's settings
+	uint64_t config;
+	vector<InputStamp> inputs;
+	/// Edges of the graph: for a model, the images its materials use
+	vector<filesystem::path> textures;
+};
+
+/// Output name --> record
+using CookState = map<string, CookRecord>;
+
+struct ModelJob {
+	filesystem::path path;
+	gengine::ModelImportSettings settings;
+	string output;
+	uint64_t config;
+};
+
+struct TextureJob {
+	filesystem::path image;
+	gpu::TextureFormat format;
+	filesystem::path output;
+	uint64_t config;
+};
+
+static auto has_extension(const filesystem::path& path, span<const char* const> extensions)
+	-> bool
+{
+	auto extension = path.extension().string();
+	transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) {
+		return static_cast<char>(tolower(c));
+	});
+	return find(extensions.begin(), extensions.end(), extension) != extensions.end();
+}
+
+static auto is_image(const filesystem::path& path) -> bool
+{
+	return has_extension(path, IMAGE_EXTENSIONS) || path.extension() == ".gtex";
+}
+
+static auto state_path() -> filesystem::path
+{
+	return filesystem::current_path() / ".gengine-cache" / "cook.state";
+}
+
+/// Size, time and contents of a file on disk
+static auto stamp(const filesystem::path& path) -> optional<InputStamp>
+{
+	auto error = error_code{};
+	const auto size = filesystem::file_size(path, error);
+	const auto modified = filesystem::last_write_time(path, error);
+	const auto file = gengine::MappedFile::open(path);
+	if (error || !file.has_value()) {
+		return nullopt;
+	}
+	return InputStamp{
+		path, size, modified.time_since_epoch().count(), gengine::hash_bytes((*file)->bytes())};
+}
+
+/**
+ * @brief Whether every input is as it was when the output was cooked.
+ *
+ * Files whose size and time changed but whose contents didn't (e.g. after a checkout)
+ * still count as unchanged, and get their new size and time.
+ */
+static auto inputs_unchanged(vector<InputStamp>& inputs) -> bool
+{
+	for (auto& input : inputs) {
+		auto error = error_code{};
+		const auto size = filesystem::file_size(input.path, error);
+		const auto modified = filesystem::last_write_time(input.path, error);
+		if (error) {
+			return false;
+		}
+		if (size == input.size && modified.time_since_epoch().count() == input.modified) {
+			continue;
+		}
+		const auto now = stamp(input.path);
+		if (!now.has_value() || now->content_hash != input.content_hash) {
+			return false;
+		}
+		input = *now;
+	}
+	return true;
+}
+
+static auto read_state() -> CookState
+{
+	auto file = ifstream(state_path());
+	auto header = string{};
+	if (!getline(file, header) || header != "gengine-cook " + to_string(COOK_VERSION)) {
+		return {};
+	}
+
+	// "output\t<config>\t<name>", then its "input\t<size>\t<time>\t<hash>\t<path>"
+	// and "texture\t<path>" lines
+	auto state = CookState{};
+	auto record = static_cast<CookRecord*>(nullptr);
+	auto line = string{};
+	while (getline(file, line)) {
+		auto fields = istringstream{line};
+		auto kind = string{};
+		getline(fields, kind, '\t');
+		if (kind == "output") {
+			auto config = uint64_t{0};
+			auto name = string{};
+			fields >> hex >> config;
+			fields.ignore();
+			getline(fields, name);
+			record = &state[name];
+			record->config = config;
+		}
+		else if (kind == "input" && record != nullptr) {
+			auto input = InputStamp{};
+			auto path = string{};
+			fields >> dec >> input.size >> input.modified >> hex >> input.content_hash;
+			fields.ignore();
+			getline(fields, path);
+			input.path = path;
+			record->inputs.push_back(input);
+		}
+		else if (kind == "texture" && record != nullptr) {
+			auto path = string{};
+			getline(fields, path);
+			record->textures.push_back(path);
+		}
+	}
+	return state;
+}
+
+static auto write_state(const CookState& state) -> bool
+{
+	auto error = error_code{};
+	filesystem::create_directories(state_path().parent_path(), error);
+
+	auto file = ofstream(state_path(), ios::trunc);
+	if (!file.is_open()) {
+		cerr << "Error: Cannot write " << state_path().string() << endl;
+		return false;
+	}
+	file << "gengine-cook " << COOK_VERSION << "\n";
+	for (const auto& [name, record] : state) {
+		file << "output\t" << hex << record.config << "\t" << name << "\n";
+		for (const auto& input : record.inputs) {
+			file << "input\t" << dec << input.size << "\t" << input.modified << "\t" << hex
+				 << input.content_hash << "\t" << input.path.string() << "\n";
+		}
+		for (const auto& texture : record.textures) {
+			file << "texture\t" << texture.string() << "\n";
+		}
+	}
+	return true;
+}
+
+/// Every model file under a directory, each with the imports cook.txt asks for
+static auto find_models(const filesystem::path& directory) -> vector<ModelJob>
+{
+	auto listed = multimap<filesystem::path, gengine::ModelImportSettings>{};
+	auto manifest = ifstream(directory / "cook.txt");
+	auto line = string{};
+	while (getline(manifest, line)) {
+		auto words = istringstream{line};
+		auto path = string{};
+		if (!(words >> path) || path.starts_with("#")) {
+			continue;
+		}
+		auto settings = gengine::ModelImportSettings{};
+		for (auto word = string{}; words >> word;) {
+			if (word == "flip_uvs") {
+				settings.flip_uvs = true;
+			}
+			else if (word == "flip_winding") {
+				settings.flip_winding_order = true;
+			}
+			else {
+				cerr << "Error: Unknown setting " << word << " for " << path << endl;
+			}
+		}
+		listed.insert({(directory / path).lexically_normal(), settings});
+	}
+
+	auto paths = vector<filesystem::path>{};
+	for (const auto& entry : filesystem::recursive_directory_iterator(directory)) {
+		if (entry.is_regular_file() && has_extension(entry.path(), MODEL_EXTENSIONS)) {
+			paths.push_back(entry.path().lexically_normal());
+		}
+	}
+	sort(paths.begin(), paths.end());
+
+	auto jobs = vector<ModelJob>{};
+	for (const auto& path : paths) {
+		auto imports = vector<gengine::ModelImportSettings>{};
+		const auto [first, last] = listed.equal_range(path);
+		for (auto it = first; it != last; ++it) {
+			imports.push_back(it->second);
+		}
+		if (imports.empty()) {
+			imports.push_back({});
+		}
+
+		for (const auto& settings : imports) {
+			auto output = "model " + path.string();
+			output += settings.flip_uvs ? " flip_uvs" : "";
+			output += settings.flip_winding_order ? " flip_winding" : "";
+
+			auto config = gengine::hash_combine(gengine::hash_string("model"), COOK_VERSION);
+			config = gengine::hash_combine(config, gengine::SCENE_CACHE_VERSION);
+			config = gengine::hash_combine(config, settings.flip_uvs);
+			config = gengine::hash_combine(config, settings.flip_winding_order);
+			config = gengine::hash_combine(config, settings.optimize_meshes);
+			for (const auto lod_error : settings.lod_errors) {
+				config = gengine::hash_combine(config, lod_error);
+			}
+			jobs.push_back({path, settings, std::move(output), config});
+		}
+	}
+	return jobs;
+}
+
+/// Import a model afresh into the scene cache, noting what it was made from
+static auto cook_model(gengine::TextureFactory& texture_factory, const ModelJob& job)
+	-> optional<CookRecord>
+{
+	auto recorder = gengine::ReadRecorder{};
+	auto settings = job.settings;
+	settings.reuse_cache = false;
+	const auto scene = gengine::load_model(texture_factory, job.path.string(), settings);
+	if (scene.objects.empty()) {
+		cerr << "Error: Cannot import " << job.path.string() << endl;
+		return nullopt;
+	}
+
+	auto record = CookRecord{job.config, {}, {}};
+
+	// Images are nodes of their own; everything else the import read is an input
+	auto inputs = set<filesystem::path>{};
+	for (const auto& path : recorder.paths()) {
+		if (!is_image(path)) {
+			inputs.insert(path);
+		}
+	}
+	for (const auto& path : inputs) {
+		auto input = stamp(path);
+		if (!input.has_value()) {
+			cerr << "Error: Cannot read " << path.string() << endl;
+			return nullopt;
+		}
+		record.inputs.push_back(std::move(*input));
+	}
+
+	// Embedded textures are named after the model and have no file to bake
+	auto textures = set<filesystem::path>{};
+	for (const auto& material : scene.materials) {
+		for (const auto& texture : material.textures) {
+			const auto path = filesystem::path{texture.name}.lexically_normal();
+			if (has_extension(path, IMAGE_EXTENSIONS) && filesystem::is_regular_file(path)) {
+				textures.insert(path);
+			}
+		}
+	}
+	record.textures.assign(textures.begin(), textures.end());
+	return record;
+}
+
+/// Bake one image to a .gtex beside it
+static auto cook_texture(const TextureJob& job) -> optional<CookRecord>
+{
+	auto input = stamp(job.image);
+	const auto file = gengine::MappedFile::open(job.image);
+	if (!input.has_value() || !file.has_value()) {
+		cerr << "Error: Cannot read " << job.image.string() << endl;
+		return nullopt;
+	}
+
+	auto width = 0;
+	auto height = 0;
+	auto channel_count = 0;
+	const auto encoded = (*file)->bytes();
+	const auto data = stbi_load_from_memory(
+		reinterpret_cast<const unsigned char*>(encoded.data()),
+		static_cast<int>(encoded.size()),
+		&width,
+		&height,
+		&channel_count,
+		4);
+	if (data == nullptr) {
+		cerr << "Error: Cannot load " << job.image.string() << endl;
+		return nullopt;
+	}
+	const auto texture = gpu::encode_texture(job.format, width, height, data);
+	stbi_image_free(data);
+	const auto bytes = gpu::write_texture_file(texture);
+
+	// Write beside the output first, so the engine never loads half a texture
+	auto temp_path = job.output;
+	temp_path += ".tmp";
+	{
+		auto stream = ofstream(temp_path, ios::binary | ios::trunc);
+		if (!stream.is_open()) {
+			cerr << "Error: Cannot write " << temp_path.string() << endl;
+			return nullopt;
+		}
+		stream.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+	}
+	auto error = error_code{};
+	filesystem::rename(temp_path, job.output, error);
+	if (error) {
+		cerr << "Error: Cannot write " << job.output.string() << ": " << error.message() << endl;
+		return nullopt;
+	}
+
+	cout << job.output.string() << " (" << width << "x" << height
+		 << ") mips:" << texture.levels.size() << endl;
+	return CookRecord{job.config, {std::move(*input)}, {}};
+}
+
+/// Whether an output's record says it is up to date
+static auto up_to_date(CookState& state, const string& output, uint64_t config) -> bool
+{
+	const auto it = state.find(output);
+	return it != state.end() && it->second.config == config &&
+		   inputs_unchanged(it->second.inputs);
+}
+
+static auto elapsed_ms(chrono::steady_clock::time_point start) -> long long
+{
+	const auto elapsed = chrono::steady_clock::now() - start;
+	return chrono::duration_cast<chrono::milliseconds>(elapsed).count();
+}
+
+int main(int argc, char** argv)
+{
+	auto formats = vector<gpu::TextureFormat>{};
+	auto force = false;
+	auto directory = filesystem::path{"data"};
+
+	for (auto i = 1; i < argc; i++) {
+		const auto arg = string(argv[i]);
+		if (arg == "--format" && i + 1 < argc) {
+			const auto named = gpu::texture_format_from_name(argv[++i]);
+			if (!named.has_value()) {
+				cerr << "Error: Unknown format " << argv[i] << endl;
+				return 1;
+			}
+			formats.push_back(*named);
+		}
+		else if (arg == "--force") {
+			force = true;
+		}
+		else if (!arg.starts_with("--")) {
+			directory = arg;
+		}
+		else {
+			cerr << "Usage: " << argv[0]
+				 << " [--format bc7|bc1|etc2|rgba8]... [--force] [directory]" << endl;
+			return 1;
+		}
+	}
+	if (formats.empty()) {
+		formats.push_back(gpu::TextureFormat::BC7);
+	}
+	if (!filesystem::is_directory(directory)) {
+		cerr << "Error: No directory " << directory.string() << endl;
+		return 1;
+	}
+	directory = filesystem::absolute(directory).lexically_normal();
+
+	const auto start = chrono::steady_clock::now();
+	auto& pool = gengine::ThreadPool::shared();
+	auto old_state = force ? CookState{} : read_state();
+	auto new_state = CookState{};
+	auto ok = true;
+	auto cooked = 0;
+	auto fresh = 0;
+
+	// Models first: cooking them finds the textures they lead to
+	auto texture_factory = gengine::TextureFactory{};
+	texture_factory.set_baked_formats(formats);
+
+	auto model_jobs = find_models(directory);
+	auto model_cooks = vector<pair<const ModelJob*, future<optional<CookRecord>>>>{};
+	for (const auto& job : model_jobs) {
+		if (up_to_date(old_state, job.output, job.config)) {
+			new_state[job.output] = std::move(old_state[job.output]);
+			fresh++;
+			continue;
+		}
+		model_cooks.push_back(
+			{&job, pool.submit([&texture_factory, &job]() {
+				 return cook_model(texture_factory, job);
+			 })});
+	}
+	for (auto& [job, cook] : model_cooks) {
+		if (auto record = pool.wait(cook)) {
+			new_state[job->output] = std::move(*record);
+			cooked++;
+		}
+		else {
+			ok = false;
+		}
+	}
+	texture_factory.unload_all_images();
+	const auto models_ms = elapsed_ms(start);
+
+	// Then every texture any model uses, once per format
+	auto images = set<filesystem::path>{};
+	for (const auto& [output, record] : new_state) {
+		images.insert(record.textures.begin(), record.textures.end());
+	}
+	auto texture_jobs = vector<TextureJob>{};
+	for (const auto& image : images) {
+		for (const auto format : formats) {
+			auto output = image;
+			output += "." + string(gpu::texture_format_name(format)) + ".gtex";
+			auto config = gengine::hash_combine(gengine::hash_string("texture"), COOK_VERSION);
+			config = gengine::hash_combine(config, static_cast<uint32_t>(format));
+			texture_jobs.push_back({image, format, std::move(output), config});
+		}
+	}
+
+	auto texture_cooks = vector<pair<const TextureJob*, future<optional<CookRecord>>>>{};
+	for (const auto& job : texture_jobs) {
+		const auto name = job.output.string();
+		if (filesystem::exists(job.output) && up_to_date(old_state, name, job.config)) {
+			new_state[name] = std::move(old_state[name]);
+			fresh++;
+			continue;
+		}
+		texture_cooks.push_back({&job, pool.submit([&job]() { return cook_texture(job); })});
+	}
+	for (auto& [job, cook] : texture_cooks) {
+		if (auto record = pool.wait(cook)) {
+			new_state[job->output.string()] = std::move(*record);
+			cooked++;
+		}
+		else {
+			ok = false;
+		}
+	}
+
+	ok = write_state(new_state) && ok;
+
+	const auto outputs = model_jobs.size() + texture_jobs.size();
+	const auto total_ms = elapsed_ms(start);
+	cout << "[info]\t Cooked " << cooked << " of " << outputs << " outputs ("
+		 << model_jobs.size() << " model imports, " << texture_jobs.size() << " textures) in "
+		 << total_ms << " ms (models " << models_ms << " ms, textures " << total_ms - models_ms
+		 << " ms) on " << pool.thread_count() << " threads; " << fresh << " up to date" << endl;
+	return ok ? 0 : 1;
+}
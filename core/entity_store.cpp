@@ -0,0 +1,175 @@
+#include "entity_store.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+/// Bytes per component, by ComponentId
+array<size_t, MAX_COMPONENT_TYPES> component_sizes{};
+
+atomic<ComponentId> next_component_id = 0;
+
+} // namespace
+
+namespace detail {
+
+auto register_component(std::size_t size) -> ComponentId
+{
+	const auto id = next_component_id++;
+	if (id >= MAX_COMPONENT_TYPES) {
+		cout << "Error: more than " << MAX_COMPONENT_TYPES << " component types" << endl;
+		abort();
+	}
+	component_sizes[id] = size;
+	return id;
+}
+
+auto component_size(ComponentId id) -> std::size_t { return component_sizes[id]; }
+
+} // namespace detail
+
+auto EntityStore::create() -> Entity
+{
+	if (archetypes.empty()) {
+		archetype_for(0);
+	}
+
+	auto index = uint32_t{0};
+	if (!free_slots.empty()) {
+		index = free_slots.back();
+		free_slots.pop_back();
+	}
+	else {
+		index = static_cast<uint32_t>(slots.size());
+		slots.push_back({0, 0, 0, false});
+	}
+
+	auto& slot = slots[index];
+	const auto entity = Entity{index, slot.generation};
+	auto& empty = archetypes[0];
+	slot.archetype = 0;
+	slot.row = static_cast<uint32_t>(empty.entities.size());
+	slot.alive = true;
+	empty.entities.push_back(entity);
+	live_count++;
+	return entity;
+}
+
+auto EntityStore::destroy(Entity entity) -> bool
+{
+	if (!alive(entity)) {
+		return false;
+	}
+	auto& slot = slots[entity.index];
+	remove_row(slot.archetype, slot.row);
+	slot.alive = false;
+	slot.generation++;
+	free_slots.push_back(entity.index);
+	live_count--;
+	return true;
+}
+
+auto EntityStore::alive(Entity entity) const -> bool
+{
+	return entity.index < slots.size() && slots[entity.index].alive &&
+		   slots[entity.index].generation == entity.generation;
+}
+
+auto EntityStore::archetype_for(ComponentMask mask) -> uint32_t
+{
+	if (const auto it = archetype_by_mask.find(mask); it != archetype_by_mask.end()) {
+		return it->second;
+	}
+
+	auto archetype = Archetype{};
+	archetype.mask = mask;
+	archetype.column_of.fill(-1);
+	archetype.edges.fill(NO_EDGE);
+	for (auto id = ComponentId{0}; id < MAX_COMPONENT_TYPES; id++) {
+		if ((mask & bit(id)) == 0) {
+			continue;
+		}
+		archetype.column_of[id] = static_cast<int8_t>(archetype.columns.size());
+		archetype.columns.push_back({id, detail::component_size(id), {}});
+	}
+
+	const auto index = static_cast<uint32_t>(archetypes.size());
+	archetypes.push_back(std::move(archetype));
+	archetype_by_mask[mask] = index;
+	return index;
+}
+
+auto EntityStore::toggle_component(Entity entity, ComponentId id) -> void
+{
+	const auto source_index = slots[entity.index].archetype;
+	auto target_index = archetypes[source_index].edges[id];
+	if (target_index == NO_EDGE) {
+		target_index = archetype_for(archetypes[source_index].mask ^ bit(id));
+		archetypes[source_index].edges[id] = target_index;
+		archetypes[target_index].edges[id] = source_index;
+	}
+
+	move_entity(entity, target_index);
+}
+
+auto EntityStore::move_entity(Entity entity, uint32_t target_index) -> void
+{
+	const auto source_index = slots[entity.index].archetype;
+	if (source_index == target_index) {
+		return;
+	}
+	auto& source = archetypes[source_index];
+	auto& target = archetypes[target_index];
+	const auto source_row = slots[entity.index].row;
+	const auto target_row = static_cast<uint32_t>(target.entities.size());
+
+	// Copy the components both archetypes have; added ones are left for the caller
+	target.entities.push_back(entity);
+	for (auto& column : target.columns) {
+		column.bytes.resize(column.bytes.size() + column.stride);
+		const auto from = source.column_of[column.component];
+		if (from < 0) {
+			continue;
+		}
+		const auto& source_column = source.columns[from];
+		memcpy(
+			column.bytes.data() + target_row * column.stride,
+			source_column.bytes.data() + source_row * column.stride,
+			column.stride);
+	}
+
+	remove_row(source_index, source_row);
+	slots[entity.index].archetype = target_index;
+	slots[entity.index].row = target_row;
+}
+
+auto EntityStore::remove_row(uint32_t archetype_index, uint32_t row) -> void
+{
+	auto& archetype = archetypes[archetype_index];
+	const auto last = static_cast<uint32_t>(archetype.entities.size() - 1);
+
+	if (row != last) {
+		const auto moved = archetype.entities[last];
+		archetype.entities[row] = moved;
+		for (auto& column : archetype.columns) {
+			memcpy(
+				column.bytes.data() + row * column.stride,
+				column.bytes.data() + last * column.stride,
+				column.stride);
+		}
+		slots[moved.index].row = row;
+	}
+
+	archetype.entities.pop_back();
+	for (auto& column : archetype.columns) {
+		column.bytes.resize(column.bytes.size() - column.stride);
+	}
+}
+
+} // namespace gengine
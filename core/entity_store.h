@@ -0,0 +1,287 @@
+/**
+ * @file entity_store.h - entities made of components, stored by archetype.
+ *
+ * Entities with the same set of component types share an archetype, which keeps each
+ * component type in its own dense column: a query walks contiguous arrays rather than
+ * chasing pointers.  Adding or removing a component moves the entity's row to another
+ * archetype; removing a row fills the hole with the archetype's last row.
+ *
+ * Entity ids are generational, so an id kept after its entity was destroyed never
+ * names whatever reuses its slot.
+ *
+ * Components are plain data: trivially copyable, since rows move with memcpy.
+ */
+
+#pragma once
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <span>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+namespace gengine {
+
+struct Entity {
+	uint32_t index;
+	uint32_t generation;
+
+	bool operator==(const Entity& other) const = default;
+};
+
+/// An id which no entity ever has
+constexpr Entity NO_ENTITY = {UINT32_MAX, 0};
+
+/// Most component types a program may use
+constexpr std::size_t MAX_COMPONENT_TYPES = 64;
+
+using ComponentId = uint32_t;
+
+/// One bit per ComponentId
+using ComponentMask = uint64_t;
+
+namespace detail {
+
+/// Give the next component type an id
+auto register_component(std::size_t size) -> ComponentId;
+
+/// Bytes per component of each registered type
+auto component_size(ComponentId id) -> std::size_t;
+
+} // namespace detail
+
+/// The id of a component type, the same for every EntityStore
+template <class Component> auto component_id() -> ComponentId
+{
+	static_assert(
+		std::is_trivially_copyable_v<Component>, "components are moved with memcpy");
+	static_assert(
+		alignof(Component) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__,
+		"columns are only aligned like operator new");
+	static const auto id = detail::register_component(sizeof(Component));
+	return id;
+}
+
+template <class... Components> auto component_mask() -> ComponentMask
+{
+	return (ComponentMask{0} | ... | (ComponentMask{1} << component_id<Components>()));
+}
+
+/**
+ * @brief Entities and their components.
+ * @note Not thread-safe.  Queries may run their callbacks on many threads, but nothing
+ *       may add or remove entities or components while a query runs.
+ */
+class EntityStore {
+public:
+	/// Rows handed to each job by parallel_each
+	static constexpr std::size_t DEFAULT_CHUNK_SIZE = 4096;
+
+	/// A new entity without components
+	auto create() -> Entity;
+
+	/// A new entity with these components, placed straight into their archetype
+	template <class... Components> auto create(const Components&... components) -> Entity
+	{
+		const auto entity = create();
+		move_entity(entity, archetype_for(component_mask<Components...>()));
+		const auto& slot = slots[entity.index];
+		auto& archetype = archetypes[slot.archetype];
+		((column_data<Components>(archetype, component_id<Components>())[slot.row] = components),
+		 ...);
+		return entity;
+	}
+
+	/// Destroy an entity and its components; false if it was already gone
+	auto destroy(Entity entity) -> bool;
+
+	auto alive(Entity entity) const -> bool;
+
+	/// Entities alive
+	auto size() const -> std::size_t { return live_count; }
+
+	/// Add a component, or overwrite the entity's existing one
+	template <class Component> auto add(Entity entity, const Component& component) -> Component&
+	{
+		const auto id = component_id<Component>();
+		if (!has(entity, id)) {
+			toggle_component(entity, id);
+		}
+		const auto& slot = slots[entity.index];
+		auto* stored = column_data<Component>(archetypes[slot.archetype], id) + slot.row;
+		*stored = component;
+		return *stored;
+	}
+
+	/// Remove a component; false if the entity didn't have it
+	template <class Component> auto remove(Entity entity) -> bool
+	{
+		const auto id = component_id<Component>();
+		if (!has(entity, id)) {
+			return false;
+		}
+		toggle_component(entity, id);
+		return true;
+	}
+
+	/// The entity's component, or nullptr if it's gone or has none
+	template <class Component> auto get(Entity entity) -> Component*
+	{
+		const auto id = component_id<Component>();
+		if (!has(entity, id)) {
+			return nullptr;
+		}
+		const auto& slot = slots[entity.index];
+		return column_data<Component>(archetypes[slot.archetype], id) + slot.row;
+	}
+
+	template <class Component> auto has(Entity entity) const -> bool
+	{
+		return has(entity, component_id<Component>());
+	}
+
+	/**
+	 * @brief Call `fn(std::span<const Entity>, std::span<Components>...)` once per archetype
+	 *        holding every listed component, with its rows as contiguous arrays.
+	 */
+	template <class... Components, class Fn> auto each_chunk(Fn&& fn) -> void
+	{
+		const auto mask = component_mask<Components...>();
+		for (auto& archetype : archetypes) {
+			if ((archetype.mask & mask) != mask || archetype.entities.empty()) {
+				continue;
+			}
+			const auto count = archetype.entities.size();
+			fn(std::span<const Entity>{archetype.entities},
+			   std::span<Components>{
+				   column_data<Components>(archetype, component_id<Components>()), count}...);
+		}
+	}
+
+	/// Call `fn(Entity, Components&...)` for every entity holding every listed component
+	template <class... Components, class Fn> auto each(Fn&& fn) -> void
+	{
+		each_chunk<Components...>([&fn](std::span<const Entity> entities, auto... columns) {
+			for (auto row = std::size_t{0}; row < entities.size(); row++) {
+				fn(entities[row], columns[row]...);
+			}
+		});
+	}
+
+	/**
+	 * @brief Like `each`, split into chunks of rows which run as jobs on a pool.
+	 *
+	 * Returns once every chunk is done; the calling thread runs chunks meanwhile, but no other
+	 * jobs.  `fn` must be safe to call from several threads.
+	 */
+	template <class... Components, class Fn>
+	auto parallel_each(ThreadPool& pool, Fn&& fn, std::size_t chunk_size = DEFAULT_CHUNK_SIZE)
+		-> void
+	{
+		auto chunks = std::vector<std::function<void()>>{};
+		each_chunk<Components...>([&](std::span<const Entity> entities, auto... columns) {
+			for (auto first = std::size_t{0}; first < entities.size(); first += chunk_size) {
+				const auto count = std::min(chunk_size, entities.size() - first);
+				chunks.emplace_back([&fn, entities, columns..., first, count]() {
+					for (auto row = first; row < first + count; row++) {
+						fn(entities[row], columns[row]...);
+					}
+				});
+			}
+		});
+		pool.run_batch(chunks);
+	}
+
+	/// Entities holding every listed component
+	template <class... Components> auto count() const -> std::size_t
+	{
+		const auto mask = component_mask<Components...>();
+		auto total = std::size_t{0};
+		for (const auto& archetype : archetypes) {
+			if ((archetype.mask & mask) == mask) {
+				total += archetype.entities.size();
+			}
+		}
+		return total;
+	}
+
+	/// Archetypes made so far, including empty ones
+	auto archetype_count() const -> std::size_t { return archetypes.size(); }
+
+private:
+	/// Components of one type, one per row, back to back
+	struct Column {
+		ComponentId component;
+		std::size_t stride;
+		std::vector<std::byte> bytes;
+	};
+
+	struct Archetype {
+		ComponentMask mask;
+		/// Sorted by component id
+		std::vector<Column> columns;
+		/// Index into `columns` by component id, or -1
+		std::array<int8_t, MAX_COMPONENT_TYPES> column_of;
+		/// The entity in each row
+		std::vector<Entity> entities;
+		/// Archetype reached by adding or removing each component, once looked up; or NO_EDGE
+		std::array<uint32_t, MAX_COMPONENT_TYPES> edges;
+	};
+
+	struct Slot {
+		uint32_t generation;
+		uint32_t archetype;
+		uint32_t row;
+		bool alive;
+	};
+
+	static constexpr uint32_t NO_EDGE = UINT32_MAX;
+
+	static auto bit(ComponentId id) -> ComponentMask { return ComponentMask{1} << id; }
+
+	template <class Component>
+	static auto column_data(Archetype& archetype, ComponentId id) -> Component*
+	{
+		auto& column = archetype.columns[archetype.column_of[id]];
+		return reinterpret_cast<Component*>(column.bytes.data());
+	}
+
+	auto has(Entity entity, ComponentId id) const -> bool
+	{
+		return alive(entity) && (archetypes[slots[entity.index].archetype].mask & bit(id)) != 0;
+	}
+
+	/// The archetype of exactly these components, made if it's new
+	auto archetype_for(ComponentMask mask) -> uint32_t;
+
+	/**
+	 * Add a component the entity lacks, or remove one it has, by moving its row to the
+	 * neighbouring archetype.  An added component is left for the caller to write.
+	 */
+	auto toggle_component(Entity entity, ComponentId id) -> void;
+
+	/// Move an entity's row to another archetype, keeping the components both have
+	auto move_entity(Entity entity, uint32_t archetype) -> void;
+
+	/// Drop a row, moving the archetype's last row into its place
+	auto remove_row(uint32_t archetype, uint32_t row) -> void;
+
+	std::vector<Slot> slots;
+	/// Slots of destroyed entities, reused before new ones
+	std::vector<uint32_t> free_slots;
+	std::size_t live_count = 0;
+
+	/// Archetype 0 holds entities without components
+	std::vector<Archetype> archetypes;
+	std::unordered_map<ComponentMask, uint32_t> archetype_by_mask;
+};
+
+} // namespace gengine
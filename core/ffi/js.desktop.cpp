@@ -5,6 +5,7 @@
  */
 
 #include "camera.hpp"
+#include "file_watcher.h"
 #include "fps_controller.h"
 #include "gpu.h"
 #include "physics.h"
@@ -13,6 +14,7 @@
 #include "world.h"
 
 #include <GLFW/glfw3.h>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -115,6 +117,8 @@ class NativeWorld : public World {
 	shared_ptr<gpu::RenderDevice> gpu;
 	gengine::TextureFactory texture_factory{};
 	ResourceContainer resources;
+	/// Scene files to re-import when they're saved
+	gengine::FileWatcher asset_watcher{};
 
 	// Game data
 	Camera camera;
@@ -129,14 +133,7 @@ public:
 		physics_engine = make_unique<gengine::PhysicsEngine>();
 
 		// Load the JS file
-		const char* script_path = "./examples/javascript.js";
-		ifstream script_file(script_path);
-		if (!script_file.is_open()) {
-			cerr << "Failed to open " << script_path << endl;
-		}
-		stringstream script_data;
-		script_data << script_file.rdbuf();
-		string script_str = script_data.str();
+		const auto script = gengine::load_file_view("./examples/javascript.js");
 
 		// Set up the JS runtime
 		ctx = duk_create_heap_default();
@@ -156,7 +153,8 @@ public:
 		dukglue_register_function(ctx, js_create_capsule, "createCapsule");
 		dukglue_register_function(ctx, js_create_sphere, "createSphere");
 
-		duk_push_string(ctx, script_str.data());
+		// The mapped script isn't null-terminated, so push it with its length
+		duk_push_lstring(ctx, script.text().data(), script.text().size());
 		int failed = duk_peval(ctx);
 		if (failed) {
 			const char* err = duk_safe_to_string(ctx, -1);
@@ -192,20 +190,18 @@ public:
 		sceneBuilder.add_game_object(glm::mat4{}, VisualModel{.path = "./data/map.obj"});
 
 		// Describe the "shape" of our geometry data
-		std::vector<gpu::VertexAttribute> vertex_attributes;
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // position
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // normal
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC2_FLOAT); // uv
+		// (position, normal, uv) - the same layout models are imported in
+		const auto& vertex_attributes = gengine::MODEL_VERTEX_LAYOUT;
 
 		// TODO: this is incorrect because GL rendering on Desktop Linux will break
 #ifdef __EMSCRIPTEN__
-		const auto vert = gengine::load_file("./data/gl.vert.glsl");
-		const auto frag = gengine::load_file("./data/gl.frag.glsl");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/gl.vert.glsl");
+		const auto frag = gengine::load_file_view("./data/gl.frag.glsl");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #else
-		const auto vert = gengine::load_file("./data/cube.vert.spv");
-		const auto frag = gengine::load_file("./data/cube.frag.spv");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/cube.vert.spv");
+		const auto frag = gengine::load_file_view("./data/cube.frag.spv");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #endif
 
 		scene = sceneBuilder.build(
@@ -214,11 +210,15 @@ public:
 		// Assumes all images are uploaded to the GPU and are useless in system memory.
 		texture_factory.unload_all_images();
 
-		cout << "[info]\t SUCCESS!! Created scene with " << scene->transforms.size() << " objects"
+		cout << "[info]\t SUCCESS!! Created scene with " << scene->entities.size() << " entities"
 			 << endl;
 
-		fps_controller =
-			make_unique<FirstPersonController>(physics_engine.get(), camera, scene->collidables[0]);
+		for (const auto& path : reloadable_asset_paths(*scene, resources)) {
+			asset_watcher.watch(path);
+		}
+
+		const auto player = scene->entities.get<RigidBody>(player_entity())->collidable;
+		fps_controller = make_unique<FirstPersonController>(physics_engine.get(), camera, player);
 
 		// start getting things going
 		update_physics(0.16f);
@@ -230,8 +230,11 @@ public:
 
 		duk_destroy_heap(ctx);
 
-		for (const auto& rigidbody : resources.rigidbodies) {
-			physics_engine->destroy_collidable(rigidbody);
+		scene->entities.each<RigidBody>([&](gengine::Entity, const RigidBody& body) {
+			physics_engine->destroy_collidable(body.collidable);
+		});
+		for (const auto shape : resources.collision_shapes) {
+			physics_engine->destroy_shape(shape);
 		}
 
 		gpu->destroy_pipeline(pipeline);
@@ -243,23 +246,48 @@ public:
 
 	void update(double elapsed_time) override
 	{
+		// Swap in scene files saved since the last frame
+		if (const auto changed = asset_watcher.poll(); !changed.empty()) {
+			reload_assets(
+				*scene,
+				resources,
+				changed,
+				pipeline,
+				gpu.get(),
+				physics_engine.get(),
+				&texture_factory);
+		}
 
-		update_input(elapsed_time, scene->collidables[0]);
+		update_input(elapsed_time, scene->entities.get<RigidBody>(player_entity())->collidable);
 		update_physics(elapsed_time);
 
-		camera.Position = glm::vec3(scene->transforms[0][3]);
+		camera.Position = glm::vec3(scene->entities.get<Transform>(player_entity())->matrix[3]);
+
+		auto framebuffer_width = 0;
+		auto framebuffer_height = 0;
+		glfwGetFramebufferSize(window.get(), &framebuffer_width, &framebuffer_height);
+		const auto projection_scale =
+			framebuffer_height / (2.0f * std::tan(glm::radians(gpu::FIELD_OF_VIEW_DEGREES) / 2.0f));
+		select_lod_levels(*scene, camera.Position, projection_scale);
+		stream_textures(*scene, resources, gpu.get(), camera.Position, projection_scale);
+		prepare_instances(*scene, gpu::projection_matrix() * camera.get_view_matrix());
 
 		const auto gui_func = []() {};
 
 		gpu->render(
 			camera.get_view_matrix(),
 			pipeline,
-			scene->transforms,
-			scene->render_components,
-			scene->descriptors,
+			scene->instance_transforms,
+			scene->instance_batches,
 			gui_func);
 	}
 
+	/// The body of the scene's first game object, which the camera follows
+	auto player_entity() const -> gengine::Entity
+	{
+		return scene->instances.front().bodies.front();
+	}
+
 	auto update_input(float delta, gengine::Collidable* player) -> void
 	{
 		auto window_data = static_cast<gengine::WindowData*>(glfwGetWindowUserPointer(window.get()));
@@ -276,9 +304,7 @@ public:
 	{
 		physics_engine->step(delta, 10);
 
-		for (auto i = 0; i < scene->collidables.size(); ++i) {
-			physics_engine->get_model_matrix(scene->collidables[i], scene->transforms[i]);
-		}
+		update_transforms(*scene, physics_engine.get());
 	}
 };
 
@@ -22,6 +22,7 @@
 #include "world.h"
 
 #include <GLFW/glfw3.h>
+#include <cmath>
 #include <fstream>
 #include <functional>
 #include <iostream>
@@ -173,20 +174,18 @@ public:
 		sceneBuilder.add_game_object(glm::mat4{}, VisualModel{.path = "./data/map.obj"});
 
 		// Describe the "shape" of our geometry data
-		std::vector<gpu::VertexAttribute> vertex_attributes;
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // position
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // normal
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC2_FLOAT); // uv
+		// (position, normal, uv) - the same layout models are imported in
+		const auto& vertex_attributes = gengine::MODEL_VERTEX_LAYOUT;
 
 		// TODO: this is incorrect because GL rendering on Desktop Linux will break
 #ifdef __EMSCRIPTEN__
-		const auto vert = gengine::load_file("./data/gl.vert.glsl");
-		const auto frag = gengine::load_file("./data/gl.frag.glsl");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/gl.vert.glsl");
+		const auto frag = gengine::load_file_view("./data/gl.frag.glsl");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #else
-		const auto vert = gengine::load_file("./data/cube.vert.spv");
-		const auto frag = gengine::load_file("./data/cube.frag.spv");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/cube.vert.spv");
+		const auto frag = gengine::load_file_view("./data/cube.frag.spv");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #endif
 
 		scene = sceneBuilder.build(
@@ -195,11 +194,11 @@ public:
 		// Assumes all images are uploaded to the GPU and are useless in system memory.
 		texture_factory.unload_all_images();
 
-		cout << "[info]\t SUCCESS!! Created scene with " << scene->transforms.size() << " objects"
+		cout << "[info]\t SUCCESS!! Created scene with " << scene->entities.size() << " entities"
 			 << endl;
 
-		fps_controller =
-			make_unique<FirstPersonController>(physics_engine.get(), camera, scene->collidables[0]);
+		const auto player = scene->entities.get<RigidBody>(player_entity())->collidable;
+		fps_controller = make_unique<FirstPersonController>(physics_engine.get(), camera, player);
 
 		// start getting things going
 		update_physics(0.16f);
@@ -209,8 +208,11 @@ public:
 	{
 		cout << "~ NativeWorld" << endl;
 
-		for (const auto& rigidbody : resources.rigidbodies) {
-			physics_engine->destroy_collidable(rigidbody);
+		scene->entities.each<RigidBody>([&](gengine::Entity, const RigidBody& body) {
+			physics_engine->destroy_collidable(body.collidable);
+		});
+		for (const auto shape : resources.collision_shapes) {
+			physics_engine->destroy_shape(shape);
 		}
 
 		gpu->destroy_pipeline(pipeline);
@@ -223,22 +225,36 @@ public:
 	void update(double elapsed_time) override
 	{
 
-		update_input(elapsed_time, scene->collidables[0]);
+		update_input(elapsed_time, scene->entities.get<RigidBody>(player_entity())->collidable);
 		update_physics(elapsed_time);
 
-		camera.Position = glm::vec3(scene->transforms[0][3]);
+		camera.Position = glm::vec3(scene->entities.get<Transform>(player_entity())->matrix[3]);
+
+		auto framebuffer_width = 0;
+		auto framebuffer_height = 0;
+		glfwGetFramebufferSize(window.get(), &framebuffer_width, &framebuffer_height);
+		const auto projection_scale =
+			framebuffer_height / (2.0f * std::tan(glm::radians(gpu::FIELD_OF_VIEW_DEGREES) / 2.0f));
+		select_lod_levels(*scene, camera.Position, projection_scale);
+		stream_textures(*scene, resources, gpu.get(), camera.Position, projection_scale);
+		prepare_instances(*scene, gpu::projection_matrix() * camera.get_view_matrix());
 
 		const auto gui_func = []() {};
 
 		gpu->render(
 			camera.get_view_matrix(),
 			pipeline,
-			scene->transforms,
-			scene->render_components,
-			scene->descriptors,
+			scene->instance_transforms,
+			scene->instance_batches,
 			gui_func);
 	}
 
+	/// The body of the scene's first game object, which the camera follows
+	auto player_entity() const -> gengine::Entity
+	{
+		return scene->instances.front().bodies.front();
+	}
+
 	auto update_input(float delta, gengine::Collidable* player) -> void
 	{
 		auto window_data = static_cast<gengine::WindowData*>(glfwGetWindowUserPointer(window.get()));
@@ -255,9 +271,7 @@ public:
 	{
 		physics_engine->step(delta, 10);
 
-		for (auto i = 0; i < scene->collidables.size(); ++i) {
-			physics_engine->get_model_matrix(scene->collidables[i], scene->transforms[i]);
-		}
+		update_transforms(*scene, physics_engine.get());
 	}
 };
 
@@ -0,0 +1,115 @@
+#include "file_watcher.h"
+
+#include <filesystem>
+#include <iostream>
+
+#if defined(__linux__) && !defined(__EMSCRIPTEN__)
+#define GENGINE_INOTIFY 1
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#else
+#define GENGINE_INOTIFY 0
+#endif
+
+using namespace std;
+
+namespace gengine {
+
+#if GENGINE_INOTIFY
+namespace {
+
+auto normalized(const filesystem::path& path) -> string
+{
+	return filesystem::absolute(path).lexically_normal().string();
+}
+
+} // namespace
+#endif
+
+FileWatcher::FileWatcher()
+{
+#if GENGINE_INOTIFY
+	inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (inotify_fd < 0) {
+		cout << "Error: inotify is unavailable, assets won't hot-reload" << endl;
+	}
+#endif
+}
+
+FileWatcher::~FileWatcher()
+{
+#if GENGINE_INOTIFY
+	if (inotify_fd >= 0) {
+		close(inotify_fd);
+	}
+#endif
+}
+
+auto FileWatcher::watch(const std::string& path) -> bool
+{
+#if GENGINE_INOTIFY
+	if (inotify_fd < 0) {
+		return false;
+	}
+
+	const auto file = normalized(path);
+	const auto directory = filesystem::path{file}.parent_path().string();
+
+	if (!directory_watches.contains(directory)) {
+		const auto wd = inotify_add_watch(
+			inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR);
+		if (wd < 0) {
+			cout << "Error: cannot watch " << directory << endl;
+			return false;
+		}
+		directories[wd] = directory;
+		directory_watches[directory] = wd;
+	}
+
+	files[file] = path;
+	return true;
+#else
+	return false;
+#endif
+}
+
+auto FileWatcher::poll() -> std::vector<std::string>
+{
+	auto changed = vector<string>{};
+
+#if GENGINE_INOTIFY
+	if (inotify_fd < 0) {
+		return changed;
+	}
+
+	auto seen = unordered_set<string>{};
+	alignas(inotify_event) char buffer[4096];
+	while (true) {
+		const auto length = read(inotify_fd, buffer, sizeof(buffer));
+		if (length <= 0) {
+			break; // EAGAIN: nothing more queued
+		}
+
+		for (auto offset = ssize_t{0}; offset < length;) {
+			const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+			offset += sizeof(inotify_event) + event->len;
+
+			const auto directory = directories.find(event->wd);
+			if (event->len == 0 || directory == directories.end()) {
+				continue;
+			}
+
+			const auto file = (filesystem::path{directory->second} / event->name).string();
+			const auto watched = files.find(file);
+			if (watched != files.end() && seen.insert(file).second) {
+				changed.push_back(watched->second);
+			}
+		}
+	}
+#endif
+
+	return changed;
+}
+
+} // namespace gengine
@@ -0,0 +1,55 @@
+/**
+ * @file file_watcher.h - reports asset files which were rewritten on disk.
+ *
+ * Backed by inotify on Linux. Elsewhere nothing is ever reported, so callers
+ * don't need platform checks of their own.
+ */
+
+#pragma once
+
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace gengine {
+
+class FileWatcher {
+public:
+	FileWatcher();
+	~FileWatcher();
+
+	FileWatcher(const FileWatcher&) = delete;
+	FileWatcher& operator=(const FileWatcher&) = delete;
+
+	/**
+	 * @brief Start reporting changes to a file.
+	 * @param path reported back by poll() exactly as given here
+	 * @return whether the file can be watched on this platform
+	 *
+	 * The file's directory is watched rather than the file, so saves which replace
+	 * the file (write to a temporary, then rename) are seen too.
+	 */
+	auto watch(const std::string& path) -> bool;
+
+	/**
+	 * @brief Files which finished being written since the last poll, without blocking.
+	 *
+	 * Each path is reported once per poll, however many times it was written.
+	 */
+	auto poll() -> std::vector<std::string>;
+
+private:
+	int inotify_fd = -1;
+
+	/// inotify watch descriptor --> normalized directory path
+	std::unordered_map<int, std::string> directories;
+
+	/// normalized directory path --> inotify watch descriptor
+	std::unordered_map<std::string, int> directory_watches;
+
+	/// normalized file path --> path as given to watch()
+	std::unordered_map<std::string, std::string> files;
+};
+
+} // namespace gengine
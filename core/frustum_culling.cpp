@@ -0,0 +1,166 @@
+#include "frustum_culling.h"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+#include <cmath>
+
+using namespace std;
+
+namespace gengine {
+
+auto make_frustum(const glm::mat4& view_projection) -> Frustum
+{
+	// Gribb & Hartmann: each plane is the last row of the matrix plus or minus another
+	const auto& m = view_projection;
+	const auto row = [&](int i) { return glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]); };
+	const auto planes = array<glm::vec4, 6>{
+		row(3) + row(0), // left
+		row(3) - row(0), // right
+		row(3) + row(1), // bottom
+		row(3) - row(1), // top
+		row(3) + row(2), // near
+		row(3) - row(2), // far
+	};
+
+	auto frustum = Frustum{};
+	for (auto i = size_t{0}; i < planes.size(); i++) {
+		// Unit normals, so that distances compare with box extents
+		const auto length = glm::length(glm::vec3(planes[i]));
+		const auto scale = length > 0.0f ? 1.0f / length : 1.0f;
+		frustum.x[i] = planes[i].x * scale;
+		frustum.y[i] = planes[i].y * scale;
+		frustum.z[i] = planes[i].z * scale;
+		frustum.w[i] = planes[i].w * scale;
+	}
+	for (auto i = planes.size(); i < frustum.x.size(); i++) {
+		frustum.x[i] = frustum.y[i] = frustum.z[i] = 0.0f;
+		frustum.w[i] = 1.0f;
+	}
+	return frustum;
+}
+
+auto intersects(const Frustum& frustum, const BoundingBox& box) -> bool
+{
+	// Outside a plane if even the box's corner furthest along its normal is behind it
+	for (auto i = size_t{0}; i < 6; i++) {
+		const auto distance = frustum.x[i] * box.center.x + frustum.y[i] * box.center.y +
+							  frustum.z[i] * box.center.z + frustum.w[i];
+		const auto reach = abs(frustum.x[i]) * box.extents.x + abs(frustum.y[i]) * box.extents.y +
+						   abs(frustum.z[i]) * box.extents.z;
+		if (distance + reach < 0.0f) {
+			return false;
+		}
+	}
+	return true;
+}
+
+#if defined(__AVX__)
+
+auto cull_boxes(const Frustum& frustum, std::span<const BoundingBox> boxes, uint32_t* visible)
+	-> std::size_t
+{
+	const auto sign = _mm256_set1_ps(-0.0f);
+	const auto zero = _mm256_setzero_ps();
+	const auto x = _mm256_load_ps(frustum.x.data());
+	const auto y = _mm256_load_ps(frustum.y.data());
+	const auto z = _mm256_load_ps(frustum.z.data());
+	const auto w = _mm256_load_ps(frustum.w.data());
+	const auto abs_x = _mm256_andnot_ps(sign, x);
+	const auto abs_y = _mm256_andnot_ps(sign, y);
+	const auto abs_z = _mm256_andnot_ps(sign, z);
+
+	auto count = size_t{0};
+	for (auto i = size_t{0}; i < boxes.size(); i++) {
+		const auto& box = boxes[i];
+		const auto distance = _mm256_add_ps(
+			_mm256_add_ps(
+				_mm256_mul_ps(x, _mm256_set1_ps(box.center.x)),
+				_mm256_mul_ps(y, _mm256_set1_ps(box.center.y))),
+			_mm256_add_ps(_mm256_mul_ps(z, _mm256_set1_ps(box.center.z)), w));
+		const auto reach = _mm256_add_ps(
+			_mm256_add_ps(
+				_mm256_mul_ps(abs_x, _mm256_set1_ps(box.extents.x)),
+				_mm256_mul_ps(abs_y, _mm256_set1_ps(box.extents.y))),
+			_mm256_mul_ps(abs_z, _mm256_set1_ps(box.extents.z)));
+		const auto outside =
+			_mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, reach), zero, _CMP_LT_OQ));
+
+		// Write every index, but only keep the visible ones
+		visible[count] = static_cast<uint32_t>(i);
+		count += outside == 0;
+	}
+	return count;
+}
+
+#elif defined(__SSE__) || defined(_M_X64)
+
+auto cull_boxes(const Frustum& frustum, std::span<const BoundingBox> boxes, uint32_t* visible)
+	-> std::size_t
+{
+	// Planes 0-3 in the low registers, 4-7 in the high ones
+	const auto sign = _mm_set1_ps(-0.0f);
+	const auto zero = _mm_setzero_ps();
+	const auto x_lo = _mm_load_ps(frustum.x.data());
+	const auto y_lo = _mm_load_ps(frustum.y.data());
+	const auto z_lo = _mm_load_ps(frustum.z.data());
+	const auto w_lo = _mm_load_ps(frustum.w.data());
+	const auto x_hi = _mm_load_ps(frustum.x.data() + 4);
+	const auto y_hi = _mm_load_ps(frustum.y.data() + 4);
+	const auto z_hi = _mm_load_ps(frustum.z.data() + 4);
+	const auto w_hi = _mm_load_ps(frustum.w.data() + 4);
+	const auto abs_x_lo = _mm_andnot_ps(sign, x_lo);
+	const auto abs_y_lo = _mm_andnot_ps(sign, y_lo);
+	const auto abs_z_lo = _mm_andnot_ps(sign, z_lo);
+	const auto abs_x_hi = _mm_andnot_ps(sign, x_hi);
+	const auto abs_y_hi = _mm_andnot_ps(sign, y_hi);
+	const auto abs_z_hi = _mm_andnot_ps(sign, z_hi);
+
+	auto count = size_t{0};
+	for (auto i = size_t{0}; i < boxes.size(); i++) {
+		const auto& box = boxes[i];
+		const auto cx = _mm_set1_ps(box.center.x);
+		const auto cy = _mm_set1_ps(box.center.y);
+		const auto cz = _mm_set1_ps(box.center.z);
+		const auto ex = _mm_set1_ps(box.extents.x);
+		const auto ey = _mm_set1_ps(box.extents.y);
+		const auto ez = _mm_set1_ps(box.extents.z);
+
+		const auto test =
+			[&](__m128 x, __m128 y, __m128 z, __m128 w, __m128 ax, __m128 ay, __m128 az) {
+				const auto distance = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(x, cx), _mm_mul_ps(y, cy)),
+					_mm_add_ps(_mm_mul_ps(z, cz), w));
+				const auto reach = _mm_add_ps(
+					_mm_add_ps(_mm_mul_ps(ax, ex), _mm_mul_ps(ay, ey)), _mm_mul_ps(az, ez));
+				return _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, reach), zero));
+			};
+		const auto outside = test(x_lo, y_lo, z_lo, w_lo, abs_x_lo, abs_y_lo, abs_z_lo) |
+							 test(x_hi, y_hi, z_hi, w_hi, abs_x_hi, abs_y_hi, abs_z_hi);
+
+		// Write every index, but only keep the visible ones
+		visible[count] = static_cast<uint32_t>(i);
+		count += outside == 0;
+	}
+	return count;
+}
+
+#else
+
+auto cull_boxes(const Frustum& frustum, std::span<const BoundingBox> boxes, uint32_t* visible)
+	-> std::size_t
+{
+	auto count = size_t{0};
+	for (auto i = size_t{0}; i < boxes.size(); i++) {
+		visible[count] = static_cast<uint32_t>(i);
+		count += intersects(frustum, boxes[i]) ? 1 : 0;
+	}
+	return count;
+}
+
+#endif
+
+} // namespace gengine
@@ -0,0 +1,49 @@
+/**
+ * @file frustum_culling.h - which bounding boxes the camera can see.
+ *
+ * Each box is tested against all six frustum planes at once: in one 8-wide test where the
+ * compiler targets AVX, in two 4-wide ones with SSE, and plane by plane elsewhere (e.g. on
+ * the web).  Boxes crossing a plane count as visible.
+ */
+
+#pragma once
+
+#include "assets.h"
+
+#include <glm/glm.hpp>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+namespace gengine {
+
+/**
+ * @brief The planes bounding what a view-projection matrix puts on screen.
+ *
+ * Plane i keeps the points p with `x[i] * p.x + y[i] * p.y + z[i] * p.z + w[i] >= 0`.
+ * Lanes 6 and 7 pad the planes to a full AVX register, and keep everything.
+ */
+struct Frustum {
+	alignas(32) std::array<float, 8> x;
+	alignas(32) std::array<float, 8> y;
+	alignas(32) std::array<float, 8> z;
+	alignas(32) std::array<float, 8> w;
+};
+
+/// Extract the planes of a view-projection matrix with OpenGL clip space
+auto make_frustum(const glm::mat4& view_projection) -> Frustum;
+
+/// Whether a box is at least partly inside the frustum
+auto intersects(const Frustum& frustum, const BoundingBox& box) -> bool;
+
+/**
+ * @brief Compact the indices of the boxes at least partly inside the frustum.
+ * @param visible receives indices into `boxes`, in order; must hold boxes.size()
+ * @return how many were written
+ */
+auto cull_boxes(const Frustum& frustum, std::span<const BoundingBox> boxes, uint32_t* visible)
+	-> std::size_t;
+
+} // namespace gengine
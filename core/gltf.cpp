@@ -0,0 +1,746 @@
+#include "gltf.h"
+#include "vfs.h"
+
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <string_view>
+#include <variant>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+constexpr uint32_t GLB_MAGIC = 0x46546c67; // "glTF"
+constexpr uint32_t GLB_CHUNK_JSON = 0x4e4f534a;
+constexpr uint32_t GLB_CHUNK_BIN = 0x004e4942;
+
+/// Just enough JSON for glTF: no duplicate keys, numbers as doubles
+struct JsonValue {
+	using Array = vector<JsonValue>;
+	using Object = map<string, JsonValue, less<>>;
+
+	variant<nullptr_t, bool, double, string, Array, Object> value;
+
+	auto operator[](string_view key) const -> const JsonValue&
+	{
+		static const auto null = JsonValue{};
+		const auto object = get_if<Object>(&value);
+		if (object == nullptr) {
+			return null;
+		}
+		const auto it = object->find(key);
+		return it == object->end() ? null : it->second;
+	}
+
+	auto array() const -> const Array&
+	{
+		static const auto empty = Array{};
+		const auto items = get_if<Array>(&value);
+		return items == nullptr ? empty : *items;
+	}
+
+	auto has(string_view key) const -> bool
+	{
+		const auto object = get_if<Object>(&value);
+		return object != nullptr && object->contains(key);
+	}
+
+	auto number(double fallback = 0.0) const -> double
+	{
+		const auto number = get_if<double>(&value);
+		return number == nullptr ? fallback : *number;
+	}
+
+	/// A whole number from 0 up to what `Integer` holds; nullopt for anything else
+	template <class Integer> auto integer() const -> optional<Integer>
+	{
+		const auto number = get_if<double>(&value);
+		// 2^digits is exact as a double, unlike the largest Integer, which would round up
+		if (number == nullptr || !(*number >= 0.0) || std::trunc(*number) != *number ||
+			*number >= std::ldexp(1.0, numeric_limits<Integer>::digits)) {
+			return nullopt;
+		}
+		return static_cast<Integer>(*number);
+	}
+
+	auto index() const -> optional<uint32_t> { return integer<uint32_t>(); }
+
+	/// Like integer(), but an absent member is `fallback`
+	template <class Integer>
+	auto integer(string_view key, Integer fallback) const -> optional<Integer>
+	{
+		return has(key) ? (*this)[key].integer<Integer>() : optional<Integer>{fallback};
+	}
+
+	auto text() const -> string_view
+	{
+		const auto text = get_if<string>(&value);
+		return text == nullptr ? string_view{} : string_view{*text};
+	}
+};
+
+class JsonParser {
+public:
+	explicit JsonParser(string_view text) : text{text} {}
+
+	auto parse() -> expected<JsonValue, string>
+	{
+		auto value = parse_value(0);
+		skip_space();
+		if (value.has_value() && position != text.size()) {
+			return fail("trailing characters");
+		}
+		return value;
+	}
+
+private:
+	static constexpr auto MAX_DEPTH = 128;
+
+	string_view text;
+	size_t position = 0;
+
+	auto fail(string_view what) const -> unexpected<string>
+	{
+		return unexpected("JSON " + string(what) + " at byte " + to_string(position));
+	}
+
+	auto skip_space() -> void
+	{
+		while (position < text.size() && (text[position] == ' ' || text[position] == '\t' ||
+										   text[position] == '\n' || text[position] == '\r')) {
+			position++;
+		}
+	}
+
+	auto consume(string_view token) -> bool
+	{
+		if (text.substr(position, token.size()) != token) {
+			return false;
+		}
+		position += token.size();
+		return true;
+	}
+
+	auto parse_value(int depth) -> expected<JsonValue, string>
+	{
+		if (depth > MAX_DEPTH) {
+			return fail("nested too deeply");
+		}
+		skip_space();
+		if (position >= text.size()) {
+			return fail("ended early");
+		}
+
+		switch (text[position]) {
+		case '{':
+			return parse_object(depth);
+		case '[':
+			return parse_array(depth);
+		case '"': {
+			auto string_value = parse_string();
+			if (!string_value.has_value()) {
+				return unexpected(string_value.error());
+			}
+			return JsonValue{std::move(*string_value)};
+		}
+		default:
+			break;
+		}
+
+		if (consume("true")) {
+			return JsonValue{true};
+		}
+		if (consume("false")) {
+			return JsonValue{false};
+		}
+		if (consume("null")) {
+			return JsonValue{nullptr};
+		}
+		return parse_number();
+	}
+
+	auto parse_object(int depth) -> expected<JsonValue, string>
+	{
+		auto object = JsonValue::Object{};
+		position++; // {
+		skip_space();
+		if (consume("}")) {
+			return JsonValue{std::move(object)};
+		}
+		while (true) {
+			skip_space();
+			auto key = parse_string();
+			if (!key.has_value()) {
+				return unexpected(key.error());
+			}
+			skip_space();
+			if (!consume(":")) {
+				return fail("expected ':'");
+			}
+			auto value = parse_value(depth + 1);
+			if (!value.has_value()) {
+				return value;
+			}
+			object.insert_or_assign(std::move(*key), std::move(*value));
+			skip_space();
+			if (consume("}")) {
+				return JsonValue{std::move(object)};
+			}
+			if (!consume(",")) {
+				return fail("expected ',' or '}'");
+			}
+		}
+	}
+
+	auto parse_array(int depth) -> expected<JsonValue, string>
+	{
+		auto array = JsonValue::Array{};
+		position++; // [
+		skip_space();
+		if (consume("]")) {
+			return JsonValue{std::move(array)};
+		}
+		while (true) {
+			auto value = parse_value(depth + 1);
+			if (!value.has_value()) {
+				return value;
+			}
+			array.push_back(std::move(*value));
+			skip_space();
+			if (consume("]")) {
+				return JsonValue{std::move(array)};
+			}
+			if (!consume(",")) {
+				return fail("expected ',' or ']'");
+			}
+		}
+	}
+
+	auto parse_number() -> expected<JsonValue, string>
+	{
+		const auto start = position;
+		while (position < text.size() && (isdigit(static_cast<unsigned char>(text[position])) ||
+										   text[position] == '-' || text[position] == '+' ||
+										   text[position] == '.' || text[position] == 'e' ||
+										   text[position] == 'E')) {
+			position++;
+		}
+		// strtod wants a terminated string; numbers are short
+		const auto token = string(text.substr(start, position - start));
+		char* end = nullptr;
+		const auto number = strtod(token.c_str(), &end);
+		if (token.empty() || end != token.c_str() + token.size()) {
+			position = start;
+			return fail("unexpected character");
+		}
+		return JsonValue{number};
+	}
+
+	auto parse_hex4() -> optional<uint32_t>
+	{
+		if (position + 4 > text.size()) {
+			return nullopt;
+		}
+		auto code = uint32_t{0};
+		for (auto i = 0; i < 4; i++) {
+			const auto c = text[position++];
+			code <<= 4;
+			if (c >= '0' && c <= '9') {
+				code |= c - '0';
+			}
+			else if (c >= 'a' && c <= 'f') {
+				code |= c - 'a' + 10;
+			}
+			else if (c >= 'A' && c <= 'F') {
+				code |= c - 'A' + 10;
+			}
+			else {
+				return nullopt;
+			}
+		}
+		return code;
+	}
+
+	auto parse_string() -> expected<string, string>
+	{
+		if (!consume("\"")) {
+			return fail("expected a string");
+		}
+		auto out = string{};
+		while (position < text.size()) {
+			const auto c = text[position++];
+			if (c == '"') {
+				return out;
+			}
+			if (c != '\\') {
+				out += c;
+				continue;
+			}
+			if (position >= text.size()) {
+				break;
+			}
+			switch (text[position++]) {
+			case '"':
+				out += '"';
+				break;
+			case '\\':
+				out += '\\';
+				break;
+			case '/':
+				out += '/';
+				break;
+			case 'b':
+				out += '\b';
+				break;
+			case 'f':
+				out += '\f';
+				break;
+			case 'n':
+				out += '\n';
+				break;
+			case 'r':
+				out += '\r';
+				break;
+			case 't':
+				out += '\t';
+				break;
+			case 'u': {
+				auto code = parse_hex4();
+				if (!code.has_value()) {
+					return fail("bad \\u escape");
+				}
+				// A surrogate pair encodes one code point above U+FFFF
+				if (*code >= 0xd800 && *code < 0xdc00 && consume("\\u")) {
+					const auto low = parse_hex4();
+					if (!low.has_value() || *low < 0xdc00 || *low >= 0xe000) {
+						return fail("bad surrogate pair");
+					}
+					*code = 0x10000 + ((*code - 0xd800) << 10) + (*low - 0xdc00);
+				}
+				append_utf8(out, *code);
+				break;
+			}
+			default:
+				return fail("bad escape");
+			}
+		}
+		return fail("unterminated string");
+	}
+
+	static auto append_utf8(string& out, uint32_t code) -> void
+	{
+		if (code < 0x80) {
+			out += static_cast<char>(code);
+		}
+		else if (code < 0x800) {
+			out += static_cast<char>(0xc0 | (code >> 6));
+			out += static_cast<char>(0x80 | (code & 0x3f));
+		}
+		else if (code < 0x10000) {
+			out += static_cast<char>(0xe0 | (code >> 12));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+			out += static_cast<char>(0x80 | (code & 0x3f));
+		}
+		else {
+			out += static_cast<char>(0xf0 | (code >> 18));
+			out += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+			out += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+			out += static_cast<char>(0x80 | (code & 0x3f));
+		}
+	}
+};
+
+auto read_u32(span<const byte> bytes, size_t offset) -> uint32_t
+{
+	auto value = uint32_t{0};
+	memcpy(&value, bytes.data() + offset, sizeof(value));
+	return value;
+}
+
+auto component_size(GltfComponentType type) -> size_t
+{
+	switch (type) {
+	case GltfComponentType::BYTE:
+	case GltfComponentType::UNSIGNED_BYTE:
+		return 1;
+	case GltfComponentType::SHORT:
+	case GltfComponentType::UNSIGNED_SHORT:
+		return 2;
+	case GltfComponentType::UNSIGNED_INT:
+	case GltfComponentType::FLOAT:
+		return 4;
+	}
+	return 0;
+}
+
+auto component_count(string_view type) -> uint32_t
+{
+	if (type == "SCALAR") {
+		return 1;
+	}
+	if (type == "VEC2") {
+		return 2;
+	}
+	if (type == "VEC3") {
+		return 3;
+	}
+	if (type == "VEC4" || type == "MAT2") {
+		return 4;
+	}
+	if (type == "MAT3") {
+		return 9;
+	}
+	if (type == "MAT4") {
+		return 16;
+	}
+	return 0;
+}
+
+auto node_transform(const JsonValue& node) -> glm::mat4
+{
+	if (node.has("matrix")) {
+		auto values = array<float, 16>{};
+		const auto& matrix = node["matrix"].array();
+		for (auto i = size_t{0}; i < min(matrix.size(), values.size()); i++) {
+			values[i] = static_cast<float>(matrix[i].number());
+		}
+		// glTF matrices are column-major, like glm's
+		return glm::make_mat4(values.data());
+	}
+
+	const auto vec = [](const JsonValue& value, size_t size, float fallback) {
+		auto out = array<float, 4>{fallback, fallback, fallback, fallback};
+		const auto& items = value.array();
+		for (auto i = size_t{0}; i < min(items.size(), size); i++) {
+			out[i] = static_cast<float>(items[i].number());
+		}
+		return out;
+	};
+	const auto t = vec(node["translation"], 3, 0.0f);
+	const auto r = node.has("rotation") ? vec(node["rotation"], 4, 0.0f)
+										: array<float, 4>{0.0f, 0.0f, 0.0f, 1.0f};
+	const auto s = vec(node["scale"], 3, 1.0f);
+
+	const auto translation = glm::translate(glm::mat4(1.0f), glm::vec3(t[0], t[1], t[2]));
+	const auto rotation = glm::mat4_cast(glm::quat(r[3], r[0], r[1], r[2]));
+	const auto scale = glm::scale(glm::mat4(1.0f), glm::vec3(s[0], s[1], s[2]));
+	return translation * rotation * scale;
+}
+
+} // namespace
+
+auto GltfAccessor::read_float(std::size_t element, float* out) const -> void
+{
+	const auto base = data.data() + element * stride;
+	for (auto c = 0u; c < components; c++) {
+		const auto at = base + c * component_size(component_type);
+		switch (component_type) {
+		case GltfComponentType::FLOAT:
+			memcpy(&out[c], at, sizeof(float));
+			break;
+		case GltfComponentType::UNSIGNED_BYTE: {
+			const auto value = static_cast<float>(static_cast<uint8_t>(*at));
+			out[c] = normalized ? value / 255.0f : value;
+			break;
+		}
+		case GltfComponentType::BYTE: {
+			const auto value = static_cast<float>(static_cast<int8_t>(*at));
+			out[c] = normalized ? std::max(value / 127.0f, -1.0f) : value;
+			break;
+		}
+		case GltfComponentType::UNSIGNED_SHORT: {
+			auto raw = uint16_t{0};
+			memcpy(&raw, at, sizeof(raw));
+			out[c] = normalized ? raw / 65535.0f : static_cast<float>(raw);
+			break;
+		}
+		case GltfComponentType::SHORT: {
+			auto raw = int16_t{0};
+			memcpy(&raw, at, sizeof(raw));
+			out[c] = normalized ? std::max(raw / 32767.0f, -1.0f) : static_cast<float>(raw);
+			break;
+		}
+		case GltfComponentType::UNSIGNED_INT: {
+			auto raw = uint32_t{0};
+			memcpy(&raw, at, sizeof(raw));
+			out[c] = normalized ? static_cast<float>(raw / 4294967295.0) : static_cast<float>(raw);
+			break;
+		}
+		}
+	}
+}
+
+auto GltfAccessor::read_index(std::size_t element) const -> uint32_t
+{
+	const auto at = data.data() + element * stride;
+	switch (component_type) {
+	case GltfComponentType::UNSIGNED_BYTE:
+		return static_cast<uint8_t>(*at);
+	case GltfComponentType::UNSIGNED_SHORT: {
+		auto value = uint16_t{0};
+		memcpy(&value, at, sizeof(value));
+		return value;
+	}
+	case GltfComponentType::UNSIGNED_INT: {
+		auto value = uint32_t{0};
+		memcpy(&value, at, sizeof(value));
+		return value;
+	}
+	default:
+		return 0;
+	}
+}
+
+auto GltfAccessor::tightly_packed() const -> bool
+{
+	return stride == components * component_size(component_type);
+}
+
+auto read_glb(const std::filesystem::path& path) -> std::expected<GlbModel, std::string>
+{
+	auto model = GlbModel{};
+
+	auto file = read_asset_file(path);
+	if (!file.has_value()) {
+		return unexpected(file.error());
+	}
+	model.file = std::move(*file);
+	const auto bytes = model.file.bytes();
+	const auto name = path.string();
+
+	// Header, then a JSON chunk and an optional binary chunk
+	if (bytes.size() < 20 || read_u32(bytes, 0) != GLB_MAGIC || read_u32(bytes, 4) != 2) {
+		return unexpected(name + " is not a glTF 2.0 binary");
+	}
+	const auto length = min<size_t>(read_u32(bytes, 8), bytes.size());
+	auto json_text = string_view{};
+	auto binary = span<const byte>{};
+	for (auto offset = size_t{12}; offset + 8 <= length;) {
+		const auto chunk_length = size_t{read_u32(bytes, offset)};
+		const auto chunk_type = read_u32(bytes, offset + 4);
+		offset += 8;
+		if (chunk_length > length - offset) {
+			return unexpected(name + " has a truncated chunk");
+		}
+		const auto chunk = bytes.subspan(offset, chunk_length);
+		if (chunk_type == GLB_CHUNK_JSON && json_text.empty()) {
+			json_text = {reinterpret_cast<const char*>(chunk.data()), chunk.size()};
+		}
+		else if (chunk_type == GLB_CHUNK_BIN && binary.empty()) {
+			binary = chunk;
+		}
+		// Chunks are padded to 4 bytes
+		offset += (chunk_length + 3) & ~size_t{3};
+	}
+
+	auto parsed = JsonParser{json_text}.parse();
+	if (!parsed.has_value()) {
+		return unexpected(name + ": " + parsed.error());
+	}
+	const auto& json = *parsed;
+
+	if (!json["extensionsRequired"].array().empty()) {
+		return unexpected(
+			name + " requires extension " + string(json["extensionsRequired"].array()[0].text()));
+	}
+
+	// Buffers: the binary chunk, or files beside this one
+	auto buffers = vector<span<const byte>>{};
+	for (const auto& buffer : json["buffers"].array()) {
+		const auto uri = buffer["uri"].text();
+		if (!buffer.has("uri")) {
+			buffers.push_back(binary);
+			continue;
+		}
+		if (uri.starts_with("data:")) {
+			return unexpected(name + " has a data: URI buffer");
+		}
+		auto external = read_asset_file(path.parent_path() / uri);
+		if (!external.has_value()) {
+			return unexpected(external.error());
+		}
+		buffers.push_back(external->bytes());
+		model.external_buffers.push_back(std::move(*external));
+	}
+
+	struct BufferView {
+		span<const byte> bytes;
+		size_t stride;
+	};
+	auto views = vector<BufferView>{};
+	for (const auto& view : json["bufferViews"].array()) {
+		const auto buffer = view["buffer"].index();
+		const auto offset = view.integer<size_t>("byteOffset", 0);
+		const auto size = view["byteLength"].integer<size_t>();
+		const auto stride = view.integer<size_t>("byteStride", 0);
+		if (!buffer.has_value() || !offset.has_value() || !size.has_value() ||
+			!stride.has_value()) {
+			return unexpected(name + " has a bufferView with an invalid number");
+		}
+		if (*buffer >= buffers.size() || *offset > buffers[*buffer].size() ||
+			*size > buffers[*buffer].size() - *offset) {
+			return unexpected(name + " has a bufferView outside its buffer");
+		}
+		views.push_back({buffers[*buffer].subspan(*offset, *size), *stride});
+	}
+
+	for (const auto& accessor : json["accessors"].array()) {
+		if (accessor.has("sparse")) {
+			return unexpected(name + " has sparse accessors");
+		}
+		const auto count = accessor["count"].integer<size_t>();
+		const auto component_type = accessor["componentType"].integer<uint32_t>();
+		const auto offset = accessor.integer<size_t>("byteOffset", 0);
+		if (!count.has_value() || !component_type.has_value() || !offset.has_value()) {
+			return unexpected(name + " has an accessor with an invalid number");
+		}
+
+		auto out = GltfAccessor{};
+		out.count = *count;
+		out.components = component_count(accessor["type"].text());
+		out.component_type = static_cast<GltfComponentType>(*component_type);
+		out.normalized = get_if<bool>(&accessor["normalized"].value) != nullptr &&
+						 get<bool>(accessor["normalized"].value);
+		const auto element_size = out.components * component_size(out.component_type);
+		if (element_size == 0) {
+			return unexpected(name + " has an accessor of unknown type");
+		}
+
+		const auto view = accessor["bufferView"].index();
+		if (!view.has_value() || *view >= views.size()) {
+			// All zeros per the spec; nothing the engine draws uses these
+			return unexpected(name + " has an accessor without a bufferView");
+		}
+		const auto& [view_bytes, view_stride] = views[*view];
+		out.stride = view_stride != 0 ? view_stride : element_size;
+
+		// Checked by division first, so the size can't wrap around
+		if (*offset > view_bytes.size() ||
+			(out.count > 0 && (element_size > view_bytes.size() - *offset ||
+							   out.count - 1 > (view_bytes.size() - *offset - element_size) /
+												   out.stride))) {
+			return unexpected(name + " has an accessor outside its bufferView");
+		}
+		const auto size = out.count == 0 ? 0 : out.stride * (out.count - 1) + element_size;
+		out.data = view_bytes.subspan(*offset, size);
+		model.accessors.push_back(out);
+	}
+
+	const auto accessor_index = [&](const JsonValue& value) -> optional<uint32_t> {
+		const auto index = value.index();
+		if (!index.has_value() || *index >= model.accessors.size()) {
+			return nullopt;
+		}
+		return index;
+	};
+
+	for (const auto& mesh : json["meshes"].array()) {
+		auto& out = model.meshes.emplace_back();
+		for (const auto& primitive : mesh["primitives"].array()) {
+			const auto& attributes = primitive["attributes"];
+			const auto mode = primitive.integer<uint32_t>("mode", GLTF_MODE_TRIANGLES);
+			if (!mode.has_value()) {
+				return unexpected(name + " has a primitive with an invalid mode");
+			}
+			out.primitives.push_back(
+				{accessor_index(attributes["POSITION"]),
+				 accessor_index(attributes["NORMAL"]),
+				 accessor_index(attributes["TEXCOORD_0"]),
+				 accessor_index(primitive["indices"]),
+				 primitive["material"].index(),
+				 *mode});
+		}
+	}
+
+	for (const auto& image : json["images"].array()) {
+		auto& out = model.images.emplace_back();
+		if (const auto view = image["bufferView"].index(); view.has_value()) {
+			if (*view >= views.size()) {
+				return unexpected(name + " has an image outside its buffers");
+			}
+			out.bytes = views[*view].bytes;
+		}
+		else if (image["uri"].text().starts_with("data:")) {
+			return unexpected(name + " has a data: URI image");
+		}
+		else {
+			out.uri = image["uri"].text();
+		}
+	}
+
+	const auto& textures = json["textures"].array();
+	for (const auto& material : json["materials"].array()) {
+		const auto& pbr = material["pbrMetallicRoughness"];
+		auto color = glm::vec4(1.0f);
+		const auto& factor = pbr["baseColorFactor"].array();
+		for (auto i = 0; i < std::min<int>(factor.size(), 4); i++) {
+			color[i] = static_cast<float>(factor[i].number());
+		}
+
+		auto image = optional<uint32_t>{};
+		if (const auto texture = pbr["baseColorTexture"]["index"].index();
+			texture.has_value() && *texture < textures.size()) {
+			image = textures[*texture]["source"].index();
+			if (image.has_value() && *image >= model.images.size()) {
+				image = nullopt;
+			}
+		}
+		model.materials.push_back({color, image});
+	}
+
+	const auto& nodes = json["nodes"].array();
+	for (const auto& node : nodes) {
+		auto& out = model.nodes.emplace_back();
+		out.transform = node_transform(node);
+		out.mesh = node["mesh"].index();
+		if (out.mesh.has_value() && *out.mesh >= model.meshes.size()) {
+			out.mesh = nullopt;
+		}
+		for (const auto& child : node["children"].array()) {
+			if (const auto index = child.index(); index.has_value() && *index < nodes.size()) {
+				out.children.push_back(*index);
+			}
+		}
+	}
+
+	// The default scene, else the first one, else every node nobody parents
+	const auto& scenes = json["scenes"].array();
+	const auto scene = json["scene"].index().value_or(0);
+	if (scene < scenes.size()) {
+		for (const auto& root : scenes[scene]["nodes"].array()) {
+			if (const auto index = root.index(); index.has_value() && *index < nodes.size()) {
+				model.roots.push_back(*index);
+			}
+		}
+	}
+	else {
+		auto parented = vector<bool>(nodes.size());
+		for (const auto& node : model.nodes) {
+			for (const auto child : node.children) {
+				parented[child] = true;
+			}
+		}
+		for (auto i = 0u; i < nodes.size(); i++) {
+			if (!parented[i]) {
+				model.roots.push_back(i);
+			}
+		}
+	}
+
+	return model;
+}
+
+} // namespace gengine
@@ -0,0 +1,115 @@
+/**
+ * @file gltf.h - reads binary glTF (.glb) files without copying their data.
+ *
+ * The JSON chunk is parsed into the few objects the engine uses; accessors and
+ * embedded images become spans into the file's binary chunk, which stays mapped for
+ * as long as the GlbModel lives.
+ *
+ * Unsupported features (sparse accessors, required extensions such as Draco, data:
+ * URIs) make read_glb fail, so callers can fall back to a general importer.
+ */
+
+#pragma once
+
+#include "mapped_file.h"
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace gengine {
+
+enum class GltfComponentType : uint32_t {
+	BYTE = 5120,
+	UNSIGNED_BYTE = 5121,
+	SHORT = 5122,
+	UNSIGNED_SHORT = 5123,
+	UNSIGNED_INT = 5125,
+	FLOAT = 5126,
+};
+
+/// glTF primitive mode for triangle lists, the only one the engine draws
+constexpr uint32_t GLTF_MODE_TRIANGLES = 4;
+
+/// A typed, strided view of one accessor's elements, pointing into the file
+struct GltfAccessor {
+	/// From the first byte of the first element to the last byte of the last
+	std::span<const std::byte> data;
+	/// Bytes from one element to the next
+	std::size_t stride;
+	std::size_t count;
+	/// 1 for SCALAR, 2 for VEC2, ...
+	uint32_t components;
+	GltfComponentType component_type;
+	/// Integers map to [0, 1] or [-1, 1] when read as floats
+	bool normalized;
+
+	/// Read one element into `components` floats
+	auto read_float(std::size_t element, float* out) const -> void;
+
+	/// Read one element of a SCALAR integer accessor
+	auto read_index(std::size_t element) const -> uint32_t;
+
+	/// Whether the elements are back to back, so `data` can be used as an array
+	auto tightly_packed() const -> bool;
+};
+
+/// Accessor indices of one primitive's attributes
+struct GltfPrimitive {
+	std::optional<uint32_t> position;
+	std::optional<uint32_t> normal;
+	std::optional<uint32_t> texcoord;
+	std::optional<uint32_t> indices;
+	std::optional<uint32_t> material;
+	uint32_t mode = GLTF_MODE_TRIANGLES;
+};
+
+struct GltfMesh {
+	std::vector<GltfPrimitive> primitives;
+};
+
+struct GltfNode {
+	/// Relative to the parent, from "matrix" or from "translation", "rotation" and "scale"
+	glm::mat4 transform;
+	std::optional<uint32_t> mesh;
+	std::vector<uint32_t> children;
+};
+
+struct GltfMaterial {
+	glm::vec4 base_color;
+	/// Index into GlbModel::images of the base color texture
+	std::optional<uint32_t> base_color_image;
+};
+
+/// Embedded images have `bytes`; the others have a `uri` relative to the file
+struct GltfImage {
+	std::span<const std::byte> bytes;
+	std::string uri;
+};
+
+struct GlbModel {
+	/// Keeps every span below alive
+	FileView file;
+	/// Buffers stored beside the .glb, if any
+	std::vector<FileView> external_buffers;
+
+	std::vector<GltfAccessor> accessors;
+	std::vector<GltfMesh> meshes;
+	std::vector<GltfNode> nodes;
+	std::vector<GltfMaterial> materials;
+	std::vector<GltfImage> images;
+	/// Root nodes of the default scene
+	std::vector<uint32_t> roots;
+};
+
+/// Parse a .glb file, leaving its binary data where it is
+auto read_glb(const std::filesystem::path& path) -> std::expected<GlbModel, std::string>;
+
+} // namespace gengine
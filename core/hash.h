@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string_view>
+
+namespace gengine {
+
+/**
+ * @brief 64-bit FNV-1a over 8-byte words, for content hashing of asset payloads.
+ *
+ * Not cryptographic.  Stable across runs and platforms of the same endianness,
+ * so hashes may be persisted in cache files.
+ */
+inline auto hash_bytes(std::span<const std::byte> bytes, uint64_t seed = 0xcbf29ce484222325ull)
+	-> uint64_t
+{
+	constexpr uint64_t prime = 0x100000001b3ull;
+
+	auto hash = seed;
+	std::size_t i = 0;
+	for (; i + 8 <= bytes.size(); i += 8) {
+		uint64_t word;
+		std::memcpy(&word, bytes.data() + i, sizeof(word));
+		hash = (hash ^ word) * prime;
+		hash ^= hash >> 29;
+	}
+	for (; i < bytes.size(); i++) {
+		hash = (hash ^ static_cast<uint64_t>(bytes[i])) * prime;
+	}
+	return hash;
+}
+
+inline auto hash_string(std::string_view text, uint64_t seed = 0xcbf29ce484222325ull) -> uint64_t
+{
+	return hash_bytes(std::as_bytes(std::span{text.data(), text.size()}), seed);
+}
+
+/// Mix a plain value (flags, versions) into an existing hash
+template <class Value> auto hash_combine(uint64_t hash, const Value& value) -> uint64_t
+{
+	return hash_bytes(std::as_bytes(std::span{&value, 1}), hash);
+}
+
+} // namespace gengine
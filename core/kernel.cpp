@@ -6,7 +6,9 @@
 #include <emscripten.h>
 #endif
 
+#include "asset_archive.h"
 #include "kernel.h"
+#include "vfs.h"
 #include "window.h"
 #include "world.h"
 
@@ -14,6 +16,7 @@
 
 #include <GLFW/glfw3.h>
 
+#include <filesystem>
 #include <iostream>
 #include <memory>
 
@@ -83,6 +86,13 @@ EngineKernel* kernel_create(bool editor_enabled)
 
 	// >> System startup
 
+	// Packed assets take precedence over loose files
+	if (filesystem::exists(DEFAULT_ARCHIVE_PATH)) {
+		if (const auto mounted = mount_archive(DEFAULT_ARCHIVE_PATH); !mounted.has_value()) {
+			cout << "Error: " << mounted.error() << endl;
+		}
+	}
+
 	kernel->renderer = gpu::RenderDevice::create(kernel->window);
 
 	kernel->world = World::create(kernel->window, kernel->renderer);
@@ -0,0 +1,70 @@
+#include "mapped_file.h"
+#include "config.h"
+
+#if GENGINE_PLATFORM_WINDOWS
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace gengine {
+
+auto MappedFile::open(const std::filesystem::path& path)
+	-> std::expected<std::shared_ptr<const MappedFile>, std::string>
+{
+	auto file = std::shared_ptr<MappedFile>(new MappedFile{});
+
+#if GENGINE_PLATFORM_WINDOWS
+	auto stream = std::ifstream(path, std::ios::binary | std::ios::ate);
+	if (!stream) {
+		return std::unexpected("Cannot open " + path.string());
+	}
+	file->fallback.resize(stream.tellg());
+	stream.seekg(0);
+	stream.read(reinterpret_cast<char*>(file->fallback.data()), file->fallback.size());
+	file->data = file->fallback.data();
+	file->size = file->fallback.size();
+#else
+	const int fd = ::open(path.c_str(), O_RDONLY);
+	if (fd < 0) {
+		return std::unexpected("Cannot open " + path.string());
+	}
+
+	struct stat info {};
+	if (fstat(fd, &info) != 0) {
+		close(fd);
+		return std::unexpected("Cannot stat " + path.string());
+	}
+
+	file->size = static_cast<std::size_t>(info.st_size);
+
+	// mmap rejects empty mappings, but an empty file is still a valid file
+	if (file->size > 0) {
+		void* mapping = mmap(nullptr, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapping == MAP_FAILED) {
+			close(fd);
+			return std::unexpected("Cannot map " + path.string());
+		}
+		file->data = static_cast<const std::byte*>(mapping);
+	}
+
+	// The mapping keeps its own reference to the file
+	close(fd);
+#endif
+
+	return file;
+}
+
+MappedFile::~MappedFile()
+{
+#if !GENGINE_PLATFORM_WINDOWS
+	if (data != nullptr) {
+		munmap(const_cast<std::byte*>(data), size);
+	}
+#endif
+}
+
+} // namespace gengine
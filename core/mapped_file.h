@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <expected>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gengine {
+
+/**
+ * @brief A read-only view of a whole file, mapped into memory.
+ *
+ * The bytes stay valid for as long as the MappedFile lives, so hand out
+ * a shared_ptr to anything which keeps spans into it.
+ */
+class MappedFile {
+public:
+	static auto open(const std::filesystem::path& path)
+		-> std::expected<std::shared_ptr<const MappedFile>, std::string>;
+
+	~MappedFile();
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	auto bytes() const -> std::span<const std::byte> { return {data, size}; }
+
+	auto text() const -> std::string_view
+	{
+		return {reinterpret_cast<const char*>(data), size};
+	}
+
+private:
+	MappedFile() = default;
+
+	const std::byte* data = nullptr;
+
+	std::size_t size = 0;
+
+	/// Platforms without mmap read the file into this buffer instead
+	std::vector<std::byte> fallback;
+};
+
+/**
+ * @brief A read-only view of a whole file, which stays valid for as long as the view lives.
+ *
+ * The bytes may be a mapped file, or a buffer the file was decompressed into.
+ */
+struct FileView {
+	/// Owns the memory behind `data`; null if the file couldn't be opened
+	std::shared_ptr<const void> storage;
+	std::span<const std::byte> data;
+
+	auto bytes() const -> std::span<const std::byte> { return data; }
+
+	auto text() const -> std::string_view
+	{
+		return {reinterpret_cast<const char*>(data.data()), data.size()};
+	}
+};
+
+} // namespace gengine
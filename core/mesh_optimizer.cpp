@@ -0,0 +1,360 @@
+#include "mesh_optimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <numeric>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+constexpr auto NO_TRIANGLE = numeric_limits<size_t>::max();
+
+// Forsyth's scoring constants, from "Linear-Speed Vertex Cache Optimisation"
+constexpr int FORSYTH_CACHE_SIZE = 32;
+constexpr float FORSYTH_CACHE_DECAY_POWER = 1.5f;
+constexpr float FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+constexpr float FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+constexpr float FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+auto forsyth_vertex_score(int cache_position, unsigned int remaining_triangles) -> float
+{
+	if (remaining_triangles == 0) {
+		return -1.0f;
+	}
+
+	auto score = 0.0f;
+	if (cache_position >= 0) {
+		if (cache_position < 3) {
+			// Vertices of the triangle just drawn score the same, whatever their order
+			score = FORSYTH_LAST_TRIANGLE_SCORE;
+		}
+		else {
+			const auto scale = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+			score = pow(1.0f - (cache_position - 3) * scale, FORSYTH_CACHE_DECAY_POWER);
+		}
+	}
+
+	// Favor vertices with few triangles left, so they leave the working set sooner
+	score += FORSYTH_VALENCE_BOOST_SCALE *
+			 pow(static_cast<float>(remaining_triangles), -FORSYTH_VALENCE_BOOST_POWER);
+
+	return score;
+}
+
+auto read_position(span<const byte> vertices, size_t stride, unsigned int vertex) -> glm::vec3
+{
+	auto position = glm::vec3{};
+	memcpy(&position, vertices.data() + vertex * stride, sizeof(position));
+	return position;
+}
+
+} // namespace
+
+auto analyze_vertex_cache(span<const unsigned int> indices, size_t vertex_count, size_t cache_size)
+	-> VertexCacheStats
+{
+	if (indices.empty() || vertex_count == 0) {
+		return {0.0f, 0.0f};
+	}
+
+	auto cache = deque<unsigned int>{};
+	auto misses = size_t{0};
+	for (const auto index : indices) {
+		if (find(cache.begin(), cache.end(), index) == cache.end()) {
+			misses++;
+			cache.push_back(index);
+			if (cache.size() > cache_size) {
+				cache.pop_front();
+			}
+		}
+	}
+
+	return {
+		static_cast<float>(misses) / static_cast<float>(indices.size() / 3),
+		static_cast<float>(misses) / static_cast<float>(vertex_count)};
+}
+
+auto weld_vertices(span<const byte> vertices, size_t stride, vector<unsigned int>& indices)
+	-> vector<byte>
+{
+	const auto vertex_count = stride == 0 ? 0 : vertices.size() / stride;
+
+	// Key each vertex by its bytes; the views point into the source buffer
+	auto unique = unordered_map<string_view, unsigned int>{};
+	unique.reserve(vertex_count);
+
+	auto remap = vector<unsigned int>(vertex_count);
+	auto welded = vector<byte>{};
+	welded.reserve(vertices.size());
+
+	for (auto vertex = size_t{0}; vertex < vertex_count; vertex++) {
+		const auto bytes = vertices.subspan(vertex * stride, stride);
+		const auto key = string_view{reinterpret_cast<const char*>(bytes.data()), stride};
+		const auto [it, inserted] =
+			unique.try_emplace(key, static_cast<unsigned int>(welded.size() / stride));
+		if (inserted) {
+			welded.insert(welded.end(), bytes.begin(), bytes.end());
+		}
+		remap[vertex] = it->second;
+	}
+
+	for (auto& index : indices) {
+		index = remap[index];
+	}
+
+	return welded;
+}
+
+auto optimize_vertex_cache(vector<unsigned int>& indices, size_t vertex_count) -> void
+{
+	const auto triangle_count = indices.size() / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+
+	// Vertex --> triangles which use it, packed into one array
+	auto remaining = vector<unsigned int>(vertex_count, 0);
+	for (const auto index : indices) {
+		remaining[index]++;
+	}
+	auto adjacency_offsets = vector<size_t>(vertex_count + 1, 0);
+	partial_sum(remaining.begin(), remaining.end(), adjacency_offsets.begin() + 1);
+	auto adjacency = vector<size_t>(indices.size());
+	{
+		auto fill = vector<size_t>(adjacency_offsets.begin(), adjacency_offsets.end() - 1);
+		for (auto triangle = size_t{0}; triangle < triangle_count; triangle++) {
+			for (auto corner = 0; corner < 3; corner++) {
+				adjacency[fill[indices[triangle * 3 + corner]]++] = triangle;
+			}
+		}
+	}
+
+	auto cache_position = vector<int>(vertex_count, -1);
+	auto vertex_scores = vector<float>(vertex_count);
+	for (auto vertex = size_t{0}; vertex < vertex_count; vertex++) {
+		vertex_scores[vertex] = forsyth_vertex_score(-1, remaining[vertex]);
+	}
+
+	auto emitted = vector<bool>(triangle_count, false);
+	auto triangle_scores = vector<float>(triangle_count);
+	auto best_triangle = NO_TRIANGLE;
+	auto best_score = -1.0f;
+	for (auto triangle = size_t{0}; triangle < triangle_count; triangle++) {
+		triangle_scores[triangle] = vertex_scores[indices[triangle * 3 + 0]] +
+									vertex_scores[indices[triangle * 3 + 1]] +
+									vertex_scores[indices[triangle * 3 + 2]];
+		if (triangle_scores[triangle] > best_score) {
+			best_score = triangle_scores[triangle];
+			best_triangle = triangle;
+		}
+	}
+
+	auto output = vector<unsigned int>{};
+	output.reserve(indices.size());
+	auto cache = vector<unsigned int>{};
+	auto next_cache = vector<unsigned int>{};
+	auto fallback_cursor = size_t{0};
+
+	while (output.size() < indices.size()) {
+		// Nothing in the cache touches a live triangle; take the next one in input order
+		if (best_triangle == NO_TRIANGLE) {
+			while (emitted[fallback_cursor]) {
+				fallback_cursor++;
+			}
+			best_triangle = fallback_cursor;
+		}
+
+		const auto* corners = &indices[best_triangle * 3];
+		emitted[best_triangle] = true;
+
+		// Emit the triangle and drop it from its vertices' adjacency
+		next_cache.assign(corners, corners + 3);
+		for (auto corner = 0; corner < 3; corner++) {
+			const auto vertex = corners[corner];
+			output.push_back(vertex);
+
+			const auto begin = adjacency.begin() + adjacency_offsets[vertex];
+			const auto end = begin + remaining[vertex];
+			iter_swap(find(begin, end, best_triangle), end - 1);
+			remaining[vertex]--;
+		}
+
+		// The new triangle's vertices go to the front of the cache; the rest shift back
+		for (const auto vertex : cache) {
+			if (vertex != corners[0] && vertex != corners[1] && vertex != corners[2]) {
+				next_cache.push_back(vertex);
+			}
+		}
+		for (auto i = size_t{0}; i < next_cache.size(); i++) {
+			cache_position[next_cache[i]] = i < FORSYTH_CACHE_SIZE ? static_cast<int>(i) : -1;
+		}
+		for (auto i = size_t{0}; i < next_cache.size(); i++) {
+			const auto vertex = next_cache[i];
+			vertex_scores[vertex] = forsyth_vertex_score(cache_position[vertex], remaining[vertex]);
+		}
+
+		// Rescore every live triangle touching the cache, and pick the best of them
+		best_triangle = NO_TRIANGLE;
+		best_score = -1.0f;
+		for (const auto vertex : next_cache) {
+			const auto begin = adjacency.begin() + adjacency_offsets[vertex];
+			for (auto it = begin; it != begin + remaining[vertex]; ++it) {
+				const auto triangle = *it;
+				triangle_scores[triangle] = vertex_scores[indices[triangle * 3 + 0]] +
+											vertex_scores[indices[triangle * 3 + 1]] +
+											vertex_scores[indices[triangle * 3 + 2]];
+				if (triangle_scores[triangle] > best_score) {
+					best_score = triangle_scores[triangle];
+					best_triangle = triangle;
+				}
+			}
+		}
+
+		if (next_cache.size() > FORSYTH_CACHE_SIZE) {
+			next_cache.resize(FORSYTH_CACHE_SIZE);
+		}
+		swap(cache, next_cache);
+	}
+
+	indices = std::move(output);
+}
+
+auto optimize_overdraw(vector<unsigned int>& indices, span<const byte> vertices, size_t stride)
+	-> void
+{
+	const auto triangle_count = indices.size() / 3;
+	if (triangle_count == 0) {
+		return;
+	}
+
+	// A cluster starts wherever a triangle misses the cache on all three vertices
+	constexpr auto cache_size = size_t{16};
+	auto cache = deque<unsigned int>{};
+	auto cluster_starts = vector<size_t>{};
+	for (auto triangle = size_t{0}; triangle < triangle_count; triangle++) {
+		auto misses = 0;
+		for (auto corner = 0; corner < 3; corner++) {
+			const auto vertex = indices[triangle * 3 + corner];
+			if (find(cache.begin(), cache.end(), vertex) == cache.end()) {
+				misses++;
+				cache.push_back(vertex);
+				if (cache.size() > cache_size) {
+					cache.pop_front();
+				}
+			}
+		}
+		if (triangle == 0 || misses == 3) {
+			cluster_starts.push_back(triangle);
+		}
+	}
+	cluster_starts.push_back(triangle_count);
+
+	// Area-weighted centroid and normal of every cluster, and of the whole mesh
+	const auto cluster_count = cluster_starts.size() - 1;
+	auto cluster_centroids = vector<glm::vec3>(cluster_count, glm::vec3{0.0f});
+	auto cluster_normals = vector<glm::vec3>(cluster_count, glm::vec3{0.0f});
+	auto mesh_centroid = glm::vec3{0.0f};
+	auto mesh_area = 0.0f;
+	for (auto cluster = size_t{0}; cluster < cluster_count; cluster++) {
+		auto cluster_area = 0.0f;
+		for (auto triangle = cluster_starts[cluster]; triangle < cluster_starts[cluster + 1];
+			 triangle++) {
+			const auto a = read_position(vertices, stride, indices[triangle * 3 + 0]);
+			const auto b = read_position(vertices, stride, indices[triangle * 3 + 1]);
+			const auto c = read_position(vertices, stride, indices[triangle * 3 + 2]);
+			const auto normal = glm::cross(b - a, c - a);
+			const auto area = glm::length(normal);
+			cluster_centroids[cluster] += (a + b + c) * (area / 3.0f);
+			cluster_normals[cluster] += normal;
+			cluster_area += area;
+		}
+		mesh_centroid += cluster_centroids[cluster];
+		mesh_area += cluster_area;
+		if (cluster_area > 0.0f) {
+			cluster_centroids[cluster] /= cluster_area;
+		}
+	}
+	if (mesh_area > 0.0f) {
+		mesh_centroid /= mesh_area;
+	}
+
+	// Clusters facing away from the middle of the mesh tend to occlude the others
+	auto occlusion = vector<float>(cluster_count, 0.0f);
+	for (auto cluster = size_t{0}; cluster < cluster_count; cluster++) {
+		const auto normal_length = glm::length(cluster_normals[cluster]);
+		if (normal_length > 0.0f) {
+			occlusion[cluster] = glm::dot(
+				cluster_centroids[cluster] - mesh_centroid, cluster_normals[cluster] / normal_length);
+		}
+	}
+
+	auto order = vector<size_t>(cluster_count);
+	iota(order.begin(), order.end(), 0);
+	stable_sort(order.begin(), order.end(), [&occlusion](size_t a, size_t b) {
+		return occlusion[a] > occlusion[b];
+	});
+
+	auto output = vector<unsigned int>{};
+	output.reserve(indices.size());
+	for (const auto cluster : order) {
+		output.insert(
+			output.end(),
+			indices.begin() + cluster_starts[cluster] * 3,
+			indices.begin() + cluster_starts[cluster + 1] * 3);
+	}
+
+	indices = std::move(output);
+}
+
+auto optimize_vertex_fetch(vector<byte>& vertices, size_t stride, vector<unsigned int>& indices)
+	-> void
+{
+	constexpr auto unused = numeric_limits<unsigned int>::max();
+
+	const auto vertex_count = stride == 0 ? 0 : vertices.size() / stride;
+	auto remap = vector<unsigned int>(vertex_count, unused);
+	auto fetched = vector<byte>{};
+	fetched.reserve(vertices.size());
+
+	for (auto& index : indices) {
+		if (remap[index] == unused) {
+			remap[index] = static_cast<unsigned int>(fetched.size() / stride);
+			fetched.insert(
+				fetched.end(),
+				vertices.begin() + index * stride,
+				vertices.begin() + (index + 1) * stride);
+		}
+		index = remap[index];
+	}
+
+	vertices = std::move(fetched);
+}
+
+auto optimize_geometry(const GeometryAsset& geometry) -> GeometryAsset
+{
+	const auto stride = geometry.vertex_stride();
+	if (stride == 0 || geometry.indices.empty()) {
+		return geometry;
+	}
+
+	auto indices = vector<unsigned int>(geometry.indices.begin(), geometry.indices.end());
+
+	auto vertices = weld_vertices(geometry.vertices, stride, indices);
+	optimize_vertex_cache(indices, vertices.size() / stride);
+	optimize_overdraw(indices, vertices, stride);
+	optimize_vertex_fetch(vertices, stride, indices);
+
+	return make_geometry_asset(geometry.layout, std::move(vertices), std::move(indices));
+}
+
+} // namespace gengine
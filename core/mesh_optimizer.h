@@ -0,0 +1,65 @@
+/**
+ * @file mesh_optimizer.h - reorders imported meshes so the GPU does less work drawing them.
+ *
+ * Every function works on an interleaved vertex buffer whose first attribute is the
+ * position (three floats), plus a triangle list of 32-bit indices.
+ */
+
+#pragma once
+
+#include "assets.h"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace gengine {
+
+/// How well an index buffer uses a simulated FIFO post-transform vertex cache
+struct VertexCacheStats {
+	/// Average cache miss ratio: vertex shader runs per triangle (0.5 at best, 3 at worst)
+	float acmr;
+	/// Average transform to vertex ratio: vertex shader runs per vertex (1 at best)
+	float atvr;
+};
+
+/// Simulate a FIFO vertex cache of `cache_size` entries over the triangle list
+auto analyze_vertex_cache(
+	std::span<const unsigned int> indices, std::size_t vertex_count, std::size_t cache_size = 16)
+	-> VertexCacheStats;
+
+/**
+ * @brief Merge vertices whose bytes are identical.
+ * @param indices rewritten to point at the welded vertices
+ * @return the welded vertex buffer
+ */
+auto weld_vertices(
+	std::span<const std::byte> vertices, std::size_t stride, std::vector<unsigned int>& indices)
+	-> std::vector<std::byte>;
+
+/// Reorder triangles for post-transform cache hits (Forsyth's linear-speed algorithm)
+auto optimize_vertex_cache(std::vector<unsigned int>& indices, std::size_t vertex_count) -> void;
+
+/**
+ * @brief Reorder clusters of triangles so that outward-facing ones are drawn first.
+ *
+ * Clusters split where the vertex cache runs cold, so the cache order found by
+ * optimize_vertex_cache is mostly kept.  Run it after optimize_vertex_cache.
+ */
+auto optimize_overdraw(
+	std::vector<unsigned int>& indices, std::span<const std::byte> vertices, std::size_t stride)
+	-> void;
+
+/**
+ * @brief Renumber vertices in the order the index buffer first uses them.
+ *
+ * Unreferenced vertices are dropped.  Run it last, since it keeps the triangle order.
+ */
+auto optimize_vertex_fetch(
+	std::vector<std::byte>& vertices, std::size_t stride, std::vector<unsigned int>& indices)
+	-> void;
+
+/// Weld, then reorder for the vertex cache, overdraw and vertex fetch, in that order
+auto optimize_geometry(const GeometryAsset& geometry) -> GeometryAsset;
+
+} // namespace gengine
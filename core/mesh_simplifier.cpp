@@ -0,0 +1,357 @@
+#include "mesh_simplifier.h"
+#include "mesh_optimizer.h"
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+/// Smallest cosine allowed between a triangle's normal before and after a collapse
+constexpr float MAX_NORMAL_FLIP = 0.2f;
+
+/// Keep a level only if it has at most this fraction of the previous level's indices
+constexpr float MIN_LOD_REDUCTION = 0.8f;
+
+/**
+ * Sum of squared distances to a set of planes, weighted by triangle area.
+ * Stored as the upper triangle of a symmetric 4x4 matrix.
+ */
+struct Quadric {
+	double a2 = 0, ab = 0, ac = 0, ad = 0;
+	double b2 = 0, bc = 0, bd = 0;
+	double c2 = 0, cd = 0;
+	double d2 = 0;
+	double weight = 0;
+
+	static auto from_plane(glm::vec3 normal, float distance, double weight) -> Quadric
+	{
+		const double a = normal.x, b = normal.y, c = normal.z, d = distance;
+		return {
+			a * a * weight,
+			a * b * weight,
+			a * c * weight,
+			a * d * weight,
+			b * b * weight,
+			b * c * weight,
+			b * d * weight,
+			c * c * weight,
+			c * d * weight,
+			d * d * weight,
+			weight};
+	}
+
+	auto operator+=(const Quadric& other) -> Quadric&
+	{
+		a2 += other.a2, ab += other.ab, ac += other.ac, ad += other.ad;
+		b2 += other.b2, bc += other.bc, bd += other.bd;
+		c2 += other.c2, cd += other.cd;
+		d2 += other.d2;
+		weight += other.weight;
+		return *this;
+	}
+
+	/// Average squared distance from `p` to the planes
+	auto error(glm::vec3 p) const -> double
+	{
+		if (weight == 0) {
+			return 0;
+		}
+		const double x = p.x, y = p.y, z = p.z;
+		const auto sum = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x + b2 * y * y +
+						 2 * bc * y * z + 2 * bd * y + c2 * z * z + 2 * cd * z + d2;
+		return max(sum / weight, 0.0);
+	}
+};
+
+struct Collapse {
+	unsigned int from;
+	unsigned int to;
+	double cost;
+};
+
+/// Triangles around each vertex, in compressed rows
+struct Adjacency {
+	vector<unsigned int> offsets;
+	vector<unsigned int> triangles;
+
+	Adjacency(span<const unsigned int> indices, size_t vertex_count) : offsets(vertex_count + 1)
+	{
+		for (const auto index : indices) {
+			offsets[index + 1]++;
+		}
+		for (auto v = size_t{0}; v < vertex_count; v++) {
+			offsets[v + 1] += offsets[v];
+		}
+		triangles.resize(indices.size());
+		auto fill = vector<unsigned int>(offsets.begin(), offsets.end() - 1);
+		for (auto i = size_t{0}; i < indices.size(); i++) {
+			triangles[fill[indices[i]]++] = static_cast<unsigned int>(i / 3);
+		}
+	}
+
+	auto of(unsigned int vertex) const -> span<const unsigned int>
+	{
+		return span{triangles}.subspan(offsets[vertex], offsets[vertex + 1] - offsets[vertex]);
+	}
+};
+
+/// Whether moving `from` onto `to` turns any remaining triangle around `from` over
+auto collapse_flips(
+	span<const unsigned int> indices,
+	const Adjacency& adjacency,
+	const vector<glm::vec3>& positions,
+	unsigned int from,
+	unsigned int to) -> bool
+{
+	for (const auto triangle : adjacency.of(from)) {
+		const auto corners = indices.subspan(triangle * 3, 3);
+		if (corners[0] == to || corners[1] == to || corners[2] == to) {
+			continue; // this one collapses away
+		}
+
+		glm::vec3 before[3];
+		glm::vec3 after[3];
+		for (auto k = 0; k < 3; k++) {
+			before[k] = positions[corners[k]];
+			after[k] = corners[k] == from ? positions[to] : before[k];
+		}
+
+		const auto normal_before = glm::cross(before[1] - before[0], before[2] - before[0]);
+		const auto normal_after = glm::cross(after[1] - after[0], after[2] - after[0]);
+		const auto length_product = glm::length(normal_before) * glm::length(normal_after);
+		if (length_product == 0.0f) {
+			continue;
+		}
+		if (glm::dot(normal_before, normal_after) < MAX_NORMAL_FLIP * length_product) {
+			return true;
+		}
+	}
+	return false;
+}
+
+} // namespace
+
+auto simplify_mesh(
+	span<const unsigned int> indices, span<const byte> vertices, size_t stride, float max_error)
+	-> SimplifiedMesh
+{
+	const auto vertex_count = stride == 0 ? 0 : vertices.size() / stride;
+
+	auto positions = vector<glm::vec3>(vertex_count);
+	for (auto v = size_t{0}; v < vertex_count; v++) {
+		memcpy(&positions[v], vertices.data() + v * stride, sizeof(glm::vec3));
+	}
+
+	// Seams: vertices sharing a position with another vertex
+	auto locked = vector<char>(vertex_count, false);
+	auto position_group = vector<unsigned int>(vertex_count);
+	{
+		auto groups = unordered_map<string_view, unsigned int>{};
+		groups.reserve(vertex_count);
+		auto group_size = vector<unsigned int>{};
+		for (auto v = size_t{0}; v < vertex_count; v++) {
+			const auto key =
+				string_view{reinterpret_cast<const char*>(&positions[v]), sizeof(glm::vec3)};
+			const auto [it, inserted] =
+				groups.try_emplace(key, static_cast<unsigned int>(group_size.size()));
+			if (inserted) {
+				group_size.push_back(0);
+			}
+			position_group[v] = it->second;
+			group_size[it->second]++;
+		}
+		for (auto v = size_t{0}; v < vertex_count; v++) {
+			locked[v] = group_size[position_group[v]] > 1;
+		}
+	}
+
+	// Borders: edges with a single triangle, counted by position so seams aren't borders
+	{
+		auto edge_uses = unordered_map<uint64_t, int>{};
+		edge_uses.reserve(indices.size());
+		const auto edge_key = [&](unsigned int a, unsigned int b) {
+			auto ga = uint64_t{position_group[a]};
+			auto gb = uint64_t{position_group[b]};
+			if (ga > gb) {
+				swap(ga, gb);
+			}
+			return (ga << 32) | gb;
+		};
+		for (auto i = size_t{0}; i + 2 < indices.size(); i += 3) {
+			for (auto k = 0; k < 3; k++) {
+				edge_uses[edge_key(indices[i + k], indices[i + (k + 1) % 3])]++;
+			}
+		}
+		for (auto i = size_t{0}; i + 2 < indices.size(); i += 3) {
+			for (auto k = 0; k < 3; k++) {
+				const auto a = indices[i + k];
+				const auto b = indices[i + (k + 1) % 3];
+				if (edge_uses[edge_key(a, b)] == 1) {
+					locked[a] = locked[b] = true;
+				}
+			}
+		}
+	}
+
+	// Each vertex starts with the planes of the triangles around it
+	auto quadrics = vector<Quadric>(vertex_count);
+	for (auto i = size_t{0}; i + 2 < indices.size(); i += 3) {
+		const auto p0 = positions[indices[i + 0]];
+		const auto p1 = positions[indices[i + 1]];
+		const auto p2 = positions[indices[i + 2]];
+		const auto normal = glm::cross(p1 - p0, p2 - p0);
+		const auto double_area = glm::length(normal);
+		if (double_area == 0.0f) {
+			continue;
+		}
+		const auto unit_normal = normal / double_area;
+		const auto plane =
+			Quadric::from_plane(unit_normal, -glm::dot(unit_normal, p0), double_area * 0.5);
+		for (auto k = 0; k < 3; k++) {
+			quadrics[indices[i + k]] += plane;
+		}
+	}
+
+	const auto max_cost = static_cast<double>(max_error) * max_error;
+	auto worst_cost = 0.0;
+
+	auto result = vector<unsigned int>(indices.begin(), indices.end());
+	auto remap = vector<unsigned int>(vertex_count);
+	auto touched = vector<char>(vertex_count);
+	auto candidates = vector<Collapse>{};
+
+	// Each pass collapses a set of independent edges, cheapest first
+	while (true) {
+		const auto adjacency = Adjacency(result, vertex_count);
+
+		candidates.clear();
+		for (auto from = 0u; from < vertex_count; from++) {
+			if (locked[from]) {
+				continue;
+			}
+			auto best = Collapse{from, from, max_cost};
+			for (const auto triangle : adjacency.of(from)) {
+				for (auto k = 0; k < 3; k++) {
+					const auto to = result[triangle * 3 + k];
+					if (to == from) {
+						continue;
+					}
+					auto merged = quadrics[from];
+					merged += quadrics[to];
+					const auto cost = merged.error(positions[to]);
+					if (cost <= best.cost &&
+						!collapse_flips(result, adjacency, positions, from, to)) {
+						best = {from, to, cost};
+					}
+				}
+			}
+			if (best.to != from) {
+				candidates.push_back(best);
+			}
+		}
+
+		sort(candidates.begin(), candidates.end(), [](const Collapse& a, const Collapse& b) {
+			return a.cost < b.cost;
+		});
+
+		for (auto v = 0u; v < vertex_count; v++) {
+			remap[v] = v;
+		}
+		fill(touched.begin(), touched.end(), false);
+
+		auto collapsed = size_t{0};
+		for (const auto& collapse : candidates) {
+			if (touched[collapse.from] || touched[collapse.to]) {
+				continue;
+			}
+			// The triangles around `from` change shape, so their vertices wait a pass
+			for (const auto triangle : adjacency.of(collapse.from)) {
+				for (auto k = 0; k < 3; k++) {
+					touched[result[triangle * 3 + k]] = true;
+				}
+			}
+			remap[collapse.from] = collapse.to;
+			quadrics[collapse.to] += quadrics[collapse.from];
+			worst_cost = max(worst_cost, collapse.cost);
+			collapsed++;
+		}
+
+		if (collapsed == 0) {
+			break;
+		}
+
+		// Rewrite the triangle list, dropping triangles that collapsed to a line
+		auto kept = size_t{0};
+		for (auto i = size_t{0}; i + 2 < result.size(); i += 3) {
+			const auto a = remap[result[i + 0]];
+			const auto b = remap[result[i + 1]];
+			const auto c = remap[result[i + 2]];
+			if (a == b || b == c || c == a) {
+				continue;
+			}
+			result[kept++] = a;
+			result[kept++] = b;
+			result[kept++] = c;
+		}
+		result.resize(kept);
+	}
+
+	return {std::move(result), static_cast<float>(sqrt(worst_cost))};
+}
+
+auto generate_lods(const GeometryAsset& geometry, span<const float> relative_errors)
+	-> GeometryAsset
+{
+	const auto stride = geometry.vertex_stride();
+	const auto base = geometry.lod_indices(0);
+	if (stride == 0 || base.empty() || relative_errors.empty()) {
+		return geometry;
+	}
+
+	const auto radius = geometry.bounding_sphere().radius;
+
+	auto indices = vector<unsigned int>(base.begin(), base.end());
+	auto lods = vector<GeometryLod>{{0, static_cast<uint32_t>(base.size()), 0.0f}};
+
+	// Every level is simplified from the full mesh, so errors don't compound
+	for (const auto relative_error : relative_errors) {
+		auto level = simplify_mesh(base, geometry.vertices, stride, relative_error * radius);
+		const auto& previous = lods.back();
+		if (level.indices.empty() ||
+			level.indices.size() > previous.index_count * MIN_LOD_REDUCTION) {
+			continue;
+		}
+
+		optimize_vertex_cache(level.indices, geometry.vertex_count());
+
+		lods.push_back(
+			{static_cast<uint32_t>(indices.size()),
+			 static_cast<uint32_t>(level.indices.size()),
+			 max(level.error, previous.error)});
+		indices.insert(indices.end(), level.indices.begin(), level.indices.end());
+	}
+
+	if (lods.size() == 1) {
+		return geometry;
+	}
+
+	// The vertices are shared with the source geometry, so keep its storage alive
+	struct Arrays {
+		shared_ptr<const void> vertices;
+		vector<unsigned int> indices;
+	};
+	const auto arrays = make_shared<const Arrays>(Arrays{geometry.storage, std::move(indices)});
+	return {geometry.layout, geometry.vertices, arrays->indices, arrays, std::move(lods)};
+}
+
+} // namespace gengine
@@ -0,0 +1,46 @@
+/**
+ * @file mesh_simplifier.h - builds coarser levels of detail for imported meshes.
+ *
+ * Simplification collapses edges in order of quadric error (Garland & Heckbert),
+ * always onto an existing vertex, so every level reuses the original vertex buffer
+ * and only needs its own index range.
+ */
+
+#pragma once
+
+#include "assets.h"
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+namespace gengine {
+
+struct SimplifiedMesh {
+	std::vector<unsigned int> indices;
+	/// Largest distance any collapse moved the surface, in model units
+	float error;
+};
+
+/**
+ * @brief Collapse edges until the next one would move the surface further than `max_error`.
+ *
+ * Vertices on open borders and on attribute seams (several vertices at one position)
+ * never move, so simplification can't tear the mesh apart.
+ */
+auto simplify_mesh(
+	std::span<const unsigned int> indices,
+	std::span<const std::byte> vertices,
+	std::size_t stride,
+	float max_error) -> SimplifiedMesh;
+
+/**
+ * @brief Append one level of detail per error target to a single-level geometry.
+ * @param relative_errors fractions of the bounding radius, coarsest last
+ *
+ * Levels that don't save at least a fifth of the previous level's triangles are skipped.
+ */
+auto generate_lods(const GeometryAsset& geometry, std::span<const float> relative_errors)
+	-> GeometryAsset;
+
+} // namespace gengine
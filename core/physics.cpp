@@ -12,13 +12,39 @@
 
 namespace gengine {
 struct Collidable {
-	std::unique_ptr<btTriangleMesh> mesh;
+	std::unique_ptr<btTriangleIndexVertexArray> mesh;
+	/// Owns the vertices and indices `mesh` reads from
+	std::shared_ptr<const void> geometry;
 	std::unique_ptr<btMotionState> motion_state;
 	std::unique_ptr<btCollisionShape> shape;
 	std::unique_ptr<btRigidBody> body;
 	glm::vec3 scale;
+	/// The shape `body` collides with when it isn't `shape`, from create_body
+	const CollisionShape* shared_shape;
 };
 
+struct CollisionShape {
+	std::unique_ptr<btTriangleIndexVertexArray> mesh;
+	/// Owns the vertices and indices `mesh` reads from
+	std::shared_ptr<const void> geometry;
+	std::unique_ptr<btCollisionShape> shape;
+	float rolling_friction;
+	/// 0 keeps bodies upright
+	float angular_factor;
+};
+
+/// The scale part of a model matrix
+static auto decompose_scale(const glm::mat4& model_matrix) -> glm::vec3
+{
+	auto scale = glm::vec3{};
+	auto rotation = glm::quat{};
+	auto translation = glm::vec3{};
+	auto skew = glm::vec3{};
+	auto perspective = glm::vec4{};
+	glm::decompose(model_matrix, scale, rotation, translation, skew, perspective);
+	return scale;
+}
+
 PhysicsEngine::PhysicsEngine()
 {
 	std::cout << "[info]\t Intitializing physics engine" << std::endl;
@@ -36,7 +62,12 @@ PhysicsEngine::PhysicsEngine()
 	dynamics_world->setGravity(btVector3(0, -9.8, 0));
 }
 
-PhysicsEngine::~PhysicsEngine() {}
+PhysicsEngine::~PhysicsEngine()
+{
+	for (const auto collidable : free_collidables) {
+		delete collidable;
+	}
+}
 
 auto PhysicsEngine::create_box(float mass, const glm::mat4& model_matrix) -> Collidable*
 {
@@ -161,50 +192,31 @@ auto PhysicsEngine::create_mesh(
 	auto perspective = glm::vec4{};
 	glm::decompose(model_matrix, scale, rotation, translation, skew, perspective);
 
-	// Convert our optimized (vertex, index) buffer into non-optimized (vertex) buffer
-
-	const auto& vertices = geometry.vertices;
-	const auto& indices = geometry.indices;
-
-	auto nonIndexedVertices = std::vector<float>();
-	for (int i = 0; i < indices.size(); i++) {
-		const auto idx = indices[i];
-		nonIndexedVertices.push_back(-vertices[idx * 3 + 0]);
-		nonIndexedVertices.push_back(vertices[idx * 3 + 1]);
-		nonIndexedVertices.push_back(vertices[idx * 3 + 2]);
-	}
-
-	std::cout << "[info]\t Collidable (" << vertices.size() << " vertices, "
-			  << nonIndexedVertices.size() << " non-indexed)" << std::endl;
+	// Collide with the full-detail mesh, reading the interleaved render vertices in place.
+	// Those have Y flipped at import; physics also wants X flipped, relative to the source,
+	// which the shape's scaling applies below.
+	const auto indices = geometry.lod_indices(0);
 
-	// Populate a triangle mesh using our non-optimized vertex buffer
+	auto indexed_mesh = btIndexedMesh{};
+	indexed_mesh.m_numTriangles = indices.size() / 3;
+	indexed_mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(indices.data());
+	indexed_mesh.m_triangleIndexStride = 3 * sizeof(unsigned int);
+	indexed_mesh.m_numVertices = geometry.vertex_count();
+	indexed_mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(geometry.vertices.data());
+	indexed_mesh.m_vertexStride = geometry.vertex_stride();
+	indexed_mesh.m_vertexType = PHY_FLOAT;
 
-	collidable->mesh = std::make_unique<btTriangleMesh>();
-	for (int i = 0; i < nonIndexedVertices.size(); i += 9) {
-		const auto v0 = btVector3(
-			nonIndexedVertices[i + 0], nonIndexedVertices[i + 1], nonIndexedVertices[i + 2]);
-		const auto v1 = btVector3(
-			nonIndexedVertices[i + 3], nonIndexedVertices[i + 4], nonIndexedVertices[i + 5]);
-		const auto v2 = btVector3(
-			nonIndexedVertices[i + 6], nonIndexedVertices[i + 7], nonIndexedVertices[i + 8]);
-		collidable->mesh->addTriangle(v0, v1, v2, true);
-	}
-
-	// // auto indexed_mesh = btIndexedMesh{};
-	// // indexed_mesh.m_numTriangles = indices.size() / 3;
-	// // indexed_mesh.m_numVertices = vertices.size() / 3;
-	// // indexed_mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(indices.data());
-	// // indexed_mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(vertices.data());
-	// // indexed_mesh.m_triangleIndexStride = 3 * sizeof(unsigned int);
-	// // indexed_mesh.m_vertexStride = 3 * sizeof(float);
-	// // indexed_mesh.m_vertexType = PHY_FLOAT;
+	collidable->geometry = geometry.storage;
+	collidable->mesh = std::make_unique<btTriangleIndexVertexArray>();
+	collidable->mesh->addIndexedMesh(indexed_mesh, PHY_INTEGER);
 
-	// collidable->mesh = new btTriangleIndexVertexArray();
-	// collidable->mesh->addIndexedMesh(indexed_mesh, PHY_INTEGER);
+	std::cout << "[info]\t Collidable (" << geometry.vertex_count() << " vertices, "
+			  << indices.size() << " indices)" << std::endl;
 
 	collidable->scale = scale;
 	collidable->shape = std::make_unique<btBvhTriangleMeshShape>(collidable->mesh.get(), true);
-	collidable->shape->setLocalScaling(btVector3(scale.x, scale.y, scale.z));
+	// Flipping both X and Y is a half turn, so triangle winding is unchanged
+	collidable->shape->setLocalScaling(btVector3(-scale.x, -scale.y, scale.z));
 
 	auto trans = btTransform{};
 	trans.setIdentity();
@@ -229,10 +241,113 @@ auto PhysicsEngine::create_mesh(
 	return collidable;
 }
 
+auto PhysicsEngine::create_sphere_shape(float radius) -> CollisionShape*
+{
+	auto shape = new CollisionShape{};
+	shape->shape = std::make_unique<btSphereShape>(radius);
+	shape->rolling_friction = 0.3f;
+	shape->angular_factor = 1.0f;
+	return shape;
+}
+
+auto PhysicsEngine::create_capsule_shape() -> CollisionShape*
+{
+	auto shape = new CollisionShape{};
+	shape->shape = std::make_unique<btCapsuleShape>(4.0, 1.7);
+	shape->rolling_friction = 0.0f;
+	shape->angular_factor = 0.0f;
+	return shape;
+}
+
+auto PhysicsEngine::create_mesh_shape(const GeometryAsset& geometry, const glm::vec3& scale)
+	-> CollisionShape*
+{
+	// As in create_mesh: read the render vertices in place, flipping X back by scaling
+	const auto indices = geometry.lod_indices(0);
+
+	auto indexed_mesh = btIndexedMesh{};
+	indexed_mesh.m_numTriangles = indices.size() / 3;
+	indexed_mesh.m_triangleIndexBase = reinterpret_cast<const unsigned char*>(indices.data());
+	indexed_mesh.m_triangleIndexStride = 3 * sizeof(unsigned int);
+	indexed_mesh.m_numVertices = geometry.vertex_count();
+	indexed_mesh.m_vertexBase = reinterpret_cast<const unsigned char*>(geometry.vertices.data());
+	indexed_mesh.m_vertexStride = geometry.vertex_stride();
+	indexed_mesh.m_vertexType = PHY_FLOAT;
+
+	auto shape = new CollisionShape{};
+	shape->geometry = geometry.storage;
+	shape->mesh = std::make_unique<btTriangleIndexVertexArray>();
+	shape->mesh->addIndexedMesh(indexed_mesh, PHY_INTEGER);
+
+	std::cout << "[info]\t Collision shape (" << geometry.vertex_count() << " vertices, "
+			  << indices.size() << " indices)" << std::endl;
+
+	shape->shape = std::make_unique<btBvhTriangleMeshShape>(shape->mesh.get(), true);
+	shape->shape->setLocalScaling(btVector3(-scale.x, -scale.y, scale.z));
+	shape->rolling_friction = 0.0f;
+	shape->angular_factor = 0.0f;
+	return shape;
+}
+
+auto PhysicsEngine::destroy_shape(CollisionShape* shape) -> void { delete shape; }
+
+auto PhysicsEngine::create_body(
+	const CollisionShape* shape, float mass, const glm::mat4& model_matrix) -> Collidable*
+{
+	auto trans = btTransform{};
+	trans.setFromOpenGLMatrix(glm::value_ptr(model_matrix));
+
+	auto inertia = btVector3(1, 1, 1);
+	if (mass != 0) {
+		shape->shape->calculateLocalInertia(mass, inertia);
+	}
+
+	auto collidable = static_cast<Collidable*>(nullptr);
+	if (free_collidables.empty()) {
+		collidable = new Collidable{};
+		collidable->motion_state = std::make_unique<btDefaultMotionState>(trans);
+		collidable->body = std::make_unique<btRigidBody>(
+			mass, collidable->motion_state.get(), shape->shape.get(), inertia);
+	}
+	else {
+		// Reset everything the last simulation left on the body
+		collidable = free_collidables.back();
+		free_collidables.pop_back();
+		collidable->motion_state->setWorldTransform(trans);
+		auto& body = *collidable->body;
+		body.setCollisionShape(shape->shape.get());
+		body.setMassProps(mass, inertia);
+		body.updateInertiaTensor();
+		body.setWorldTransform(trans);
+		body.setInterpolationWorldTransform(trans);
+		body.setLinearVelocity(btVector3(0, 0, 0));
+		body.setAngularVelocity(btVector3(0, 0, 0));
+		body.setInterpolationLinearVelocity(btVector3(0, 0, 0));
+		body.setInterpolationAngularVelocity(btVector3(0, 0, 0));
+		body.clearForces();
+		body.activate(true);
+	}
+
+	collidable->scale = decompose_scale(model_matrix);
+	collidable->shared_shape = shape;
+	collidable->body->setFriction(0.3);
+	collidable->body->setRollingFriction(shape->rolling_friction);
+	collidable->body->setSpinningFriction(shape->rolling_friction);
+	collidable->body->setAngularFactor(shape->angular_factor);
+
+	dynamics_world->addRigidBody(collidable->body.get());
+
+	return collidable;
+}
+
 auto PhysicsEngine::destroy_collidable(Collidable* collidable) -> void
 {
 	dynamics_world->removeRigidBody(collidable->body.get());
 
+	if (collidable->shared_shape != nullptr) {
+		free_collidables.push_back(collidable);
+		return;
+	}
 	delete collidable;
 }
 
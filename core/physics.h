@@ -15,6 +15,9 @@ namespace gengine {
 
 struct Collidable;
 
+/// A collision shape which any number of collidables can share
+struct CollisionShape;
+
 class PhysicsEngine {
 public:
 	PhysicsEngine();
@@ -26,6 +29,24 @@ public:
 	auto create_mesh(float mass, const GeometryAsset& geometry, const glm::mat4& model_matrix)
 		-> Collidable*;
 
+	/// Shapes for create_body; make one per kind of object and share it
+	auto create_sphere_shape(float radius) -> CollisionShape*;
+	auto create_capsule_shape() -> CollisionShape*;
+	auto create_mesh_shape(const GeometryAsset& geometry, const glm::vec3& scale)
+		-> CollisionShape*;
+
+	/// Destroy a shape which no collidable uses any more
+	auto destroy_shape(CollisionShape* shape) -> void;
+
+	/**
+	 * @brief A rigidbody of a shared shape.
+	 *
+	 * Collidables destroyed earlier are reused, so once as many have been destroyed as are
+	 * created this allocates nothing.
+	 */
+	auto create_body(const CollisionShape* shape, float mass, const glm::mat4& model_matrix)
+		-> Collidable*;
+
 	auto destroy_collidable(Collidable* collidable) -> void;
 
 	auto apply_force(Collidable* collidable, glm::vec3 force) -> void;
@@ -39,5 +60,8 @@ private:
 	std::unique_ptr<btDefaultCollisionConfiguration> collision_cfg;
 	std::unique_ptr<btBroadphaseInterface> broadphase;
 	std::unique_ptr<btDiscreteDynamicsWorld> dynamics_world;
+
+	/// Destroyed collidables of shared shapes, kept for create_body to reuse
+	std::vector<Collidable*> free_collidables;
 };
 } // namespace gengine
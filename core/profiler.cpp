@@ -0,0 +1,212 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_map>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+auto thread_number() -> uint32_t
+{
+	static auto next = atomic<uint32_t>{0};
+	thread_local const auto number = next++;
+	return number;
+}
+
+auto json_string(const string& text) -> string
+{
+	auto out = string{"\""};
+	for (const auto c : text) {
+		switch (c) {
+		case '"':
+			out += "\\\"";
+			break;
+		case '\\':
+			out += "\\\\";
+			break;
+		case '\n':
+			out += "\\n";
+			break;
+		case '\t':
+			out += "\\t";
+			break;
+		default:
+			if (static_cast<unsigned char>(c) < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				out += escaped;
+			}
+			else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+auto write_text(const filesystem::path& path, const string& text) -> expected<void, string>
+{
+	auto file = ofstream(path, ios::binary | ios::trunc);
+	if (!file.is_open()) {
+		return unexpected("Cannot write " + path.string());
+	}
+	file << text;
+	return {};
+}
+
+} // namespace
+
+Profiler::Profiler() : epoch{chrono::steady_clock::now()} {}
+
+auto Profiler::shared() -> Profiler&
+{
+	static auto profiler = Profiler{};
+	return profiler;
+}
+
+auto Profiler::now_us() const -> uint64_t
+{
+	const auto elapsed = chrono::steady_clock::now() - epoch;
+	return chrono::duration_cast<chrono::microseconds>(elapsed).count();
+}
+
+auto Profiler::record(ProfileEvent event) -> void
+{
+	lock_guard lock{mutex};
+	event_log.push_back(std::move(event));
+}
+
+auto Profiler::events() -> vector<ProfileEvent>
+{
+	lock_guard lock{mutex};
+	return event_log;
+}
+
+auto Profiler::assets() -> vector<AssetProfile>
+{
+	auto profiles = vector<AssetProfile>{};
+	auto spans = vector<pair<uint64_t, uint64_t>>{};
+	auto asset_index = unordered_map<string, size_t>{};
+
+	for (const auto& event : events()) {
+		const auto [it, added] = asset_index.try_emplace(event.asset, profiles.size());
+		if (added) {
+			profiles.push_back({event.asset, 0, {}});
+			spans.push_back({event.start_us, 0});
+		}
+		auto& profile = profiles[it->second];
+		auto& [first_start, last_end] = spans[it->second];
+		first_start = std::min(first_start, event.start_us);
+		last_end = std::max(last_end, event.start_us + event.duration_us);
+		profile.duration_us = last_end - first_start;
+
+		auto stage = std::find_if(profile.stages.begin(), profile.stages.end(), [&](auto& s) {
+			return s.stage == event.stage;
+		});
+		if (stage == profile.stages.end()) {
+			profile.stages.push_back({event.stage, 0, 0, 0});
+			stage = profile.stages.end() - 1;
+		}
+		stage->count++;
+		stage->duration_us += event.duration_us;
+		stage->bytes += event.bytes;
+	}
+
+	std::stable_sort(profiles.begin(), profiles.end(), [](const auto& a, const auto& b) {
+		return a.duration_us > b.duration_us;
+	});
+	return profiles;
+}
+
+auto Profiler::clear() -> void
+{
+	lock_guard lock{mutex};
+	event_log.clear();
+}
+
+auto Profiler::to_json() -> string
+{
+	auto out = ostringstream{};
+	out << "{\"assets\": [";
+	auto first_asset = true;
+	for (const auto& asset : assets()) {
+		out << (first_asset ? "\n" : ",\n") << "  {\"asset\": " << json_string(asset.asset)
+			<< ", \"duration_us\": " << asset.duration_us << ", \"stages\": [";
+		auto first_stage = true;
+		for (const auto& stage : asset.stages) {
+			out << (first_stage ? "" : ", ") << "{\"stage\": " << json_string(stage.stage)
+				<< ", \"count\": " << stage.count << ", \"duration_us\": " << stage.duration_us
+				<< ", \"bytes\": " << stage.bytes << "}";
+			first_stage = false;
+		}
+		out << "]}";
+		first_asset = false;
+	}
+	out << "\n]}\n";
+	return out.str();
+}
+
+auto Profiler::to_chrome_trace() -> string
+{
+	auto out = ostringstream{};
+	out << "{\"traceEvents\": [";
+	auto first = true;
+	for (const auto& event : events()) {
+		out << (first ? "\n" : ",\n") << "  {\"name\": " << json_string(event.stage)
+			<< ", \"cat\": \"import\", \"ph\": \"X\", \"ts\": " << event.start_us
+			<< ", \"dur\": " << event.duration_us << ", \"pid\": 0, \"tid\": " << event.thread
+			<< ", \"args\": {\"asset\": " << json_string(event.asset)
+			<< ", \"bytes\": " << event.bytes << "}}";
+		first = false;
+	}
+	out << "\n], \"displayTimeUnit\": \"ms\"}\n";
+	return out.str();
+}
+
+auto Profiler::write(const filesystem::path& directory) -> expected<void, string>
+{
+	auto error = error_code{};
+	filesystem::create_directories(directory, error);
+	if (error) {
+		return unexpected("Cannot create " + directory.string() + ": " + error.message());
+	}
+
+	const auto profile_path = directory / "import_profile.json";
+	const auto trace_path = directory / "import_trace.json";
+	if (auto written = write_text(profile_path, to_json()); !written.has_value()) {
+		return written;
+	}
+	if (auto written = write_text(trace_path, to_chrome_trace()); !written.has_value()) {
+		return written;
+	}
+
+	cout << "[info]\t Wrote " << profile_path.string() << " and " << trace_path.string() << endl;
+	return {};
+}
+
+ProfileScope::ProfileScope(std::string asset, std::string stage)
+	: asset{std::move(asset)}, stage{std::move(stage)}, start_us{Profiler::shared().now_us()}
+{
+}
+
+ProfileScope::~ProfileScope()
+{
+	auto& profiler = Profiler::shared();
+	profiler.record(
+		{std::move(asset),
+		 std::move(stage),
+		 start_us,
+		 profiler.now_us() - start_us,
+		 bytes,
+		 thread_number()});
+}
+
+} // namespace gengine
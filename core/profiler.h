@@ -0,0 +1,120 @@
+/**
+ * @file profiler.h - scoped timers and byte counters for asset import stages.
+ *
+ * Stages are coarse (one read, decode or upload at a time), so every scope is
+ * recorded.  The recording can be summarised per asset, or written out as JSON and
+ * as a Chrome trace (load it in chrome://tracing or ui.perfetto.dev).
+ */
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gengine {
+
+/// One stage of one asset, as it ran
+struct ProfileEvent {
+	/// Model path or image name
+	std::string asset;
+	/// e.g. "read", "decode", "upload"
+	std::string stage;
+	/// Microseconds since the profiler started
+	uint64_t start_us;
+	uint64_t duration_us;
+	/// Bytes the stage produced or consumed; zero when it doesn't apply
+	uint64_t bytes;
+	/// Small per-thread number, stable for the thread's lifetime
+	uint32_t thread;
+};
+
+/// Every run of one stage of one asset, added up
+struct StageProfile {
+	std::string stage;
+	std::size_t count;
+	uint64_t duration_us;
+	uint64_t bytes;
+};
+
+struct AssetProfile {
+	std::string asset;
+	/// From the start of its first stage to the end of its last
+	uint64_t duration_us;
+	/// In the order the stages first ran
+	std::vector<StageProfile> stages;
+};
+
+/**
+ * @brief Collects ProfileEvents from every thread.
+ * @note Thread-safe.
+ */
+class Profiler {
+public:
+	Profiler();
+
+	/// The process-wide profiler used by asset loading
+	static auto shared() -> Profiler&;
+
+	/// Microseconds since the profiler started
+	auto now_us() const -> uint64_t;
+
+	auto record(ProfileEvent event) -> void;
+
+	auto events() -> std::vector<ProfileEvent>;
+
+	/// Events grouped by asset, slowest asset first
+	auto assets() -> std::vector<AssetProfile>;
+
+	auto clear() -> void;
+
+	/// `{"assets": [...]}` holding assets()
+	auto to_json() -> std::string;
+
+	/// Chrome's Trace Event Format, one complete ("X") event per ProfileEvent
+	auto to_chrome_trace() -> std::string;
+
+	/// Write "import_profile.json" and "import_trace.json" into a directory
+	auto write(const std::filesystem::path& directory) -> std::expected<void, std::string>;
+
+private:
+	std::chrono::steady_clock::time_point epoch;
+
+	std::vector<ProfileEvent> event_log;
+
+	/// Guards event_log
+	std::mutex mutex;
+};
+
+/**
+ * @brief Times one stage of one asset, from construction to destruction.
+ *
+ * @code
+ * auto scope = ProfileScope{path, "decode"};
+ * ...
+ * scope.add_bytes(size);
+ * @endcode
+ */
+class ProfileScope {
+public:
+	ProfileScope(std::string asset, std::string stage);
+	~ProfileScope();
+
+	ProfileScope(const ProfileScope&) = delete;
+	ProfileScope& operator=(const ProfileScope&) = delete;
+
+	auto add_bytes(uint64_t count) -> void { bytes += count; }
+
+private:
+	std::string asset;
+	std::string stage;
+	uint64_t start_us;
+	uint64_t bytes = 0;
+};
+
+} // namespace gengine
@@ -1,29 +1,81 @@
 #include "scene.h"
 #include "gpu.h"
 #include "physics.h"
-
+#include "profiler.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <expected>
+#include <filesystem>
+#include <future>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <memory>
+#include <span>
+#include <tuple>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 using namespace std;
 
-// Cache GPU images that we've seen before
-using GpuImageIndex = std::unordered_map<std::string, gpu::Image*>;
+/// Upload an image in whichever form it was loaded; baked images stream their levels
+static auto upload_image(
+	ResourceContainer& resources, gpu::RenderDevice* gpu, const gengine::ImageAsset& image)
+	-> gpu::Image*
+{
+	if (image.baked) {
+		return resources.texture_streamer.add(gpu, image.name, image.baked);
+	}
+	return gpu->create_image(image.name, image.width, image.height, image.format, image.data);
+}
+
+/**
+ * The GPU image holding this image's pixels, uploading them only if they're new.  The
+ * image's name becomes an alias of it, like a path for its content.
+ */
+static auto share_image(
+	ResourceContainer& resources,
+	gpu::RenderDevice* gpu,
+	const gengine::ImageAsset& image,
+	gengine::ProfileScope& scope) -> gpu::Image*
+{
+	// Identical images, under any name, share one upload
+	auto gpu_image = static_cast<gpu::Image*>(nullptr);
+	if (const auto it = resources.gpu_images_by_content.find(image.content_hash);
+		it != resources.gpu_images_by_content.end()) {
+		resources.deduplicated.images++;
+		resources.deduplicated.bytes += image.size_bytes;
+		gpu_image = it->second;
+	}
+	else {
+		gpu_image = upload_image(resources, gpu, image);
+		scope.add_bytes(image.size_bytes);
+		resources.gpu_images.insert(gpu_image);
+		resources.gpu_images_by_content[image.content_hash] = gpu_image;
+	}
+
+	// A name follows the pixels last loaded under it, e.g. after a reload
+	resources.gpu_images_by_name[image.name] = gpu_image;
+	return gpu_image;
+}
 
-/// TODO this shouldn't be void, make it return some information about WHERE in the Scene* this
-/// model's GPU resources have been placed, so that future objects which use that model can simply
-/// copy those regions from the Scene* and append them back into its self.
-static ResourceContainer make_game_object(
+/// Upload a model's GPU resources, returning its entry for the model registry
+static SceneModel make_game_object(
 	ResourceContainer& global_resources,
 	gpu::ShaderPipelineHandle pipeline,
 	gpu::RenderDevice* gpu,
 	gengine::TextureFactory* texture_factory,
-	GpuImageIndex& gpu_image_index,
 	const gengine::SceneAsset& model)
 {
-	cout << "Creating ResourceContainer for " << model.path << endl;
-	ResourceContainer local_resources;
+	cout << "Creating SceneModel for " << model.path << endl;
+	auto local_resources = SceneModel{.path = model.path};
+	auto scope = gengine::ProfileScope{model.path, "upload"};
 
 	/// For each material in this model...
 	for (const auto& material : model.materials) {
@@ -37,79 +89,344 @@ static ResourceContainer make_game_object(
 			texture_0 = *texture_factory->load_image_from_file("./data/Albedo.png");
 		}
 
-		// Create GPU image (if we haven't already)
-		if (!gpu_image_index.contains(texture_0.name)) {
-			const auto albedo = gpu->create_image(
-				texture_0.name,
-				texture_0.width,
-				texture_0.height,
-				texture_0.channel_count,
-				texture_0.data);
-			global_resources.gpu_images.insert(albedo);
-			gpu_image_index[texture_0.name] = albedo;
-		}
-		const auto albedo = gpu_image_index[texture_0.name];
+		// Create GPU image (if we haven't already, under any name)
+		const auto albedo = share_image(global_resources, gpu, texture_0, scope);
 
 		// Create descriptor
 		const auto descriptor_0 = gpu->create_descriptors(pipeline, albedo, material.color);
 
 		global_resources.gpu_descriptors.insert(descriptor_0);
-		local_resources.gpu_descriptors.insert(descriptor_0);
+		global_resources.descriptor_materials[descriptor_0] = {
+			texture_0.name, albedo, material.color};
+		local_resources.descriptors.push_back(descriptor_0);
 	}
 
 	/// Geometry --> Renderable
 	for (const auto& geometry : model.geometries) {
 
-		auto gpu_data = std::vector<float>{};
-		const auto& vertices = geometry.vertices;
-		const auto& vertices_aux = geometry.vertices_aux;
-		const auto& indices = geometry.indices;
-		for (int i = 0; i < vertices.size() / 3; i++) {
-			const auto v = (i * 3);
-			gpu_data.push_back(vertices[v + 0]);
-			gpu_data.push_back(-vertices[v + 1]);
-			gpu_data.push_back(vertices[v + 2]);
-			const auto a = (i * 5);
-			gpu_data.push_back(vertices_aux[a + 0]);
-			gpu_data.push_back(vertices_aux[a + 1]);
-			gpu_data.push_back(vertices_aux[a + 2]);
-			gpu_data.push_back(vertices_aux[a + 3]);
-			gpu_data.push_back(vertices_aux[a + 4]);
+		// Small meshes get 16-bit indices, which halves their index memory
+		const auto short_indices = geometry.vertex_count() <= std::numeric_limits<uint16_t>::max();
+
+		// Identical meshes, from this model or any other, share one upload
+		if (const auto it = global_resources.gpu_geometries_by_content.find(geometry.content_hash);
+			it != global_resources.gpu_geometries_by_content.end()) {
+			global_resources.deduplicated.geometries++;
+			global_resources.deduplicated.bytes +=
+				geometry.vertices.size() +
+				geometry.indices.size() * (short_indices ? sizeof(uint16_t) : sizeof(unsigned int));
+			// Meshes repeated within the model are drawn once, as before
+			if (ranges::find(local_resources.geometries, it->second) ==
+				local_resources.geometries.end()) {
+				local_resources.geometries.push_back(it->second);
+				local_resources.lods.push_back(global_resources.geometry_lods.at(it->second));
+			}
+			continue;
 		}
 
+		// Vertices are interleaved at import, so they're uploaded as-is
 		auto vbo = gpu->create_buffer(
-			gpu::BufferUsage::VERTEX, sizeof(float), gpu_data.size(), gpu_data.data());
-		auto ebo = gpu->create_buffer(
-			gpu::BufferUsage::INDEX, sizeof(unsigned int), indices.size(), indices.data());
+			gpu::BufferUsage::VERTEX,
+			geometry.vertex_stride(),
+			geometry.vertex_count(),
+			geometry.vertices.data());
+
+		auto ebo = gpu::BufferHandle{};
+		if (short_indices) {
+			const auto indices =
+				std::vector<uint16_t>(geometry.indices.begin(), geometry.indices.end());
+			ebo = gpu->create_buffer(
+				gpu::BufferUsage::INDEX, sizeof(uint16_t), indices.size(), indices.data());
+		}
+		else {
+			ebo = gpu->create_buffer(
+				gpu::BufferUsage::INDEX,
+				sizeof(unsigned int),
+				geometry.indices.size(),
+				geometry.indices.data());
+		}
 
 		const auto gpu_geometry = gpu->create_geometry(pipeline, vbo, ebo);
+		scope.add_bytes(
+			geometry.vertices.size() +
+			geometry.indices.size() * (short_indices ? sizeof(uint16_t) : sizeof(unsigned int)));
 		global_resources.gpu_geometries.insert(gpu_geometry);
-		local_resources.gpu_geometries.insert(gpu_geometry);
+		global_resources.gpu_geometries_by_content[geometry.content_hash] = gpu_geometry;
+		local_resources.geometries.push_back(gpu_geometry);
+
+		// Levels of detail share the buffers; the GPU only needs their index ranges
+		const auto bounds = geometry.bounding_sphere();
+		const auto box = geometry.bounding_box();
+		auto render_lod = RenderLod{bounds.center, bounds.radius, box.extents, 1, {}};
+		if (!geometry.lods.empty()) {
+			auto levels = std::vector<gpu::IndexRange>{};
+			for (const auto& lod : geometry.lods) {
+				if (levels.size() == MAX_LOD_LEVELS) {
+					break;
+				}
+				render_lod.errors[levels.size()] = lod.error;
+				levels.push_back({lod.first_index, lod.index_count});
+			}
+			render_lod.level_count = levels.size();
+			gpu->set_geometry_lods(gpu_geometry, levels);
+		}
+		global_resources.geometry_lods[gpu_geometry] = render_lod;
+		local_resources.lods.push_back(render_lod);
 	}
 
 	// Game objects
+	local_resources.nodes = model.nodes;
+	for (const auto& object : model.objects) {
+		local_resources.object_transforms.push_back(object.transform);
+		local_resources.object_nodes.push_back(object.node);
+	}
 
-	cout << "ResourceContainer completed" << endl;
+	cout << "SceneModel completed" << endl;
 
 	return local_resources;
 }
 
-struct RigidBodySet {
-	std::vector<glm::mat4> transforms;
-	std::vector<gengine::Collidable*> rigidbodies;
+/// Give each object of a model its own collision shape, for all of its game objects to share
+static auto make_collision_shapes(
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const gengine::SceneAsset& model,
+	SceneModel& scene_model) -> void
+{
+	auto scope = gengine::ProfileScope{model.path, "rigidbody"};
+	for (const auto& object : model.objects) {
+		const auto& geometry = model.geometries[object.geometry];
+		scope.add_bytes(geometry.vertices.size_bytes() + geometry.indices.size_bytes());
+		const auto scale = glm::vec3(
+			glm::length(glm::vec3(object.transform[0])),
+			glm::length(glm::vec3(object.transform[1])),
+			glm::length(glm::vec3(object.transform[2])));
+		const auto shape = physics_engine->create_mesh_shape(geometry, scale);
+		resources.collision_shapes.insert(shape);
+		scene_model.object_shapes.push_back(shape);
+	}
+}
+
+/// A renderable's bounding box in world space
+static auto world_bounds(const RenderLod& lod, const glm::mat4& transform) -> gengine::BoundingBox
+{
+	// Each world axis reaches as far as the transformed model axes do along it
+	const auto center = glm::vec3(transform * glm::vec4(lod.center, 1.0f));
+	const auto extents = glm::abs(glm::vec3(transform[0])) * lod.extents.x +
+						 glm::abs(glm::vec3(transform[1])) * lod.extents.y +
+						 glm::abs(glm::vec3(transform[2])) * lod.extents.z;
+	return {center, extents};
+}
+
+/// The rigidbody of a game object which doesn't use its model's own
+struct PrimitiveBody {
+	const gengine::CollisionShape* shape;
+	float mass;
 };
 
-static RigidBodySet
-make_rigidbody_from_model(gengine::PhysicsEngine* physics_engine, const gengine::SceneAsset& model)
+/**
+ * Give a game object its nodes and bodies: one root node and body of a primitive shape,
+ * or a copy of the model's hierarchy with a static body per model object.
+ */
+static auto spawn_bodies(
+	Scene& scene,
+	gengine::PhysicsEngine* physics_engine,
+	SceneInstance& instance,
+	const PrimitiveBody* primitive) -> void
 {
-	RigidBodySet rbs;
-	for (const auto& object : model.objects) {
-		const auto& [t, geometry_idx, material_idx] = object;
-		rbs.transforms.push_back(t);
-		rbs.rigidbodies.push_back(
-			physics_engine->create_mesh(0.0f, model.geometries[geometry_idx], t));
+	const auto& model = *instance.model;
+	const auto& matrix = instance.placement;
+
+	if (primitive != nullptr) {
+		instance.first_node = scene.hierarchy.add_block(1);
+		instance.node_count = 1;
+		scene.hierarchy.set_node(instance.first_node, gengine::NO_PARENT, matrix);
+		const auto rigidbody =
+			physics_engine->create_body(primitive->shape, primitive->mass, matrix);
+		instance.bodies.push_back(scene.entities.create(
+			Transform{matrix}, SceneNode{instance.first_node}, RigidBody{rigidbody}));
+		return;
+	}
+
+	// Each game object gets its own copy of the model's hierarchy
+	const auto first = scene.hierarchy.add_block(model.nodes.size());
+	instance.first_node = first;
+	instance.node_count = model.nodes.size();
+	for (auto i = uint32_t{0}; i < model.nodes.size(); i++) {
+		const auto& node = model.nodes[i];
+		if (node.parent == gengine::NO_PARENT) {
+			scene.hierarchy.set_node(first + i, gengine::NO_PARENT, matrix * node.transform);
+		}
+		else {
+			scene.hierarchy.set_node(first + i, first + node.parent, node.transform);
+		}
+	}
+
+	for (auto i = size_t{0}; i < model.object_shapes.size(); i++) {
+		const auto transform = matrix * model.object_transforms[i];
+		const auto rigidbody = physics_engine->create_body(model.object_shapes[i], 0.0f, transform);
+		instance.bodies.push_back(scene.entities.create(
+			Transform{transform}, SceneNode{first + model.object_nodes[i]}, RigidBody{rigidbody}));
+	}
+}
+
+/**
+ * Spawn an entity for each geometry of a game object's model.  Renderable k follows
+ * body k, or the root body when the model has more geometries than rigidbodies.
+ */
+static auto spawn_renderables(Scene& scene, SceneInstance& instance) -> void
+{
+	const auto& model = *instance.model;
+	if (model.descriptors.empty() || instance.bodies.empty()) {
+		return;
+	}
+
+	for (auto k = size_t{0}; k < model.geometries.size(); k++) {
+		const auto body = instance.bodies[k < instance.bodies.size() ? k : 0];
+		const auto transform = *scene.entities.get<Transform>(body);
+		const auto node = *scene.entities.get<SceneNode>(body);
+		const auto material = model.descriptors[min(k, model.descriptors.size() - 1)];
+		const auto renderable = Renderable{model.geometries[k], material, 0};
+		const auto& lod = model.lods[k];
+		const auto bounds = world_bounds(lod, transform.matrix);
+		const auto entity = scene.entities.create(
+			transform, node, renderable, lod, bounds, SpatialProxy{gengine::NO_PROXY});
+		const auto proxy = scene.spatial_index.insert(entity, bounds);
+		scene.entities.get<SpatialProxy>(entity)->proxy = proxy;
+		instance.renderables.push_back(entity);
 	}
-	return rbs;
+}
+
+/// Destroy a game object's renderables and take them out of the spatial index
+static auto despawn_renderables(Scene& scene, SceneInstance& instance) -> void
+{
+	for (const auto entity : instance.renderables) {
+		scene.spatial_index.remove(scene.entities.get<SpatialProxy>(entity)->proxy);
+		scene.entities.destroy(entity);
+	}
+	instance.renderables.clear();
+}
+
+/// Destroy a game object's entities, rigidbodies and nodes, keeping its slot
+static auto despawn_entities(
+	Scene& scene, gengine::PhysicsEngine* physics_engine, SceneInstance& instance) -> void
+{
+	despawn_renderables(scene, instance);
+	for (const auto entity : instance.bodies) {
+		physics_engine->destroy_collidable(scene.entities.get<RigidBody>(entity)->collidable);
+		scene.entities.destroy(entity);
+	}
+	instance.bodies.clear();
+	scene.hierarchy.release_block(instance.first_node, instance.node_count);
+}
+
+static auto spawn_object(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix,
+	const PrimitiveBody* primitive) -> std::expected<SceneObject, std::string>
+{
+	const auto model = resources.models.find(model_path);
+	if (model == resources.models.end()) {
+		return std::unexpected("no model " + model_path + " in the registry");
+	}
+	if (primitive == nullptr && model->second.object_shapes.empty()) {
+		return std::unexpected(model_path + " was not imported with make_rigidbody");
+	}
+
+	auto slot = uint32_t{0};
+	if (!scene.free_instances.empty()) {
+		slot = scene.free_instances.back();
+		scene.free_instances.pop_back();
+	}
+	else {
+		slot = static_cast<uint32_t>(scene.instances.size());
+		scene.instances.push_back({});
+	}
+
+	// A reused slot keeps its vectors' capacity
+	auto& instance = scene.instances[slot];
+	instance.model = &model->second;
+	instance.placement = matrix;
+	instance.model_rigidbodies = primitive == nullptr;
+	instance.alive = true;
+	spawn_bodies(scene, physics_engine, instance, primitive);
+	spawn_renderables(scene, instance);
+	return SceneObject{slot, instance.generation};
+}
+
+static auto import_settings(const VisualModelSettings& settings) -> gengine::ModelImportSettings
+{
+	return {
+		.flip_uvs = settings.flip_uvs,
+		.flip_winding_order = settings.flip_triangle_winding,
+		.optimize_meshes = settings.optimize_meshes,
+		.lod_errors = settings.lod_errors};
+}
+
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix,
+	const TactileSphere& sphere) -> std::expected<SceneObject, std::string>
+{
+	// Sized like create_sphere: the radius is scaled by the matrix's mean axis scale
+	const auto scale = (glm::length(glm::vec3(matrix[0])) + glm::length(glm::vec3(matrix[1])) +
+						glm::length(glm::vec3(matrix[2]))) /
+					   3.0f;
+	auto& shape = resources.sphere_shapes[sphere.radius * scale];
+	if (shape == nullptr) {
+		shape = physics_engine->create_sphere_shape(sphere.radius * scale);
+		resources.collision_shapes.insert(shape);
+	}
+	const auto body = PrimitiveBody{shape, sphere.mass};
+	return spawn_object(scene, resources, physics_engine, model_path, matrix, &body);
+}
+
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix,
+	const TactileCapsule& capsule) -> std::expected<SceneObject, std::string>
+{
+	if (resources.capsule_shape == nullptr) {
+		resources.capsule_shape = physics_engine->create_capsule_shape();
+		resources.collision_shapes.insert(resources.capsule_shape);
+	}
+	const auto body = PrimitiveBody{resources.capsule_shape, capsule.mass};
+	return spawn_object(scene, resources, physics_engine, model_path, matrix, &body);
+}
+
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix) -> std::expected<SceneObject, std::string>
+{
+	return spawn_object(scene, resources, physics_engine, model_path, matrix, nullptr);
+}
+
+auto despawn(Scene& scene, gengine::PhysicsEngine* physics_engine, SceneObject object) -> bool
+{
+	if (object.slot >= scene.instances.size()) {
+		return false;
+	}
+	auto& instance = scene.instances[object.slot];
+	if (!instance.alive || instance.generation != object.generation) {
+		return false;
+	}
+
+	despawn_entities(scene, physics_engine, instance);
+	instance.alive = false;
+	instance.generation++;
+	scene.free_instances.push_back(object.slot);
+	return true;
 }
 
 SceneBuilder::SceneBuilder() {}
@@ -167,120 +484,506 @@ unique_ptr<Scene> SceneBuilder::build(
 	/* Everything inside this function is horribly named. */
 	auto scene = make_unique<Scene>();
 
-	/// scene path --> Scene object
-	/// this bridges phase 1 and 2
-	unordered_map<string, ResourceContainer> asset_resource_lookup;
-
-	/// scene path --> (tranform[], rigidbody[])
-	/// this bridges phase 1 and 2
-	unordered_map<string, RigidBodySet> rigid_body_storage;
-
 	////
 	// Phase 1: process 3D assets
 	////
 
-	GpuImageIndex gpu_image_index;
+	// Load baked textures in the best format this GPU can sample
+	auto baked_formats = vector<gpu::TextureFormat>{};
+	for (const auto format :
+		 {gpu::TextureFormat::BC7,
+		  gpu::TextureFormat::BC1,
+		  gpu::TextureFormat::ETC2_RGB8,
+		  gpu::TextureFormat::RGBA8}) {
+		if (gpu->supports_texture_format(format)) {
+			baked_formats.push_back(format);
+		}
+	}
+	texture_factory->set_baked_formats(baked_formats);
 
-	// For each 3D model used in this scene...
+	auto& pool = gengine::ThreadPool::shared();
+	const auto import_start = chrono::steady_clock::now();
+
+	// Decode every 3D model used in this scene on the worker pool...
+	unordered_map<string, future<gengine::SceneAsset>> model_imports;
+	for (const auto& [model_path, model_settings] : model_settings_storage) {
+		model_imports[model_path] = pool.submit([texture_factory, model_path, model_settings]() {
+			return gengine::load_model(
+				*texture_factory, model_path, import_settings(model_settings));
+		});
+	}
+
+	// ...then create GPU & physics resources on this thread, which owns them.
 	for (const auto& [model_path, model_settings] : model_settings_storage) {
 
 		// Load this model
-		const auto model = gengine::load_model(
-			*texture_factory,
-			model_path,
-			model_settings.flip_uvs,
-			model_settings.flip_triangle_winding);
-
-		// Generate rigid bodies (if necessary)
-		bool make_rigidbody = model_settings_storage.at(model_path).make_rigidbody;
-		if (make_rigidbody) {
-			rigid_body_storage[model_path] = make_rigidbody_from_model(physics_engine, model);
-		}
+		const auto model = pool.wait(model_imports.at(model_path));
 
-		// Instantiate the Renderable Scene by creating GPU resources
-		asset_resource_lookup[model_path] =
-			make_game_object(resources, pipeline, gpu, texture_factory, gpu_image_index, model);
-		const ResourceContainer& asset_resources = asset_resource_lookup[model_path];
+		// Register it with its GPU resources, and collision shapes (if necessary)
+		auto scene_model = make_game_object(resources, pipeline, gpu, texture_factory, model);
+		if (model_settings.make_rigidbody) {
+			make_collision_shapes(resources, physics_engine, model, scene_model);
+		}
+		resources.models[model_path] = std::move(scene_model);
 	}
+	scene->model_settings = model_settings_storage;
+
+	const auto import_time = chrono::steady_clock::now() - import_start;
+	cout << "[info]\t Imported " << model_settings_storage.size() << " models in "
+		 << chrono::duration_cast<chrono::milliseconds>(import_time).count() << " ms ("
+		 << pool.thread_count() << " workers)" << endl;
+	cout << "[info]\t Deduplicated " << resources.deduplicated.geometries << " geometries and "
+		 << resources.deduplicated.images << " images ("
+		 << resources.deduplicated.bytes / 1024 << " KiB not uploaded)" << endl;
 
 	////
 	// Phase 2: use processed 3D assets to create game objects
 	////
 
-	// For each object we've queued,
+	// Spawn each object we've queued
 	for (const GameObject& game_object : game_objects) {
-
 		const auto& model_path = models[game_object.model_idx].path;
 
-		// If we haven't loaded this model from Assimp yet,
-		if (!asset_resource_lookup.contains(model_path)) {
-			cout << "Error: unrecognized scene path " << model_path << endl;
-			continue;
+		auto spawned = std::expected<SceneObject, std::string>{};
+		switch (game_object.shape_type) {
+		case TactileType::CAPSULE:
+			spawned = spawn(
+				*scene,
+				resources,
+				physics_engine,
+				model_path,
+				game_object.matrix,
+				capsule_shapes[game_object.shape_idx]);
+			break;
+		case TactileType::SPHERE:
+			spawned = spawn(
+				*scene,
+				resources,
+				physics_engine,
+				model_path,
+				game_object.matrix,
+				sphere_shapes[game_object.shape_idx]);
+			break;
+		case TactileType::MESH:
+			// The model's rigidbodies stay where the model puts them
+			spawned = spawn(*scene, resources, physics_engine, model_path, glm::mat4(1.0f));
+			break;
 		}
+		if (!spawned.has_value()) {
+			cout << "Error: " << spawned.error() << endl;
+		}
+	}
+
+	scene->hierarchy.update();
+
+	// CI runs set this to collect a per-asset import profile
+	if (const auto profile_directory = std::getenv("GENGINE_PROFILE_DIR")) {
+		if (const auto written = gengine::Profiler::shared().write(profile_directory);
+			!written.has_value()) {
+			cout << "Error: " << written.error() << endl;
+		}
+	}
+
+	return std::move(scene);
+}
 
-		// Get this renderable scene from the cache
-		const ResourceContainer& asset_resources =
-			asset_resource_lookup[models[game_object.model_idx].path];
-
-		///
-		// Inserting rigidbodies into the scene has two modes of action.
-		// (1) Generate them from a 3D model, which may produce multiple rigidbodies.
-		// (2) Create them from a shape primitive, which produces one rigidbody.
-		//
-		// Generate a rigidbody...
-		if (game_object.shape_type == TactileType::MESH) {
-
-			// Ensure this mesh has been previously processed into a rigidbody
-			if (!rigid_body_storage.contains(model_path)) {
-				cout << "Error: trying to use generated rigidbody from a model " << model_path
-					 << " which was not configured for rigidbody generation." << endl;
-				continue;
+auto update_transforms(Scene& scene, gengine::PhysicsEngine* physics_engine) -> void
+{
+	auto& hierarchy = scene.hierarchy;
+	scene.entities.each<RigidBody, SceneNode>(
+		[&](gengine::Entity, const RigidBody& body, const SceneNode& node) {
+			if (hierarchy.parent(node.node) != gengine::NO_PARENT) {
+				return;
 			}
-			// Grab the cached rigidbodies and append them hoes
-			// TODO: we should be making rigidbodies once-per- game entity (i.e. on site).
-			// TODO: rigid_body_storage should store shape info.
-			const auto& rigidbodies = rigid_body_storage.at(model_path);
-			for (const auto& transform : rigidbodies.transforms) {
-				scene->transforms.push_back(transform);
+			auto matrix = glm::mat4{};
+			physics_engine->get_model_matrix(body.collidable, matrix);
+			hierarchy.set_local(node.node, matrix);
+		});
+
+	hierarchy.update();
+
+	scene.entities.parallel_each<SceneNode, Transform>(
+		gengine::ThreadPool::shared(),
+		[&hierarchy](gengine::Entity, const SceneNode& node, Transform& transform) {
+			if (hierarchy.was_updated(node.node)) {
+				transform.matrix = hierarchy.world(node.node);
 			}
-			for (const auto& rigidbody : rigidbodies.rigidbodies) {
-				scene->collidables.push_back(rigidbody);
+		});
+
+	scene.entities.parallel_each<SceneNode, RenderLod, gengine::BoundingBox>(
+		gengine::ThreadPool::shared(),
+		[&hierarchy](
+			gengine::Entity,
+			const SceneNode& node,
+			const RenderLod& lod,
+			gengine::BoundingBox& bounds) {
+			if (hierarchy.was_updated(node.node)) {
+				bounds = world_bounds(lod, hierarchy.world(node.node));
 			}
-		}
-		// Else, create shape primitive...
-		else {
-			// Construct its rigid body using the physics engine
-			gengine::Collidable* rigidbody = nullptr;
-			switch (game_object.shape_type) {
-			case TactileType::CAPSULE: {
-				const auto details = capsule_shapes[game_object.shape_idx];
-				rigidbody = physics_engine->create_capsule(details.mass, game_object.matrix);
-				break;
+		});
+
+	// The tree takes one writer at a time, so its moves are gathered first
+	auto moves = vector<gengine::ProxyMove>{};
+	scene.entities.each<SceneNode, gengine::BoundingBox, SpatialProxy>(
+		[&](gengine::Entity,
+			const SceneNode& node,
+			const gengine::BoundingBox& bounds,
+			const SpatialProxy& proxy) {
+			if (hierarchy.was_updated(node.node)) {
+				moves.push_back({proxy.proxy, bounds});
 			}
-			case TactileType::SPHERE: {
-				const auto details = sphere_shapes[game_object.shape_idx];
-				rigidbody =
-					physics_engine->create_sphere(details.radius, details.mass, game_object.matrix);
-				break;
+		});
+	scene.spatial_index.move(moves);
+}
+
+/// A renderable's world-space scale and its distance from the camera to its bounds
+struct ViewDistance {
+	float scale;
+	float distance;
+};
+
+static auto
+view_distance(const RenderLod& lod, const glm::mat4& transform, const glm::vec3& camera_position)
+	-> ViewDistance
+{
+	// Largest axis scale of the transform, so errors & radii are in world units
+	const auto scale = std::sqrt(std::max(
+		{glm::dot(glm::vec3(transform[0]), glm::vec3(transform[0])),
+		 glm::dot(glm::vec3(transform[1]), glm::vec3(transform[1])),
+		 glm::dot(glm::vec3(transform[2]), glm::vec3(transform[2]))}));
+
+	const auto center = glm::vec3(transform * glm::vec4(lod.center, 1.0f));
+	const auto distance =
+		std::max(glm::length(center - camera_position) - lod.radius * scale, 1e-3f);
+	return {scale, distance};
+}
+
+auto select_lod_levels(
+	Scene& scene, const glm::vec3& camera_position, float projection_scale, float max_pixel_error)
+	-> void
+{
+	scene.entities.parallel_each<Transform, RenderLod, Renderable>(
+		gengine::ThreadPool::shared(),
+		[&](gengine::Entity,
+			const Transform& transform,
+			const RenderLod& lod,
+			Renderable& renderable) {
+			const auto [scale, distance] = view_distance(lod, transform.matrix, camera_position);
+
+			// Pixels covered by one model unit of error at this distance
+			const auto pixels_per_unit = projection_scale * scale / distance;
+
+			auto level = uint32_t{0};
+			for (auto candidate = lod.level_count; candidate-- > 1;) {
+				if (lod.errors[candidate] * pixels_per_unit <= max_pixel_error) {
+					level = candidate;
+					break;
+				}
 			}
-			default: {
-				std::cout << "Error: unknown tactile type for scene object" << std::endl;
-				assert(false);
+			renderable.lod_level = level;
+		});
+}
+
+/// What renderables must share to draw as one instanced batch
+using BatchKey = tuple<gpu::Descriptors*, uint64_t, uint32_t>;
+
+static auto batch_key(const Renderable& renderable) -> BatchKey
+{
+	return {
+		renderable.descriptors,
+		renderable.geometry.id,
+		std::min<uint32_t>(renderable.lod_level, MAX_LOD_LEVELS - 1)};
+}
+
+auto prepare_instances(Scene& scene, const glm::mat4& view_projection) -> void
+{
+	const auto frustum = gengine::make_frustum(view_projection);
+	scene.instance_batches.clear();
+	scene.visible.clear();
+	scene.culling = {};
+
+	// Cull each archetype's boxes into a compact list of visible rows, counting the
+	// instances of each batch on the way
+	auto rows = vector<uint32_t>{};
+	auto chunk_ends = vector<size_t>{};
+	auto slots = map<BatchKey, uint32_t>{};
+	scene.entities.each_chunk<Renderable, gengine::BoundingBox, Transform>(
+		[&](span<const gengine::Entity> entities,
+			span<Renderable> renderables,
+			span<gengine::BoundingBox> bounds,
+			span<Transform>) {
+			const auto first = rows.size();
+			rows.resize(first + entities.size());
+			const auto visible = gengine::cull_boxes(frustum, bounds, rows.data() + first);
+			rows.resize(first + visible);
+			chunk_ends.push_back(rows.size());
+			for (auto i = first; i < rows.size(); i++) {
+				slots[batch_key(renderables[rows[i]])]++;
+				scene.visible.push_back(entities[rows[i]]);
 			}
+			scene.culling.tested += entities.size();
+		});
+	scene.culling.visible = rows.size();
+	scene.culling.culled = scene.culling.tested - scene.culling.visible;
+
+	// Ordered by material, then mesh, then LOD, so neighbouring batches skip rebinding what
+	// they share
+	auto offset = uint32_t{0};
+	for (auto& [key, slot] : slots) {
+		const auto& [descriptors, geometry, level] = key;
+		const auto count = slot;
+		scene.instance_batches.push_back({{geometry}, descriptors, level, offset, count});
+		slot = offset;
+		offset += count;
+	}
+
+	// Running the same query again visits the same archetypes in the same order
+	scene.instance_transforms.resize(offset);
+	auto chunk = size_t{0};
+	auto row = size_t{0};
+	scene.entities.each_chunk<Renderable, gengine::BoundingBox, Transform>(
+		[&](span<const gengine::Entity>,
+			span<Renderable> renderables,
+			span<gengine::BoundingBox>,
+			span<Transform> transforms) {
+			for (; row < chunk_ends[chunk]; row++) {
+				const auto i = rows[row];
+				const auto slot = slots[batch_key(renderables[i])]++;
+				scene.instance_transforms[slot] = transforms[i].matrix;
 			}
-			scene->collidables.push_back(rigidbody);
-			scene->transforms.push_back(game_object.matrix);
+			chunk++;
+		});
+}
+
+auto stream_textures(
+	Scene& scene,
+	ResourceContainer& resources,
+	gpu::RenderDevice* gpu,
+	const glm::vec3& camera_position,
+	float projection_scale) -> void
+{
+	// Each image needs enough texels for the largest renderable drawn with it
+	auto screen_pixels = unordered_map<gpu::Image*, float>{};
+	scene.entities.each<Transform, RenderLod, Renderable>(
+		[&](gengine::Entity,
+			const Transform& transform,
+			const RenderLod& lod,
+			const Renderable& renderable) {
+			const auto material = resources.descriptor_materials.find(renderable.descriptors);
+			if (material == resources.descriptor_materials.end()) {
+				return;
+			}
+
+			const auto [scale, distance] = view_distance(lod, transform.matrix, camera_position);
+			const auto pixels = 2.0f * lod.radius * scale * projection_scale / distance;
+
+			auto& needed = screen_pixels[material->second.gpu_image];
+			needed = std::max(needed, pixels);
+		});
+
+	resources.texture_streamer.update(gpu, screen_pixels);
+}
+
+/// Destroy the images which no descriptor binds any more, and the names which lead to them
+static auto release_unbound_images(ResourceContainer& resources, gpu::RenderDevice* gpu) -> void
+{
+	auto bound = unordered_set<gpu::Image*>{};
+	for (const auto& [descriptor, material] : resources.descriptor_materials) {
+		bound.insert(material.gpu_image);
+	}
+
+	auto unbound = vector<gpu::Image*>{};
+	for (const auto image : resources.gpu_images) {
+		if (!bound.contains(image)) {
+			unbound.push_back(image);
 		}
+	}
+	for (const auto image : unbound) {
+		erase_if(resources.gpu_images_by_name, [&](const auto& entry) {
+			return entry.second == image;
+		});
+		erase_if(resources.gpu_images_by_content, [&](const auto& entry) {
+			return entry.second == image;
+		});
+		resources.gpu_images.erase(image);
+		resources.texture_streamer.remove(image);
+		gpu->destroy_image(image);
+	}
+}
+
+static auto reload_model(
+	Scene& scene,
+	ResourceContainer& resources,
+	const std::string& model_path,
+	gpu::ShaderPipelineHandle pipeline,
+	gpu::RenderDevice* gpu,
+	gengine::PhysicsEngine* physics_engine,
+	gengine::TextureFactory* texture_factory) -> void
+{
+	const auto reload_start = chrono::steady_clock::now();
+	const auto& settings = scene.model_settings.at(model_path);
+
+	// The file's contents are part of the scene cache key, so this is a fresh import; its
+	// embedded textures, "<path>#<index>", must be decoded afresh too
+	const auto normalized_path = filesystem::current_path() / model_path;
+	texture_factory->unload_images_with_prefix(normalized_path.string() + "#");
+	const auto model =
+		gengine::load_model(*texture_factory, model_path, import_settings(settings));
+	if (model.geometries.empty()) {
+		cout << "Error: " << model_path << " has no geometry, keeping the loaded version" << endl;
+		return;
+	}
 
-		// For render components and material descriptors, we can re-use whatever we created from
-		// the function `make_game_object`.
-		for (const auto& g : asset_resources.gpu_geometries) {
-			scene->render_components.push_back(g);
+	// Swap the registry entry in place: game objects point at it
+	auto& scene_model = resources.models.at(model_path);
+	const auto old_model = std::move(scene_model);
+	scene_model = make_game_object(resources, pipeline, gpu, texture_factory, model);
+	if (settings.make_rigidbody) {
+		make_collision_shapes(resources, physics_engine, model, scene_model);
+	}
+
+	// Respawn each game object's renderables, and its bodies if they came from the model
+	for (auto& instance : scene.instances) {
+		if (!instance.alive || instance.model != &scene_model) {
+			continue;
 		}
-		for (const auto& d : asset_resources.gpu_descriptors) {
-			scene->descriptors.push_back(d);
+
+		if (instance.model_rigidbodies) {
+			despawn_entities(scene, physics_engine, instance);
+			spawn_bodies(scene, physics_engine, instance, nullptr);
 		}
+		else {
+			despawn_renderables(scene, instance);
+		}
+		spawn_renderables(scene, instance);
 	}
 
-	return std::move(scene);
-}
\ No newline at end of file
+	// Nothing refers to the old version now, except geometries and images which are shared
+	// by content: with other models, or with the new version where they didn't change
+	for (const auto descriptor : old_model.descriptors) {
+		resources.gpu_descriptors.erase(descriptor);
+		resources.descriptor_materials.erase(descriptor);
+		gpu->destroy_descriptors(descriptor);
+	}
+	release_unbound_images(resources, gpu);
+	auto used_geometries = unordered_set<gpu::GeometryHandle>{};
+	for (const auto& [path, registered] : resources.models) {
+		used_geometries.insert(registered.geometries.begin(), registered.geometries.end());
+	}
+	for (const auto geometry : old_model.geometries) {
+		if (used_geometries.contains(geometry)) {
+			continue;
+		}
+		erase_if(resources.gpu_geometries_by_content, [&](const auto& entry) {
+			return entry.second == geometry;
+		});
+		resources.gpu_geometries.erase(geometry);
+		resources.geometry_lods.erase(geometry);
+		gpu->destroy_geometry(geometry);
+	}
+	for (const auto shape : old_model.object_shapes) {
+		resources.collision_shapes.erase(shape);
+		physics_engine->destroy_shape(shape);
+	}
+
+	const auto reload_time = chrono::steady_clock::now() - reload_start;
+	cout << "[info]\t Reloaded " << model_path << " in "
+		 << chrono::duration_cast<chrono::milliseconds>(reload_time).count() << " ms" << endl;
+}
+
+static auto reload_image(
+	Scene& scene,
+	ResourceContainer& resources,
+	const std::string& image_name,
+	gpu::ShaderPipelineHandle pipeline,
+	gpu::RenderDevice* gpu,
+	gengine::TextureFactory* texture_factory) -> void
+{
+	// Drop any decoded copy, under whichever path it was requested, so the file is read
+	// again; a baked sibling older than the edit is skipped
+	texture_factory->unload_image({.name = image_name});
+	const auto image = texture_factory->load_image_from_file(image_name);
+	if (!image.has_value()) {
+		cout << "Error: " << image.error() << ", keeping the loaded version" << endl;
+		return;
+	}
+
+	// Descriptors bind the image itself, so every material using it is remade
+	auto materials = vector<pair<gpu::Descriptors*, MaterialBinding>>{};
+	for (const auto& [descriptor, material] : resources.descriptor_materials) {
+		if (material.image == image_name) {
+			materials.emplace_back(descriptor, material);
+		}
+	}
+	for (const auto& [descriptor, material] : materials) {
+		resources.gpu_descriptors.erase(descriptor);
+		resources.descriptor_materials.erase(descriptor);
+		gpu->destroy_descriptors(descriptor);
+	}
+
+	auto scope = gengine::ProfileScope{image_name, "upload"};
+	const auto albedo = share_image(resources, gpu, *image, scope);
+	texture_factory->unload_image(*image);
+
+	auto replacements = unordered_map<gpu::Descriptors*, gpu::Descriptors*>{};
+	for (const auto& [old_descriptor, material] : materials) {
+		const auto descriptor = gpu->create_descriptors(pipeline, albedo, material.color);
+		resources.gpu_descriptors.insert(descriptor);
+		resources.descriptor_materials[descriptor] = {material.image, albedo, material.color};
+		replacements[old_descriptor] = descriptor;
+	}
+
+	scene.entities.each<Renderable>([&](gengine::Entity, Renderable& renderable) {
+		if (const auto it = replacements.find(renderable.descriptors); it != replacements.end()) {
+			renderable.descriptors = it->second;
+		}
+	});
+	for (auto& [path, model] : resources.models) {
+		for (auto& descriptor : model.descriptors) {
+			if (const auto it = replacements.find(descriptor); it != replacements.end()) {
+				descriptor = it->second;
+			}
+		}
+	}
+
+	// The old image stays only if other materials still bind it, e.g. by another name
+	release_unbound_images(resources, gpu);
+
+	cout << "[info]\t Reloaded " << image_name << " (" << materials.size() << " materials)"
+		 << endl;
+}
+
+auto reloadable_asset_paths(const Scene& scene, const ResourceContainer& resources)
+	-> std::vector<std::string>
+{
+	auto paths = std::vector<std::string>{};
+	for (const auto& [model_path, settings] : scene.model_settings) {
+		paths.push_back(model_path);
+	}
+	// Embedded images are named after their model and reload with it
+	for (const auto& [image_name, image] : resources.gpu_images_by_name) {
+		if (filesystem::is_regular_file(image_name)) {
+			paths.push_back(image_name);
+		}
+	}
+	return paths;
+}
+
+auto reload_assets(
+	Scene& scene,
+	ResourceContainer& resources,
+	std::span<const std::string> changed_paths,
+	gpu::ShaderPipelineHandle pipeline,
+	gpu::RenderDevice* gpu,
+	gengine::PhysicsEngine* physics_engine,
+	gengine::TextureFactory* texture_factory) -> void
+{
+	for (const auto& path : changed_paths) {
+		if (scene.model_settings.contains(path)) {
+			reload_model(scene, resources, path, pipeline, gpu, physics_engine, texture_factory);
+		}
+		else if (resources.gpu_images_by_name.contains(path)) {
+			reload_image(scene, resources, path, pipeline, gpu, texture_factory);
+		}
+	}
+}
@@ -1,10 +1,21 @@
 #pragma once
 
+#include "aabb_tree.h"
+#include "entity_store.h"
+#include "frustum_culling.h"
 #include "gpu.h"
 #include "physics.h"
+#include "texture_streaming.h"
+#include "transform_hierarchy.h"
 #include <glm/glm.hpp>
+#include <array>
+#include <cstdint>
+#include <expected>
 #include <memory>
+#include <span>
+#include <string>
 #include <vector>
+#include <unordered_map>
 #include <unordered_set>
 
 namespace std {
@@ -17,6 +28,54 @@ namespace std {
     };
 }
 
+/// Most levels of detail a renderable can choose between
+constexpr std::size_t MAX_LOD_LEVELS = 8;
+
+/// What LOD selection and culling need to know about one renderable
+struct RenderLod {
+	/// Bounding sphere in model space...
+	glm::vec3 center;
+	float radius;
+	/// ...and the half extents of the bounding box with the same center
+	glm::vec3 extents;
+	uint32_t level_count;
+	/// Error of each level in model units; level 0 is exact
+	std::array<float, MAX_LOD_LEVELS> errors;
+};
+
+/// What a material's descriptors were made from, so they can be made again
+struct MaterialBinding {
+	/// Key into ResourceContainer::gpu_images_by_name...
+	std::string image;
+	/// ...and the image the descriptors bind, which a reload may have moved the name off
+	gpu::Image* gpu_image;
+	glm::vec3 color;
+};
+
+/// Uploads skipped because an identical payload was already on the GPU
+struct DeduplicationStats {
+	std::size_t geometries;
+	std::size_t images;
+	/// Vertex, index and pixel bytes which weren't uploaded again
+	std::size_t bytes;
+};
+
+/// What every game object of one model shares, so spawning one creates no resources
+struct SceneModel {
+	std::string path;
+	/// One renderable per geometry, with its LOD selection data
+	std::vector<gpu::GeometryHandle> geometries;
+	std::vector<RenderLod> lods;
+	std::vector<gpu::Descriptors*> descriptors;
+	/// The node hierarchy, copied for each game object with the model's rigidbodies
+	std::vector<gengine::NodeAsset> nodes;
+	/// Each model object's transform and node...
+	std::vector<glm::mat4> object_transforms;
+	std::vector<uint32_t> object_nodes;
+	/// ...and collision shape, if the model was imported with make_rigidbody
+	std::vector<gengine::CollisionShape*> object_shapes;
+};
+
 struct ResourceContainer {
 
 	/**
@@ -25,25 +84,209 @@ struct ResourceContainer {
 	 */
 	template <class Resource> using ResourceSet = std::unordered_set<Resource>;
 
-	ResourceSet<gengine::Collidable*> rigidbodies;
+	ResourceSet<gengine::CollisionShape*> collision_shapes;
 	ResourceSet<gpu::Descriptors*> gpu_descriptors;
 	ResourceSet<gpu::GeometryHandle> gpu_geometries;
 	ResourceSet<gpu::Image*> gpu_images;
+
+	/// LOD selection data for each geometry in `gpu_geometries`
+	std::unordered_map<gpu::GeometryHandle, RenderLod> geometry_lods;
+
+	/// Aliases into `gpu_images_by_content`: the image last loaded under each asset name
+	std::unordered_map<std::string, gpu::Image*> gpu_images_by_name;
+
+	/// Content-addressed registry: one GPU image per ImageAsset::content_hash...
+	std::unordered_map<uint64_t, gpu::Image*> gpu_images_by_content;
+
+	/// ...and one GPU geometry per GeometryAsset::content_hash, across every model
+	std::unordered_map<uint64_t, gpu::GeometryHandle> gpu_geometries_by_content;
+
+	DeduplicationStats deduplicated{};
+
+	/// What each descriptor in `gpu_descriptors` binds
+	std::unordered_map<gpu::Descriptors*, MaterialBinding> descriptor_materials;
+
+	/// Streams the mip levels of baked images in `gpu_images`
+	gengine::TextureStreamer texture_streamer;
+
+	/// Model registry: every model the scene was built with, by path
+	std::unordered_map<std::string, SceneModel> models;
+
+	/// Shapes of primitive game objects, in `collision_shapes` too; spheres by radius
+	gengine::CollisionShape* capsule_shape = nullptr;
+	std::unordered_map<float, gengine::CollisionShape*> sphere_shapes;
+};
+
+/// Settings we apply while processing a 3D model file
+struct VisualModelSettings {
+	bool flip_uvs;
+	bool flip_triangle_winding;
+	bool make_rigidbody;
+	bool optimize_meshes = true;
+	/// See gengine::ModelImportSettings::lod_errors
+	std::vector<float> lod_errors = gengine::DEFAULT_LOD_ERRORS;
+};
+
+// Components of a Scene's entities
+
+/// World transform, mirrored from the entity's node
+struct Transform {
+	glm::mat4 matrix;
+};
+
+/// The entity's node in Scene::hierarchy
+struct SceneNode {
+	uint32_t node;
+};
+
+/// A rigidbody which moves the entity, if its node is a root
+struct RigidBody {
+	gengine::Collidable* collidable;
+};
+
+struct Renderable {
+	gpu::GeometryHandle geometry;
+	gpu::Descriptors* descriptors;
+	/// Level of detail to draw at, refreshed by select_lod_levels
+	uint32_t lod_level;
+};
+
+/// The renderable's world-space BoundingBox in Scene::spatial_index
+struct SpatialProxy {
+	uint32_t proxy;
+};
+
+/// Renderables tested against the view frustum by the last prepare_instances
+struct CullingStats {
+	std::size_t tested;
+	std::size_t visible;
+	std::size_t culled;
+};
+
+/// The entities one game object is made of
+struct SceneInstance {
+	/// Entry in ResourceContainer::models
+	const SceneModel* model;
+	/// Where the object was spawned
+	glm::mat4 placement;
+	/// Transform, SceneNode and RigidBody; the first is the object's root
+	std::vector<gengine::Entity> bodies;
+	/// Transform, SceneNode, Renderable, RenderLod, a world-space BoundingBox and its
+	/// SpatialProxy, following a body's node
+	std::vector<gengine::Entity> renderables;
+	/// The object's block of nodes in Scene::hierarchy
+	uint32_t first_node;
+	uint32_t node_count;
+	/// Whether the bodies are the model's rigidbodies, rather than a primitive shape
+	bool model_rigidbodies;
+	/// Bumped by despawn, so SceneObject handles to the slot's old object go stale
+	uint32_t generation;
+	bool alive;
+};
+
+/// A handle to a spawned game object
+struct SceneObject {
+	uint32_t slot;
+	uint32_t generation;
 };
 
 /**
  * @brief A container for everything we need to simulate and render a game scene.
  */
 struct Scene {
-	// The Scene implements an index-based entity system.
-	// Each entity in the scene has one slot in each of the below vectors.
-	// The resources in the vectors "belong" to the res_* equivalents below.
-	std::vector<glm::mat4> transforms{};
-	std::vector<gengine::Collidable*> collidables{};
-	std::vector<gpu::GeometryHandle> render_components{};
-	std::vector<gpu::Descriptors*> descriptors{};
+	/// Every game object's entities; the resources their components point at "belong"
+	/// to the ResourceContainer the scene was built with
+	gengine::EntityStore entities{};
+
+	/// This frame's draws and the model matrices they read, refreshed by prepare_instances
+	std::vector<gpu::InstanceBatch> instance_batches{};
+	std::vector<glm::mat4> instance_transforms{};
+
+	/// Renderables inside the view frustum this frame, refreshed by prepare_instances
+	std::vector<gengine::Entity> visible{};
+	CullingStats culling{};
+
+	/// Every renderable's world bounds, for picking and proximity queries; safe to query
+	/// from other threads
+	gengine::AabbTree spatial_index{};
+
+	/// Every node of every object, including model nodes without an entity
+	gengine::TransformHierarchy hierarchy{};
+
+	/// Every game object, by slot; build order first, then spawns in reused or new slots
+	std::vector<SceneInstance> instances{};
+	/// Slots of despawned objects, reused before new ones
+	std::vector<uint32_t> free_instances{};
+
+	/// How each model in the scene was imported, by path
+	std::unordered_map<std::string, VisualModelSettings> model_settings{};
 };
 
+/**
+ * @brief Move root entities to their rigidbodies, then refresh the Transform, world
+ *        bounds and spatial index entry of every entity whose node moved.
+ *
+ * Entities below another node follow their parents; their rigidbodies aren't read.
+ */
+auto update_transforms(Scene& scene, gengine::PhysicsEngine* physics_engine) -> void;
+
+/**
+ * @brief Pick the coarsest level of detail of each renderable whose error
+ *        covers at most `max_pixel_error` pixels on screen.
+ * @param projection_scale pixels per model unit at a distance of one unit:
+ *        viewport_height / (2 * tan(vertical_fov / 2))
+ */
+auto select_lod_levels(
+	Scene& scene,
+	const glm::vec3& camera_position,
+	float projection_scale,
+	float max_pixel_error = 1.0f) -> void;
+
+/**
+ * @brief Cull renderables outside the view frustum, then gather the visible ones' model
+ *        matrices into one instanced batch per geometry, descriptors and LOD.
+ * @param view_projection e.g. gpu::projection_matrix() * view
+ *
+ * Run after update_transforms and select_lod_levels, before RenderDevice::render.
+ */
+auto prepare_instances(Scene& scene, const glm::mat4& view_projection) -> void;
+
+/**
+ * @brief Stream in the mip levels each image needs for how large its renderables are on
+ *        screen, and drop those no longer needed.
+ * @param projection_scale as for select_lod_levels
+ */
+auto stream_textures(
+	Scene& scene,
+	ResourceContainer& resources,
+	gpu::RenderDevice* gpu,
+	const glm::vec3& camera_position,
+	float projection_scale) -> void;
+
+/**
+ * @brief Files the scene was built from which can change on disk: its models, and the
+ *        images their materials load from files.
+ */
+auto reloadable_asset_paths(const Scene& scene, const ResourceContainer& resources)
+	-> std::vector<std::string>;
+
+/**
+ * @brief Re-import changed models and images and patch them into a live scene.
+ * @param changed_paths as returned by reloadable_asset_paths; others are ignored
+ *
+ * Only the entities of game objects using a changed model are respawned, and only the
+ * descriptors bound to a changed image are remade. The replaced GPU resources, collision
+ * shapes and rigidbodies are destroyed. A file which fails to import keeps its old version.
+ */
+auto reload_assets(
+	Scene& scene,
+	ResourceContainer& resources,
+	std::span<const std::string> changed_paths,
+	gpu::ShaderPipelineHandle pipeline,
+	gpu::RenderDevice* gpu,
+	gengine::PhysicsEngine* physics_engine,
+	gengine::TextureFactory* texture_factory) -> void;
+
 /// Building block used for creating Capsule shapes.
 struct TactileCapsule {
 	float mass;
@@ -60,12 +303,40 @@ struct VisualModel {
 	std::string path;
 };
 
-/// Settings we apply while processing a 3D model file
-struct VisualModelSettings {
-	bool flip_uvs;
-	bool flip_triangle_winding;
-	bool make_rigidbody;
-};
+/**
+ * @brief Add a game object to a live scene, with a primitive rigidbody.
+ *
+ * The model must be in the registry, i.e. given to the SceneBuilder which built the scene
+ * (apply_model_settings is enough).  Its GPU resources and collision shapes are shared,
+ * and the object's entities, nodes and collidable reuse those of despawned objects, so
+ * once as many objects have been despawned as are spawned this allocates nothing.
+ */
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix,
+	const TactileSphere& sphere) -> std::expected<SceneObject, std::string>;
+
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix,
+	const TactileCapsule& capsule) -> std::expected<SceneObject, std::string>;
+
+/// Add a game object with the model's own static rigidbodies, placed by `matrix`
+auto spawn(
+	Scene& scene,
+	ResourceContainer& resources,
+	gengine::PhysicsEngine* physics_engine,
+	const std::string& model_path,
+	const glm::mat4& matrix) -> std::expected<SceneObject, std::string>;
+
+/// Remove a game object and destroy its rigidbodies; false if it was already gone
+auto despawn(Scene& scene, gengine::PhysicsEngine* physics_engine, SceneObject object) -> bool;
 
 /**
  * @brief \c SceneBuilder is an interface for describing and creating a \c Scene.
@@ -0,0 +1,401 @@
+#include "scene_cache.h"
+#include "hash.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "vfs.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <sstream>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+// On-disk layout.  Every offset is from the start of the file, and every
+// array is aligned to ALIGNMENT so the mapped bytes can be used in place.
+
+constexpr char MAGIC[4] = {'G', 'S', 'C', 'N'};
+
+constexpr size_t ALIGNMENT = 16;
+
+struct CacheRange {
+	uint64_t offset;
+	uint64_t count;
+};
+
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	CacheRange path;
+	CacheRange objects;
+	CacheRange geometries;
+	CacheRange materials;
+	CacheRange textures;
+	CacheRange nodes;
+};
+
+struct CacheObject {
+	float transform[16];
+	uint64_t geometry;
+	uint64_t material;
+	uint64_t node;
+};
+
+struct CacheNode {
+	float transform[16];
+	int64_t parent;
+};
+
+struct CacheGeometry {
+	/// gpu::VertexAttribute values, as uint32_t
+	CacheRange layout;
+	/// Interleaved vertex bytes
+	CacheRange vertices;
+	CacheRange indices;
+	/// GeometryLod ranges into `indices`
+	CacheRange lods;
+	uint64_t content_hash;
+};
+
+struct CacheMaterial {
+	float color[3];
+	uint32_t first_texture;
+	uint32_t texture_count;
+};
+
+struct CacheTexture {
+	CacheRange name;
+	CacheRange embedded;
+};
+
+/// Appends aligned arrays to a growing file image
+class CacheWriter {
+public:
+	template <class T> auto append(std::span<T> items) -> CacheRange
+	{
+		const auto offset = (bytes.size() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		bytes.resize(offset + items.size_bytes());
+		if (!items.empty()) {
+			memcpy(bytes.data() + offset, items.data(), items.size_bytes());
+		}
+		return {offset, items.size()};
+	}
+
+	auto append(string_view text) -> CacheRange { return append(span{text.data(), text.size()}); }
+
+	template <class T> auto overwrite(uint64_t offset, const T& item) -> void
+	{
+		memcpy(bytes.data() + offset, &item, sizeof(T));
+	}
+
+	std::vector<char> bytes;
+};
+
+/// Bounds-checked access to arrays inside a mapped cache file
+class CacheReader {
+public:
+	explicit CacheReader(span<const byte> bytes) : bytes{bytes} {}
+
+	template <class T> auto get(CacheRange range) const -> optional<span<const T>>
+	{
+		if (range.offset % alignof(T) != 0 || range.offset > bytes.size() ||
+			range.count > (bytes.size() - range.offset) / sizeof(T)) {
+			return nullopt;
+		}
+		return span{reinterpret_cast<const T*>(bytes.data() + range.offset), range.count};
+	}
+
+private:
+	span<const byte> bytes;
+};
+
+auto cache_directory() -> filesystem::path
+{
+	return filesystem::current_path() / ".gengine-cache";
+}
+
+auto cache_file_path(uint64_t key) -> filesystem::path
+{
+	auto name = stringstream{};
+	name << hex << key << ".scene";
+	return cache_directory() / name.str();
+}
+
+} // namespace
+
+auto scene_cache_key(
+	const filesystem::path& normalized_path,
+	uint32_t import_flags,
+	const ModelImportSettings& settings) -> optional<uint64_t>
+{
+	const auto file = read_asset_file(normalized_path);
+	if (!file.has_value()) {
+		return nullopt;
+	}
+
+	auto key = hash_string(normalized_path.lexically_normal().string());
+	key = hash_combine(key, import_flags);
+	key = hash_combine(key, settings.optimize_meshes);
+	for (const auto lod_error : settings.lod_errors) {
+		key = hash_combine(key, lod_error);
+	}
+	for (const auto attribute : settings.vertex_layout) {
+		key = hash_combine(key, static_cast<uint32_t>(attribute));
+	}
+	key = hash_combine(key, SCENE_CACHE_VERSION);
+	return hash_bytes(file->bytes(), key);
+}
+
+auto read_scene_cache(
+	TextureFactory& texture_factory, const filesystem::path& normalized_path, uint64_t key)
+	-> optional<SceneAsset>
+{
+	const auto cache_path = cache_file_path(key);
+	if (!filesystem::exists(cache_path)) {
+		return nullopt;
+	}
+
+	const auto file = MappedFile::open(cache_path);
+	if (!file.has_value()) {
+		return nullopt;
+	}
+	const auto mapping = *file;
+	const auto reader = CacheReader{mapping->bytes()};
+
+	const auto header = reader.get<CacheHeader>({0, 1});
+	if (!header.has_value() || memcmp((*header)[0].magic, MAGIC, sizeof(MAGIC)) != 0 ||
+		(*header)[0].version != SCENE_CACHE_VERSION || (*header)[0].key != key) {
+		cout << "[info]\t Stale scene cache " << cache_path << endl;
+		return nullopt;
+	}
+	const auto& info = (*header)[0];
+
+	const auto path = reader.get<char>(info.path);
+	const auto objects = reader.get<CacheObject>(info.objects);
+	const auto geometries = reader.get<CacheGeometry>(info.geometries);
+	const auto materials = reader.get<CacheMaterial>(info.materials);
+	const auto textures = reader.get<CacheTexture>(info.textures);
+	const auto nodes = reader.get<CacheNode>(info.nodes);
+	if (!path || !objects || !geometries || !materials || !textures || !nodes ||
+		string_view{path->data(), path->size()} != normalized_path.string()) {
+		cout << "Error: damaged scene cache " << cache_path << endl;
+		return nullopt;
+	}
+
+	auto assets = SceneAsset{};
+	assets.path = normalized_path;
+
+	for (const auto& node : *nodes) {
+		// Parents must come first, as in the importer's flat hierarchy
+		if (node.parent != NO_PARENT &&
+			(node.parent < 0 || static_cast<uint64_t>(node.parent) >= assets.nodes.size())) {
+			cout << "Error: damaged scene cache " << cache_path << endl;
+			return nullopt;
+		}
+		assets.nodes.push_back(
+			{glm::make_mat4(node.transform), static_cast<int32_t>(node.parent)});
+	}
+
+	for (const auto& object : *objects) {
+		if (object.geometry >= geometries->size() || object.material >= materials->size() ||
+			object.node >= assets.nodes.size()) {
+			cout << "Error: damaged scene cache " << cache_path << endl;
+			return nullopt;
+		}
+		assets.objects.push_back(
+			{glm::make_mat4(object.transform),
+			 object.geometry,
+			 object.material,
+			 static_cast<uint32_t>(object.node)});
+	}
+
+	// Geometry arrays are used in place; the spans keep the mapping alive.
+	for (const auto& geometry : *geometries) {
+		const auto layout = reader.get<uint32_t>(geometry.layout);
+		const auto vertices = reader.get<byte>(geometry.vertices);
+		const auto indices = reader.get<unsigned int>(geometry.indices);
+		const auto lods = reader.get<GeometryLod>(geometry.lods);
+		if (!layout || !vertices || !indices || !lods) {
+			cout << "Error: damaged scene cache " << cache_path << endl;
+			return nullopt;
+		}
+		auto geometry_asset = GeometryAsset{{}, *vertices, *indices, mapping};
+		geometry_asset.content_hash = geometry.content_hash;
+		for (const auto& lod : *lods) {
+			if (lod.first_index > indices->size() ||
+				lod.index_count > indices->size() - lod.first_index) {
+				cout << "Error: damaged scene cache " << cache_path << endl;
+				return nullopt;
+			}
+			geometry_asset.lods.push_back(lod);
+		}
+		for (const auto attribute : *layout) {
+			if (attribute > static_cast<uint32_t>(gpu::VertexAttribute::VEC2_HALF)) {
+				cout << "Error: damaged scene cache " << cache_path << endl;
+				return nullopt;
+			}
+			geometry_asset.layout.push_back(static_cast<gpu::VertexAttribute>(attribute));
+		}
+		assets.geometries.push_back(std::move(geometry_asset));
+	}
+
+	// Textures still go through the TextureFactory, which decodes them as one batch.
+	// Keep the order of the cache file, so material texture ranges index `images`.
+	auto& pool = ThreadPool::shared();
+	auto names = vector<string>{};
+	auto blobs = vector<ImageBlob>{};
+	auto is_embedded = vector<bool>{};
+	for (const auto& texture : *textures) {
+		const auto name = reader.get<char>(texture.name);
+		const auto embedded = reader.get<unsigned char>(texture.embedded);
+		if (!name || !embedded) {
+			cout << "Error: damaged scene cache " << cache_path << endl;
+			return nullopt;
+		}
+		is_embedded.push_back(!embedded->empty());
+		if (embedded->empty()) {
+			names.emplace_back(name->begin(), name->end());
+		}
+		else {
+			blobs.push_back({string(name->begin(), name->end()), *embedded});
+		}
+	}
+	const auto file_images = texture_factory.load_images_from_files(names);
+	const auto embedded_images = texture_factory.load_images_from_memory(blobs);
+
+	auto images = vector<TextureFactory::ImageFuture>{};
+	auto next_file = file_images.begin();
+	auto next_embedded = embedded_images.begin();
+	for (const auto embedded : is_embedded) {
+		images.push_back(embedded ? *next_embedded++ : *next_file++);
+	}
+
+	// Every decode must finish before returning, since the embedded bytes live in `mapping`
+	for (auto& image : images) {
+		pool.wait(image);
+	}
+
+	for (const auto& material : *materials) {
+		auto material_asset = MaterialAsset{{}, glm::make_vec3(material.color)};
+		for (auto i = 0u; i < material.texture_count; i++) {
+			const auto texture_idx = material.first_texture + i;
+			if (texture_idx >= images.size()) {
+				cout << "Error: damaged scene cache " << cache_path << endl;
+				return nullopt;
+			}
+			const auto image = pool.wait(images[texture_idx]);
+			if (image.has_value()) {
+				material_asset.textures.push_back(*image);
+			}
+			else {
+				cout << "Error: " << image.error() << endl;
+			}
+		}
+		assets.materials.push_back(material_asset);
+	}
+
+	cout << "[info]\t Scene cache hit " << cache_path << endl;
+
+	return assets;
+}
+
+auto write_scene_cache(
+	uint64_t key,
+	const SceneAsset& scene,
+	const vector<vector<TextureReference>>& material_textures) -> void
+{
+	auto writer = CacheWriter{};
+
+	// Reserve the header; it's filled in once every offset is known.
+	auto header = CacheHeader{};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = SCENE_CACHE_VERSION;
+	header.key = key;
+	writer.append(span{&header, 1});
+
+	header.path = writer.append(scene.path);
+
+	auto objects = vector<CacheObject>{};
+	for (const auto& object : scene.objects) {
+		auto cache_object = CacheObject{{}, object.geometry, object.material, object.node};
+		memcpy(cache_object.transform, glm::value_ptr(object.transform), sizeof(float) * 16);
+		objects.push_back(cache_object);
+	}
+	header.objects = writer.append(span<const CacheObject>{objects});
+
+	auto nodes = vector<CacheNode>{};
+	for (const auto& node : scene.nodes) {
+		auto cache_node = CacheNode{{}, node.parent};
+		memcpy(cache_node.transform, glm::value_ptr(node.transform), sizeof(float) * 16);
+		nodes.push_back(cache_node);
+	}
+	header.nodes = writer.append(span<const CacheNode>{nodes});
+
+	auto geometries = vector<CacheGeometry>{};
+	for (const auto& geometry : scene.geometries) {
+		auto layout = vector<uint32_t>{};
+		for (const auto attribute : geometry.layout) {
+			layout.push_back(static_cast<uint32_t>(attribute));
+		}
+		geometries.push_back(
+			{writer.append(span<const uint32_t>{layout}),
+			 writer.append(geometry.vertices),
+			 writer.append(geometry.indices),
+			 writer.append(span<const GeometryLod>{geometry.lods}),
+			 geometry.content_hash});
+	}
+	header.geometries = writer.append(span<const CacheGeometry>{geometries});
+
+	auto materials = vector<CacheMaterial>{};
+	auto textures = vector<CacheTexture>{};
+	for (auto material_idx = 0u; material_idx < scene.materials.size(); material_idx++) {
+		const auto& material = scene.materials[material_idx];
+		const auto& references = material_idx < material_textures.size()
+									 ? material_textures[material_idx]
+									 : vector<TextureReference>{};
+		materials.push_back(
+			{{material.color.r, material.color.g, material.color.b},
+			 static_cast<uint32_t>(textures.size()),
+			 static_cast<uint32_t>(references.size())});
+		for (const auto& reference : references) {
+			textures.push_back({writer.append(reference.name), writer.append(reference.embedded)});
+		}
+	}
+	header.materials = writer.append(span<const CacheMaterial>{materials});
+	header.textures = writer.append(span<const CacheTexture>{textures});
+
+	writer.overwrite(0, header);
+
+	// Write to a temporary file first so readers never see a half-written cache
+	auto error = error_code{};
+	filesystem::create_directories(cache_directory(), error);
+	const auto cache_path = cache_file_path(key);
+	auto temp_path = cache_path;
+	temp_path += ".tmp";
+	{
+		auto stream = ofstream(temp_path, ios::binary | ios::trunc);
+		if (!stream) {
+			cout << "Error: cannot write scene cache " << cache_path << endl;
+			return;
+		}
+		stream.write(writer.bytes.data(), writer.bytes.size());
+	}
+	filesystem::rename(temp_path, cache_path, error);
+	if (error) {
+		cout << "Error: cannot write scene cache " << cache_path << ": " << error.message() << endl;
+		return;
+	}
+
+	cout << "[info]\t Wrote scene cache " << cache_path << " (" << writer.bytes.size() << " bytes)"
+		 << endl;
+}
+
+} // namespace gengine
@@ -0,0 +1,63 @@
+/**
+ * @file scene_cache.h - persists imported SceneAssets so warm starts can skip Assimp.
+ *
+ * Each import is written to one versioned binary file under `.gengine-cache/`.
+ * Vertex and index arrays are stored aligned, so reading a cached scene maps
+ * the file and points the GeometryAsset spans straight into it.
+ */
+
+#pragma once
+
+#include "assets.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace gengine {
+
+/// Bump whenever the file layout or the output of the import pipeline changes
+constexpr uint32_t SCENE_CACHE_VERSION = 7;
+
+/// Where one of a material's textures came from, so a cached scene can load it again
+struct TextureReference {
+	/// Path on disk, or the TextureFactory name of an embedded texture
+	std::string name;
+	/// Encoded image bytes of an embedded texture; empty for textures on disk
+	std::span<const std::byte> embedded;
+};
+
+/**
+ * @brief Identify one import of a model file.
+ * @param settings the optimizer switch, vertex layout and LOD errors are part of the key
+ * @return a hash of the path, the import settings and the file contents,
+ *         or nothing if the file can't be read.
+ */
+auto scene_cache_key(
+	const std::filesystem::path& normalized_path,
+	uint32_t import_flags,
+	const ModelImportSettings& settings) -> std::optional<uint64_t>;
+
+/**
+ * @brief Load a previously imported scene.
+ * @return nothing on a cache miss, or if the cache file is stale or damaged.
+ */
+auto read_scene_cache(
+	TextureFactory& texture_factory,
+	const std::filesystem::path& normalized_path,
+	uint64_t key) -> std::optional<SceneAsset>;
+
+/**
+ * @brief Store an imported scene.
+ * @param material_textures for each material, the sources of its textures in order
+ */
+auto write_scene_cache(
+	uint64_t key,
+	const SceneAsset& scene,
+	const std::vector<std::vector<TextureReference>>& material_textures) -> void;
+
+} // namespace gengine
@@ -0,0 +1,156 @@
+#include "texture_streaming.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+/// Touching one byte per page is enough to fault a mapped file in
+constexpr size_t PAGE_SIZE = 4096;
+
+/// Bytes taken by the levels from `first_level` down
+auto levels_size(const gpu::TextureData& texture, uint32_t first_level) -> size_t
+{
+	auto bytes = size_t{0};
+	for (auto level = first_level; level < texture.levels.size(); level++) {
+		bytes += texture.levels[level].data.size();
+	}
+	return bytes;
+}
+
+/// The coarsest level with at least one texel per pixel covered
+auto wanted_level(const gpu::TextureData& texture, uint32_t resident_level, float pixels)
+	-> uint32_t
+{
+	const auto texels = static_cast<float>(max(texture.width, texture.height));
+	if (pixels <= 0.0f) {
+		return resident_level;
+	}
+	const auto level = floor(log2(max(texels / pixels, 1.0f)));
+	return min(static_cast<uint32_t>(level), resident_level);
+}
+
+/// Fault in the pages of levels [first, last) so that uploading them doesn't wait on disk
+auto read_ahead(shared_ptr<const gpu::TextureData> texture, uint32_t first, uint32_t last)
+	-> void
+{
+	auto sum = 0u;
+	for (auto level = first; level < last; level++) {
+		const auto data = texture->levels[level].data;
+		for (auto offset = size_t{0}; offset < data.size(); offset += PAGE_SIZE) {
+			sum += static_cast<unsigned>(data[offset]);
+		}
+	}
+	// Keep the reads from being optimized away
+	[[maybe_unused]] volatile auto sink = sum;
+}
+
+} // namespace
+
+auto TextureStreamer::add(
+	gpu::RenderDevice* gpu,
+	const std::string& name,
+	std::shared_ptr<const gpu::TextureData> texture) -> gpu::Image*
+{
+	if (texture->levels.size() <= 1) {
+		return gpu->create_image(name, *texture);
+	}
+
+	auto resident_level = static_cast<uint32_t>(texture->levels.size() - 1);
+	for (auto level = 0u; level < texture->levels.size(); level++) {
+		const auto& data = texture->levels[level];
+		if (max(data.width, data.height) <= RESIDENT_SIZE) {
+			resident_level = level;
+			break;
+		}
+	}
+
+	const auto image = gpu->create_image(name, *texture, resident_level);
+	streamed[image] = {std::move(texture), resident_level, resident_level, frame, 0.0f, {}, {}};
+	return image;
+}
+
+auto TextureStreamer::remove(gpu::Image* image) -> void { streamed.erase(image); }
+
+auto TextureStreamer::update(
+	gpu::RenderDevice* gpu, const std::unordered_map<gpu::Image*, float>& screen_pixels) -> void
+{
+	frame++;
+	uploaded_bytes = 0;
+
+	auto ready = vector<gpu::Image*>{};
+	for (auto& [image, entry] : streamed) {
+		const auto it = screen_pixels.find(image);
+		entry.pixels = it == screen_pixels.end() ? 0.0f : it->second;
+		const auto wanted = wanted_level(*entry.texture, entry.resident_level, entry.pixels);
+
+		if (wanted <= entry.level) {
+			entry.needed_frame = frame;
+		}
+		else if (frame - entry.needed_frame > EVICTION_DELAY_FRAMES) {
+			gpu->set_image_levels(image, *entry.texture, wanted);
+			entry.level = wanted;
+			entry.loading.reset();
+			evictions++;
+			continue;
+		}
+
+		if (wanted < entry.level && !entry.loading.has_value()) {
+			entry.loading = wanted;
+			entry.read_ahead = ThreadPool::shared().submit(
+				[texture = entry.texture, wanted, last = entry.level]() {
+					read_ahead(texture, wanted, last);
+				});
+		}
+
+		if (entry.loading.has_value() &&
+			entry.read_ahead.wait_for(chrono::seconds(0)) == future_status::ready) {
+			ready.push_back(image);
+		}
+	}
+
+	// The images covering the most of the screen go first
+	ranges::sort(ready, [this](gpu::Image* a, gpu::Image* b) {
+		return streamed.at(a).pixels > streamed.at(b).pixels;
+	});
+
+	for (const auto image : ready) {
+		auto& entry = streamed.at(image);
+		// Levels the image already holds are copied on the GPU; only finer ones are sent
+		const auto bytes =
+			levels_size(*entry.texture, *entry.loading) - levels_size(*entry.texture, entry.level);
+		// Always upload at least one, so no image waits forever for a bigger budget
+		if (uploaded_bytes > 0 && uploaded_bytes + bytes > upload_budget) {
+			break;
+		}
+		gpu->set_image_levels(image, *entry.texture, *entry.loading);
+		entry.level = *entry.loading;
+		entry.loading.reset();
+		uploaded_bytes += bytes;
+		uploads++;
+	}
+}
+
+auto TextureStreamer::stats() const -> TextureStreamingStats
+{
+	auto stats = TextureStreamingStats{};
+	stats.streamed_images = streamed.size();
+	for (const auto& [image, entry] : streamed) {
+		stats.resident_bytes += levels_size(*entry.texture, entry.level);
+		stats.full_bytes += levels_size(*entry.texture, 0);
+		stats.pending_loads += entry.loading.has_value() ? 1 : 0;
+	}
+	stats.uploaded_bytes = uploaded_bytes;
+	stats.uploads = uploads;
+	stats.evictions = evictions;
+	return stats;
+}
+
+} // namespace gengine
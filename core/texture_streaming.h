@@ -0,0 +1,108 @@
+/**
+ * @file texture_streaming.h - keeps only the mip levels the screen needs in VRAM.
+ *
+ * A streamed image starts with its coarse levels only.  Each frame the scene reports how
+ * many pixels each image covers; the pages of finer levels are faulted in on the worker
+ * pool, then the levels are uploaded a few per frame from this thread, and levels nobody
+ * has needed for a while are dropped again.
+ *
+ * Only baked textures stream: their levels are already in the file, so no level has to
+ * be decoded or generated to be uploaded.
+ */
+
+#pragma once
+
+#include "gpu.h"
+#include "textures.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+namespace gengine {
+
+struct TextureStreamingStats {
+	std::size_t streamed_images;
+	/// VRAM taken by the levels held now...
+	std::size_t resident_bytes;
+	/// ...and what every level of every streamed image would take
+	std::size_t full_bytes;
+	/// Bytes of new levels sent by the last update; levels already held aren't counted
+	std::size_t uploaded_bytes;
+	/// Images whose finer levels are being read ahead
+	std::size_t pending_loads;
+	uint64_t uploads;
+	uint64_t evictions;
+};
+
+/**
+ * @brief Streams the mip levels of baked textures in and out of their GPU images.
+ * @note Not thread-safe; use it from the thread which owns the RenderDevice.
+ */
+class TextureStreamer {
+public:
+	/// Bytes uploaded per update before the rest wait for the next frame
+	static constexpr std::size_t DEFAULT_UPLOAD_BUDGET = 8 * 1024 * 1024;
+
+	/// Levels no larger than this are always held
+	static constexpr uint32_t RESIDENT_SIZE = 64;
+
+	/// Frames a level must go unneeded before it is dropped, so turning around is cheap
+	static constexpr uint64_t EVICTION_DELAY_FRAMES = 120;
+
+	/**
+	 * @brief Upload a baked texture's coarse levels and stream the rest.
+	 * @return an image which the RenderDevice owns, as from create_image; textures with a
+	 *         single level are uploaded whole and not streamed
+	 */
+	auto add(
+		gpu::RenderDevice* gpu,
+		const std::string& name,
+		std::shared_ptr<const gpu::TextureData> texture) -> gpu::Image*;
+
+	/// Stop streaming an image, e.g. before destroying it
+	auto remove(gpu::Image* image) -> void;
+
+	/**
+	 * @brief Read ahead, upload and drop levels for one frame.
+	 * @param screen_pixels how many pixels across each image's largest user covers on
+	 *        screen; images missing from it are not visible
+	 */
+	auto update(
+		gpu::RenderDevice* gpu, const std::unordered_map<gpu::Image*, float>& screen_pixels)
+		-> void;
+
+	auto set_upload_budget(std::size_t bytes) -> void { upload_budget = bytes; }
+
+	auto stats() const -> TextureStreamingStats;
+
+private:
+	struct Streamed {
+		std::shared_ptr<const gpu::TextureData> texture;
+		/// The finest level held at all times
+		uint32_t resident_level;
+		/// The finest level held now
+		uint32_t level;
+		/// The last frame which needed `level`
+		uint64_t needed_frame;
+		/// How much of the screen the image covered this frame, for upload order
+		float pixels;
+		/// The level being read ahead, with the job reading it
+		std::optional<uint32_t> loading;
+		std::future<void> read_ahead;
+	};
+
+	std::unordered_map<gpu::Image*, Streamed> streamed;
+
+	std::size_t upload_budget = DEFAULT_UPLOAD_BUDGET;
+	uint64_t frame = 0;
+	std::size_t uploaded_bytes = 0;
+	uint64_t uploads = 0;
+	uint64_t evictions = 0;
+};
+
+} // namespace gengine
@@ -0,0 +1,102 @@
+/**
+ * Bake images into block-compressed ".gtex" textures with precomputed mip chains.
+ *
+ * BUILD: cmake --workflow --preset linux-(vk|gl)-dev
+ * RUN: texturetools [--format bc7|bc1|etc2|rgba8] <image>...
+ *
+ * Each "<image>" becomes "<image>.<format>.gtex" beside it, which TextureFactory
+ * picks up in place of the original when the GPU supports that format.
+ */
+
+#include "stb/stb_image.h"
+#include "textures.h"
+#include "thread_pool.h"
+#include "vfs.h"
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static auto bake(const string& image_path, gpu::TextureFormat format) -> bool
+{
+	auto width = 0;
+	auto height = 0;
+	auto channel_count = 0;
+
+	// Read through the file system like the engine does, so mounted archives work too
+	const auto file = gengine::read_asset_file(image_path);
+	const auto encoded = file.has_value() ? file->bytes() : span<const byte>{};
+	const auto data = stbi_load_from_memory(
+		reinterpret_cast<const unsigned char*>(encoded.data()),
+		static_cast<int>(encoded.size()),
+		&width,
+		&height,
+		&channel_count,
+		4);
+	if (data == nullptr) {
+		cerr << "Error: Cannot load " << image_path << endl;
+		return false;
+	}
+
+	const auto texture = gpu::encode_texture(format, width, height, data);
+	stbi_image_free(data);
+
+	const auto bytes = gpu::write_texture_file(texture);
+	const auto baked_path = image_path + "." + string(gpu::texture_format_name(format)) + ".gtex";
+
+	ofstream baked_file(baked_path, ios::binary | ios::trunc);
+	if (!baked_file.is_open()) {
+		cerr << "Error: Cannot write " << baked_path << endl;
+		return false;
+	}
+	baked_file.write(reinterpret_cast<const char*>(bytes.data()), bytes.size());
+
+	cout << baked_path << " (" << width << "x" << height << ") mips:" << texture.levels.size()
+		 << " " << (static_cast<size_t>(width) * height * 4) << " -> "
+		 << texture.levels[0].data.size() << " bytes" << endl;
+
+	return true;
+}
+
+int main(int argc, char** argv)
+{
+	auto format = gpu::TextureFormat::BC7;
+	auto image_paths = vector<string>{};
+
+	for (auto i = 1; i < argc; i++) {
+		const auto arg = string(argv[i]);
+		if (arg == "--format" && i + 1 < argc) {
+			const auto named = gpu::texture_format_from_name(argv[++i]);
+			if (!named.has_value()) {
+				cerr << "Error: Unknown format " << argv[i] << endl;
+				return 1;
+			}
+			format = *named;
+		}
+		else {
+			image_paths.push_back(arg);
+		}
+	}
+
+	if (image_paths.empty()) {
+		cerr << "Usage: " << argv[0] << " [--format bc7|bc1|etc2|rgba8] <image>..." << endl;
+		return 1;
+	}
+
+	// Images are independent, so bake them all at once
+	auto& pool = gengine::ThreadPool::shared();
+	auto jobs = vector<future<bool>>{};
+	for (const auto& image_path : image_paths) {
+		jobs.push_back(pool.submit([&image_path, format]() { return bake(image_path, format); }));
+	}
+
+	auto ok = true;
+	for (auto& job : jobs) {
+		ok = pool.wait(job) && ok;
+	}
+
+	return ok ? 0 : 1;
+}
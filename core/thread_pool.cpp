@@ -0,0 +1,127 @@
+#include "thread_pool.h"
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <latch>
+
+namespace gengine {
+
+/// See ThreadPool::running_job
+static thread_local auto current_job = uint64_t{0};
+
+ThreadPool::ThreadPool(std::size_t thread_count)
+{
+	for (std::size_t i = 0; i < thread_count; i++) {
+		workers.emplace_back([this]() { worker_loop(); });
+	}
+	std::cout << "[info]\t ThreadPool (" << thread_count << " workers)" << std::endl;
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard lock{mutex};
+		stopping = true;
+	}
+	wakeup.notify_all();
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+auto ThreadPool::shared() -> ThreadPool&
+{
+#if GENGINE_PLATFORM_WEB
+	// Emscripten builds don't enable pthreads, so jobs run inline.
+	static auto pool = ThreadPool{0};
+#else
+	// Leave one core for the thread that owns the GPU and physics world.
+	static auto pool = ThreadPool{std::max(1u, std::thread::hardware_concurrency()) - 1};
+#endif
+	return pool;
+}
+
+auto ThreadPool::run_batch(std::span<const std::function<void()>> tasks) -> void
+{
+	if (tasks.empty()) {
+		return;
+	}
+
+	// Helpers may only get to run after the batch is done, so they share ownership of its
+	// progress, and claim tasks from it rather than being handed one each.
+	struct Batch {
+		explicit Batch(std::span<const std::function<void()>> tasks)
+			: tasks{tasks}, done{static_cast<std::ptrdiff_t>(tasks.size())}
+		{
+		}
+
+		std::span<const std::function<void()>> tasks;
+		std::atomic<std::size_t> next{0};
+		std::latch done;
+	};
+	auto batch = std::make_shared<Batch>(tasks);
+
+	const auto run_tasks = [](Batch& batch) {
+		for (auto i = batch.next++; i < batch.tasks.size(); i = batch.next++) {
+			batch.tasks[i]();
+			batch.done.count_down();
+		}
+	};
+
+	const auto helpers = std::min(workers.size(), tasks.size() - 1);
+	for (std::size_t i = 0; i < helpers; i++) {
+		submit([batch, run_tasks]() { run_tasks(*batch); });
+	}
+
+	run_tasks(*batch);
+	batch->done.wait();
+}
+
+auto ThreadPool::running_job() -> uint64_t { return current_job; }
+
+auto ThreadPool::run(Job& job) -> void
+{
+	const auto outer = current_job;
+	current_job = job.id;
+	job.run();
+	current_job = outer;
+}
+
+auto ThreadPool::run_one(uint64_t parent) -> bool
+{
+	Job job;
+	{
+		std::lock_guard lock{mutex};
+		const auto it =
+			std::ranges::find_if(jobs, [&](const Job& queued) { return queued.parent == parent; });
+		if (it == jobs.end()) {
+			return false;
+		}
+		job = std::move(*it);
+		jobs.erase(it);
+	}
+	run(job);
+	return true;
+}
+
+auto ThreadPool::worker_loop() -> void
+{
+	while (true) {
+		Job job;
+		{
+			std::unique_lock lock{mutex};
+			wakeup.wait(lock, [this]() { return stopping || !jobs.empty(); });
+			if (stopping && jobs.empty()) {
+				return;
+			}
+			job = std::move(jobs.front());
+			jobs.pop_front();
+		}
+		run(job);
+	}
+}
+
+} // namespace gengine
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace gengine {
+
+/**
+ * @brief A fixed set of worker threads which run queued jobs in FIFO order.
+ *
+ * Jobs may submit more jobs and wait on them.  Waiting through \c ThreadPool::wait
+ * runs the waiter's own queued jobs on the waiting thread, so nested fan-out never
+ * starves the pool: a job only helps with the jobs it submitted, and a thread outside
+ * the pool with the jobs submitted outside the pool.  A model import waiting on its
+ * texture decodes can't pick up another whole import.  \c ThreadPool::run_batch only
+ * ever runs its own tasks on the calling thread.
+ *
+ * A pool with zero workers runs every job inline inside \c submit (used on the web).
+ */
+class ThreadPool {
+public:
+	explicit ThreadPool(std::size_t thread_count);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	/// The process-wide pool used by asset loading
+	static auto shared() -> ThreadPool&;
+
+	auto thread_count() const -> std::size_t { return workers.size(); }
+
+	/// Queue a job and get a future for its result
+	template <class Job> auto submit(Job&& job) -> std::future<std::invoke_result_t<Job>>
+	{
+		using Result = std::invoke_result_t<Job>;
+
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Job>(job));
+		auto future = task->get_future();
+
+		if (workers.empty()) {
+			(*task)();
+			return future;
+		}
+
+		{
+			std::lock_guard lock{mutex};
+			jobs.push_back({[task]() { (*task)(); }, next_job_id++, running_job()});
+		}
+		wakeup.notify_one();
+
+		return future;
+	}
+
+	/// Block until the future (or shared_future) is ready, helping with this thread's own
+	/// queued jobs meanwhile
+	template <class Future> auto wait(Future& future) -> decltype(future.get())
+	{
+		const auto waiter = running_job();
+		while (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+			if (!run_one(waiter)) {
+				future.wait_for(std::chrono::microseconds(100));
+			}
+		}
+		return future.get();
+	}
+
+	/**
+	 * Run every task, on the calling thread and on idle workers, and return once all are done.
+	 *
+	 * The calling thread only runs tasks of this batch, never other queued jobs, so it can't
+	 * pick up unrelated work while it waits.  Workers busy elsewhere are not waited for.
+	 */
+	auto run_batch(std::span<const std::function<void()>> tasks) -> void;
+
+private:
+	struct Job {
+		std::function<void()> run;
+		uint64_t id;
+		/// The job which submitted this one, or NO_JOB from outside the pool's jobs
+		uint64_t parent;
+	};
+
+	static constexpr uint64_t NO_JOB = 0;
+
+	/// The job running on the calling thread, or NO_JOB
+	static auto running_job() -> uint64_t;
+
+	/// Run a job on the calling thread, as the running job
+	static auto run(Job& job) -> void;
+
+	/// Pop and run the first queued job submitted by `parent`, if there is one
+	auto run_one(uint64_t parent) -> bool;
+
+	auto worker_loop() -> void;
+
+	std::vector<std::thread> workers;
+
+	std::deque<Job> jobs;
+
+	/// Guarded by `mutex`
+	uint64_t next_job_id = NO_JOB + 1;
+
+	std::mutex mutex;
+
+	std::condition_variable wakeup;
+
+	bool stopping = false;
+};
+
+} // namespace gengine
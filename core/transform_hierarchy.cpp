@@ -0,0 +1,97 @@
+#include "transform_hierarchy.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace std;
+
+namespace gengine {
+
+auto TransformHierarchy::add_node(int32_t parent, const glm::mat4& local) -> uint32_t
+{
+	const auto node = static_cast<uint32_t>(parents.size());
+	assert(parent == NO_PARENT || (parent >= 0 && static_cast<uint32_t>(parent) < node));
+
+	parents.push_back(parent);
+	locals.push_back(local);
+	worlds.push_back(local);
+	dirty.push_back(true);
+	updated.push_back(false);
+	first_dirty = min<size_t>(first_dirty, node);
+	return node;
+}
+
+auto TransformHierarchy::add_block(uint32_t count) -> uint32_t
+{
+	if (auto it = free_blocks.find(count); it != free_blocks.end() && !it->second.empty()) {
+		const auto first = it->second.back();
+		it->second.pop_back();
+		return first;
+	}
+
+	const auto first = static_cast<uint32_t>(parents.size());
+	const auto size = parents.size() + count;
+	parents.resize(size, NO_PARENT);
+	locals.resize(size, glm::mat4(1.0f));
+	worlds.resize(size, glm::mat4(1.0f));
+	dirty.resize(size, false);
+	updated.resize(size, false);
+	return first;
+}
+
+auto TransformHierarchy::set_node(uint32_t node, int32_t parent, const glm::mat4& local) -> void
+{
+	assert(parent == NO_PARENT || (parent >= 0 && static_cast<uint32_t>(parent) < node));
+	parents[node] = parent;
+	set_local(node, local);
+}
+
+auto TransformHierarchy::release_block(uint32_t first, uint32_t count) -> void
+{
+	// Released nodes are roots which never move, so update() passes over them
+	for (auto node = first; node < first + count; node++) {
+		parents[node] = NO_PARENT;
+		dirty[node] = false;
+	}
+	free_blocks[count].push_back(first);
+}
+
+auto TransformHierarchy::set_local(uint32_t node, const glm::mat4& local) -> void
+{
+	locals[node] = local;
+	dirty[node] = true;
+	first_dirty = min<size_t>(first_dirty, node);
+}
+
+auto TransformHierarchy::reserve(size_t node_count) -> void
+{
+	parents.reserve(node_count);
+	locals.reserve(node_count);
+	worlds.reserve(node_count);
+	dirty.reserve(node_count);
+	updated.reserve(node_count);
+}
+
+auto TransformHierarchy::update() -> void
+{
+	const auto node_count = parents.size();
+	updated_from = first_dirty;
+
+	// Parents come first, so a parent's `updated` flag is final before its children read it
+	for (auto node = first_dirty; node < node_count; node++) {
+		const auto parent = parents[node];
+		const auto moved = dirty[node] || (parent != NO_PARENT &&
+										   static_cast<size_t>(parent) >= updated_from &&
+										   updated[parent]);
+		updated[node] = moved;
+		if (!moved) {
+			continue;
+		}
+		dirty[node] = false;
+		worlds[node] = parent == NO_PARENT ? locals[node] : worlds[parent] * locals[node];
+	}
+
+	first_dirty = numeric_limits<size_t>::max();
+}
+
+} // namespace gengine
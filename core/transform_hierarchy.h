@@ -0,0 +1,89 @@
+/**
+ * @file transform_hierarchy.h - parent-relative transforms stored as flat arrays.
+ *
+ * Nodes are topologically sorted: a node's parent always has a smaller index, so
+ * world transforms are resolved front to back in a single pass.
+ *
+ * Nodes can't be removed one by one, as that would break the order; instead a block of
+ * nodes added together is released whole, and reused by the next block of its size.
+ */
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <unordered_map>
+#include <vector>
+
+namespace gengine {
+
+constexpr int32_t NO_PARENT = -1;
+
+class TransformHierarchy {
+public:
+	/**
+	 * @param parent an existing node, or NO_PARENT
+	 * @return the new node, whose world transform is valid after the next update()
+	 */
+	auto add_node(int32_t parent, const glm::mat4& local) -> uint32_t;
+
+	/**
+	 * @brief Make room for `count` nodes, reusing a released block of that size if any.
+	 * @return the first node; give each its parent with set_node, which must be NO_PARENT
+	 *         or in the block, before its own index
+	 */
+	auto add_block(uint32_t count) -> uint32_t;
+
+	/// Place a node of a block
+	auto set_node(uint32_t node, int32_t parent, const glm::mat4& local) -> void;
+
+	/// Give back a block from add_block, or nodes added one by one which nothing else uses
+	auto release_block(uint32_t first, uint32_t count) -> void;
+
+	/// Move a node relative to its parent; its subtree follows on the next update()
+	auto set_local(uint32_t node, const glm::mat4& local) -> void;
+
+	auto local(uint32_t node) const -> const glm::mat4& { return locals[node]; }
+
+	auto world(uint32_t node) const -> const glm::mat4& { return worlds[node]; }
+
+	auto parent(uint32_t node) const -> int32_t { return parents[node]; }
+
+	auto size() const -> std::size_t { return parents.size(); }
+
+	auto reserve(std::size_t node_count) -> void;
+
+	/**
+	 * @brief Recompute the world transforms of moved nodes and their descendants.
+	 *
+	 * One linear pass starting at the first moved node; nodes that didn't move
+	 * cost a flag check each.
+	 */
+	auto update() -> void;
+
+	/// Whether the last update() recomputed this node's world transform
+	auto was_updated(uint32_t node) const -> bool
+	{
+		return node >= updated_from && updated[node];
+	}
+
+private:
+	std::vector<int32_t> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	/// Set by set_local, cleared by update
+	std::vector<uint8_t> dirty;
+	/// What the last update recomputed; only meaningful from `updated_from` onwards
+	std::vector<uint8_t> updated;
+
+	/// First node of each released block, by block size
+	std::unordered_map<uint32_t, std::vector<uint32_t>> free_blocks;
+
+	std::size_t first_dirty = std::numeric_limits<std::size_t>::max();
+	std::size_t updated_from = std::numeric_limits<std::size_t>::max();
+};
+
+} // namespace gengine
@@ -0,0 +1,328 @@
+#include "vfs.h"
+#include "asset_archive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+
+using namespace std;
+
+namespace gengine {
+
+namespace {
+
+auto normalized(const filesystem::path& path) -> filesystem::path
+{
+	return filesystem::absolute(path).lexically_normal();
+}
+
+auto elapsed_us(chrono::steady_clock::time_point start) -> uint64_t
+{
+	const auto elapsed = chrono::steady_clock::now() - start;
+	return chrono::duration_cast<chrono::microseconds>(elapsed).count();
+}
+
+/// The innermost ReadRecorder on this thread
+thread_local ReadRecorder* active_recorder = nullptr;
+
+} // namespace
+
+struct FileSystem::Mount {
+	MountId id;
+	/// Normalized; empty for a mount at every path
+	filesystem::path mount_point;
+	shared_ptr<const MountSource> source;
+	int priority;
+
+	atomic<uint64_t> reads = 0;
+	atomic<uint64_t> bytes = 0;
+	atomic<uint64_t> latency_us = 0;
+	atomic<uint64_t> failures = 0;
+};
+
+DirectorySource::DirectorySource(std::filesystem::path root) : root{std::move(root)} {}
+
+auto DirectorySource::read(std::string_view name) const -> std::expected<FileView, std::string>
+{
+	auto file = MappedFile::open(root.empty() ? filesystem::path{name} : root / name);
+	if (!file.has_value()) {
+		return unexpected(file.error());
+	}
+	const auto data = (*file)->bytes();
+	return FileView{std::move(*file), data};
+}
+
+auto DirectorySource::exists(std::string_view name) const -> bool
+{
+	auto error = error_code{};
+	return filesystem::is_regular_file(root.empty() ? filesystem::path{name} : root / name, error);
+}
+
+auto DirectorySource::describe() const -> std::string
+{
+	return root.empty() ? "disk" : root.string();
+}
+
+ArchiveSource::ArchiveSource(std::shared_ptr<const AssetArchive> archive, std::string description)
+	: archive{std::move(archive)}, description{std::move(description)}
+{
+}
+
+auto ArchiveSource::read(std::string_view name) const -> std::expected<FileView, std::string>
+{
+	return archive->read(name);
+}
+
+auto ArchiveSource::exists(std::string_view name) const -> bool { return archive->contains(name); }
+
+auto ArchiveSource::describe() const -> std::string { return description; }
+
+auto MemorySource::add(std::string name, std::vector<std::byte> bytes) -> void
+{
+	auto file = make_shared<const vector<byte>>(std::move(bytes));
+	lock_guard lock{mutex};
+	files[std::move(name)] = std::move(file);
+}
+
+auto MemorySource::read(std::string_view name) const -> std::expected<FileView, std::string>
+{
+	lock_guard lock{mutex};
+	const auto it = files.find(string{name});
+	if (it == files.end()) {
+		return unexpected("No file " + string{name} + " in memory");
+	}
+	return FileView{it->second, *it->second};
+}
+
+auto MemorySource::exists(std::string_view name) const -> bool
+{
+	lock_guard lock{mutex};
+	return files.contains(string{name});
+}
+
+auto MemorySource::describe() const -> std::string { return "memory"; }
+
+FileSystem::FileSystem()
+{
+	mount({}, make_shared<DirectorySource>(filesystem::path{}), DISK_MOUNT_PRIORITY);
+}
+
+auto FileSystem::shared() -> FileSystem&
+{
+	static auto file_system = FileSystem{};
+	return file_system;
+}
+
+auto FileSystem::mount(
+	const std::filesystem::path& mount_point,
+	std::shared_ptr<const MountSource> source,
+	int priority) -> MountId
+{
+	lock_guard lock{mounts_mutex};
+
+	auto mount = make_shared<Mount>();
+	mount->id = next_id++;
+	mount->mount_point = mount_point.empty() ? filesystem::path{} : normalized(mount_point);
+	mount->source = std::move(source);
+	mount->priority = priority;
+
+	// Before the first mount of the same or lower priority, so recent mounts win ties
+	const auto position = find_if(mounts.begin(), mounts.end(), [priority](const auto& other) {
+		return other->priority <= priority;
+	});
+	mounts.insert(position, mount);
+
+	// The new mount may shadow files already cached from others
+	{
+		lock_guard cache_lock{cache_mutex};
+		cache.clear();
+		lru_order.clear();
+		cache_bytes = 0;
+	}
+
+	cout << "[info]\t Mounted " << mount->source->describe() << " at "
+		 << (mount->mount_point.empty() ? "/" : mount->mount_point.string()) << endl;
+	return mount->id;
+}
+
+auto FileSystem::unmount(MountId id) -> bool
+{
+	{
+		lock_guard lock{mounts_mutex};
+		const auto it =
+			find_if(mounts.begin(), mounts.end(), [id](const auto& m) { return m->id == id; });
+		if (it == mounts.end()) {
+			return false;
+		}
+		mounts.erase(it);
+	}
+
+	lock_guard lock{cache_mutex};
+	for (auto it = cache.begin(); it != cache.end();) {
+		if (it->second.mount != id) {
+			++it;
+			continue;
+		}
+		cache_bytes -= it->second.file.data.size();
+		lru_order.erase(it->second.lru_position);
+		it = cache.erase(it);
+	}
+	return true;
+}
+
+auto FileSystem::candidates(const std::filesystem::path& path)
+	-> std::vector<std::pair<std::shared_ptr<Mount>, std::string>>
+{
+	const auto file = normalized(path);
+
+	auto found = vector<pair<shared_ptr<Mount>, string>>{};
+	lock_guard lock{mounts_mutex};
+	for (const auto& mount : mounts) {
+		if (mount->mount_point.empty()) {
+			found.push_back({mount, file.string()});
+			continue;
+		}
+		const auto name = file.lexically_relative(mount->mount_point).generic_string();
+		if (name.empty() || name == "." || name.starts_with("..")) {
+			continue;
+		}
+		found.push_back({mount, name});
+	}
+	return found;
+}
+
+auto FileSystem::read(const std::filesystem::path& path) -> std::expected<FileView, std::string>
+{
+	const auto key = normalized(path).string();
+	{
+		lock_guard lock{cache_mutex};
+		if (const auto it = cache.find(key); it != cache.end()) {
+			cache_hits++;
+			lru_order.splice(lru_order.begin(), lru_order, it->second.lru_position);
+			if (active_recorder != nullptr) {
+				active_recorder->recorded.push_back(key);
+			}
+			return it->second.file;
+		}
+	}
+
+	for (const auto& [mount, name] : candidates(path)) {
+		if (!mount->source->exists(name)) {
+			continue;
+		}
+
+		const auto start = chrono::steady_clock::now();
+		auto file = mount->source->read(name);
+		mount->latency_us += elapsed_us(start);
+		mount->reads++;
+		if (!file.has_value()) {
+			mount->failures++;
+			return file;
+		}
+		mount->bytes += file->data.size();
+		if (active_recorder != nullptr) {
+			active_recorder->recorded.push_back(key);
+		}
+
+		if (mount->source->cacheable()) {
+			lock_guard lock{cache_mutex};
+			cache_misses++;
+			if (!cache.contains(key)) {
+				lru_order.push_front(key);
+				cache[key] = {*file, mount->id, lru_order.begin()};
+				cache_bytes += file->data.size();
+				trim_cache();
+			}
+		}
+		return file;
+	}
+
+	return unexpected("Cannot find " + path.string());
+}
+
+auto FileSystem::exists(const std::filesystem::path& path) -> bool
+{
+	{
+		lock_guard lock{cache_mutex};
+		if (cache.contains(normalized(path).string())) {
+			return true;
+		}
+	}
+	for (const auto& [mount, name] : candidates(path)) {
+		if (mount->source->exists(name)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+auto FileSystem::set_cache_budget(std::size_t bytes) -> void
+{
+	lock_guard lock{cache_mutex};
+	cache_budget = bytes;
+	trim_cache();
+}
+
+auto FileSystem::trim_cache() -> void
+{
+	while (cache_bytes > cache_budget && !lru_order.empty()) {
+		const auto it = cache.find(lru_order.back());
+		cache_bytes -= it->second.file.data.size();
+		cache.erase(it);
+		lru_order.pop_back();
+	}
+}
+
+auto FileSystem::stats() -> FileSystemStats
+{
+	auto stats = FileSystemStats{};
+	{
+		lock_guard lock{mounts_mutex};
+		for (const auto& mount : mounts) {
+			stats.mounts.push_back(
+				{mount->id,
+				 mount->source->describe(),
+				 mount->mount_point,
+				 mount->priority,
+				 mount->reads,
+				 mount->bytes,
+				 mount->latency_us,
+				 mount->failures});
+		}
+	}
+	lock_guard lock{cache_mutex};
+	stats.cache_hits = cache_hits;
+	stats.cache_misses = cache_misses;
+	stats.cache_bytes = cache_bytes;
+	stats.cache_budget_bytes = cache_budget;
+	return stats;
+}
+
+auto mount_archive(const std::filesystem::path& archive_path, int priority)
+	-> std::expected<MountId, std::string>
+{
+	auto archive = AssetArchive::open(archive_path);
+	if (!archive.has_value()) {
+		return unexpected(archive.error());
+	}
+	auto source = make_shared<ArchiveSource>(std::move(*archive), archive_path.string());
+	return FileSystem::shared().mount(
+		normalized(archive_path).parent_path(), std::move(source), priority);
+}
+
+auto read_asset_file(const std::filesystem::path& path) -> std::expected<FileView, std::string>
+{
+	return FileSystem::shared().read(path);
+}
+
+auto asset_file_exists(const std::filesystem::path& path) -> bool
+{
+	return FileSystem::shared().exists(path);
+}
+
+ReadRecorder::ReadRecorder() : outer{active_recorder} { active_recorder = this; }
+
+ReadRecorder::~ReadRecorder() { active_recorder = outer; }
+
+} // namespace gengine
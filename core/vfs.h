@@ -0,0 +1,247 @@
+/**
+ * @file vfs.h - one path for every asset read: mounts, overlays, a read cache and I/O stats.
+ *
+ * A mount serves the files under one directory (its mount point) from a source: a
+ * directory on disk, an archive, or files held in memory.  Mounts overlay each other;
+ * the highest priority mount holding a file wins, and among equal priorities the most
+ * recent one.  Files which no mount holds come from the "disk" mount, which reads
+ * paths as they are.
+ *
+ * Paths are compared after making them absolute and lexically normal, so
+ * "./data/a.png" and "/game/data/../data/a.png" name the same file.
+ */
+
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <filesystem>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace gengine {
+
+class AssetArchive;
+
+/**
+ * @brief Where a mount's files come from.
+ * @note Implementations must be thread-safe.
+ */
+class MountSource {
+public:
+	virtual ~MountSource() = default;
+
+	/// @param name path relative to the mount point, with '/' separators
+	virtual auto read(std::string_view name) const -> std::expected<FileView, std::string> = 0;
+
+	virtual auto exists(std::string_view name) const -> bool = 0;
+
+	/// For stats and logs
+	virtual auto describe() const -> std::string = 0;
+
+	/// Whether a file's contents never change while mounted, so reads may be cached
+	virtual auto cacheable() const -> bool { return false; }
+};
+
+/// Files on disk under a root directory, memory mapped.  Never cached: they may be rewritten.
+class DirectorySource : public MountSource {
+public:
+	/// @param root an empty root takes names as paths of their own
+	explicit DirectorySource(std::filesystem::path root);
+
+	auto read(std::string_view name) const -> std::expected<FileView, std::string> override;
+	auto exists(std::string_view name) const -> bool override;
+	auto describe() const -> std::string override;
+
+private:
+	std::filesystem::path root;
+};
+
+/// Entries of an AssetArchive; compressed entries are worth caching once decompressed
+class ArchiveSource : public MountSource {
+public:
+	explicit ArchiveSource(std::shared_ptr<const AssetArchive> archive, std::string description);
+
+	auto read(std::string_view name) const -> std::expected<FileView, std::string> override;
+	auto exists(std::string_view name) const -> bool override;
+	auto describe() const -> std::string override;
+	auto cacheable() const -> bool override { return true; }
+
+private:
+	std::shared_ptr<const AssetArchive> archive;
+	std::string description;
+};
+
+/// Files held in memory, e.g. generated at runtime or downloaded
+class MemorySource : public MountSource {
+public:
+	/// Add or replace one file
+	auto add(std::string name, std::vector<std::byte> bytes) -> void;
+
+	auto read(std::string_view name) const -> std::expected<FileView, std::string> override;
+	auto exists(std::string_view name) const -> bool override;
+	auto describe() const -> std::string override;
+
+private:
+	std::unordered_map<std::string, std::shared_ptr<const std::vector<std::byte>>> files;
+
+	/// Guards `files`
+	mutable std::mutex mutex;
+};
+
+using MountId = uint32_t;
+
+/// Lowest priority, held by the "disk" mount
+constexpr int DISK_MOUNT_PRIORITY = std::numeric_limits<int>::min();
+
+/// I/O through one mount since it was mounted
+struct MountStats {
+	MountId id;
+	std::string description;
+	std::filesystem::path mount_point;
+	int priority;
+	/// Reads served, cache hits excluded
+	uint64_t reads;
+	uint64_t bytes;
+	/// Time spent in the source's reads
+	uint64_t latency_us;
+	/// Reads which found the file but failed to load it
+	uint64_t failures;
+};
+
+struct FileSystemStats {
+	/// Highest priority first
+	std::vector<MountStats> mounts;
+	uint64_t cache_hits;
+	uint64_t cache_misses;
+	std::size_t cache_bytes;
+	std::size_t cache_budget_bytes;
+};
+
+/**
+ * @brief Mounts and the read cache shared by every asset loader.
+ * @note Thread-safe.
+ */
+class FileSystem {
+public:
+	static constexpr std::size_t DEFAULT_CACHE_BUDGET = 64 * 1024 * 1024;
+
+	/// Starts with only the "disk" mount
+	FileSystem();
+
+	/// The process-wide file system used by asset loading
+	static auto shared() -> FileSystem&;
+
+	/**
+	 * @brief Serve files under a directory from a source.
+	 * @param mount_point an empty path mounts at every path
+	 */
+	auto mount(
+		const std::filesystem::path& mount_point,
+		std::shared_ptr<const MountSource> source,
+		int priority = 0) -> MountId;
+
+	/// Remove a mount and drop its cached files
+	auto unmount(MountId id) -> bool;
+
+	/// Read a whole file from the first mount which holds it
+	auto read(const std::filesystem::path& path) -> std::expected<FileView, std::string>;
+
+	auto exists(const std::filesystem::path& path) -> bool;
+
+	/// Evict least recently read files until the cache fits `bytes`
+	auto set_cache_budget(std::size_t bytes) -> void;
+
+	auto stats() -> FileSystemStats;
+
+private:
+	struct Mount;
+
+	struct CacheEntry {
+		FileView file;
+		MountId mount;
+		/// Position in lru_order
+		std::list<std::string>::iterator lru_position;
+	};
+
+	/// Mounts which could hold a path, best first, with the file's name in each
+	auto candidates(const std::filesystem::path& path)
+		-> std::vector<std::pair<std::shared_ptr<Mount>, std::string>>;
+
+	/// Needs `cache_mutex`
+	auto trim_cache() -> void;
+
+	/// Highest priority first; among equals, most recent first
+	std::vector<std::shared_ptr<Mount>> mounts;
+
+	MountId next_id = 0;
+
+	/// Guards `mounts` and `next_id`
+	std::mutex mounts_mutex;
+
+	/// Normalized path --> cached file
+	std::unordered_map<std::string, CacheEntry> cache;
+
+	/// Cached paths, most recently read first
+	std::list<std::string> lru_order;
+
+	std::size_t cache_bytes = 0;
+	std::size_t cache_budget = DEFAULT_CACHE_BUDGET;
+	uint64_t cache_hits = 0;
+	uint64_t cache_misses = 0;
+
+	/// Guards the cache and its counters
+	std::mutex cache_mutex;
+};
+
+/**
+ * @brief Serve an archive's entries in place of the files beside it.
+ *
+ * An entry "data/a.png" in "/game/data.gpak" answers for "/game/data/a.png".
+ */
+auto mount_archive(const std::filesystem::path& archive_path, int priority = 0)
+	-> std::expected<MountId, std::string>;
+
+/// Read a whole file through the shared FileSystem
+auto read_asset_file(const std::filesystem::path& path) -> std::expected<FileView, std::string>;
+
+/// Whether read_asset_file can find a file
+auto asset_file_exists(const std::filesystem::path& path) -> bool;
+
+/**
+ * @brief Notes every file read through a FileSystem on this thread while it lives.
+ *
+ * Finds the files an import depends on, such as an .obj's .mtl.  Recorders nest; each
+ * read goes to the innermost one.  Reads made by jobs on other threads are not seen.
+ */
+class ReadRecorder {
+public:
+	ReadRecorder();
+	~ReadRecorder();
+
+	ReadRecorder(const ReadRecorder&) = delete;
+	ReadRecorder& operator=(const ReadRecorder&) = delete;
+
+	/// Normalized paths of the files read so far, in order, repeats included
+	auto paths() const -> const std::vector<std::filesystem::path>& { return recorded; }
+
+private:
+	friend class FileSystem;
+
+	std::vector<std::filesystem::path> recorded;
+
+	/// The recorder this one hides, restored when it goes
+	ReadRecorder* outer;
+};
+
+} // namespace gengine
@@ -10,7 +10,6 @@ layout (binding = 1) uniform sampler2D albedo;
 
 layout (push_constant) uniform PushConstants
 {
-	mat4 model;
 	mat4 view;
 	vec3 matColor;
 };
@@ -3,6 +3,7 @@
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNorm;
 layout (location = 2) in vec2 aUv;
+layout (location = 3) in mat4 model; // per instance
 
 layout (location = 0) out vec3 pos;
 layout (location = 1) out vec3 norm;
@@ -15,7 +16,6 @@ layout (binding = 0) uniform UniformBufferObject
 
 layout (push_constant) uniform PushConstants
 {
-	mat4 model;
 	mat4 view;
 	vec3 matColor;
 };
@@ -4,10 +4,10 @@ precision highp float;
 layout (location = 0) in vec3 vPos;
 layout (location = 1) in vec3 vNorm;
 layout (location = 2) in vec2 vTexCoord;
+layout (location = 3) in mat4 model; // per instance
 
 out vec2 fTexCoord;
 
-uniform mat4 model;
 uniform mat4 view;
 uniform mat4 projection;
 
@@ -1,14 +1,19 @@
 #include "world.h"
 #include "camera.hpp"
+#include "file_watcher.h"
 #include "fps_controller.h"
 #include "gpu.h"
 #include "physics.h"
+#include "profiler.h"
 #include "scene.h"
+#include "vfs.h"
 #include "window.h"
 #ifndef __EMSCRIPTEN__
 #include <imgui.h>
 #endif
 #include <GLFW/glfw3.h>
+#include <chrono>
+#include <cmath>
 #include <iostream>
 
 using namespace std;
@@ -21,11 +26,21 @@ class NativeWorld : public World {
 	shared_ptr<gpu::RenderDevice> gpu;
 	gengine::TextureFactory texture_factory{};
 	ResourceContainer resources;
+	/// Scene files to re-import when they're saved
+	gengine::FileWatcher asset_watcher{};
 
 	// Game data
 	Camera camera;
 	unique_ptr<FirstPersonController> fps_controller;
 	gpu::ShaderPipelineHandle pipeline;
+	/// Balls spawned from the debug menu, and its requests for the next update
+	vector<SceneObject> balls;
+	bool spawn_balls = false;
+	bool despawn_balls = false;
+	/// Renderable last clicked in editor mode, and the renderables around the player
+	gengine::RayHit picked{gengine::NO_ENTITY, 0.0f};
+	vector<gengine::Entity> nearby;
+	bool was_clicking = false;
 
 public:
 	NativeWorld(shared_ptr<GLFWwindow> window, shared_ptr<gpu::RenderDevice> gpu) : window{window}, gpu{gpu}
@@ -60,20 +75,18 @@ public:
 		sceneBuilder.add_game_object(glm::mat4{}, VisualModel{.path = "./data/map.obj"});
 
 		// Describe the "shape" of our geometry data
-		std::vector<gpu::VertexAttribute> vertex_attributes;
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // position
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC3_FLOAT); // normal
-		vertex_attributes.push_back(gpu::VertexAttribute::VEC2_FLOAT); // uv
+		// (position, normal, uv) - the same layout models are imported in
+		const auto& vertex_attributes = gengine::MODEL_VERTEX_LAYOUT;
 
 		// TODO: this is incorrect because GL rendering on Desktop Linux will break
 #ifdef __EMSCRIPTEN__
-		const auto vert = gengine::load_file("./data/gl.vert.glsl");
-		const auto frag = gengine::load_file("./data/gl.frag.glsl");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/gl.vert.glsl");
+		const auto frag = gengine::load_file_view("./data/gl.frag.glsl");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #else
-		const auto vert = gengine::load_file("./data/cube.vert.spv");
-		const auto frag = gengine::load_file("./data/cube.frag.spv");
-		pipeline = gpu->create_pipeline(vert, frag, vertex_attributes);
+		const auto vert = gengine::load_file_view("./data/cube.vert.spv");
+		const auto frag = gengine::load_file_view("./data/cube.frag.spv");
+		pipeline = gpu->create_pipeline(vert.text(), frag.text(), vertex_attributes);
 #endif
 
 		scene = sceneBuilder.build(resources, pipeline, gpu.get(), physics_engine.get(), &texture_factory);
@@ -81,11 +94,15 @@ public:
 		// Assumes all images are uploaded to the GPU and are useless in system memory.
 		texture_factory.unload_all_images();
 
-		cout << "[info]\t SUCCESS!! Created scene with " << scene->transforms.size() << " objects"
+		cout << "[info]\t SUCCESS!! Created scene with " << scene->entities.size() << " entities"
 			 << endl;
 
-		fps_controller =
-			make_unique<FirstPersonController>(physics_engine.get(), camera, scene->collidables[0]);
+		for (const auto& path : reloadable_asset_paths(*scene, resources)) {
+			asset_watcher.watch(path);
+		}
+
+		const auto player = scene->entities.get<RigidBody>(player_entity())->collidable;
+		fps_controller = make_unique<FirstPersonController>(physics_engine.get(), camera, player);
 
 		// start getting things going
 		update_physics(0.16f);
@@ -95,8 +112,11 @@ public:
 	{
 		cout << "~ NativeWorld" << endl;
 
-		for (const auto& rigidbody : resources.rigidbodies) {
-			physics_engine->destroy_collidable(rigidbody);
+		scene->entities.each<RigidBody>([&](gengine::Entity, const RigidBody& body) {
+			physics_engine->destroy_collidable(body.collidable);
+		});
+		for (const auto shape : resources.collision_shapes) {
+			physics_engine->destroy_shape(shape);
 		}
 
 		gpu->destroy_pipeline(pipeline);
@@ -108,11 +128,47 @@ public:
 
 	void update(double elapsed_time) override
 	{
+		// Swap in scene files saved since the last frame
+		if (const auto changed = asset_watcher.poll(); !changed.empty()) {
+			reload_assets(
+				*scene,
+				resources,
+				changed,
+				pipeline,
+				gpu.get(),
+				physics_engine.get(),
+				&texture_factory);
+		}
+
+		if (spawn_balls) {
+			spawn_ball_rain();
+			spawn_balls = false;
+		}
+		if (despawn_balls) {
+			for (const auto ball : balls) {
+				despawn(*scene, physics_engine.get(), ball);
+			}
+			balls.clear();
+			despawn_balls = false;
+		}
 
-		update_input(elapsed_time, scene->collidables[0]);
+		update_input(elapsed_time, scene->entities.get<RigidBody>(player_entity())->collidable);
 		update_physics(elapsed_time);
 
-		camera.Position = glm::vec3(scene->transforms[0][3]);
+		camera.Position = glm::vec3(scene->entities.get<Transform>(player_entity())->matrix[3]);
+
+		auto framebuffer_width = 0;
+		auto framebuffer_height = 0;
+		glfwGetFramebufferSize(window.get(), &framebuffer_width, &framebuffer_height);
+		const auto projection_scale =
+			framebuffer_height / (2.0f * std::tan(glm::radians(gpu::FIELD_OF_VIEW_DEGREES) / 2.0f));
+		select_lod_levels(*scene, camera.Position, projection_scale);
+		stream_textures(*scene, resources, gpu.get(), camera.Position, projection_scale);
+		prepare_instances(*scene, gpu::projection_matrix() * camera.get_view_matrix());
+
+		pick_with_cursor();
+		nearby.clear();
+		scene->spatial_index.query(gengine::Sphere{camera.Position, 20.0f}, nearby);
 
 #ifndef __EMSCRIPTEN__
 		const auto gui_func = [&]() {
@@ -122,7 +178,72 @@ public:
 			SetNextWindowSize({0.0f, 0.0f});
 			Begin("Debug Menu", nullptr, ImGuiWindowFlags_NoCollapse);
 			Text("ms / frame: %.2f", static_cast<float>(elapsed_time));
-			Text("Objects: %i", scene->transforms.size());
+			Text(
+				"Entities: %zu in %zu archetypes",
+				scene->entities.size(),
+				scene->entities.archetype_count());
+			Text(
+				"Draw calls: %zu for %zu instances",
+				scene->instance_batches.size(),
+				scene->instance_transforms.size());
+			Text(
+				"Culling: %zu of %zu visible, %zu culled",
+				scene->culling.visible,
+				scene->culling.tested,
+				scene->culling.culled);
+			Text(
+				"Spatial index: %zu boxes, height %u, %zu within 20 units",
+				scene->spatial_index.size(),
+				scene->spatial_index.height(),
+				nearby.size());
+			if (picked.entity != gengine::NO_ENTITY) {
+				Text("  picked entity %u, %.1f units away", picked.entity.index, picked.distance);
+			}
+			spawn_balls = Button("Spawn 100 balls");
+			SameLine();
+			despawn_balls = Button("Despawn balls");
+			const auto image_stats = texture_factory.get_cache_stats();
+			Text(
+				"Image cache: %zu images, %.1f / %.1f MiB",
+				image_stats.resident_images,
+				image_stats.resident_bytes / (1024.0f * 1024.0f),
+				image_stats.budget_bytes / (1024.0f * 1024.0f));
+			Text(
+				"  hits %zu, misses %zu, evictions %zu",
+				image_stats.hits,
+				image_stats.misses,
+				image_stats.evictions);
+			Text(
+				"Deduplicated: %zu geometries, %zu images, %.1f MiB",
+				resources.deduplicated.geometries,
+				resources.deduplicated.images,
+				resources.deduplicated.bytes / (1024.0f * 1024.0f));
+			const auto io_stats = gengine::FileSystem::shared().stats();
+			for (const auto& mount : io_stats.mounts) {
+				Text(
+					"I/O %s: %llu reads, %.1f MiB, %.1f ms",
+					mount.description.c_str(),
+					static_cast<unsigned long long>(mount.reads),
+					mount.bytes / (1024.0f * 1024.0f),
+					mount.latency_us / 1000.0f);
+			}
+			Text(
+				"  read cache hits %llu, misses %llu, %.1f MiB",
+				static_cast<unsigned long long>(io_stats.cache_hits),
+				static_cast<unsigned long long>(io_stats.cache_misses),
+				io_stats.cache_bytes / (1024.0f * 1024.0f));
+			const auto streaming = resources.texture_streamer.stats();
+			Text(
+				"Streamed textures: %zu, %.1f / %.1f MiB in VRAM",
+				streaming.streamed_images,
+				streaming.resident_bytes / (1024.0f * 1024.0f),
+				streaming.full_bytes / (1024.0f * 1024.0f));
+			Text(
+				"  %.1f KiB this frame, %zu pending, %llu uploads, %llu evictions",
+				streaming.uploaded_bytes / 1024.0f,
+				streaming.pending_loads,
+				static_cast<unsigned long long>(streaming.uploads),
+				static_cast<unsigned long long>(streaming.evictions));
 			// Text("GPU Images: %i", images.size());
 			End();
 			// Matrices
@@ -130,25 +251,49 @@ public:
 			SetNextWindowPos({200.0f, 20.0f});
 			Begin("Matrices");
 			PushItemWidth(200.0f);
-			for (auto i = 0u; i < scene->transforms.size(); i++) {
-				auto& transform = scene->transforms[i];
-				const std::string label = "Pos " + i;
-				InputFloat3(std::to_string(i).c_str(), &transform[3][0]);
-			}
+			scene->entities.each<Transform, RigidBody>(
+				[](gengine::Entity entity, Transform& transform, const RigidBody&) {
+					InputFloat3(std::to_string(entity.index).c_str(), &transform.matrix[3][0]);
+				});
 			PopItemWidth();
 			End();
-			// Textures
-			const auto* images_loaded = texture_factory.get_image_log();
-			if (images_loaded->size() > 0) {
+			// Textures, and where each asset's import time went
+			const auto images_loaded = texture_factory.get_image_log();
+			const auto asset_profiles = gengine::Profiler::shared().assets();
+			if (images_loaded.size() > 0 || asset_profiles.size() > 0) {
 				SetNextWindowSize({0.0f, 0.0f});
 				SetNextWindowPos({500.0f, 20.0f});
 				Begin("Texture Loading Timeline", nullptr, ImGuiWindowFlags_NoCollapse);
-				for (const auto& image_asset : *images_loaded) {
+				for (const auto& image_asset : images_loaded) {
 					Text(
-						"%s (%i x %i)",
+						"%s (%i x %i) %s %.1f KiB",
 						image_asset.name.c_str(),
 						image_asset.width,
-						image_asset.height);
+						image_asset.height,
+						image_asset.baked_format.has_value()
+							? gpu::texture_format_name(*image_asset.baked_format).data()
+							: "decoded",
+						image_asset.size_bytes / 1024.0f);
+				}
+				Separator();
+				for (const auto& profile : asset_profiles) {
+					const auto expanded = TreeNode(
+						profile.asset.c_str(),
+						"%s: %.2f ms",
+						profile.asset.c_str(),
+						profile.duration_us / 1000.0f);
+					if (!expanded) {
+						continue;
+					}
+					for (const auto& stage : profile.stages) {
+						Text(
+							"%s x%zu: %.2f ms, %.1f KiB",
+							stage.stage.c_str(),
+							stage.count,
+							stage.duration_us / 1000.0f,
+							stage.bytes / 1024.0f);
+					}
+					TreePop();
 				}
 				End();
 			}
@@ -160,12 +305,81 @@ public:
 		gpu->render(
 			camera.get_view_matrix(),
 			pipeline,
-			scene->transforms,
-			scene->render_components,
-			scene->descriptors,
+			scene->instance_transforms,
+			scene->instance_batches,
 			gui_func);
 	}
 
+	/// Drop a grid of balls above the player
+	auto spawn_ball_rain() -> void
+	{
+		const auto start = chrono::steady_clock::now();
+		const auto above = glm::vec3(camera.Position) + glm::vec3(0.0f, 30.0f, 0.0f);
+		for (auto i = 0; i < 100; i++) {
+			const auto offset = glm::vec3((i % 10 - 5) * 3.0f, 0.0f, (i / 10 - 5) * 3.0f);
+			const auto ball = spawn(
+				*scene,
+				resources,
+				physics_engine.get(),
+				"./data/spinny.obj",
+				glm::translate(glm::mat4(1.0f), above + offset),
+				TactileSphere{.mass = 1.0f, .radius = 1.0f});
+			if (!ball.has_value()) {
+				cout << "Error: " << ball.error() << endl;
+				return;
+			}
+			balls.push_back(*ball);
+		}
+		const auto spawn_time = chrono::steady_clock::now() - start;
+		cout << "[info]\t Spawned 100 balls in "
+			 << chrono::duration_cast<chrono::microseconds>(spawn_time).count() << " us" << endl;
+	}
+
+	/// In editor mode the cursor is free, and clicking the scene picks what's under it
+	auto pick_with_cursor() -> void
+	{
+		const auto clicking =
+			glfwGetMouseButton(window.get(), GLFW_MOUSE_BUTTON_LEFT) == GLFW_PRESS;
+		const auto clicked = clicking && !was_clicking;
+		was_clicking = clicking;
+		if (!clicked || glfwGetInputMode(window.get(), GLFW_CURSOR) == GLFW_CURSOR_DISABLED) {
+			return;
+		}
+#ifndef __EMSCRIPTEN__
+		if (ImGui::GetIO().WantCaptureMouse) {
+			return;
+		}
+#endif
+
+		auto cursor_x = 0.0;
+		auto cursor_y = 0.0;
+		auto width = 0;
+		auto height = 0;
+		glfwGetCursorPos(window.get(), &cursor_x, &cursor_y);
+		glfwGetWindowSize(window.get(), &width, &height);
+		if (width == 0 || height == 0) {
+			return;
+		}
+
+		// Unproject the cursor onto the near and far planes
+		const auto x = static_cast<float>(2.0 * cursor_x / width - 1.0);
+		const auto y = static_cast<float>(1.0 - 2.0 * cursor_y / height);
+		const auto inverse = glm::inverse(gpu::projection_matrix() * camera.get_view_matrix());
+		const auto near_point = inverse * glm::vec4(x, y, -1.0f, 1.0f);
+		const auto far_point = inverse * glm::vec4(x, y, 1.0f, 1.0f);
+		const auto origin = glm::vec3(near_point) * (1.0f / near_point.w);
+		const auto target = glm::vec3(far_point) * (1.0f / far_point.w);
+
+		picked = scene->spatial_index.raycast(
+			{origin, glm::normalize(target - origin), glm::length(target - origin)});
+	}
+
+	/// The body of the scene's first game object, which the camera follows
+	auto player_entity() const -> gengine::Entity
+	{
+		return scene->instances.front().bodies.front();
+	}
+
 	auto update_input(float delta, gengine::Collidable* player) -> void
 	{
 		auto window_data = static_cast<gengine::WindowData*>(glfwGetWindowUserPointer(window.get()));
@@ -182,9 +396,7 @@ public:
 	{
 		physics_engine->step(delta, 10);
 
-		for (auto i = 0; i < scene->collidables.size(); ++i) {
-			physics_engine->get_model_matrix(scene->collidables[i], scene->transforms[i]);
-		}
+		update_transforms(*scene, physics_engine.get());
 	}
 };
 
@@ -17,10 +17,14 @@
 
 #pragma once
 
+#include "textures.h"
+
 #include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 
 #include <functional>
 #include <memory>
+#include <span>
 #include <string_view>
 #include <vector>
 
@@ -41,11 +45,70 @@ struct Geometry;
 
 /**
  * A "vertex" is a set of attributes, like position, texture coordinates, etc.
+ *
+ * Normalized formats are read by the shader as floats: SNORM maps to [-1, 1] and
+ * UNORM to [0, 1].  Three-component packed formats are padded to four so every
+ * attribute stays 4-byte aligned; the padding is never read.
  */
-enum class VertexAttribute { VEC3_FLOAT, VEC2_FLOAT };
+enum class VertexAttribute {
+	VEC3_FLOAT,
+	VEC2_FLOAT,
+	/// 3 x int16, normalized (8 bytes with padding)
+	VEC3_SNORM16,
+	/// 3 x int8, normalized (4 bytes with padding); suits unit normals
+	VEC3_SNORM8,
+	/// 2 x int16, normalized; suits octahedral-encoded normals
+	VEC2_SNORM16,
+	/// 2 x uint16, normalized; suits texture coordinates inside [0, 1]
+	VEC2_UNORM16,
+	/// 2 x half float; suits texture coordinates that tile
+	VEC2_HALF,
+};
+
+/// Bytes taken by one attribute inside an interleaved vertex
+constexpr auto vertex_attribute_size(VertexAttribute attribute) -> std::size_t
+{
+	switch (attribute) {
+	case VertexAttribute::VEC3_FLOAT:
+		return 3 * sizeof(float);
+	case VertexAttribute::VEC2_FLOAT:
+		return 2 * sizeof(float);
+	case VertexAttribute::VEC3_SNORM16:
+		return 4 * sizeof(int16_t);
+	case VertexAttribute::VEC3_SNORM8:
+		return 4 * sizeof(int8_t);
+	case VertexAttribute::VEC2_SNORM16:
+	case VertexAttribute::VEC2_UNORM16:
+	case VertexAttribute::VEC2_HALF:
+		return 2 * sizeof(int16_t);
+	}
+	return 0;
+}
+
+/// Vertical field of view of the projection that `RenderDevice::render` draws with
+constexpr float FIELD_OF_VIEW_DEGREES = 90.0f;
+
+/// Width over height of that projection
+constexpr float ASPECT_RATIO = 0.8888f;
+
+constexpr float NEAR_PLANE = 0.1f;
+constexpr float FAR_PLANE = 10000.0f;
+
+/// The projection `RenderDevice::render` draws with, in OpenGL clip space
+inline auto projection_matrix() -> glm::mat4
+{
+	return glm::perspective(
+		glm::radians(FIELD_OF_VIEW_DEGREES), ASPECT_RATIO, NEAR_PLANE, FAR_PLANE);
+}
 
 enum class BufferUsage { VERTEX, INDEX };
 
+/// A run of indices inside an index buffer
+struct IndexRange {
+	uint32_t first;
+	uint32_t count;
+};
+
 enum class WindingOrder { CLOCKWISE, COUNTERCLOCKWISE };
 
 enum class ShaderStage { VERTEX, FRAGMENT };
@@ -69,6 +132,19 @@ struct GeometryHandle {
 	bool operator==(const GeometryHandle& other) const { return id == other.id; }
 };
 
+/**
+ * One instanced draw: a geometry drawn with the same descriptors once per transform.
+ * The transforms are a run of the instance transforms passed to `RenderDevice::render`.
+ */
+struct InstanceBatch {
+	GeometryHandle geometry;
+	Descriptors* descriptors;
+	/// Level of detail every instance is drawn at
+	uint32_t lod_level;
+	uint32_t first_instance;
+	uint32_t instance_count;
+};
+
 /**
  * @class gpu::RenderDevice
  * A physical hardware accelerator.
@@ -92,6 +168,7 @@ public:
 
 	/**
 	 * Allocate VRAM and instantiate it with data from RAM.
+	 * @param stride for INDEX buffers, 2 or 4: the width of each index
 	 */
 	virtual auto create_buffer(
 		BufferUsage usage, std::size_t stride, std::size_t element_count, const void* data)
@@ -104,17 +181,57 @@ public:
 	virtual auto destroy_buffer(BufferHandle buffer) -> void = 0;
 
 	/**
-	 * @brief Allocate VRAM and instantiate it with a bitmap image.
-	 * @param name unique
+	 * @brief Allocate VRAM and instantiate it with a bitmap image, generating its mips.
+	 * @param name for logs; images aren't shared by name
 	 * @param width pixels
 	 * @param height pixels
-	 * @param channel_count RGB=3 and RGBA=4
-	 * @param data size must be width*height*channel_count
+	 * @param format picks the GPU format; one- and two-channel images stay that small
+	 * @param data size must be width*height*pixel_format_channels(format)
+	 */
+	virtual auto create_image(
+		const std::string& name,
+		int width,
+		int height,
+		PixelFormat format,
+		const unsigned char* data) -> Image* = 0;
+
+	/**
+	 * @brief Allocate VRAM and upload a baked texture's mip levels.
+	 * @param name for logs; images aren't shared by name
+	 * @param texture must be in a format for which `supports_texture_format` is true
+	 * @param first_level the finest level to upload; the image holds it and every coarser
+	 *        level, and samples as if finer levels didn't exist
 	 */
 	virtual auto create_image(
-		const std::string& name, int width, int height, int channel_count, unsigned char* data)
+		const std::string& name, const TextureData& texture, uint32_t first_level = 0)
 		-> Image* = 0;
 
+	/**
+	 * @brief Change which of a baked texture's levels an image holds, for streaming.
+	 *
+	 * The image is refilled with levels from `first_level` down, and only those take VRAM.
+	 * It stays the same Image, so descriptors binding it need not be remade.  Frames already
+	 * in flight finish with the old levels.
+	 *
+	 * On Vulkan, levels the image already held are copied on the GPU and only finer ones
+	 * are staged from `texture`; the copies are submitted ahead of the next frame's draws,
+	 * and nothing waits on the GPU.  GL sends every level again.
+	 * @param texture the texture the image was created from
+	 */
+	virtual auto set_image_levels(Image* image, const TextureData& texture, uint32_t first_level)
+		-> void = 0;
+
+	/**
+	 * Whether baked textures of this format can be sampled on this device.
+	 */
+	virtual auto supports_texture_format(TextureFormat format) -> bool = 0;
+
+	/**
+	 * Free an image's VRAM.
+	 * @param image must no longer be bound by any Descriptors
+	 */
+	virtual auto destroy_image(Image* image) -> void = 0;
+
 	/**
 	 * @deprecated may be removed in the future
 	 */
@@ -126,6 +243,9 @@ public:
 	 * @param frag_code fragment shader content
 	 * @param vertex_attributes a list of attributes used in each vertex
 	 * @return ShaderPipelineHandle
+	 *
+	 * Each instance's model matrix is a per-instance mat4 input at the location after the
+	 * vertex attributes; with three attributes, `layout (location = 3) in mat4 model`.
 	 */
 	virtual auto create_pipeline(
 		std::string_view vert_code,
@@ -143,6 +263,11 @@ public:
 	create_descriptors(ShaderPipelineHandle pipeline, Image* albedo, const glm::vec3& color)
 		-> Descriptors* = 0;
 
+	/**
+	 * Free descriptors made by `create_descriptors`.
+	 */
+	virtual auto destroy_descriptors(Descriptors* descriptors) -> void = 0;
+
 	virtual auto destroy_pipeline(ShaderPipelineHandle pso) -> void = 0;
 
 	/**
@@ -150,21 +275,37 @@ public:
 	 * @param vertices see implementation
 	 * @param vertices_aux see implementation
 	 * @param indices see implementation
+	 *
+	 * The index width (16 or 32 bits) follows the stride of the index buffer.
 	 */
 	virtual auto create_geometry(
 		ShaderPipelineHandle pipeline, BufferHandle vertex_buffer, BufferHandle index_buffer)
 		-> GeometryHandle = 0;
 
+	/**
+	 * Describe the levels of detail inside a geometry's index buffer.
+	 * @param levels one index range per level, finest first
+	 *
+	 * Without this a geometry has one level: the whole index buffer.
+	 */
+	virtual auto set_geometry_lods(GeometryHandle geometry, const std::vector<IndexRange>& levels)
+		-> void = 0;
+
 	virtual auto destroy_geometry(const GeometryHandle geometry) -> void = 0;
 
 	virtual auto simple_draw(ShaderPipelineHandle pipeline, GeometryHandle geometry) -> void = 0;
 
+	/**
+	 * Draw a frame, one instanced draw call per batch.
+	 * @param instance_transforms every batch's model matrices, uploaded once per frame
+	 * @param batches draws in submission order; consecutive batches sharing descriptors or
+	 *        geometry skip rebinding them
+	 */
 	virtual auto render(
 		const glm::mat4& view,
 		ShaderPipelineHandle pipeline,
-		const std::vector<glm::mat4>& transforms,
-		const std::vector<GeometryHandle>& renderables,
-		const std::vector<Descriptors*>& descriptors,
+		std::span<const glm::mat4> instance_transforms,
+		std::span<const InstanceBatch> batches,
 		std::function<void()> gui_code) -> void = 0;
 };
 } // namespace gpu
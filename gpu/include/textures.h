@@ -0,0 +1,112 @@
+/**
+ * @headerfile textures.h
+ * @brief GPU texture formats, pixel formats of decoded images, and the offline
+ *        encoder for baked textures.
+ *
+ * A baked texture (".gtex") holds one image in a block-compressed format with
+ * every mip level precomputed, so it can be uploaded without decoding and
+ * without generating mips on the GPU.
+ *
+ * Everything here runs on the CPU; nothing needs a RenderDevice.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace gpu {
+
+enum class TextureFormat : uint32_t {
+	/// Uncompressed, 4 bytes per pixel
+	RGBA8,
+	/// 4x4 blocks of 8 bytes; opaque RGB
+	BC1,
+	/// 4x4 blocks of 16 bytes; RGBA (desktop)
+	BC7,
+	/// 4x4 blocks of 8 bytes; opaque RGB (mobile & web)
+	ETC2_RGB8,
+};
+
+/**
+ * Layout of a decoded, uncompressed image: one byte per channel, rows packed with no
+ * padding.  Images keep as few channels as they were stored with.
+ */
+enum class PixelFormat : uint32_t {
+	/// Gray; sampled as (r, r, r, 1)
+	R8,
+	/// Gray and alpha; sampled as (r, r, r, g)
+	RG8,
+	/// Kept at 3 bytes in system memory, widened to RGBA on upload where the GPU needs it
+	RGB8,
+	RGBA8,
+	/// sRGB-encoded color, decoded to linear when sampled
+	RGB8_SRGB,
+	RGBA8_SRGB,
+};
+
+/// Bytes per pixel
+auto pixel_format_channels(PixelFormat format) -> uint32_t;
+
+/// Short lowercase name for logs, e.g. "rg8"
+auto pixel_format_name(PixelFormat format) -> std::string_view;
+
+/// The format of an image decoded with this many channels (as by stb_image)
+auto pixel_format_from_channels(uint32_t channel_count, bool srgb = false) -> PixelFormat;
+
+/**
+ * @brief Copy pixels to RGBA8, filling channels the way sampling the image would.
+ * @param pixels width*height*pixel_format_channels(format) bytes
+ */
+auto expand_to_rgba(PixelFormat format, uint32_t width, uint32_t height, const unsigned char* pixels)
+	-> std::vector<unsigned char>;
+
+/// One mip level; level 0 is the full-size image
+struct TextureLevel {
+	uint32_t width;
+	uint32_t height;
+	std::span<const std::byte> data;
+};
+
+/// A texture ready for upload.  The level spans point into `storage`.
+struct TextureData {
+	TextureFormat format;
+	uint32_t width;
+	uint32_t height;
+	std::vector<TextureLevel> levels;
+	std::shared_ptr<const void> storage;
+};
+
+/// Short lowercase name, e.g. "bc7", as used in baked file names
+auto texture_format_name(TextureFormat format) -> std::string_view;
+
+auto texture_format_from_name(std::string_view name) -> std::optional<TextureFormat>;
+
+/// Bytes taken by one level of the given size
+auto texture_level_size(TextureFormat format, uint32_t width, uint32_t height) -> std::size_t;
+
+/**
+ * @brief Build the full mip chain of an RGBA8 image and encode every level.
+ * @param rgba width*height*4 bytes
+ */
+auto encode_texture(TextureFormat format, uint32_t width, uint32_t height, const unsigned char* rgba)
+	-> TextureData;
+
+/// Serialize a texture into the ".gtex" container
+auto write_texture_file(const TextureData& texture) -> std::vector<std::byte>;
+
+/**
+ * @brief Parse a ".gtex" container in place.
+ * @param storage owns `bytes`; the returned levels keep it alive
+ */
+auto read_texture_file(std::span<const std::byte> bytes, std::shared_ptr<const void> storage)
+	-> std::expected<TextureData, std::string>;
+
+} // namespace gpu
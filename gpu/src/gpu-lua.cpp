@@ -7,11 +7,14 @@
 #include "gpu.h"
 #include "shaders.h"
 #include <GLFW/glfw3.h>
-#include <fstream>
+#include <fcntl.h>
 #include <iostream>
 #include <memory>
 #include <string>
 #include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #undef SOL_SAFE_NUMERICS
 #include <sol/sol.hpp>
@@ -38,16 +41,31 @@ static shared_ptr<GLFWwindow> createSharedGlfwWindow(
 	return shared_ptr<GLFWwindow>(window, GlfwWindowDeleter());
 }
 
-static string open_file(const char* filename)
+/// Map the file and hand its bytes straight to Lua, which makes the only copy
+static sol::object open_file(const char* filename, sol::this_state lua)
 {
-	ifstream file(filename);
-	if (!file.is_open()) {
+	const int fd = open(filename, O_RDONLY);
+	struct stat info {};
+	if (fd < 0 || fstat(fd, &info) != 0) {
 		cerr << "Failed to open file: " << filename << endl;
-		return "";
+		if (fd >= 0) {
+			close(fd);
+		}
+		return sol::make_object(lua, "");
+	}
+
+	const auto size = static_cast<size_t>(info.st_size);
+	void* mapping = size > 0 ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+	close(fd);
+	if (mapping == MAP_FAILED) {
+		cerr << "Failed to map file: " << filename << endl;
+		return sol::make_object(lua, "");
 	}
 
-	string content((istreambuf_iterator<char>(file)), istreambuf_iterator<char>());
-	file.close();
+	const auto content = sol::make_object(lua, string_view{static_cast<const char*>(mapping), size});
+	if (mapping != nullptr) {
+		munmap(mapping, size);
+	}
 	return content;
 }
 
@@ -112,7 +130,20 @@ int main()
 	lua["BufferUsage"] =
 		lua.create_table_with("VERTEX", gpu::BufferUsage::VERTEX, "INDEX", gpu::BufferUsage::INDEX);
 	lua["VertexAttribute"] = lua.create_table_with(
-		"VEC3", gpu::VertexAttribute::VEC3_FLOAT, "VEC2", gpu::VertexAttribute::VEC2_FLOAT);
+		"VEC3",
+		gpu::VertexAttribute::VEC3_FLOAT,
+		"VEC2",
+		gpu::VertexAttribute::VEC2_FLOAT,
+		"VEC3_SNORM16",
+		gpu::VertexAttribute::VEC3_SNORM16,
+		"VEC3_SNORM8",
+		gpu::VertexAttribute::VEC3_SNORM8,
+		"VEC2_SNORM16",
+		gpu::VertexAttribute::VEC2_SNORM16,
+		"VEC2_UNORM16",
+		gpu::VertexAttribute::VEC2_UNORM16,
+		"VEC2_HALF",
+		gpu::VertexAttribute::VEC2_HALF);
 	lua["WindingOrder"] = lua.create_table_with(
 		"CLOCKWISE",
 		gpu::WindingOrder::CLOCKWISE,
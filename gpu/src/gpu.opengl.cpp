@@ -15,12 +15,39 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <algorithm>
+#include <cstring>
 #include <iostream>
 
+// Compressed formats aren't declared by every GL header we build against
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM_EXT
+#define GL_COMPRESSED_RGBA_BPTC_UNORM_EXT 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_RGB8_ETC2
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#endif
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B
+#endif
+// Nor are the unsized luminance formats and sRGB in every profile
+#ifndef GL_LUMINANCE
+#define GL_LUMINANCE 0x1909
+#endif
+#ifndef GL_LUMINANCE_ALPHA
+#define GL_LUMINANCE_ALPHA 0x190A
+#endif
+#ifndef GL_SRGB8_ALPHA8
+#define GL_SRGB8_ALPHA8 0x8C43
+#endif
+
 using namespace std;
 
 struct gpu::Buffer {
 	std::size_t element_count;
+	std::size_t stride;
 	GLuint gl_buffer;
 };
 
@@ -42,6 +69,19 @@ struct gpu::Geometry {
 	gpu::BufferHandle vbo;
 	gpu::BufferHandle ebo;
 	unsigned long index_count;
+	/// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	GLenum index_type;
+	/// Levels of detail within `ebo`; empty means one level of `index_count` indices
+	std::vector<gpu::IndexRange> lods;
+
+	/// The range to draw at `level`, or the coarsest one if there aren't that many
+	auto lod(uint32_t level) const -> gpu::IndexRange
+	{
+		if (lods.empty()) {
+			return {0, static_cast<uint32_t>(index_count)};
+		}
+		return lods[std::min<size_t>(level, lods.size() - 1)];
+	}
 };
 
 // This abstracts over OpenGL/glES differences
@@ -74,6 +114,25 @@ void deleteVertexArrays(GLsizei count, const GLuint* vaos)
 #endif
 }
 
+void vertexAttribDivisor(GLuint index, GLuint divisor)
+{
+#ifdef __EMSCRIPTEN__
+	glVertexAttribDivisorANGLE(index, divisor);
+#else
+	glVertexAttribDivisor(index, divisor);
+#endif
+}
+
+void drawElementsInstanced(
+	GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instance_count)
+{
+#ifdef __EMSCRIPTEN__
+	glDrawElementsInstancedANGLE(mode, count, type, indices, instance_count);
+#else
+	glDrawElementsInstanced(mode, count, type, indices, instance_count);
+#endif
+}
+
 void GLAPIENTRY messageCallback(
 	GLenum source,
 	GLenum type,
@@ -118,6 +177,9 @@ class RenderDeviceGL : public RenderDevice {
 	std::vector<ShaderPipeline*> res_pipelines;
 	std::vector<Geometry*> res_geometries;
 
+	/// Every batch's model matrices for the frame being drawn, streamed anew each frame
+	GLuint instance_buffer = 0;
+
 public:
 	RenderDeviceGL(shared_ptr<GLFWwindow> window) : window{window}
 	{
@@ -143,6 +205,8 @@ public:
 
 		glCullFace(GL_BACK);
 		glFrontFace(GL_CCW);
+
+		glGenBuffers(1, &instance_buffer);
 	}
 
 	~RenderDeviceGL()
@@ -173,6 +237,8 @@ public:
 				delete pipeline;
 			}
 		}
+
+		glDeleteBuffers(1, &instance_buffer);
 	}
 
 	auto create_buffer(
@@ -190,7 +256,7 @@ public:
 		glBindBuffer(buffer_type, VBO);
 		glBufferData(buffer_type, size, data, GL_STATIC_DRAW);
 		uint64_t buffer_handle = res_buffers.size();
-		res_buffers.push_back(new Buffer{element_count, VBO});
+		res_buffers.push_back(new Buffer{element_count, stride, VBO});
 		return {.id = buffer_handle};
 	}
 
@@ -208,9 +274,21 @@ public:
 	}
 
 	auto create_image(
-		const std::string& name, int width, int height, int channel_count, unsigned char* data_in)
-		-> Image* override
+		const std::string& name,
+		int width,
+		int height,
+		PixelFormat format,
+		const unsigned char* data_in) -> Image* override
 	{
+		// ES 3.0 can't generate mips for 3-channel sRGB, so it goes up as RGBA
+		auto widened = vector<unsigned char>{};
+		if (format == PixelFormat::RGB8_SRGB) {
+			widened = expand_to_rgba(format, width, height, data_in);
+			data_in = widened.data();
+			format = PixelFormat::RGBA8_SRGB;
+		}
+		const auto [internal_format, pixel_format] = gl_pixel_format(format);
+
 		GLuint texture;
 		glGenTextures(1, &texture);
 		glBindTexture(GL_TEXTURE_2D, texture);
@@ -220,17 +298,189 @@ public:
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
 		// const float tex_border_color[] = {1.0f, 1.0f, 0.0f, 1.0f};
 		// glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, tex_border_color);
+		// Rows of 1-3 byte pixels needn't be 4-byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
 		glTexImage2D(
-			GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data_in);
+			GL_TEXTURE_2D,
+			0,
+			internal_format,
+			width,
+			height,
+			0,
+			pixel_format,
+			GL_UNSIGNED_BYTE,
+			data_in);
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		const auto image = new Image{texture};
 
-		cout << "GPU Image " << name << " " << image << endl;
+		cout << "GPU Image " << name << " " << pixel_format_name(format) << " " << image << endl;
 
 		return image;
 	}
 
+	auto create_image(const std::string& name, const TextureData& texture, uint32_t first_level)
+		-> Image* override
+	{
+		const auto image = new Image{upload_texture(texture, first_level)};
+
+		cout << "GPU Image " << name << " " << texture_format_name(texture.format)
+			 << " mips:" << texture.levels.size() - first_level << "/" << texture.levels.size()
+			 << " " << image << endl;
+
+		return image;
+	}
+
+	auto set_image_levels(Image* image, const TextureData& texture, uint32_t first_level)
+		-> void override
+	{
+		// Descriptors hold the Image, not the GL texture, so swapping textures rebinds them
+		const auto gl_texture = upload_texture(texture, first_level);
+		glDeleteTextures(1, &image->gl_texture);
+		image->gl_texture = gl_texture;
+	}
+
+	/// Make a texture of a baked texture's levels from `first_level` down to 1x1
+	static auto upload_texture(const TextureData& texture, uint32_t first_level) -> GLuint
+	{
+		GLuint gl_texture;
+		glGenTextures(1, &gl_texture);
+		glBindTexture(GL_TEXTURE_2D, gl_texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+
+		// Every level is baked, so there is nothing to generate
+		first_level = std::min<uint32_t>(first_level, texture.levels.size() - 1);
+		for (auto level = first_level; level < texture.levels.size(); level++) {
+			const auto& data = texture.levels[level];
+			if (texture.format == TextureFormat::RGBA8) {
+				glTexImage2D(
+					GL_TEXTURE_2D,
+					level - first_level,
+					GL_RGBA,
+					data.width,
+					data.height,
+					0,
+					GL_RGBA,
+					GL_UNSIGNED_BYTE,
+					data.data.data());
+			}
+			else {
+				glCompressedTexImage2D(
+					GL_TEXTURE_2D,
+					level - first_level,
+					compressed_format(texture.format),
+					data.width,
+					data.height,
+					0,
+					data.data.size(),
+					data.data.data());
+			}
+		}
+
+		return gl_texture;
+	}
+
+	auto supports_texture_format(TextureFormat format) -> bool override
+	{
+		const auto extensions = reinterpret_cast<const char*>(glGetString(GL_EXTENSIONS));
+		const auto has_extension = [extensions](const char* name) {
+			return extensions != nullptr && strstr(extensions, name) != nullptr;
+		};
+
+		switch (format) {
+		case TextureFormat::RGBA8:
+			return true;
+		case TextureFormat::BC1:
+			return has_extension("texture_compression_s3tc") ||
+				   has_extension("compressed_texture_s3tc");
+		case TextureFormat::BC7:
+			return has_extension("texture_compression_bptc");
+		case TextureFormat::ETC2_RGB8:
+#ifdef __EMSCRIPTEN__
+			return has_extension("compressed_texture_etc");
+#else
+			// Core in OpenGL ES 3.0
+			return true;
+#endif
+		}
+		return false;
+	}
+
+	struct PixelTransfer {
+		GLint internal_format;
+		GLenum format;
+	};
+
+	/// Luminance formats sample as gray (with alpha) without texture swizzles, which WebGL lacks
+	static auto gl_pixel_format(PixelFormat format) -> PixelTransfer
+	{
+		switch (format) {
+		case PixelFormat::R8:
+			return {GL_LUMINANCE, GL_LUMINANCE};
+		case PixelFormat::RG8:
+			return {GL_LUMINANCE_ALPHA, GL_LUMINANCE_ALPHA};
+		case PixelFormat::RGB8:
+			return {GL_RGB, GL_RGB};
+		case PixelFormat::RGBA8_SRGB:
+			return {GL_SRGB8_ALPHA8, GL_RGBA};
+		default:
+			return {GL_RGBA, GL_RGBA};
+		}
+	}
+
+	static auto compressed_format(TextureFormat format) -> GLenum
+	{
+		switch (format) {
+		case TextureFormat::BC1:
+			return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case TextureFormat::BC7:
+			return GL_COMPRESSED_RGBA_BPTC_UNORM_EXT;
+		case TextureFormat::ETC2_RGB8:
+			return GL_COMPRESSED_RGB8_ETC2;
+		default:
+			return GL_RGBA;
+		}
+	}
+
+	struct AttributeFormat {
+		GLint components;
+		GLenum type;
+		GLboolean normalized;
+	};
+
+	static auto transcode_vertex_attribute(VertexAttribute attribute) -> AttributeFormat
+	{
+		switch (attribute) {
+		case VertexAttribute::VEC3_FLOAT:
+			return {3, GL_FLOAT, GL_FALSE};
+		case VertexAttribute::VEC2_FLOAT:
+			return {2, GL_FLOAT, GL_FALSE};
+		case VertexAttribute::VEC3_SNORM16:
+			return {3, GL_SHORT, GL_TRUE};
+		case VertexAttribute::VEC3_SNORM8:
+			return {3, GL_BYTE, GL_TRUE};
+		case VertexAttribute::VEC2_SNORM16:
+			return {2, GL_SHORT, GL_TRUE};
+		case VertexAttribute::VEC2_UNORM16:
+			return {2, GL_UNSIGNED_SHORT, GL_TRUE};
+		case VertexAttribute::VEC2_HALF:
+			return {2, GL_HALF_FLOAT, GL_FALSE};
+		}
+		cout << "Error: unknown vertex attribute " << static_cast<int>(attribute) << endl;
+		return {1, GL_FLOAT, GL_FALSE};
+	}
+
+	auto destroy_image(Image* image) -> void override
+	{
+		cout << "~ GPU Image " << image << endl;
+		glDeleteTextures(1, &image->gl_texture);
+		delete image;
+	}
+
 	auto destroy_all_images() -> void override { cout << "Destroying all images" << endl; }
 
 	auto create_pipeline(
@@ -245,8 +495,10 @@ public:
 
 		// Compile vertex shader
 		GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
+		// Pass lengths, since the code may be a view into a file and not null-terminated
 		const auto vertex_source = vert_code.data();
-		glShaderSource(vertex_shader, 1, &vertex_source, nullptr);
+		const auto vertex_length = static_cast<GLint>(vert_code.size());
+		glShaderSource(vertex_shader, 1, &vertex_source, &vertex_length);
 		glCompileShader(vertex_shader);
 		glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &success);
 		if (!success) {
@@ -260,7 +512,8 @@ public:
 		// Compile fragment shader
 		GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
 		const auto fragment_source = frag_code.data();
-		glShaderSource(fragment_shader, 1, &fragment_source, nullptr);
+		const auto fragment_length = static_cast<GLint>(frag_code.size());
+		glShaderSource(fragment_shader, 1, &fragment_source, &fragment_length);
 		glCompileShader(fragment_shader);
 		glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &success);
 		if (!success) {
@@ -308,6 +561,12 @@ public:
 		return descriptor;
 	}
 
+	auto destroy_descriptors(Descriptors* descriptors) -> void override
+	{
+		cout << "~ GPU Descriptor " << descriptors << endl;
+		delete descriptors;
+	}
+
 	auto destroy_pipeline(ShaderPipelineHandle pso_handle) -> void override
 	{
 		if (pso_handle.id == UINT64_MAX) {
@@ -348,34 +607,37 @@ public:
 
 		// First, calculate the size of one vertex
 		for (size_t attribute_idx = 0; attribute_idx < attribute_count; attribute_idx++) {
-			const auto attribute = pipeline->vertex_attributes.at(attribute_idx);
-			if (attribute == VertexAttribute::VEC3_FLOAT)
-				vertex_size += 3 * sizeof(float);
-			else if (attribute == VertexAttribute::VEC2_FLOAT)
-				vertex_size += 2 * sizeof(float);
+			vertex_size += vertex_attribute_size(pipeline->vertex_attributes.at(attribute_idx));
 		}
 
 		// Next, generate the gl vertex attributes
 		size_t attribute_offset = 0;
 		for (size_t attribute_idx = 0; attribute_idx < attribute_count; attribute_idx++) {
 			const auto attribute = pipeline->vertex_attributes.at(attribute_idx);
-			if (attribute == VertexAttribute::VEC3_FLOAT) {
-				glVertexAttribPointer(
-					attribute_idx, 3, GL_FLOAT, GL_FALSE, vertex_size, (void*)(attribute_offset));
-				glEnableVertexAttribArray(attribute_idx);
-				attribute_offset += 3 * sizeof(float);
-			}
-			else if (attribute == VertexAttribute::VEC2_FLOAT) {
-				glVertexAttribPointer(
-					attribute_idx, 2, GL_FLOAT, GL_FALSE, vertex_size, (void*)(attribute_offset));
-				glEnableVertexAttribArray(attribute_idx);
-				attribute_offset += 2 * sizeof(float);
-			}
+			const auto format = transcode_vertex_attribute(attribute);
+			glVertexAttribPointer(
+				attribute_idx,
+				format.components,
+				format.type,
+				format.normalized,
+				vertex_size,
+				(void*)(attribute_offset));
+			glEnableVertexAttribArray(attribute_idx);
+			attribute_offset += vertex_attribute_size(attribute);
 		}
 
+		// The model matrix follows, one column per location, advancing once per instance
+		for (auto column = 0u; column < 4; column++) {
+			glEnableVertexAttribArray(attribute_count + column);
+			webgl::vertexAttribDivisor(attribute_count + column, 1);
+		}
+		bind_instance_transforms(attribute_count, 0);
+
 		const auto index_count = index_buffer->element_count;
+		const auto index_type =
+			index_buffer->stride == sizeof(uint16_t) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
 		const auto gpu_geometry =
-			new Geometry{vao, vertex_buffer_handle, index_buffer_handle, index_count};
+			new Geometry{vao, vertex_buffer_handle, index_buffer_handle, index_count, index_type};
 
 		cout << "GPU Geometry indices: " << index_count << " " << gpu_geometry << endl;
 
@@ -385,6 +647,13 @@ public:
 		return {.id = geometry_handle};
 	}
 
+	auto set_geometry_lods(GeometryHandle geometry_handle, const vector<IndexRange>& levels)
+		-> void override
+	{
+		Geometry* geometry = res_geometries.at(geometry_handle.id);
+		geometry->lods = levels;
+	}
+
 	auto destroy_geometry(const GeometryHandle geometry_handle) -> void override
 	{
 		if (geometry_handle.id == UINT64_MAX) {
@@ -416,20 +685,16 @@ public:
 
 		Geometry* geometry = res_geometries.at(geometry_handle.id);
 		webgl::bindVertexArray(geometry->vao);
-		glDrawElements(GL_TRIANGLES, geometry->index_count, GL_UNSIGNED_INT, 0);
+		glDrawElements(GL_TRIANGLES, geometry->index_count, geometry->index_type, 0);
 	}
 
 	auto render(
 		const glm::mat4& view,
 		ShaderPipelineHandle pipeline_handle,
-		const vector<glm::mat4>& transforms,
-		const vector<GeometryHandle>& geometries,
-		const vector<Descriptors*>& descriptors,
+		span<const glm::mat4> instance_transforms,
+		span<const InstanceBatch> batches,
 		function<void()> gui_code) -> void override
 	{
-		assert(transforms.size() == geometries.size());
-		assert(transforms.size() == descriptors.size());
-
 		GLenum err;
 		while ((err = glGetError()) != GL_NO_ERROR) {
 			cout << "GL Error: " << err << endl;
@@ -441,28 +706,62 @@ public:
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 		glUseProgram(pipeline->gl_program);
 
-		auto proj = glm::perspective(glm::radians(90.0f), 0.8888f, 0.1f, 10000.0f);
+		auto proj = projection_matrix();
 		const GLint u_projection = glGetUniformLocation(pipeline->gl_program, "projection");
 		glUniformMatrix4fv(u_projection, 1, GL_FALSE, glm::value_ptr(proj));
 		const GLint u_view = glGetUniformLocation(pipeline->gl_program, "view");
 		glUniformMatrix4fv(u_view, 1, GL_FALSE, glm::value_ptr(view));
 
-		for (int i = 0; i < transforms.size(); i++) {
-			const auto& matrix = transforms[i];
-			const auto& geometry_handle = geometries[i];
-			const auto& descriptor = descriptors[i];
-
-			const GLint u_model = glGetUniformLocation(pipeline->gl_program, "model");
-			glUniformMatrix4fv(u_model, 1, GL_FALSE, glm::value_ptr(matrix));
-
-			glActiveTexture(GL_TEXTURE0);
-			glBindTexture(GL_TEXTURE_2D, descriptor->albedo->gl_texture);
-			const auto location = glGetUniformLocation(pipeline->gl_program, "tDiffuse");
-			glUniform1i(location, 0);
+		glActiveTexture(GL_TEXTURE0);
+		const auto location = glGetUniformLocation(pipeline->gl_program, "tDiffuse");
+		glUniform1i(location, 0);
+
+		// Reallocating orphans last frame's buffer, so the upload doesn't wait for its draws
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		glBufferData(
+			GL_ARRAY_BUFFER,
+			instance_transforms.size_bytes(),
+			instance_transforms.data(),
+			GL_STREAM_DRAW);
+
+		const auto instance_location = static_cast<GLuint>(pipeline->vertex_attributes.size());
+		const Descriptors* bound_descriptors = nullptr;
+		for (const auto& batch : batches) {
+			if (batch.descriptors != bound_descriptors) {
+				glBindTexture(GL_TEXTURE_2D, batch.descriptors->albedo->gl_texture);
+				bound_descriptors = batch.descriptors;
+			}
 
-			Geometry* geometry = res_geometries.at(geometry_handle.id);
+			// ES 3.0 has no base instance, so the matrices are pointed at the batch's run
+			Geometry* geometry = res_geometries.at(batch.geometry.id);
 			webgl::bindVertexArray(geometry->vao);
-			glDrawElements(GL_TRIANGLES, geometry->index_count, GL_UNSIGNED_INT, 0);
+			bind_instance_transforms(instance_location, batch.first_instance);
+
+			const auto lod = geometry->lod(batch.lod_level);
+			const auto index_size = geometry->index_type == GL_UNSIGNED_SHORT ? 2 : 4;
+			webgl::drawElementsInstanced(
+				GL_TRIANGLES,
+				lod.count,
+				geometry->index_type,
+				reinterpret_cast<void*>(static_cast<uintptr_t>(lod.first) * index_size),
+				batch.instance_count);
+		}
+	}
+
+private:
+	/// Point the bound vertex array's model matrix inputs at one instance onwards
+	auto bind_instance_transforms(GLuint first_location, uint32_t first_instance) -> void
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, instance_buffer);
+		const auto offset = static_cast<uintptr_t>(first_instance) * sizeof(glm::mat4);
+		for (auto column = 0u; column < 4; column++) {
+			glVertexAttribPointer(
+				first_location + column,
+				4,
+				GL_FLOAT,
+				GL_FALSE,
+				sizeof(glm::mat4),
+				reinterpret_cast<void*>(offset + column * sizeof(glm::vec4)));
 		}
 	}
 };
@@ -15,6 +15,8 @@
 #include <fstream>
 #include <functional>
 #include <iostream>
+#include <list>
+#include <span>
 #include <memory>
 #include <vector>
 #include <vulkan/vulkan_core.h>
@@ -34,17 +36,43 @@ auto instance = vk::Instance{};
 const auto FRAMES_IN_FLIGHT = 2;
 const auto SWAPCHAIN_SIZE = 3;
 
+/**
+ * Vulkan format of one vertex attribute.  Padded three-component formats are fetched
+ * as four components; the shader only reads the first three.
+ */
+auto transcode_vertex_format(gpu::VertexAttribute attribute) -> vk::Format
+{
+	switch (attribute) {
+	case gpu::VertexAttribute::VEC3_FLOAT:
+		return vk::Format::eR32G32B32Sfloat;
+	case gpu::VertexAttribute::VEC2_FLOAT:
+		return vk::Format::eR32G32Sfloat;
+	case gpu::VertexAttribute::VEC3_SNORM16:
+		return vk::Format::eR16G16B16A16Snorm;
+	case gpu::VertexAttribute::VEC3_SNORM8:
+		return vk::Format::eR8G8B8A8Snorm;
+	case gpu::VertexAttribute::VEC2_SNORM16:
+		return vk::Format::eR16G16Snorm;
+	case gpu::VertexAttribute::VEC2_UNORM16:
+		return vk::Format::eR16G16Unorm;
+	case gpu::VertexAttribute::VEC2_HALF:
+		return vk::Format::eR16G16Sfloat;
+	}
+	return vk::Format::eUndefined;
+}
+
 /**
  * Utility function to convert a list of gpu::VertexAttribtute into Vulkan attribute descriptions
  */
 void transcode_vertex_attributes(
 	const std::vector<gpu::VertexAttribute>& attributes_in,
 	std::vector<vk::VertexInputAttributeDescription>& vk_attributes_out,
-	vk::VertexInputBindingDescription& binding_out)
+	std::vector<vk::VertexInputBindingDescription>& bindings_out)
 {
 
-	// There's only one vertex buffer, so hard-code the binding to 0.
+	// One buffer of vertices, and one of per-instance model matrices
 	const int VERTEX_BUFFER_BINDING = 0;
+	const int INSTANCE_BUFFER_BINDING = 1;
 
 	const size_t attribute_count = attributes_in.size();
 	vk_attributes_out.clear();
@@ -54,38 +82,47 @@ void transcode_vertex_attributes(
 	size_t vertex_size = 0;
 	for (size_t attribute_idx = 0; attribute_idx < attribute_count; attribute_idx++) {
 		const auto attribute_in = attributes_in.at(attribute_idx);
-		// [float, float, float]
-		if (attribute_in == gpu::VertexAttribute::VEC3_FLOAT) {
-			const vk::VertexInputAttributeDescription vk_attribute(
-				attribute_idx, VERTEX_BUFFER_BINDING, vk::Format::eR32G32B32Sfloat, vertex_size);
-			vk_attributes_out.push_back(vk_attribute);
-			vertex_size += 3 * sizeof(float);
-		}
-		// [float, float]
-		else if (attribute_in == gpu::VertexAttribute::VEC2_FLOAT) {
-			const vk::VertexInputAttributeDescription vk_attribute(
-				attribute_idx, VERTEX_BUFFER_BINDING, vk::Format::eR32G32Sfloat, vertex_size);
-			vk_attributes_out.push_back(vk_attribute);
-			vertex_size += 2 * sizeof(float);
-		}
-		// unknown
-		else {
+		const auto format = transcode_vertex_format(attribute_in);
+		if (format == vk::Format::eUndefined) {
 			std::cerr << "Error while processing vertex attributes: unknown attribute "
 					  << static_cast<int>(attribute_in) << std::endl;
+			continue;
 		}
+		vk_attributes_out.push_back(vk::VertexInputAttributeDescription(
+			attribute_idx, VERTEX_BUFFER_BINDING, format, vertex_size));
+		vertex_size += gpu::vertex_attribute_size(attribute_in);
+	}
+
+	// The model matrix follows the vertex attributes, one column per location
+	for (uint32_t column = 0; column < 4; column++) {
+		vk_attributes_out.push_back(vk::VertexInputAttributeDescription(
+			attribute_count + column,
+			INSTANCE_BUFFER_BINDING,
+			vk::Format::eR32G32B32A32Sfloat,
+			column * sizeof(glm::vec4)));
 	}
 
-	// Generate the Vulkan vertex binding
-	binding_out = vk::VertexInputBindingDescription(
-		VERTEX_BUFFER_BINDING, vertex_size, vk::VertexInputRate::eVertex);
+	// Generate the Vulkan vertex bindings
+	bindings_out = {
+		vk::VertexInputBindingDescription(
+			VERTEX_BUFFER_BINDING, vertex_size, vk::VertexInputRate::eVertex),
+		vk::VertexInputBindingDescription(
+			INSTANCE_BUFFER_BINDING, sizeof(glm::mat4), vk::VertexInputRate::eInstance)};
 }
 
 struct PushConstantData {
-	glm::mat4 model;
 	glm::mat4 view;
 	glm::vec3 color;
 };
 
+/// Model matrices for one frame in flight, mapped for as long as it lives
+struct InstanceBuffer {
+	vk::Buffer buffer;
+	vk::DeviceMemory mem;
+	std::size_t capacity;
+	void* mapped;
+};
+
 const auto BUFFER_USAGE_TABLE =
 	std::array{vk::BufferUsageFlagBits::eVertexBuffer, vk::BufferUsageFlagBits::eIndexBuffer};
 
@@ -97,6 +134,7 @@ struct Buffer {
 	vk::Buffer buffer;
 	vk::DeviceMemory mem;
 	size_t size;
+	size_t stride;
 };
 
 struct Image {
@@ -105,6 +143,36 @@ struct Image {
 	vk::ImageView view;
 	vk::DeviceMemory mem;
 	vk::Sampler sampler;
+	/// Descriptors sampling this image, whose sets are rewritten when it's refilled
+	std::vector<Descriptors*> bound_descriptors;
+	/// The baked texture's level held as this image's level 0, and how many it holds
+	uint32_t first_level = 0;
+	uint32_t level_count = 1;
+};
+
+/// An image replaced while frames in flight may still sample or copy from it
+struct RetiredImage {
+	Image image;
+	/// The last frame which uses it
+	uint64_t frame;
+};
+
+struct StagingBuffer {
+	vk::Buffer buffer;
+	vk::DeviceMemory mem;
+};
+
+/// Copies into a new image of a baked texture, recorded into the next frame's transfers
+struct PendingUpload {
+	vk::Image image;
+	uint32_t level_count;
+	/// Levels coming from RAM; empty when every level is copied from `source`
+	StagingBuffer staging;
+	std::vector<vk::BufferImageCopy> buffer_copies;
+	/// The image this one replaces, whose levels both hold are copied on the GPU
+	vk::Image source;
+	uint32_t source_level_count;
+	std::vector<vk::ImageCopy> image_copies;
 };
 
 struct ShaderPipeline {
@@ -115,14 +183,29 @@ struct ShaderPipeline {
 };
 
 struct Descriptors {
-	vk::DescriptorSet descset;
+	/// One set per frame in flight, so one can be rewritten while another is in use
+	std::array<vk::DescriptorSet, FRAMES_IN_FLIGHT> descsets;
 	glm::vec3 color;
+	Image* albedo;
+	/// One bit per frame in flight whose set still samples a replaced image
+	uint32_t stale_frames = 0;
 };
 
 struct Geometry {
 	BufferHandle vbo;
 	BufferHandle ebo;
 	unsigned long index_count;
+	/// Levels of detail within `ebo`; empty means one level of `index_count` indices
+	std::vector<IndexRange> lods;
+
+	/// The range to draw at `level`, or the coarsest one if there aren't that many
+	auto lod(uint32_t level) const -> IndexRange
+	{
+		if (lods.empty()) {
+			return {0, static_cast<uint32_t>(index_count)};
+		}
+		return lods[std::min<size_t>(level, lods.size() - 1)];
+	}
 };
 
 class RenderContextVk final {
@@ -175,12 +258,16 @@ public:
 	auto bind_geometry_buffers(Buffer* vbo, Buffer* ebo) -> void
 	{
 		cmdbuf.bindVertexBuffers(0, vbo->buffer, {0});
-		cmdbuf.bindIndexBuffer(ebo->buffer, 0, vk::IndexType::eUint32);
+		const auto index_type =
+			ebo->stride == sizeof(uint16_t) ? vk::IndexType::eUint16 : vk::IndexType::eUint32;
+		cmdbuf.bindIndexBuffer(ebo->buffer, 0, index_type);
 	}
 
-	auto draw(int vertex_count, int instance_count) -> void
+	auto draw(
+		int vertex_count, int instance_count, uint32_t first_index = 0, uint32_t first_instance = 0)
+		-> void
 	{
-		cmdbuf.drawIndexed(vertex_count, instance_count, 0, 0, 0);
+		cmdbuf.drawIndexed(vertex_count, instance_count, first_index, 0, first_instance);
 	}
 
 	//
@@ -296,6 +383,11 @@ public:
 
 			const auto extension_names = std::array{"VK_KHR_swapchain"};
 
+			// Baked textures may use whichever compressed formats the hardware offers
+			const auto supported_features = physical_device.getFeatures();
+			enabled_features.textureCompressionBC = supported_features.textureCompressionBC;
+			enabled_features.textureCompressionETC2 = supported_features.textureCompressionETC2;
+
 			const auto device_info = vk::DeviceCreateInfo(
 				{},
 				1,
@@ -303,7 +395,8 @@ public:
 				0,
 				nullptr,
 				extension_names.size(),
-				extension_names.data());
+				extension_names.data(),
+				&enabled_features);
 
 			device = physical_device.createDevice(device_info);
 
@@ -323,6 +416,9 @@ public:
 			const auto alloced_buffers = device.allocateCommandBuffers(alloc_info);
 
 			cmd_buffers.insert(cmd_buffers.end(), alloced_buffers.begin(), alloced_buffers.end());
+
+			const auto transfer_buffers = device.allocateCommandBuffers(alloc_info);
+			std::ranges::copy(transfer_buffers, transfer_cmd_buffers.begin());
 		}
 
 		// create swapchain
@@ -419,6 +515,14 @@ public:
 
 		// TODO(seth) - clean up res_buffers pls :)
 
+		for (auto& instances : instance_buffers) {
+			release_instance_buffer(instances);
+		}
+
+		for (auto& staging : transfer_staging) {
+			release_staging(staging);
+		}
+
 		device.destroyDescriptorPool(descpool);
 
 		device.destroyDescriptorSetLayout(descset_layout);
@@ -522,7 +626,7 @@ public:
 		device.freeMemory(staging_mem);
 
 		uint64_t buffer_handle = res_buffers.size();
-		res_buffers.push_back(new Buffer{buffer, buffer_mem, element_count});
+		res_buffers.push_back(new Buffer{buffer, buffer_mem, element_count, stride});
 		return {.id = buffer_handle};
 	}
 
@@ -542,19 +646,27 @@ public:
 	}
 
 	auto create_image(
-		const std::string& name, int width, int height, int channel_count, unsigned char* data_in)
-		-> Image* override
+		const std::string& name,
+		int width,
+		int height,
+		PixelFormat format,
+		const unsigned char* data_in) -> Image* override
 	{
-		if (image_cache.find(name) != image_cache.end()) {
-			return &image_cache.at(name);
+		// 24-bit formats are rarely sampleable, so RGB goes up as RGBA
+		auto widened = std::vector<unsigned char>{};
+		if (pixel_format_channels(format) == 3) {
+			widened = expand_to_rgba(format, width, height, data_in);
+			data_in = widened.data();
 		}
+		const auto [vk_format, component_mapping] = vk_pixel_format(format);
 
 		// TODO - determine if we even need a staging buffer!
 
 		auto staging_buffer = vk::Buffer{};
 		auto staging_mem = vk::DeviceMemory{};
 
-		const auto image_buffer_size = width * height * channel_count;
+		const auto image_buffer_size =
+			widened.empty() ? width * height * pixel_format_channels(format) : widened.size();
 
 		createBufferVk(
 			device,
@@ -578,7 +690,7 @@ public:
 			name,
 			width,
 			height,
-			vk::Format::eR8G8B8A8Unorm,
+			vk_format,
 			vk::ImageTiling::eOptimal,
 			vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst |
 				vk::ImageUsageFlagBits::eSampled,
@@ -588,7 +700,7 @@ public:
 			mipLevels);
 		transition_image_layout(
 			image,
-			vk::Format::eR8G8B8A8Unorm,
+			vk_format,
 			vk::ImageLayout::eUndefined,
 			vk::ImageLayout::eTransferDstOptimal,
 			mipLevels);
@@ -602,15 +714,326 @@ public:
 		device.freeMemory(staging_mem);
 
 		const auto image_view = create_image_view(
-			image, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor, mipLevels);
+			image, vk_format, vk::ImageAspectFlagBits::eColor, mipLevels, component_mapping);
 
 		const auto sampler = create_sampler(mipLevels);
 
 		const auto gpu_image = Image{name, image, image_view, image_mem, sampler};
 
-		image_cache[name] = gpu_image;
+		images.push_back(gpu_image);
+
+		return &images.back();
+	}
+
+	auto create_image(const std::string& name, const TextureData& texture, uint32_t first_level)
+		-> Image* override
+	{
+		images.push_back(upload_texture(name, texture, first_level, nullptr));
+		return &images.back();
+	}
 
-		return &image_cache[name];
+	auto set_image_levels(Image* image, const TextureData& texture, uint32_t first_level)
+		-> void override
+	{
+		// Frames in flight may still sample the old levels, and the next frame copies the
+		// levels both hold out of them: they're released once that frame finishes.  Each
+		// frame's set is rewritten before it's next recorded.
+		auto refilled = upload_texture(image->name, texture, first_level, image);
+		refilled.bound_descriptors = std::move(image->bound_descriptors);
+		retired_images.push_back({std::move(*image), frame_number});
+		*image = std::move(refilled);
+
+		for (const auto descriptors : image->bound_descriptors) {
+			if (descriptors->stale_frames == 0) {
+				stale_descriptors.push_back(descriptors);
+			}
+			descriptors->stale_frames = (1u << FRAMES_IN_FLIGHT) - 1;
+		}
+	}
+
+	/// Point this frame's stale descriptor sets at their images' new levels
+	auto refresh_stale_descriptors() -> void
+	{
+		const auto frame_bit = 1u << current_frame;
+		for (const auto descriptors : stale_descriptors) {
+			if (descriptors->stale_frames & frame_bit) {
+				write_image_descriptor(descriptors->descsets[current_frame], descriptors->albedo);
+				descriptors->stale_frames &= ~frame_bit;
+			}
+		}
+		std::erase_if(stale_descriptors, [](const Descriptors* descriptors) {
+			return descriptors->stale_frames == 0;
+		});
+	}
+
+	/// Release retired images which no unfinished frame samples
+	auto release_retired_images() -> void
+	{
+		// Each frame waits on the fence of the frame FRAMES_IN_FLIGHT before it, so every
+		// frame up to that one has finished
+		std::erase_if(retired_images, [&](RetiredImage& retired) {
+			if (retired.frame + FRAMES_IN_FLIGHT > frame_number) {
+				return false;
+			}
+			release_image(&retired.image);
+			return true;
+		});
+	}
+
+	/**
+	 * Make an image of a baked texture's levels from `first_level` down to 1x1.  Nothing is
+	 * copied yet: the copies are recorded into the next frame's transfers.
+	 * @param resident an image of the same texture; levels it holds are copied from it on
+	 *        the GPU, and only the others are staged
+	 */
+	auto upload_texture(
+		const std::string& name,
+		const TextureData& texture,
+		uint32_t first_level,
+		const Image* resident) -> Image
+	{
+		first_level = std::min<uint32_t>(first_level, texture.levels.size() - 1);
+		const auto levels = std::span{texture.levels}.subspan(first_level);
+		const auto format = vk_texture_format(texture.format);
+
+		if (resident && resident->first_level + resident->level_count != texture.levels.size()) {
+			resident = nullptr;
+		}
+
+		auto image = vk::Image{};
+		auto image_mem = vk::DeviceMemory{};
+
+		auto mipLevels = static_cast<uint32_t>(levels.size());
+
+		create_image_vk(
+			name,
+			levels[0].width,
+			levels[0].height,
+			format,
+			vk::ImageTiling::eOptimal,
+			vk::ImageUsageFlagBits::eTransferSrc | vk::ImageUsageFlagBits::eTransferDst |
+				vk::ImageUsageFlagBits::eSampled,
+			vk::MemoryPropertyFlagBits::eDeviceLocal,
+			image,
+			image_mem,
+			mipLevels);
+
+		auto upload = PendingUpload{image, mipLevels, {}, {}, {}, 0, {}};
+
+		// Levels the old image holds are copied across; the rest are staged back-to-back
+		auto image_buffer_size = vk::DeviceSize{0};
+		for (auto level = 0u; level < levels.size(); level++) {
+			const auto& data = levels[level];
+			const auto subresource =
+				vk::ImageSubresourceLayers(vk::ImageAspectFlagBits::eColor, level, 0, 1);
+			const auto extent = vk::Extent3D{data.width, data.height, 1};
+
+			if (resident && first_level + level >= resident->first_level) {
+				const auto source_subresource = vk::ImageSubresourceLayers(
+					vk::ImageAspectFlagBits::eColor,
+					first_level + level - resident->first_level,
+					0,
+					1);
+				upload.image_copies.push_back(
+					vk::ImageCopy(source_subresource, {}, subresource, {}, extent));
+				continue;
+			}
+
+			upload.buffer_copies.push_back(
+				vk::BufferImageCopy(image_buffer_size, 0, 0, subresource, {}, extent));
+			// Copy offsets must be a multiple of the texel block size
+			image_buffer_size += (data.data.size() + 15) / 16 * 16;
+		}
+
+		if (!upload.image_copies.empty()) {
+			upload.source = resident->image;
+			upload.source_level_count = resident->level_count;
+		}
+
+		if (!upload.buffer_copies.empty()) {
+			createBufferVk(
+				device,
+				physical_device,
+				image_buffer_size,
+				vk::BufferUsageFlagBits::eTransferSrc,
+				vk::MemoryPropertyFlagBits::eHostVisible |
+					vk::MemoryPropertyFlagBits::eHostCoherent,
+				upload.staging.buffer,
+				upload.staging.mem);
+
+			auto data = static_cast<std::byte*>(
+				device.mapMemory(upload.staging.mem, 0, image_buffer_size));
+			for (const auto& copy : upload.buffer_copies) {
+				const auto& level_data = levels[copy.imageSubresource.mipLevel].data;
+				memcpy(data + copy.bufferOffset, level_data.data(), level_data.size());
+			}
+			device.unmapMemory(upload.staging.mem);
+		}
+
+		pending_uploads.push_back(std::move(upload));
+
+		const auto image_view =
+			create_image_view(image, format, vk::ImageAspectFlagBits::eColor, mipLevels);
+
+		const auto sampler = create_sampler(mipLevels);
+
+		return Image{name, image, image_view, image_mem, sampler, {}, first_level, mipLevels};
+	}
+
+	/// Record the pending uploads, which this frame's draws then see
+	auto record_uploads(vk::CommandBuffer cmdbuf) -> void
+	{
+		const auto all_levels = [](uint32_t count) {
+			return vk::ImageSubresourceRange(vk::ImageAspectFlagBits::eColor, 0, count, 0, 1);
+		};
+
+		for (auto& upload : pending_uploads) {
+			// Earlier frames may still sample the source, and an earlier upload in this
+			// batch may have written it
+			auto before = std::vector<vk::ImageMemoryBarrier>{vk::ImageMemoryBarrier(
+				{},
+				vk::AccessFlagBits::eTransferWrite,
+				vk::ImageLayout::eUndefined,
+				vk::ImageLayout::eTransferDstOptimal,
+				VK_QUEUE_FAMILY_IGNORED,
+				VK_QUEUE_FAMILY_IGNORED,
+				upload.image,
+				all_levels(upload.level_count))};
+			if (upload.source) {
+				before.push_back(vk::ImageMemoryBarrier(
+					vk::AccessFlagBits::eTransferWrite,
+					vk::AccessFlagBits::eTransferRead,
+					vk::ImageLayout::eShaderReadOnlyOptimal,
+					vk::ImageLayout::eTransferSrcOptimal,
+					VK_QUEUE_FAMILY_IGNORED,
+					VK_QUEUE_FAMILY_IGNORED,
+					upload.source,
+					all_levels(upload.source_level_count)));
+			}
+			cmdbuf.pipelineBarrier(
+				vk::PipelineStageFlagBits::eFragmentShader | vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::DependencyFlags{},
+				nullptr,
+				nullptr,
+				before);
+
+			if (!upload.buffer_copies.empty()) {
+				cmdbuf.copyBufferToImage(
+					upload.staging.buffer,
+					upload.image,
+					vk::ImageLayout::eTransferDstOptimal,
+					upload.buffer_copies);
+				transfer_staging[current_frame].push_back(upload.staging);
+			}
+			if (!upload.image_copies.empty()) {
+				cmdbuf.copyImage(
+					upload.source,
+					vk::ImageLayout::eTransferSrcOptimal,
+					upload.image,
+					vk::ImageLayout::eTransferDstOptimal,
+					upload.image_copies);
+			}
+
+			// Every level is baked, so there is nothing to generate
+			const auto after = vk::ImageMemoryBarrier(
+				vk::AccessFlagBits::eTransferWrite,
+				vk::AccessFlagBits::eShaderRead,
+				vk::ImageLayout::eTransferDstOptimal,
+				vk::ImageLayout::eShaderReadOnlyOptimal,
+				VK_QUEUE_FAMILY_IGNORED,
+				VK_QUEUE_FAMILY_IGNORED,
+				upload.image,
+				all_levels(upload.level_count));
+			cmdbuf.pipelineBarrier(
+				vk::PipelineStageFlagBits::eTransfer,
+				vk::PipelineStageFlagBits::eFragmentShader,
+				vk::DependencyFlags{},
+				nullptr,
+				nullptr,
+				after);
+		}
+		pending_uploads.clear();
+	}
+
+	/// Free staging buffers which were never submitted, or whose frames have finished
+	auto release_staging(std::vector<StagingBuffer>& staging) -> void
+	{
+		for (const auto& buffer : staging) {
+			device.destroyBuffer(buffer.buffer);
+			device.freeMemory(buffer.mem);
+		}
+		staging.clear();
+	}
+
+	/// Drop the uploads into an image which is going away before they were recorded
+	auto drop_pending_uploads(vk::Image image) -> void
+	{
+		std::erase_if(pending_uploads, [&](PendingUpload& upload) {
+			if (upload.image != image) {
+				return false;
+			}
+			if (upload.staging.buffer) {
+				device.destroyBuffer(upload.staging.buffer);
+				device.freeMemory(upload.staging.mem);
+			}
+			return true;
+		});
+	}
+
+	auto supports_texture_format(TextureFormat format) -> bool override
+	{
+		if ((format == TextureFormat::BC1 || format == TextureFormat::BC7) &&
+			!enabled_features.textureCompressionBC) {
+			return false;
+		}
+		if (format == TextureFormat::ETC2_RGB8 && !enabled_features.textureCompressionETC2) {
+			return false;
+		}
+
+		const auto properties = physical_device.getFormatProperties(vk_texture_format(format));
+		return static_cast<bool>(
+			properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eSampledImage);
+	}
+
+	struct PixelFormatVk {
+		vk::Format format;
+		vk::ComponentMapping mapping;
+	};
+
+	/// One- and two-channel images are swizzled to sample as gray and gray-alpha
+	static auto vk_pixel_format(PixelFormat format) -> PixelFormatVk
+	{
+		using Swizzle = vk::ComponentSwizzle;
+		switch (format) {
+		case PixelFormat::R8:
+			return {
+				vk::Format::eR8Unorm,
+				vk::ComponentMapping(Swizzle::eR, Swizzle::eR, Swizzle::eR, Swizzle::eOne)};
+		case PixelFormat::RG8:
+			return {
+				vk::Format::eR8G8Unorm,
+				vk::ComponentMapping(Swizzle::eR, Swizzle::eR, Swizzle::eR, Swizzle::eG)};
+		case PixelFormat::RGB8_SRGB:
+		case PixelFormat::RGBA8_SRGB:
+			return {vk::Format::eR8G8B8A8Srgb, {}};
+		default:
+			return {vk::Format::eR8G8B8A8Unorm, {}};
+		}
+	}
+
+	static auto vk_texture_format(TextureFormat format) -> vk::Format
+	{
+		switch (format) {
+		case TextureFormat::BC1:
+			return vk::Format::eBc1RgbUnormBlock;
+		case TextureFormat::BC7:
+			return vk::Format::eBc7UnormBlock;
+		case TextureFormat::ETC2_RGB8:
+			return vk::Format::eEtc2R8G8B8UnormBlock;
+		default:
+			return vk::Format::eR8G8B8A8Unorm;
+		}
 	}
 
 	auto generate_mipmaps(vk::Image image, uint32_t width, uint32_t height, uint32_t mipLevels)
@@ -714,15 +1137,36 @@ public:
 		end_one_time_cmdbuf(cmdbuf);
 	}
 
+	auto destroy_image(Image* image) -> void override
+	{
+		// A frame in flight may still sample it
+		device.waitIdle();
+
+		drop_pending_uploads(image->image);
+		release_image(image);
+		images.remove_if([image](const Image& other) { return &other == image; });
+	}
+
 	auto destroy_all_images() -> void override
 	{
-		for (auto it = image_cache.begin(); it != image_cache.end();) {
-			destroy_image(&(it->second));
-			image_cache.erase(it++);
+		for (const auto& upload : pending_uploads) {
+			if (upload.staging.buffer) {
+				device.destroyBuffer(upload.staging.buffer);
+				device.freeMemory(upload.staging.mem);
+			}
+		}
+		pending_uploads.clear();
+		for (auto& image : images) {
+			release_image(&image);
+		}
+		images.clear();
+		for (auto& retired : retired_images) {
+			release_image(&retired.image);
 		}
+		retired_images.clear();
 	}
 
-	auto destroy_image(Image* image) -> void
+	auto release_image(Image* image) -> void
 	{
 		std::cout << "[info]\t ~ GpuImage " << image->name << std::endl;
 
@@ -747,6 +1191,13 @@ public:
 		return {.id = geometry_handle};
 	}
 
+	auto set_geometry_lods(GeometryHandle geometry_handle, const std::vector<IndexRange>& levels)
+		-> void override
+	{
+		Geometry* geometry = res_geometries.at(geometry_handle.id);
+		geometry->lods = levels;
+	}
+
 	auto destroy_geometry(const GeometryHandle geometry_handle) -> void override
 	{
 		if (geometry_handle.id == UINT64_MAX) {
@@ -780,15 +1231,21 @@ public:
 
 	auto create_descriptor_pool() -> vk::DescriptorPool
 	{
-		const auto sampler_size =
-			vk::DescriptorPoolSize(vk::DescriptorType::eCombinedImageSampler, 10);
+		// Every Descriptors takes a set per frame in flight
+		const auto sampler_size = vk::DescriptorPoolSize(
+			vk::DescriptorType::eCombinedImageSampler, 10 * FRAMES_IN_FLIGHT);
 
-		const auto uniform_size = vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 10);
+		const auto uniform_size =
+			vk::DescriptorPoolSize(vk::DescriptorType::eUniformBuffer, 10 * FRAMES_IN_FLIGHT);
 
 		const auto pool_sizes = std::array{sampler_size, uniform_size};
 
 		const auto descpool_info =
-			vk::DescriptorPoolCreateInfo({}, 20, pool_sizes.size(), pool_sizes.data());
+			vk::DescriptorPoolCreateInfo(
+				vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+				20 * FRAMES_IN_FLIGHT,
+				pool_sizes.size(),
+				pool_sizes.data());
 
 		return device.createDescriptorPool(descpool_info);
 	}
@@ -803,26 +1260,49 @@ public:
 
 		// Allocate sets
 
-		const auto descset_info = vk::DescriptorSetAllocateInfo(descpool, 1, &descset_layout);
+		auto layouts = std::array<vk::DescriptorSetLayout, FRAMES_IN_FLIGHT>{};
+		layouts.fill(descset_layout);
+		const auto descset_info =
+			vk::DescriptorSetAllocateInfo(descpool, layouts.size(), layouts.data());
 
-		const auto descset = device.allocateDescriptorSets(descset_info).at(0);
+		const auto descsets = device.allocateDescriptorSets(descset_info);
 
 		// update descriptors
 
+		const auto descriptors = new Descriptors{{}, color, albedo};
 		const auto desc_ubo_info = vk::DescriptorBufferInfo(pipeline->ubo, 0, sizeof(glm::mat4));
-		const auto ubo_write = vk::WriteDescriptorSet(
-			descset, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &desc_ubo_info);
+		for (auto frame = size_t{0}; frame < descriptors->descsets.size(); frame++) {
+			const auto descset = descsets.at(frame);
+			const auto ubo_write = vk::WriteDescriptorSet(
+				descset, 0, 0, 1, vk::DescriptorType::eUniformBuffer, nullptr, &desc_ubo_info);
+
+			device.updateDescriptorSets(ubo_write, {});
+			write_image_descriptor(descset, albedo);
+			descriptors->descsets[frame] = descset;
+		}
+		albedo->bound_descriptors.push_back(descriptors);
+
+		return descriptors;
+	}
 
+	auto write_image_descriptor(vk::DescriptorSet descset, const Image* albedo) -> void
+	{
 		const auto desc_image_info = vk::DescriptorImageInfo(
 			albedo->sampler, albedo->view, vk::ImageLayout::eShaderReadOnlyOptimal);
 		const auto albedo_write = vk::WriteDescriptorSet(
 			descset, 1, 0, 1, vk::DescriptorType::eCombinedImageSampler, &desc_image_info);
+		device.updateDescriptorSets(albedo_write, {});
+	}
 
-		const auto descset_writes = std::array{ubo_write, albedo_write};
-
-		device.updateDescriptorSets(descset_writes, {});
+	auto destroy_descriptors(Descriptors* descriptors) -> void override
+	{
+		// A frame in flight may still bind it
+		device.waitIdle();
 
-		return new Descriptors{descset, color};
+		std::erase(descriptors->albedo->bound_descriptors, descriptors);
+		std::erase(stale_descriptors, descriptors);
+		device.freeDescriptorSets(descpool, descriptors->descsets);
+		delete descriptors;
 	}
 
 	auto create_pipeline(
@@ -851,7 +1331,7 @@ public:
 			ubo,
 			ubo_mem);
 
-		auto proj = glm::perspective(glm::radians(90.0f), 0.8888f, 0.1f, 10000.0f);
+		auto proj = projection_matrix();
 		proj[1][1] *= -1;
 
 		{
@@ -896,11 +1376,15 @@ public:
 		// general graphics pipeline info
 
 		std::vector<vk::VertexInputAttributeDescription> vk_vertex_attributes;
-		vk::VertexInputBindingDescription vk_vertex_binding;
-		transcode_vertex_attributes(vertex_attributes, vk_vertex_attributes, vk_vertex_binding);
+		std::vector<vk::VertexInputBindingDescription> vk_vertex_bindings;
+		transcode_vertex_attributes(vertex_attributes, vk_vertex_attributes, vk_vertex_bindings);
 
 		const auto vertex_input_info = vk::PipelineVertexInputStateCreateInfo(
-			{}, 1, &vk_vertex_binding, vk_vertex_attributes.size(), vk_vertex_attributes.data());
+			{},
+			vk_vertex_bindings.size(),
+			vk_vertex_bindings.data(),
+			vk_vertex_attributes.size(),
+			vk_vertex_attributes.data());
 
 		const auto input_assembly = vk::PipelineInputAssemblyStateCreateInfo(
 			{}, vk::PrimitiveTopology::eTriangleList, false);
@@ -1059,9 +1543,8 @@ public:
 	auto render(
 		const glm::mat4& view,
 		ShaderPipelineHandle pso_handle,
-		const std::vector<glm::mat4>& transforms,
-		const std::vector<GeometryHandle>& renderables,
-		const std::vector<Descriptors*>& descriptors,
+		std::span<const glm::mat4> instance_transforms,
+		std::span<const InstanceBatch> batches,
 		std::function<void()> gui_code) -> void override
 	{
 		ShaderPipeline* pso = res_pipelines.at(pso_handle.id);
@@ -1075,34 +1558,55 @@ public:
 		if (!ctx) {
 			return;
 		}
+
+		// alloc_context waited for this frame's last use of its instance buffer
+		auto& instances = instance_buffers[current_frame];
+		if (instances.capacity < instance_transforms.size_bytes()) {
+			release_instance_buffer(instances);
+			instances = create_instance_buffer(instance_transforms.size_bytes());
+		}
+		if (!instance_transforms.empty()) {
+			memcpy(instances.mapped, instance_transforms.data(), instance_transforms.size_bytes());
+		}
+
 		ctx->begin();
 
 		ctx->cmdbuf.bindPipeline(vk::PipelineBindPoint::eGraphics, pso->pipeline);
+		if (instances.buffer) {
+			ctx->cmdbuf.bindVertexBuffers(1, instances.buffer, {0});
+		}
 
-		for (auto i = 0; i < transforms.size(); ++i) {
+		const Descriptors* bound_descriptors = nullptr;
+		auto bound_geometry = UINT64_MAX;
+		for (const auto& batch : batches) {
+			if (batch.descriptors != bound_descriptors) {
+				ctx->cmdbuf.bindDescriptorSets(
+					vk::PipelineBindPoint::eGraphics,
+					pso->pipeline_layout,
+					0,
+					batch.descriptors->descsets[current_frame],
+					{});
+
+				const auto push_constant_data = PushConstantData{view, batch.descriptors->color};
+				ctx->cmdbuf.pushConstants(
+					pso->pipeline_layout,
+					vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
+					0,
+					sizeof(PushConstantData),
+					&push_constant_data);
+				bound_descriptors = batch.descriptors;
+			}
 
-			ctx->cmdbuf.bindDescriptorSets(
-				vk::PipelineBindPoint::eGraphics,
-				pso->pipeline_layout,
-				0,
-				descriptors[i]->descset,
-				{});
-
-			// Push constants
-			const auto push_constant_data =
-				PushConstantData{transforms[i], view, descriptors[i]->color};
-			ctx->cmdbuf.pushConstants(
-				pso->pipeline_layout,
-				vk::ShaderStageFlagBits::eVertex | vk::ShaderStageFlagBits::eFragment,
-				0,
-				sizeof(PushConstantData),
-				&push_constant_data);
-
-			gpu::Geometry* geometry = res_geometries.at(renderables[i].id);
-			gpu::Buffer* vbo = res_buffers.at(geometry->vbo.id);
-			gpu::Buffer* ebo = res_buffers.at(geometry->ebo.id);
-			ctx->bind_geometry_buffers(vbo, ebo);
-			ctx->draw(geometry->index_count, 1);
+			gpu::Geometry* geometry = res_geometries.at(batch.geometry.id);
+			if (batch.geometry.id != bound_geometry) {
+				gpu::Buffer* vbo = res_buffers.at(geometry->vbo.id);
+				gpu::Buffer* ebo = res_buffers.at(geometry->ebo.id);
+				ctx->bind_geometry_buffers(vbo, ebo);
+				bound_geometry = batch.geometry.id;
+			}
+
+			const auto lod = geometry->lod(batch.lod_level);
+			ctx->draw(lod.count, batch.instance_count, lod.first, batch.first_instance);
 		}
 
 		ImGui::Render();
@@ -1135,6 +1639,24 @@ public:
 
 			device.resetFences({swapchain_fences[current_frame]});
 
+			// This frame's last submission has finished, so its sets are free to rewrite,
+			// and the images and staging buffers it last used can go
+			refresh_stale_descriptors();
+			release_retired_images();
+			release_staging(transfer_staging[current_frame]);
+
+			// Streamed levels are copied at the start of the frame, ahead of its draws,
+			// instead of in submissions of their own which the CPU would wait on
+			has_transfers = !pending_uploads.empty();
+			if (has_transfers) {
+				const auto& transfer_cmdbuf = transfer_cmd_buffers[current_frame];
+				transfer_cmdbuf.reset({});
+				transfer_cmdbuf.begin(vk::CommandBufferBeginInfo(
+					vk::CommandBufferUsageFlagBits::eOneTimeSubmit));
+				record_uploads(transfer_cmdbuf);
+				transfer_cmdbuf.end();
+			}
+
 			const auto& cmdbuf = cmd_buffers[current_frame];
 			cmdbuf.reset({});
 
@@ -1154,13 +1676,13 @@ public:
 		const vk::PipelineStageFlags wait_dst_stage_mask =
 			vk::PipelineStageFlagBits::eColorAttachmentOutput;
 
-		const auto cmdbuf = cmdlist->get_cmdbuf();
+		const auto cmdbufs = std::array{transfer_cmd_buffers[current_frame], cmdlist->get_cmdbuf()};
 		const auto submit_info = vk::SubmitInfo(
 			1,
 			&image_available_semaphores[current_frame],
 			&wait_dst_stage_mask,
-			1,
-			&cmdbuf,
+			has_transfers ? 2 : 1,
+			has_transfers ? cmdbufs.data() : cmdbufs.data() + 1,
 			1,
 			&render_finished_semaphores[current_frame]);
 
@@ -1180,9 +1702,38 @@ public:
 		}
 
 		current_frame = (current_frame + 1) % FRAMES_IN_FLIGHT;
+		frame_number++;
 	}
 
 private:
+	/// A host-visible buffer of at least `bytes`, grown by half again to spare regrowth
+	auto create_instance_buffer(std::size_t bytes) -> InstanceBuffer
+	{
+		auto instances = InstanceBuffer{};
+		instances.capacity = bytes + bytes / 2;
+		createBufferVk(
+			device,
+			physical_device,
+			instances.capacity,
+			vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			instances.buffer,
+			instances.mem);
+		instances.mapped = device.mapMemory(instances.mem, 0, instances.capacity);
+		return instances;
+	}
+
+	auto release_instance_buffer(InstanceBuffer& instances) -> void
+	{
+		if (!instances.buffer) {
+			return;
+		}
+		device.unmapMemory(instances.mem);
+		device.destroyBuffer(instances.buffer);
+		device.freeMemory(instances.mem);
+		instances = {};
+	}
+
 	auto begin_one_time_cmdbuf() -> vk::CommandBuffer
 	{
 		const auto alloc_info =
@@ -1262,14 +1813,12 @@ private:
 	}
 
 	auto create_image_view(
-		vk::Image image, vk::Format format, vk::ImageAspectFlags aspect, uint32_t mipLevels)
-		-> vk::ImageView
+		vk::Image image,
+		vk::Format format,
+		vk::ImageAspectFlags aspect,
+		uint32_t mipLevels,
+		vk::ComponentMapping component_mapping = {}) -> vk::ImageView
 	{
-		const auto component_mapping = vk::ComponentMapping(
-			vk::ComponentSwizzle::eR,
-			vk::ComponentSwizzle::eG,
-			vk::ComponentSwizzle::eB,
-			vk::ComponentSwizzle::eA);
 		const auto subresource = vk::ImageSubresourceRange(aspect, 0, mipLevels, 0, 1);
 		const auto view_info = vk::ImageViewCreateInfo(
 			{}, image, vk::ImageViewType::e2D, format, component_mapping, subresource);
@@ -1556,6 +2105,8 @@ private:
 
 	vk::PhysicalDevice physical_device;
 
+	vk::PhysicalDeviceFeatures enabled_features;
+
 	vk::Device device;
 
 	vk::RenderPass backbuffer_pass;
@@ -1579,13 +2130,31 @@ private:
 	std::vector<vk::Framebuffer> backbuffers;
 	std::vector<vk::CommandBuffer> cmd_buffers;
 
+	/// Each frame's streaming copies, submitted ahead of its draws
+	std::array<vk::CommandBuffer, FRAMES_IN_FLIGHT> transfer_cmd_buffers;
+	/// Staging buffers read by each frame's transfers, freed once it finishes
+	std::array<std::vector<StagingBuffer>, FRAMES_IN_FLIGHT> transfer_staging;
+	/// Uploads made since the last frame was recorded
+	std::vector<PendingUpload> pending_uploads;
+	bool has_transfers = false;
+
 	std::vector<Buffer> buffers;
 
 	std::vector<Image> swapchain_images;
 
-	std::unordered_map<std::string, Image> image_cache;
+	/// Images made by create_image; a list, so their addresses are stable
+	std::list<Image> images;
+
+	/// Images replaced by set_image_levels, and descriptors still sampling them
+	std::vector<RetiredImage> retired_images;
+	std::vector<Descriptors*> stale_descriptors;
+
+	/// Per-instance model matrices, one buffer per frame in flight
+	std::array<InstanceBuffer, FRAMES_IN_FLIGHT> instance_buffers{};
 
 	unsigned int current_frame = 0;
+	/// Frames submitted so far
+	uint64_t frame_number = 0;
 	unsigned int image_idx = 0;
 
 	uint32_t graphics_queue_idx = 0u;
@@ -0,0 +1,304 @@
+/**
+ * Round-trip baked textures through the ".gtex" container, on the CPU only.
+ *
+ * BUILD: cmake --workflow --preset linux-(vk|gl)-dev
+ * RUN: ctest -R textures, or texture-tests
+ *
+ * Each block-compressed format is encoded, written, read back, and checked for the same
+ * format, dimensions and levels; then its blocks are decoded here and compared with the
+ * source image.
+ */
+
+#include "textures.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+using Texel = array<uint8_t, 4>;
+
+static auto failures = 0;
+
+static auto check(bool ok, const string& what) -> void
+{
+	if (!ok) {
+		cerr << "Error: " << what << endl;
+		failures++;
+	}
+}
+
+/// Reads a block's fields least significant bit first, as BC7 packs them
+class BitReader {
+public:
+	explicit BitReader(const uint8_t* bytes) : bytes{bytes} {}
+
+	auto read(int count) -> uint32_t
+	{
+		auto value = 0u;
+		for (auto i = 0; i < count; i++, position++) {
+			value |= ((bytes[position / 8] >> (position % 8)) & 1u) << i;
+		}
+		return value;
+	}
+
+private:
+	const uint8_t* bytes;
+	int position = 0;
+};
+
+static auto unpack_565(uint16_t packed) -> Texel
+{
+	const auto r = (packed >> 11) & 31;
+	const auto g = (packed >> 5) & 63;
+	const auto b = packed & 31;
+	return {
+		static_cast<uint8_t>((r << 3) | (r >> 2)),
+		static_cast<uint8_t>((g << 2) | (g >> 4)),
+		static_cast<uint8_t>((b << 3) | (b >> 2)),
+		255};
+}
+
+static auto decode_bc1_block(const uint8_t* block) -> array<Texel, 16>
+{
+	const auto color0 = static_cast<uint16_t>(block[0] | block[1] << 8);
+	const auto color1 = static_cast<uint16_t>(block[2] | block[3] << 8);
+	const auto c0 = unpack_565(color0);
+	const auto c1 = unpack_565(color1);
+
+	auto palette = array<Texel, 4>{c0, c1, c0, c1};
+	for (auto c = 0; c < 3; c++) {
+		if (color0 > color1) {
+			palette[2][c] = static_cast<uint8_t>((2 * c0[c] + c1[c] + 1) / 3);
+			palette[3][c] = static_cast<uint8_t>((c0[c] + 2 * c1[c] + 1) / 3);
+		}
+		else {
+			palette[2][c] = static_cast<uint8_t>((c0[c] + c1[c] + 1) / 2);
+			palette[3] = {0, 0, 0, 0};
+		}
+	}
+
+	auto texels = array<Texel, 16>{};
+	auto bits = BitReader{block + 4};
+	for (auto& texel : texels) {
+		texel = palette[bits.read(2)];
+	}
+	return texels;
+}
+
+/// Mode 6 only, the one mode the encoder writes
+static auto decode_bc7_block(const uint8_t* block) -> array<Texel, 16>
+{
+	constexpr array<int, 16> WEIGHTS = {
+		0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+	auto bits = BitReader{block};
+	check(bits.read(7) == 1 << 6, "BC7 block not in mode 6");
+
+	auto e0 = Texel{};
+	auto e1 = Texel{};
+	for (auto c = 0; c < 4; c++) {
+		e0[c] = static_cast<uint8_t>(bits.read(7) << 1);
+		e1[c] = static_cast<uint8_t>(bits.read(7) << 1);
+	}
+	const auto p0 = bits.read(1);
+	const auto p1 = bits.read(1);
+	for (auto c = 0; c < 4; c++) {
+		e0[c] |= p0;
+		e1[c] |= p1;
+	}
+
+	auto texels = array<Texel, 16>{};
+	for (auto i = 0; i < 16; i++) {
+		const auto index = bits.read(i == 0 ? 3 : 4);
+		for (auto c = 0; c < 4; c++) {
+			const auto weight = WEIGHTS[index];
+			texels[i][c] = static_cast<uint8_t>(((64 - weight) * e0[c] + weight * e1[c] + 32) >> 6);
+		}
+	}
+	return texels;
+}
+
+/// ETC1 "individual" blocks only, the one kind the encoder writes
+static auto decode_etc2_block(const uint8_t* block) -> array<Texel, 16>
+{
+	constexpr array<array<int, 2>, 8> MODIFIERS = {{
+		{2, 8},
+		{5, 17},
+		{9, 29},
+		{13, 42},
+		{18, 60},
+		{24, 80},
+		{33, 106},
+		{47, 183},
+	}};
+
+	// ETC blocks are stored big-endian
+	auto high = 0u;
+	auto low = 0u;
+	for (auto i = 0; i < 4; i++) {
+		high = high << 8 | block[i];
+		low = low << 8 | block[4 + i];
+	}
+	check((high & 2u) == 0, "ETC2 block not in individual mode");
+
+	const auto flip = (high & 1u) != 0;
+	auto bases = array<array<int, 3>, 2>{};
+	for (auto c = 0; c < 3; c++) {
+		const auto a = (high >> (28 - c * 8)) & 15u;
+		const auto b = (high >> (24 - c * 8)) & 15u;
+		bases[0][c] = static_cast<int>(a << 4 | a);
+		bases[1][c] = static_cast<int>(b << 4 | b);
+	}
+	const auto tables = array<uint32_t, 2>{(high >> 5) & 7u, (high >> 2) & 7u};
+
+	auto texels = array<Texel, 16>{};
+	for (auto y = 0; y < 4; y++) {
+		for (auto x = 0; x < 4; x++) {
+			const auto half = flip ? y / 2 : x / 2;
+			const auto bit = x * 4 + y;
+			const auto msb = (low >> (16 + bit)) & 1u;
+			const auto lsb = (low >> bit) & 1u;
+			const auto [small, large] = MODIFIERS[tables[half]];
+			const auto offset = array<int, 4>{small, large, -small, -large}[msb << 1 | lsb];
+			for (auto c = 0; c < 3; c++) {
+				texels[y * 4 + x][c] = static_cast<uint8_t>(clamp(bases[half][c] + offset, 0, 255));
+			}
+			texels[y * 4 + x][3] = 255;
+		}
+	}
+	return texels;
+}
+
+/// Decode one level back to RGBA8
+static auto decode_level(gpu::TextureFormat format, const gpu::TextureLevel& level)
+	-> vector<uint8_t>
+{
+	const auto blocks_x = (level.width + 3) / 4;
+	const auto blocks_y = (level.height + 3) / 4;
+	const auto stride = format == gpu::TextureFormat::BC7 ? 16u : 8u;
+	const auto* data = reinterpret_cast<const uint8_t*>(level.data.data());
+
+	auto rgba = vector<uint8_t>(size_t{level.width} * level.height * 4);
+	for (auto by = 0u; by < blocks_y; by++) {
+		for (auto bx = 0u; bx < blocks_x; bx++) {
+			const auto* block = data + (by * blocks_x + bx) * stride;
+			const auto texels = format == gpu::TextureFormat::BC1 ? decode_bc1_block(block)
+								: format == gpu::TextureFormat::BC7 ? decode_bc7_block(block)
+																	 : decode_etc2_block(block);
+			for (auto i = 0u; i < 16; i++) {
+				const auto x = bx * 4 + i % 4;
+				const auto y = by * 4 + i / 4;
+				if (x < level.width && y < level.height) {
+					memcpy(&rgba[(size_t{y} * level.width + x) * 4], texels[i].data(), 4);
+				}
+			}
+		}
+	}
+	return rgba;
+}
+
+/**
+ * An image whose 4x4 blocks are each one random opaque color, so every format can
+ * represent it closely and any mix-up of blocks or channels shows.
+ */
+static auto block_image(uint32_t width, uint32_t height) -> vector<uint8_t>
+{
+	auto random = mt19937{7};
+	const auto blocks_x = (width + 3) / 4;
+	auto colors = vector<Texel>{};
+	for (auto i = 0u; i < blocks_x * ((height + 3) / 4); i++) {
+		colors.push_back(
+			{static_cast<uint8_t>(random()), static_cast<uint8_t>(random()),
+			 static_cast<uint8_t>(random()), 255});
+	}
+
+	auto rgba = vector<uint8_t>(size_t{width} * height * 4);
+	for (auto y = 0u; y < height; y++) {
+		for (auto x = 0u; x < width; x++) {
+			const auto& color = colors[(y / 4) * blocks_x + x / 4];
+			memcpy(&rgba[(size_t{y} * width + x) * 4], color.data(), 4);
+		}
+	}
+	return rgba;
+}
+
+/// @param tolerance largest difference allowed in any channel of a decoded texel
+static auto test_round_trip(gpu::TextureFormat format, int tolerance) -> void
+{
+	const auto name = string{gpu::texture_format_name(format)};
+
+	// Not a multiple of 4, so edge blocks are partial
+	constexpr auto WIDTH = 37u;
+	constexpr auto HEIGHT = 22u;
+	const auto source = block_image(WIDTH, HEIGHT);
+
+	const auto encoded = gpu::encode_texture(format, WIDTH, HEIGHT, source.data());
+	const auto file = make_shared<vector<byte>>(gpu::write_texture_file(encoded));
+	const auto read = gpu::read_texture_file(*file, file);
+	if (!read.has_value()) {
+		check(false, name + ": read failed: " + read.error());
+		return;
+	}
+
+	check(read->format == format, name + ": format changed");
+	check(read->width == WIDTH && read->height == HEIGHT, name + ": dimensions changed");
+
+	// 37x22, 18x11, 9x5, 4x2, 2x1, 1x1
+	check(encoded.levels.size() == 6, name + ": expected 6 levels");
+	check(read->levels.size() == encoded.levels.size(), name + ": level count changed");
+	for (auto i = 0u; i < min(read->levels.size(), encoded.levels.size()); i++) {
+		const auto& before = encoded.levels[i];
+		const auto& after = read->levels[i];
+		const auto level = name + " level " + to_string(i);
+		check(
+			after.width == before.width && after.height == before.height,
+			level + ": size changed");
+		check(
+			after.data.size() == gpu::texture_level_size(format, after.width, after.height),
+			level + ": wrong byte count");
+		check(
+			after.data.size() == before.data.size() &&
+				memcmp(after.data.data(), before.data.data(), after.data.size()) == 0,
+			level + ": bytes changed");
+	}
+
+	const auto decoded = decode_level(format, read->levels[0]);
+	auto worst = 0;
+	for (auto i = 0u; i < source.size(); i++) {
+		worst = max(worst, abs(int{decoded[i]} - int{source[i]}));
+	}
+	check(
+		worst <= tolerance,
+		name + ": decoded colors off by " + to_string(worst) + ", more than " +
+			to_string(tolerance));
+
+	auto corrupt = *file;
+	corrupt[0] = byte{'X'};
+	check(!gpu::read_texture_file(corrupt, nullptr).has_value(), name + ": bad magic accepted");
+	check(
+		!gpu::read_texture_file(span{*file}.first(file->size() / 2), nullptr).has_value(),
+		name + ": truncated file accepted");
+}
+
+int main()
+{
+	// RGB565 endpoints; 7-bit endpoints with a p-bit; 4-bit base colors with offsets
+	test_round_trip(gpu::TextureFormat::BC1, 8);
+	test_round_trip(gpu::TextureFormat::BC7, 2);
+	test_round_trip(gpu::TextureFormat::ETC2_RGB8, 12);
+
+	if (failures > 0) {
+		cerr << failures << " checks failed" << endl;
+		return 1;
+	}
+	cout << "[info]\t texture round trips passed" << endl;
+	return 0;
+}
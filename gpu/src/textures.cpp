@@ -0,0 +1,681 @@
+#include "textures.h"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <limits>
+
+using namespace std;
+
+namespace gpu {
+
+namespace {
+
+// ".gtex" layout: a header, a table of levels, then each level's bytes aligned
+// to ALIGNMENT.  Offsets are from the start of the file.
+
+constexpr char MAGIC[4] = {'G', 'T', 'E', 'X'};
+
+constexpr uint32_t VERSION = 1;
+
+constexpr size_t ALIGNMENT = 16;
+
+struct FileHeader {
+	char magic[4];
+	uint32_t version;
+	uint32_t format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t level_count;
+};
+
+struct FileLevel {
+	uint32_t width;
+	uint32_t height;
+	uint64_t offset;
+	uint64_t size;
+};
+
+using Texel = array<uint8_t, 4>;
+
+/// A 4x4 block of texels, row-major
+using Block = array<Texel, 16>;
+
+auto is_block_compressed(TextureFormat format) -> bool { return format != TextureFormat::RGBA8; }
+
+auto block_bytes(TextureFormat format) -> size_t
+{
+	switch (format) {
+	case TextureFormat::BC1:
+	case TextureFormat::ETC2_RGB8:
+		return 8;
+	case TextureFormat::BC7:
+		return 16;
+	default:
+		return 0;
+	}
+}
+
+auto distance(const Texel& a, const Texel& b, int channels = 3) -> int
+{
+	auto sum = 0;
+	for (auto c = 0; c < channels; c++) {
+		const auto d = int{a[c]} - int{b[c]};
+		sum += d * d;
+	}
+	return sum;
+}
+
+/// Halve an RGBA8 image with a box filter.  Odd edges repeat their last texel.
+auto downsample(const vector<uint8_t>& src, uint32_t width, uint32_t height) -> vector<uint8_t>
+{
+	const auto dst_width = max(width / 2, 1u);
+	const auto dst_height = max(height / 2, 1u);
+	auto dst = vector<uint8_t>(dst_width * dst_height * 4);
+
+	for (auto y = 0u; y < dst_height; y++) {
+		for (auto x = 0u; x < dst_width; x++) {
+			const auto x0 = min(x * 2, width - 1);
+			const auto x1 = min(x * 2 + 1, width - 1);
+			const auto y0 = min(y * 2, height - 1);
+			const auto y1 = min(y * 2 + 1, height - 1);
+			for (auto c = 0u; c < 4; c++) {
+				const auto sum = src[(y0 * width + x0) * 4 + c] + src[(y0 * width + x1) * 4 + c] +
+								 src[(y1 * width + x0) * 4 + c] + src[(y1 * width + x1) * 4 + c];
+				dst[(y * dst_width + x) * 4 + c] = static_cast<uint8_t>((sum + 2) / 4);
+			}
+		}
+	}
+
+	return dst;
+}
+
+/// Gather the block at (bx, by), clamping reads past the image edge
+auto fetch_block(const vector<uint8_t>& rgba, uint32_t width, uint32_t height, uint32_t bx, uint32_t by)
+	-> Block
+{
+	auto block = Block{};
+	for (auto y = 0u; y < 4; y++) {
+		for (auto x = 0u; x < 4; x++) {
+			const auto sx = min(bx * 4 + x, width - 1);
+			const auto sy = min(by * 4 + y, height - 1);
+			memcpy(block[y * 4 + x].data(), &rgba[(sy * width + sx) * 4], 4);
+		}
+	}
+	return block;
+}
+
+/// Packs little-endian bit fields, as used by BC1 and BC7
+struct BitWriter {
+	uint8_t* out;
+	uint32_t position = 0;
+
+	auto write(uint32_t value, uint32_t bit_count) -> void
+	{
+		for (auto i = 0u; i < bit_count; i++, position++) {
+			if ((value >> i) & 1) {
+				out[position / 8] |= static_cast<uint8_t>(1 << (position % 8));
+			}
+		}
+	}
+};
+
+// BC1: two RGB565 endpoints along the block's bounding-box diagonal, and a
+// 2-bit index per texel into the four colors interpolated between them.
+
+auto pack_565(const Texel& color) -> uint16_t
+{
+	return static_cast<uint16_t>(
+		((color[0] * 31 + 127) / 255) << 11 | ((color[1] * 63 + 127) / 255) << 5 |
+		((color[2] * 31 + 127) / 255));
+}
+
+auto unpack_565(uint16_t packed) -> Texel
+{
+	const auto r = (packed >> 11) & 31;
+	const auto g = (packed >> 5) & 63;
+	const auto b = packed & 31;
+	return {
+		static_cast<uint8_t>((r << 3) | (r >> 2)),
+		static_cast<uint8_t>((g << 2) | (g >> 4)),
+		static_cast<uint8_t>((b << 3) | (b >> 2)),
+		255};
+}
+
+auto encode_bc1_block(const Block& block, uint8_t* out) -> void
+{
+	auto lo = Texel{255, 255, 255, 255};
+	auto hi = Texel{0, 0, 0, 255};
+	for (const auto& texel : block) {
+		for (auto c = 0; c < 3; c++) {
+			lo[c] = min(lo[c], texel[c]);
+			hi[c] = max(hi[c], texel[c]);
+		}
+	}
+
+	// Pull the endpoints in slightly, which reduces error for most blocks
+	for (auto c = 0; c < 3; c++) {
+		const auto inset = (hi[c] - lo[c]) / 16;
+		lo[c] = static_cast<uint8_t>(lo[c] + inset);
+		hi[c] = static_cast<uint8_t>(hi[c] - inset);
+	}
+
+	auto color0 = pack_565(hi);
+	auto color1 = pack_565(lo);
+
+	// color0 > color1 selects the four-color mode
+	if (color0 < color1) {
+		swap(color0, color1);
+	}
+
+	auto indices = 0u;
+	if (color0 != color1) {
+		const auto c0 = unpack_565(color0);
+		const auto c1 = unpack_565(color1);
+		auto palette = array<Texel, 4>{c0, c1, c0, c1};
+		for (auto c = 0; c < 3; c++) {
+			palette[2][c] = static_cast<uint8_t>((2 * c0[c] + c1[c] + 1) / 3);
+			palette[3][c] = static_cast<uint8_t>((c0[c] + 2 * c1[c] + 1) / 3);
+		}
+		for (auto i = 0u; i < 16; i++) {
+			auto best = 0u;
+			auto best_error = numeric_limits<int>::max();
+			for (auto p = 0u; p < 4; p++) {
+				const auto error = distance(block[i], palette[p]);
+				if (error < best_error) {
+					best = p;
+					best_error = error;
+				}
+			}
+			indices |= best << (i * 2);
+		}
+	}
+
+	memset(out, 0, 8);
+	auto bits = BitWriter{out};
+	bits.write(color0, 16);
+	bits.write(color1, 16);
+	bits.write(indices, 32);
+}
+
+// BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared-per-endpoint
+// p-bit, and a 4-bit index per texel.  Only this mode is used, which keeps
+// the encoder small while still handling alpha.
+
+constexpr array<int, 16> BC7_WEIGHTS4 = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+/// Quantize an endpoint to 7 bits per channel plus a p-bit, picking the p-bit which fits best
+auto quantize_bc7_endpoint(const Texel& color, array<uint8_t, 4>& quantized, uint8_t& pbit) -> Texel
+{
+	auto best_error = numeric_limits<int>::max();
+	auto best = Texel{};
+	for (uint8_t p = 0; p < 2; p++) {
+		auto candidate = array<uint8_t, 4>{};
+		auto expanded = Texel{};
+		for (auto c = 0; c < 4; c++) {
+			const auto value = clamp((color[c] - p + 1) / 2, 0, 127);
+			candidate[c] = static_cast<uint8_t>(value);
+			expanded[c] = static_cast<uint8_t>((value << 1) | p);
+		}
+		const auto error = distance(color, expanded, 4);
+		if (error < best_error) {
+			best_error = error;
+			quantized = candidate;
+			pbit = p;
+			best = expanded;
+		}
+	}
+	return best;
+}
+
+auto encode_bc7_block(const Block& block, uint8_t* out) -> void
+{
+	auto lo = Texel{255, 255, 255, 255};
+	auto hi = Texel{0, 0, 0, 0};
+	for (const auto& texel : block) {
+		for (auto c = 0; c < 4; c++) {
+			lo[c] = min(lo[c], texel[c]);
+			hi[c] = max(hi[c], texel[c]);
+		}
+	}
+
+	auto q0 = array<uint8_t, 4>{};
+	auto q1 = array<uint8_t, 4>{};
+	auto p0 = uint8_t{};
+	auto p1 = uint8_t{};
+	const auto e0 = quantize_bc7_endpoint(lo, q0, p0);
+	const auto e1 = quantize_bc7_endpoint(hi, q1, p1);
+
+	auto palette = array<Texel, 16>{};
+	for (auto i = 0u; i < 16; i++) {
+		for (auto c = 0; c < 4; c++) {
+			palette[i][c] = static_cast<uint8_t>(
+				((64 - BC7_WEIGHTS4[i]) * e0[c] + BC7_WEIGHTS4[i] * e1[c] + 32) >> 6);
+		}
+	}
+
+	auto indices = array<uint8_t, 16>{};
+	for (auto i = 0u; i < 16; i++) {
+		auto best_error = numeric_limits<int>::max();
+		for (uint8_t p = 0; p < 16; p++) {
+			const auto error = distance(block[i], palette[p], 4);
+			if (error < best_error) {
+				best_error = error;
+				indices[i] = p;
+			}
+		}
+	}
+
+	// The first index's high bit is implicit zero; swap the endpoints to make it so
+	if (indices[0] >= 8) {
+		swap(q0, q1);
+		swap(p0, p1);
+		for (auto& index : indices) {
+			index = static_cast<uint8_t>(15 - index);
+		}
+	}
+
+	memset(out, 0, 16);
+	auto bits = BitWriter{out};
+	bits.write(1 << 6, 7);
+	for (auto c = 0; c < 4; c++) {
+		bits.write(q0[c], 7);
+		bits.write(q1[c], 7);
+	}
+	bits.write(p0, 1);
+	bits.write(p1, 1);
+	bits.write(indices[0], 3);
+	for (auto i = 1u; i < 16; i++) {
+		bits.write(indices[i], 4);
+	}
+}
+
+// ETC2 RGB8: encoded with ETC1 "individual" blocks, which every ETC2 decoder
+// accepts.  Each half of the block gets a 4-bit base color and one of eight
+// modifier tables; each texel picks one of the table's four offsets.
+
+constexpr array<array<int, 2>, 8> ETC1_MODIFIERS = {{
+	{2, 8},
+	{5, 17},
+	{9, 29},
+	{13, 42},
+	{18, 60},
+	{24, 80},
+	{33, 106},
+	{47, 183},
+}};
+
+struct EtcHalf {
+	array<uint8_t, 3> base4;
+	uint32_t table;
+	/// Pixel index (msb << 1 | lsb) per texel of the half, in visiting order
+	array<uint8_t, 8> selectors;
+	int error;
+};
+
+/// Texel coordinates of a half block: 2x4 columns, or 4x2 rows when flipped
+auto etc_half_texels(bool flip, int half) -> array<pair<int, int>, 8>
+{
+	auto texels = array<pair<int, int>, 8>{};
+	auto i = 0;
+	for (auto y = 0; y < 4; y++) {
+		for (auto x = 0; x < 4; x++) {
+			const auto in_half = flip ? (y / 2 == half) : (x / 2 == half);
+			if (in_half) {
+				texels[i++] = {x, y};
+			}
+		}
+	}
+	return texels;
+}
+
+auto encode_etc_half(const Block& block, const array<pair<int, int>, 8>& texels) -> EtcHalf
+{
+	auto sum = array<int, 3>{};
+	for (const auto& [x, y] : texels) {
+		for (auto c = 0; c < 3; c++) {
+			sum[c] += block[y * 4 + x][c];
+		}
+	}
+
+	auto half = EtcHalf{};
+	auto base = array<int, 3>{};
+	for (auto c = 0; c < 3; c++) {
+		half.base4[c] = static_cast<uint8_t>((sum[c] * 15 + 8 * 255 / 2) / (8 * 255));
+		base[c] = (half.base4[c] << 4) | half.base4[c];
+	}
+
+	half.error = numeric_limits<int>::max();
+	for (auto table = 0u; table < ETC1_MODIFIERS.size(); table++) {
+		const auto [small, large] = ETC1_MODIFIERS[table];
+		const auto offsets = array<int, 4>{small, large, -small, -large};
+		auto selectors = array<uint8_t, 8>{};
+		auto table_error = 0;
+		for (auto i = 0u; i < texels.size(); i++) {
+			const auto& texel = block[texels[i].second * 4 + texels[i].first];
+			auto best_error = numeric_limits<int>::max();
+			for (uint8_t s = 0; s < 4; s++) {
+				auto error = 0;
+				for (auto c = 0; c < 3; c++) {
+					const auto d = clamp(base[c] + offsets[s], 0, 255) - texel[c];
+					error += d * d;
+				}
+				if (error < best_error) {
+					best_error = error;
+					selectors[i] = s;
+				}
+			}
+			table_error += best_error;
+		}
+		if (table_error < half.error) {
+			half.error = table_error;
+			half.table = table;
+			half.selectors = selectors;
+		}
+	}
+
+	return half;
+}
+
+auto encode_etc2_block(const Block& block, uint8_t* out) -> void
+{
+	auto best_flip = false;
+	auto best_halves = array<EtcHalf, 2>{};
+	auto best_error = numeric_limits<int>::max();
+	for (const auto flip : {false, true}) {
+		const auto halves = array<EtcHalf, 2>{
+			encode_etc_half(block, etc_half_texels(flip, 0)),
+			encode_etc_half(block, etc_half_texels(flip, 1))};
+		if (halves[0].error + halves[1].error < best_error) {
+			best_error = halves[0].error + halves[1].error;
+			best_flip = flip;
+			best_halves = halves;
+		}
+	}
+
+	// Selector values map to the ETC1 pixel index bits: +small=00 +large=01 -small=10 -large=11
+	auto msbs = 0u;
+	auto lsbs = 0u;
+	for (auto half = 0; half < 2; half++) {
+		const auto texels = etc_half_texels(best_flip, half);
+		for (auto i = 0u; i < texels.size(); i++) {
+			const auto [x, y] = texels[i];
+			const auto bit = x * 4 + y;
+			const auto selector = best_halves[half].selectors[i];
+			msbs |= ((selector >> 1) & 1u) << bit;
+			lsbs |= (selector & 1u) << bit;
+		}
+	}
+
+	const auto& a = best_halves[0];
+	const auto& b = best_halves[1];
+	const auto high = static_cast<uint32_t>(a.base4[0]) << 28 | static_cast<uint32_t>(b.base4[0]) << 24 |
+					  static_cast<uint32_t>(a.base4[1]) << 20 | static_cast<uint32_t>(b.base4[1]) << 16 |
+					  static_cast<uint32_t>(a.base4[2]) << 12 | static_cast<uint32_t>(b.base4[2]) << 8 |
+					  a.table << 5 | b.table << 2 | (best_flip ? 1u : 0u);
+	const auto low = msbs << 16 | lsbs;
+
+	// ETC blocks are stored big-endian
+	for (auto i = 0; i < 4; i++) {
+		out[i] = static_cast<uint8_t>(high >> (24 - i * 8));
+		out[4 + i] = static_cast<uint8_t>(low >> (24 - i * 8));
+	}
+}
+
+auto encode_level(
+	TextureFormat format, const vector<uint8_t>& rgba, uint32_t width, uint32_t height, byte* out)
+	-> void
+{
+	if (!is_block_compressed(format)) {
+		memcpy(out, rgba.data(), rgba.size());
+		return;
+	}
+
+	const auto blocks_x = (width + 3) / 4;
+	const auto blocks_y = (height + 3) / 4;
+	const auto stride = block_bytes(format);
+	auto dst = reinterpret_cast<uint8_t*>(out);
+
+	for (auto by = 0u; by < blocks_y; by++) {
+		for (auto bx = 0u; bx < blocks_x; bx++) {
+			const auto block = fetch_block(rgba, width, height, bx, by);
+			switch (format) {
+			case TextureFormat::BC1:
+				encode_bc1_block(block, dst);
+				break;
+			case TextureFormat::BC7:
+				encode_bc7_block(block, dst);
+				break;
+			case TextureFormat::ETC2_RGB8:
+				encode_etc2_block(block, dst);
+				break;
+			default:
+				break;
+			}
+			dst += stride;
+		}
+	}
+}
+
+} // namespace
+
+auto pixel_format_channels(PixelFormat format) -> uint32_t
+{
+	switch (format) {
+	case PixelFormat::R8:
+		return 1;
+	case PixelFormat::RG8:
+		return 2;
+	case PixelFormat::RGB8:
+	case PixelFormat::RGB8_SRGB:
+		return 3;
+	case PixelFormat::RGBA8:
+	case PixelFormat::RGBA8_SRGB:
+		return 4;
+	}
+	return 4;
+}
+
+auto pixel_format_name(PixelFormat format) -> string_view
+{
+	switch (format) {
+	case PixelFormat::R8:
+		return "r8";
+	case PixelFormat::RG8:
+		return "rg8";
+	case PixelFormat::RGB8:
+		return "rgb8";
+	case PixelFormat::RGBA8:
+		return "rgba8";
+	case PixelFormat::RGB8_SRGB:
+		return "rgb8_srgb";
+	case PixelFormat::RGBA8_SRGB:
+		return "rgba8_srgb";
+	}
+	return "unknown";
+}
+
+auto pixel_format_from_channels(uint32_t channel_count, bool srgb) -> PixelFormat
+{
+	switch (channel_count) {
+	case 1:
+		return PixelFormat::R8;
+	case 2:
+		return PixelFormat::RG8;
+	case 3:
+		return srgb ? PixelFormat::RGB8_SRGB : PixelFormat::RGB8;
+	default:
+		return srgb ? PixelFormat::RGBA8_SRGB : PixelFormat::RGBA8;
+	}
+}
+
+auto expand_to_rgba(PixelFormat format, uint32_t width, uint32_t height, const unsigned char* pixels)
+	-> vector<unsigned char>
+{
+	const auto channels = pixel_format_channels(format);
+	const auto pixel_count = size_t{width} * height;
+	auto rgba = vector<unsigned char>(pixel_count * 4);
+
+	for (auto i = size_t{0}; i < pixel_count; i++) {
+		const auto src = pixels + i * channels;
+		const auto dst = rgba.data() + i * 4;
+		switch (channels) {
+		case 1:
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = 255;
+			break;
+		case 2:
+			dst[0] = dst[1] = dst[2] = src[0];
+			dst[3] = src[1];
+			break;
+		case 3:
+			memcpy(dst, src, 3);
+			dst[3] = 255;
+			break;
+		default:
+			memcpy(dst, src, 4);
+		}
+	}
+
+	return rgba;
+}
+
+auto texture_format_name(TextureFormat format) -> string_view
+{
+	switch (format) {
+	case TextureFormat::RGBA8:
+		return "rgba8";
+	case TextureFormat::BC1:
+		return "bc1";
+	case TextureFormat::BC7:
+		return "bc7";
+	case TextureFormat::ETC2_RGB8:
+		return "etc2";
+	}
+	return "unknown";
+}
+
+auto texture_format_from_name(string_view name) -> optional<TextureFormat>
+{
+	for (const auto format :
+		 {TextureFormat::RGBA8, TextureFormat::BC1, TextureFormat::BC7, TextureFormat::ETC2_RGB8}) {
+		if (texture_format_name(format) == name) {
+			return format;
+		}
+	}
+	return nullopt;
+}
+
+auto texture_level_size(TextureFormat format, uint32_t width, uint32_t height) -> size_t
+{
+	if (!is_block_compressed(format)) {
+		return size_t{width} * height * 4;
+	}
+	return size_t{(width + 3) / 4} * ((height + 3) / 4) * block_bytes(format);
+}
+
+auto encode_texture(TextureFormat format, uint32_t width, uint32_t height, const unsigned char* rgba)
+	-> TextureData
+{
+	auto texture = TextureData{format, width, height, {}, nullptr};
+
+	// Lay every level out in one allocation, which becomes the texture's storage
+	auto offsets = vector<size_t>{};
+	auto total_size = size_t{0};
+	for (auto w = width, h = height;; w = max(w / 2, 1u), h = max(h / 2, 1u)) {
+		offsets.push_back(total_size);
+		total_size += texture_level_size(format, w, h);
+		if (w == 1 && h == 1) {
+			break;
+		}
+	}
+
+	auto storage = make_shared<vector<byte>>(total_size);
+
+	auto level_rgba = vector<uint8_t>(rgba, rgba + size_t{width} * height * 4);
+	auto w = width;
+	auto h = height;
+	for (const auto offset : offsets) {
+		encode_level(format, level_rgba, w, h, storage->data() + offset);
+		texture.levels.push_back(
+			{w, h, span{storage->data() + offset, texture_level_size(format, w, h)}});
+		if (w > 1 || h > 1) {
+			level_rgba = downsample(level_rgba, w, h);
+			w = max(w / 2, 1u);
+			h = max(h / 2, 1u);
+		}
+	}
+
+	texture.storage = std::move(storage);
+	return texture;
+}
+
+auto write_texture_file(const TextureData& texture) -> vector<byte>
+{
+	const auto align = [](size_t offset) { return (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; };
+
+	auto header = FileHeader{};
+	memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.format = static_cast<uint32_t>(texture.format);
+	header.width = texture.width;
+	header.height = texture.height;
+	header.level_count = static_cast<uint32_t>(texture.levels.size());
+
+	auto table = vector<FileLevel>{};
+	auto offset = align(sizeof(FileHeader) + sizeof(FileLevel) * texture.levels.size());
+	for (const auto& level : texture.levels) {
+		table.push_back({level.width, level.height, offset, level.data.size()});
+		offset = align(offset + level.data.size());
+	}
+
+	auto bytes = vector<byte>(offset);
+	memcpy(bytes.data(), &header, sizeof(header));
+	memcpy(bytes.data() + sizeof(header), table.data(), sizeof(FileLevel) * table.size());
+	for (auto i = 0u; i < table.size(); i++) {
+		memcpy(bytes.data() + table[i].offset, texture.levels[i].data.data(), table[i].size);
+	}
+
+	return bytes;
+}
+
+auto read_texture_file(span<const byte> bytes, shared_ptr<const void> storage)
+	-> expected<TextureData, string>
+{
+	auto header = FileHeader{};
+	if (bytes.size() < sizeof(header)) {
+		return unexpected("truncated texture header");
+	}
+	memcpy(&header, bytes.data(), sizeof(header));
+
+	if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0) {
+		return unexpected("not a baked texture");
+	}
+	if (header.version != VERSION) {
+		return unexpected("unsupported texture version " + to_string(header.version));
+	}
+	const auto format = static_cast<TextureFormat>(header.format);
+	if (!texture_format_from_name(texture_format_name(format))) {
+		return unexpected("unknown texture format " + to_string(header.format));
+	}
+	if (header.level_count == 0 ||
+		header.level_count > (bytes.size() - sizeof(header)) / sizeof(FileLevel)) {
+		return unexpected("bad texture level count");
+	}
+
+	auto texture = TextureData{format, header.width, header.height, {}, std::move(storage)};
+
+	for (auto i = 0u; i < header.level_count; i++) {
+		auto level = FileLevel{};
+		memcpy(&level, bytes.data() + sizeof(header) + sizeof(FileLevel) * i, sizeof(level));
+		if (level.offset > bytes.size() || level.size > bytes.size() - level.offset ||
+			level.size != texture_level_size(format, level.width, level.height)) {
+			return unexpected("bad texture level " + to_string(i));
+		}
+		texture.levels.push_back({level.width, level.height, bytes.subspan(level.offset, level.size)});
+	}
+
+	return texture;
+}
+
+} // namespace gpu
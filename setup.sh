@@ -48,6 +48,8 @@ sh ./bootstrap-vcpkg.sh -disableMetrics # you evil f^#ks
 ./vcpkg install glm:x64-linux
 ./vcpkg install glm:wasm32-emscripten
 ./vcpkg install imgui[core,glfw-binding,vulkan-binding]
+./vcpkg install lz4:x64-linux
+./vcpkg install lz4:wasm32-emscripten
 ./vcpkg install lua:x64-linux
 ./vcpkg install lua:wasm32-emscripten
 ./vcpkg install reflectcpp:x64-linux